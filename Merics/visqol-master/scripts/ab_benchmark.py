@@ -0,0 +1,411 @@
+# Copyright 2019 Google LLC, Andrew Hines
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Compares the speed and scores of two ViSQOL builds or configurations.
+
+  Runs configuration A and configuration B on the same batch input CSV,
+  interleaving their runs (ABBAAB...) so that slow drifts in the state of the
+  host, such as thermal throttling, affect both alike. Each run writes the
+  debug JSON, whose computation stats give the wall time of each stage of
+  every comparison.
+
+  For the whole run and each stage, the report gives the median time of A and
+  B over the repetitions, the change from A to B with a bootstrap confidence
+  interval, and the p-value of a two sided Mann-Whitney U test. A change is
+  marked significant when the test rejects at 1 - confidence and the interval
+  excludes 0.
+
+  The report also compares the MOS-LQO of every pair, so that a speedup that
+  changes the scores is caught in the same run. Scores that differ by more
+  than the conformance tolerance are listed, as are scores that differ
+  between repetitions of the same configuration.
+
+  Where the cpufreq governors are writable (usually as root), they are set to
+  performance for the duration of the benchmark, and turbo boost is disabled,
+  so that the clock frequency does not vary between runs. The previous
+  settings are restored afterwards.
+
+  Example invocation, comparing two builds:
+    python3 scripts/ab_benchmark.py \
+      --batch_input_csv=/path/to/batch.csv \
+      --binary_a=/path/to/baseline/visqol \
+      --binary_b=bazel-bin/visqol \
+      --repetitions=10
+
+  Example invocation, comparing two configurations of one build:
+    python3 scripts/ab_benchmark.py \
+      --batch_input_csv=/path/to/batch.csv \
+      --binary_a=bazel-bin/visqol --binary_b=bazel-bin/visqol \
+      --args_b='--fine_alignment_skip_threshold=0.95'
+"""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import glob
+import json
+import math
+import os
+import shlex
+import shutil
+import subprocess
+import tempfile
+import time
+
+from absl import app
+from absl import flags
+from absl import logging
+
+import numpy as np
+
+FLAGS = flags.FLAGS
+
+flags.DEFINE_string('batch_input_csv', None,
+                    'The batch input CSV both configurations are run on.')
+flags.DEFINE_string('binary_a', None, 'The visqol binary of configuration A.')
+flags.DEFINE_string('binary_b', None,
+                    'The visqol binary of configuration B. Defaults to '
+                    '--binary_a.')
+flags.DEFINE_string('args_a', '',
+                    'Additional command line args of configuration A.')
+flags.DEFINE_string('args_b', '',
+                    'Additional command line args of configuration B.')
+flags.DEFINE_integer('repetitions', 10,
+                     'The number of timed runs of each configuration.')
+flags.DEFINE_integer('warmup_runs', 1,
+                     'The number of untimed runs of each configuration, made '
+                     'before the timed runs.')
+flags.DEFINE_float('confidence', 0.95,
+                   'The confidence level of the intervals and tests.')
+flags.DEFINE_integer('bootstrap_samples', 10000,
+                     'The number of bootstrap resamples per interval.')
+flags.DEFINE_float('mos_tolerance', 0.0001,
+                   'MOS-LQO differences above this are reported as '
+                   'conformance differences.')
+flags.DEFINE_boolean('pin_cpu_frequency', True,
+                     'If true, set the cpufreq governors to performance and '
+                     'disable turbo boost while benchmarking, where '
+                     'writable.')
+flags.DEFINE_list('cpus', [],
+                  'If set, the CPUs that the runs are restricted to.')
+flags.DEFINE_string('report', None,
+                    'If set, the report is also written to this path.')
+flags.DEFINE_integer('seed', 0, 'The seed of the bootstrap resampling.')
+
+flags.mark_flag_as_required('batch_input_csv')
+flags.mark_flag_as_required('binary_a')
+
+# The stages timed by visqol, as the debug JSON names of their computation
+# stats, and the names used in the report.
+STAGES = [
+    ('loadSeconds', 'load'),
+    ('globalAlignmentSeconds', 'global alignment'),
+    ('preprocessingSeconds', 'preprocessing'),
+    ('patchSearchSeconds', 'patch search'),
+    ('fineAlignmentSeconds', 'fine alignment'),
+    ('qualityMappingSeconds', 'quality mapping'),
+]
+
+# The cpufreq files set while pinning the frequency, and their pinned values.
+GOVERNOR_GLOB = '/sys/devices/system/cpu/cpu[0-9]*/cpufreq/scaling_governor'
+NO_TURBO_PATHS = ['/sys/devices/system/cpu/intel_pstate/no_turbo']
+BOOST_PATHS = ['/sys/devices/system/cpu/cpufreq/boost']
+
+
+class FrequencyPinner(object):
+  """Pins the CPU frequency where the cpufreq settings are writable."""
+
+  def __init__(self):
+    self._saved = []
+
+  def _Set(self, path, value):
+    """Sets a cpufreq file, saving its previous value. Returns success."""
+    try:
+      with open(path) as f:
+        previous = f.read().strip()
+      with open(path, 'w') as f:
+        f.write(value)
+    except (IOError, OSError):
+      return False
+    self._saved.append((path, previous))
+    return True
+
+  def Pin(self):
+    """Returns a description of the settings that could be pinned."""
+    notes = []
+    governors = glob.glob(GOVERNOR_GLOB)
+    pinned = [p for p in governors if self._Set(p, 'performance')]
+    if governors:
+      notes.append('performance governor on %d of %d CPUs' %
+                   (len(pinned), len(governors)))
+    for path in NO_TURBO_PATHS:
+      if os.path.exists(path) and self._Set(path, '1'):
+        notes.append('turbo disabled')
+    for path in BOOST_PATHS:
+      if os.path.exists(path) and self._Set(path, '0'):
+        notes.append('boost disabled')
+    if not self._saved:
+      return 'not pinned (cpufreq settings are not writable)'
+    return ', '.join(notes)
+
+  def Restore(self):
+    for path, value in reversed(self._saved):
+      try:
+        with open(path, 'w') as f:
+          f.write(value)
+      except (IOError, OSError):
+        logging.warning('Could not restore %s to %s', path, value)
+    self._saved = []
+
+
+def ReadDebugJSON(path):
+  """Returns the results in a debug JSON file of concatenated objects."""
+  with open(path) as f:
+    text = f.read()
+  decoder = json.JSONDecoder()
+  results = []
+  pos = 0
+  while True:
+    while pos < len(text) and text[pos].isspace():
+      pos += 1
+    if pos >= len(text):
+      return results
+    result, pos = decoder.raw_decode(text, pos)
+    results.append(result)
+
+
+def RunOnce(binary, args, work_dir):
+  """Runs visqol on the batch once.
+
+  Args:
+    binary: The visqol binary.
+    args: The additional command line args.
+    work_dir: A directory for the outputs of the run.
+
+  Returns:
+    A tuple of the wall time of the run, the summed time of each stage, and a
+    dictionary from (reference, degraded) to MOS-LQO.
+  """
+  debug_path = os.path.join(work_dir, 'debug.json')
+  if os.path.exists(debug_path):
+    os.remove(debug_path)
+  command = [binary, '--batch_input_csv', FLAGS.batch_input_csv,
+             '--output_debug', debug_path] + args
+  preexec_fn = None
+  if FLAGS.cpus:
+    cpus = set(int(cpu) for cpu in FLAGS.cpus)
+    preexec_fn = lambda: os.sched_setaffinity(0, cpus)
+  start = time.monotonic()
+  with open(os.devnull, 'w') as devnull:
+    subprocess.check_call(command, stdout=devnull, preexec_fn=preexec_fn)
+  wall_seconds = time.monotonic() - start
+
+  stage_seconds = dict((key, 0.0) for key, _ in STAGES)
+  mos = {}
+  for result in ReadDebugJSON(debug_path):
+    # Zero valued fields are omitted from the JSON.
+    stats = result.get('computationStats', {})
+    for key, _ in STAGES:
+      stage_seconds[key] += float(stats.get(key, 0.0))
+    pair = (result.get('referenceFilepath', ''),
+            result.get('degradedFilepath', ''))
+    mos[pair] = float(result.get('moslqo', 0.0))
+  return wall_seconds, stage_seconds, mos
+
+
+def MannWhitneyU(a, b):
+  """Returns the two sided p-value of the Mann-Whitney U test.
+
+  Uses the normal approximation with a tie correction and a continuity
+  correction, which is adequate from about 8 samples per group.
+
+  Args:
+    a: The samples of the first group.
+    b: The samples of the second group.
+  """
+  n_a = len(a)
+  n_b = len(b)
+  values = np.concatenate([a, b])
+  order = np.argsort(values, kind='mergesort')
+  ranks = np.empty(len(values))
+  sorted_values = values[order]
+  tie_term = 0.0
+  i = 0
+  while i < len(values):
+    j = i
+    while j + 1 < len(values) and sorted_values[j + 1] == sorted_values[i]:
+      j += 1
+    # Tied values share the mean of their ranks.
+    ranks[order[i:j + 1]] = (i + j) / 2.0 + 1
+    tie_count = j - i + 1
+    tie_term += tie_count**3 - tie_count
+    i = j + 1
+  u_a = ranks[:n_a].sum() - n_a * (n_a + 1) / 2.0
+  n = n_a + n_b
+  mean_u = n_a * n_b / 2.0
+  var_u = n_a * n_b / 12.0 * ((n + 1) - tie_term / (n * (n - 1)))
+  if var_u <= 0:
+    return 1.0
+  z = (abs(u_a - mean_u) - 0.5) / math.sqrt(var_u)
+  return min(1.0, math.erfc(max(z, 0.0) / math.sqrt(2)))
+
+
+def BootstrapDelta(a, b, rng):
+  """Returns a confidence interval of the relative change of the median.
+
+  Args:
+    a: The samples of configuration A.
+    b: The samples of configuration B.
+    rng: The random number generator used for resampling.
+
+  Returns:
+    A tuple of the lower and upper bound of the change from the median of A
+    to the median of B, as a fraction of the median of A.
+  """
+  samples_a = rng.choice(a, size=(FLAGS.bootstrap_samples, len(a)))
+  samples_b = rng.choice(b, size=(FLAGS.bootstrap_samples, len(b)))
+  medians_a = np.median(samples_a, axis=1)
+  medians_b = np.median(samples_b, axis=1)
+  valid = medians_a > 0
+  deltas = medians_b[valid] / medians_a[valid] - 1.0
+  if not len(deltas):
+    return float('nan'), float('nan')
+  alpha = 1.0 - FLAGS.confidence
+  return (np.percentile(deltas, 100 * alpha / 2),
+          np.percentile(deltas, 100 * (1 - alpha / 2)))
+
+
+def CompareTimes(name, a, b, rng):
+  """Returns a report row comparing the times of one stage."""
+  a = np.asarray(a)
+  b = np.asarray(b)
+  median_a = np.median(a)
+  median_b = np.median(b)
+  delta = median_b / median_a - 1.0 if median_a > 0 else float('nan')
+  low, high = BootstrapDelta(a, b, rng)
+  p_value = MannWhitneyU(a, b)
+  significant = (p_value < 1.0 - FLAGS.confidence and
+                 (low > 0 or high < 0))
+  return '%-18s %10.3f %10.3f %+8.1f%% [%+6.1f%%, %+6.1f%%] %8.4f %s' % (
+      name, median_a, median_b, 100 * delta, 100 * low, 100 * high, p_value,
+      '*' if significant else '')
+
+
+def CompareScores(mos_a, mos_b):
+  """Returns the report lines comparing the scores of A and B."""
+  lines = []
+  pairs = sorted(set(mos_a[0]) | set(mos_b[0]))
+  for label, runs in (('A', mos_a), ('B', mos_b)):
+    unstable = [pair for pair in pairs
+                if len(set(run.get(pair) for run in runs)) > 1]
+    if unstable:
+      lines.append('%d pair(s) scored differently between repetitions of '
+                   '%s:' % (len(unstable), label))
+      lines.extend('  %s,%s' % pair for pair in unstable)
+
+  max_diff = 0.0
+  differing = []
+  for pair in pairs:
+    if pair not in mos_a[0] or pair not in mos_b[0]:
+      differing.append((pair, None, None))
+      continue
+    diff = abs(mos_a[0][pair] - mos_b[0][pair])
+    max_diff = max(max_diff, diff)
+    if diff > FLAGS.mos_tolerance:
+      differing.append((pair, mos_a[0][pair], mos_b[0][pair]))
+  lines.append('Pairs compared: %d, max MOS-LQO difference: %.9f' %
+               (len(pairs), max_diff))
+  if differing:
+    lines.append('CONFORMANCE: %d pair(s) differ by more than %g:' %
+                 (len(differing), FLAGS.mos_tolerance))
+    for pair, a, b in differing:
+      if a is None:
+        lines.append('  %s,%s: scored by only one configuration' % pair)
+      else:
+        lines.append('  %s,%s: %.9f -> %.9f' % (pair + (a, b)))
+  else:
+    lines.append('CONFORMANCE: all scores within %g' % FLAGS.mos_tolerance)
+  return lines
+
+
+def main(argv):
+  del argv  # Unused.
+  if FLAGS.repetitions < 2:
+    raise app.UsageError('--repetitions must be at least 2.')
+
+  configs = [
+      ('A', FLAGS.binary_a, shlex.split(FLAGS.args_a)),
+      ('B', FLAGS.binary_b or FLAGS.binary_a, shlex.split(FLAGS.args_b)),
+  ]
+  wall = {'A': [], 'B': []}
+  stages = {'A': [], 'B': []}
+  mos = {'A': [], 'B': []}
+
+  pinner = FrequencyPinner()
+  frequency_note = 'not pinned'
+  work_dir = tempfile.mkdtemp(prefix='visqol_ab_')
+  try:
+    if FLAGS.pin_cpu_frequency:
+      frequency_note = pinner.Pin()
+    logging.info('CPU frequency: %s', frequency_note)
+
+    for _ in range(FLAGS.warmup_runs):
+      for _, binary, args in configs:
+        RunOnce(binary, args, work_dir)
+
+    # Alternate the order of each round, so that neither configuration
+    # always runs first.
+    for rep in range(FLAGS.repetitions):
+      order = configs if rep % 2 == 0 else list(reversed(configs))
+      for label, binary, args in order:
+        wall_seconds, stage_seconds, run_mos = RunOnce(binary, args, work_dir)
+        wall[label].append(wall_seconds)
+        stages[label].append(stage_seconds)
+        mos[label].append(run_mos)
+        logging.info('Repetition %d of %s: %.3fs', rep + 1, label,
+                     wall_seconds)
+  finally:
+    pinner.Restore()
+    shutil.rmtree(work_dir, ignore_errors=True)
+
+  rng = np.random.RandomState(FLAGS.seed)
+  lines = [
+      'A: %s %s' % (configs[0][1], ' '.join(configs[0][2])),
+      'B: %s %s' % (configs[1][1], ' '.join(configs[1][2])),
+      'Batch: %s, %d repetitions, CPU frequency %s' %
+      (FLAGS.batch_input_csv, FLAGS.repetitions, frequency_note),
+      '',
+      'Times in seconds per run (medians). Change of B from A, with the %g%% '
+      'bootstrap interval' % (100 * FLAGS.confidence),
+      'and the Mann-Whitney U p-value. * marks a significant change.',
+      '%-18s %10s %10s %9s %18s %8s' % ('stage', 'A', 'B', 'change',
+                                        'interval', 'p'),
+      CompareTimes('total (wall)', wall['A'], wall['B'], rng),
+  ]
+  for key, name in STAGES:
+    lines.append(CompareTimes(name, [s[key] for s in stages['A']],
+                              [s[key] for s in stages['B']], rng))
+  lines.append('')
+  lines.extend(CompareScores(mos['A'], mos['B']))
+
+  report = '\n'.join(lines) + '\n'
+  print(report, end='')
+  if FLAGS.report:
+    with open(FLAGS.report, 'w') as f:
+      f.write(report)
+
+
+if __name__ == '__main__':
+  app.run(main)
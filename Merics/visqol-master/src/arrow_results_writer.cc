@@ -0,0 +1,583 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "arrow_results_writer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+
+#include "status_macros.h"
+#include "zstd_frame_writer.h"
+
+namespace Visqol {
+
+const size_t ArrowResultsWriter::kDefaultRowsPerBatch = 1024;
+
+namespace {
+// The message metadata and body buffers are aligned to this many bytes.
+const size_t kArrowAlignment = 8;
+// Every message is prefixed by this marker, and the stream ends with it.
+const uint32_t kContinuationMarker = 0xFFFFFFFF;
+
+// Values from the Arrow Schema.fbs and Message.fbs definitions.
+const int16_t kMetadataVersionV5 = 4;
+const uint8_t kMessageHeaderSchema = 1;
+const uint8_t kMessageHeaderRecordBatch = 3;
+const uint8_t kTypeInt = 2;
+const uint8_t kTypeFloatingPoint = 3;
+const uint8_t kTypeUtf8 = 5;
+const uint8_t kTypeFixedSizeList = 16;
+const int16_t kPrecisionDouble = 2;
+const int8_t kCompressionTypeZstd = 1;
+const int8_t kBodyCompressionMethodBuffer = 0;
+
+// A minimal FlatBuffers encoder, sufficient for the Arrow message metadata.
+// As in the reference implementation, the buffer is built back to front, so
+// that every object is complete before an offset to it is written. Offsets
+// returned by this class count bytes from the end of the buffer.
+class FlatBufferBuilder {
+ public:
+  uint32_t Size() const { return static_cast<uint32_t>(buf_.size()); }
+
+  // Pad so that the buffer is aligned to align bytes once additional bytes
+  // have been prepended.
+  void Prep(size_t align, size_t additional) {
+    const size_t pad = (align - (buf_.size() + additional) % align) % align;
+    buf_.insert(0, pad, '\0');
+  }
+
+  template <typename T>
+  void PushScalar(T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    buf_.insert(0, bytes, sizeof(T));
+  }
+
+  void PushOffset(uint32_t target) {
+    Prep(sizeof(uint32_t), sizeof(uint32_t));
+    PushScalar<uint32_t>(Size() + sizeof(uint32_t) - target);
+  }
+
+  uint32_t CreateString(const std::string &str) {
+    Prep(sizeof(uint32_t), str.size() + 1);
+    buf_.insert(0, 1, '\0');
+    buf_.insert(0, str);
+    PushScalar<uint32_t>(static_cast<uint32_t>(str.size()));
+    return Size();
+  }
+
+  // Create a vector of structs that are each made up of int64 fields.
+  uint32_t CreateInt64StructVector(const std::vector<int64_t> &fields,
+                                   size_t fields_per_struct) {
+    Prep(sizeof(int64_t), fields.size() * sizeof(int64_t));
+    for (auto it = fields.rbegin(); it != fields.rend(); ++it) {
+      PushScalar<int64_t>(*it);
+    }
+    PushScalar<uint32_t>(
+        static_cast<uint32_t>(fields.size() / fields_per_struct));
+    return Size();
+  }
+
+  uint32_t CreateOffsetVector(const std::vector<uint32_t> &targets) {
+    Prep(sizeof(uint32_t), targets.size() * sizeof(uint32_t));
+    for (auto it = targets.rbegin(); it != targets.rend(); ++it) {
+      PushOffset(*it);
+    }
+    PushScalar<uint32_t>(static_cast<uint32_t>(targets.size()));
+    return Size();
+  }
+
+  // Tables may not be nested: the objects they reference must be created
+  // before StartTable is called.
+  void StartTable() {
+    table_fields_.clear();
+    table_start_ = Size();
+  }
+
+  template <typename T>
+  void AddScalar(uint16_t field_id, T value) {
+    Prep(sizeof(T), sizeof(T));
+    PushScalar<T>(value);
+    table_fields_.emplace_back(field_id, Size());
+  }
+
+  void AddOffset(uint16_t field_id, uint32_t target) {
+    PushOffset(target);
+    table_fields_.emplace_back(field_id, Size());
+  }
+
+  uint32_t EndTable() {
+    // The table starts with the offset to its vtable, which is written
+    // directly in front of it.
+    Prep(sizeof(int32_t), sizeof(int32_t));
+    PushScalar<int32_t>(0);
+    const uint32_t table_end = Size();
+    uint16_t num_fields = 0;
+    for (const auto &field : table_fields_) {
+      num_fields = std::max<uint16_t>(num_fields, field.first + 1);
+    }
+    std::vector<uint16_t> vtable(num_fields, 0);
+    for (const auto &field : table_fields_) {
+      vtable[field.first] = static_cast<uint16_t>(table_end - field.second);
+    }
+    for (auto it = vtable.rbegin(); it != vtable.rend(); ++it) {
+      PushScalar<uint16_t>(*it);
+    }
+    PushScalar<uint16_t>(static_cast<uint16_t>(table_end - table_start_));
+    PushScalar<uint16_t>(
+        static_cast<uint16_t>((vtable.size() + 2) * sizeof(uint16_t)));
+    const int32_t vtable_offset = static_cast<int32_t>(Size() - table_end);
+    std::memcpy(&buf_[buf_.size() - table_end], &vtable_offset,
+                sizeof(int32_t));
+    return table_end;
+  }
+
+  std::string Finish(uint32_t root) {
+    Prep(kArrowAlignment, sizeof(uint32_t));
+    PushOffset(root);
+    return buf_;
+  }
+
+ private:
+  std::string buf_;
+  std::vector<std::pair<uint16_t, uint32_t>> table_fields_;
+  uint32_t table_start_ = 0;
+};
+
+// Create a Field table. A fixed size list column has a single non-nullable
+// double child field.
+uint32_t CreateField(FlatBufferBuilder *fbb, const std::string &name,
+                     uint8_t type_type, int32_t list_size) {
+  std::vector<uint32_t> children;
+  if (type_type == kTypeFixedSizeList) {
+    children.push_back(CreateField(fbb, "item", kTypeFloatingPoint, 0));
+  }
+  const uint32_t children_vector = fbb->CreateOffsetVector(children);
+  const uint32_t name_string = fbb->CreateString(name);
+
+  fbb->StartTable();
+  switch (type_type) {
+    case kTypeInt:
+      fbb->AddScalar<int32_t>(0, 64);  // bitWidth
+      fbb->AddScalar<uint8_t>(1, 1);   // is_signed
+      break;
+    case kTypeFloatingPoint:
+      fbb->AddScalar<int16_t>(0, kPrecisionDouble);
+      break;
+    case kTypeFixedSizeList:
+      fbb->AddScalar<int32_t>(0, list_size);
+      break;
+  }
+  const uint32_t type = fbb->EndTable();
+
+  fbb->StartTable();
+  fbb->AddOffset(0, name_string);
+  fbb->AddScalar<uint8_t>(1, 0);  // nullable
+  fbb->AddScalar<uint8_t>(2, type_type);
+  fbb->AddOffset(3, type);
+  fbb->AddOffset(5, children_vector);
+  return fbb->EndTable();
+}
+
+// Wrap a Schema or RecordBatch header in a Message.
+std::string FinishMessage(FlatBufferBuilder *fbb, uint8_t header_type,
+                          uint32_t header, int64_t body_length) {
+  fbb->StartTable();
+  fbb->AddScalar<int64_t>(3, body_length);
+  fbb->AddOffset(2, header);
+  fbb->AddScalar<int16_t>(0, kMetadataVersionV5);
+  fbb->AddScalar<uint8_t>(1, header_type);
+  return fbb->Finish(fbb->EndTable());
+}
+
+void PadToAlignment(std::string *bytes) {
+  bytes->append((kArrowAlignment - bytes->size() % kArrowAlignment) %
+                    kArrowAlignment,
+                '\0');
+}
+
+void WriteMessage(std::ofstream *out, std::string metadata,
+                  const std::string &body) {
+  PadToAlignment(&metadata);
+  const int32_t metadata_length = static_cast<int32_t>(metadata.size());
+  out->write(reinterpret_cast<const char *>(&kContinuationMarker),
+             sizeof(kContinuationMarker));
+  out->write(reinterpret_cast<const char *>(&metadata_length),
+             sizeof(metadata_length));
+  out->write(metadata.data(), metadata.size());
+  out->write(body.data(), body.size());
+}
+}  // namespace
+
+ArrowResultsWriter::ArrowResultsWriter(const FilePath &results_path,
+                                       const FilePath &patches_path,
+                                       const size_t rows_per_batch,
+                                       const int compression_level)
+    : write_patches_(!patches_path.Path().empty()),
+      rows_per_batch_(std::max<size_t>(1, rows_per_batch)),
+      compression_level_(std::max(0, compression_level)) {
+  results_.path = results_path;
+  results_.columns = {{"reference", ColumnType::kUtf8},
+                      {"degraded", ColumnType::kUtf8},
+                      {"moslqo", ColumnType::kDouble},
+                      {"vnsim", ColumnType::kDouble},
+                      {"fvnsim", ColumnType::kDoubleList},
+                      {"fstdnsim", ColumnType::kDoubleList},
+                      {"fvdegenergy", ColumnType::kDoubleList}};
+  patches_.path = patches_path;
+  patches_.columns = {{"pair_index", ColumnType::kInt64},
+                      {"similarity", ColumnType::kDouble},
+                      {"ref_patch_start_time", ColumnType::kDouble},
+                      {"ref_patch_end_time", ColumnType::kDouble},
+                      {"deg_patch_start_time", ColumnType::kDouble},
+                      {"deg_patch_end_time", ColumnType::kDouble},
+                      {"freq_band_means", ColumnType::kDoubleList}};
+}
+
+ArrowResultsWriter::~ArrowResultsWriter() {
+  if (is_open_) {
+    const absl::Status status = Close();
+    if (!status.ok()) {
+      ABSL_RAW_LOG(ERROR, "%s", status.ToString().c_str());
+    }
+  }
+}
+
+absl::Status ArrowResultsWriter::Open() {
+  for (Table *table : {&results_, &patches_}) {
+    if (table == &patches_ && !write_patches_) {
+      continue;
+    }
+    table->out.open(table->path.Path(),
+                    std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!table->out) {
+      return absl::Status(absl::StatusCode::kInvalidArgument,
+                          "Could not open Arrow output file " +
+                              table->path.Path());
+    }
+  }
+  is_open_ = true;
+  if (compression_level_ > 0) {
+    absl::MutexLock lock(&mutex_);
+    closing_ = false;
+    write_status_ = absl::Status();
+    encode_thread_ = std::thread(&ArrowResultsWriter::EncodeLoop, this);
+  }
+  return absl::Status();
+}
+
+absl::Status ArrowResultsWriter::Append(
+    const SimilarityResultMsg &sim_res_msg) {
+  if (!is_open_) {
+    return absl::Status(absl::StatusCode::kFailedPrecondition,
+                        "The Arrow results writer is not open.");
+  }
+  {
+    absl::MutexLock lock(&mutex_);
+    VISQOL_RETURN_IF_ERROR(write_status_);
+  }
+  // Check every row before appending any, so that a rejected result leaves
+  // the tables unchanged.
+  std::vector<Column> &cols = results_.columns;
+  const bool first_pair = results_.num_rows == 0;
+  VISQOL_RETURN_IF_ERROR(
+      CheckListSize(sim_res_msg.fvnsim(), first_pair, &cols[4]));
+  VISQOL_RETURN_IF_ERROR(
+      CheckListSize(sim_res_msg.fstdnsim(), first_pair, &cols[5]));
+  VISQOL_RETURN_IF_ERROR(
+      CheckListSize(sim_res_msg.fvdegenergy(), first_pair, &cols[6]));
+  if (write_patches_) {
+    bool first_patch = patches_.num_rows == 0;
+    for (const auto &patch : sim_res_msg.patch_sims()) {
+      VISQOL_RETURN_IF_ERROR(CheckListSize(patch.freq_band_means(),
+                                           first_patch, &patches_.columns[6]));
+      first_patch = false;
+    }
+  }
+
+  for (int i = 0; i < 2; i++) {
+    cols[i].chars += i == 0 ? sim_res_msg.reference_filepath()
+                            : sim_res_msg.degraded_filepath();
+    cols[i].offsets.push_back(static_cast<int32_t>(cols[i].chars.size()));
+  }
+  cols[2].doubles.push_back(sim_res_msg.moslqo());
+  cols[3].doubles.push_back(sim_res_msg.vnsim());
+  cols[4].doubles.insert(cols[4].doubles.end(), sim_res_msg.fvnsim().begin(),
+                         sim_res_msg.fvnsim().end());
+  cols[5].doubles.insert(cols[5].doubles.end(),
+                         sim_res_msg.fstdnsim().begin(),
+                         sim_res_msg.fstdnsim().end());
+  cols[6].doubles.insert(cols[6].doubles.end(),
+                         sim_res_msg.fvdegenergy().begin(),
+                         sim_res_msg.fvdegenergy().end());
+  const int64_t pair_index = static_cast<int64_t>(results_.num_rows);
+  results_.num_rows++;
+  if (++results_.num_buffered_rows >= rows_per_batch_) {
+    VISQOL_RETURN_IF_ERROR(Flush(&results_));
+  }
+
+  if (write_patches_) {
+    std::vector<Column> &patch_cols = patches_.columns;
+    for (const auto &patch : sim_res_msg.patch_sims()) {
+      patch_cols[0].ints.push_back(pair_index);
+      patch_cols[1].doubles.push_back(patch.similarity());
+      patch_cols[2].doubles.push_back(patch.ref_patch_start_time());
+      patch_cols[3].doubles.push_back(patch.ref_patch_end_time());
+      patch_cols[4].doubles.push_back(patch.deg_patch_start_time());
+      patch_cols[5].doubles.push_back(patch.deg_patch_end_time());
+      patch_cols[6].doubles.insert(patch_cols[6].doubles.end(),
+                                   patch.freq_band_means().begin(),
+                                   patch.freq_band_means().end());
+      patches_.num_rows++;
+      if (++patches_.num_buffered_rows >= rows_per_batch_) {
+        VISQOL_RETURN_IF_ERROR(Flush(&patches_));
+      }
+    }
+  }
+  return absl::Status();
+}
+
+absl::Status ArrowResultsWriter::Close() {
+  if (!is_open_) {
+    return absl::Status();
+  }
+  is_open_ = false;
+  absl::Status flush_status = Flush(&results_);
+  if (flush_status.ok() && write_patches_) {
+    flush_status = Flush(&patches_);
+  }
+  if (encode_thread_.joinable()) {
+    {
+      absl::MutexLock lock(&mutex_);
+      closing_ = true;
+    }
+    encode_thread_.join();
+    VISQOL_RETURN_IF_ERROR(write_status_);
+  }
+  VISQOL_RETURN_IF_ERROR(flush_status);
+  VISQOL_RETURN_IF_ERROR(CloseTable(&results_));
+  if (write_patches_) {
+    VISQOL_RETURN_IF_ERROR(CloseTable(&patches_));
+  }
+  return absl::Status();
+}
+
+absl::Status ArrowResultsWriter::CheckListSize(
+    const google::protobuf::RepeatedField<double> &values,
+    const bool first_row, Column *column) {
+  // The schema is written with the first record batch, so the first row can
+  // still set the list size.
+  const size_t size = static_cast<size_t>(values.size());
+  if (first_row) {
+    column->list_size = size;
+  } else if (size != column->list_size) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Column " + column->name + " has " +
+                            std::to_string(size) + " values, expected " +
+                            std::to_string(column->list_size) + ".");
+  }
+  return absl::Status();
+}
+
+absl::Status ArrowResultsWriter::Flush(Table *table) {
+  PendingBatch batch;
+  batch.table = table;
+  batch.write_schema = !table->schema_written;
+  batch.num_rows = static_cast<int64_t>(table->num_buffered_rows);
+  for (Column &col : table->columns) {
+    Column buffered = {col.name, col.type, col.list_size};
+    buffered.offsets.swap(col.offsets);
+    buffered.chars.swap(col.chars);
+    buffered.ints.swap(col.ints);
+    buffered.doubles.swap(col.doubles);
+    batch.columns.push_back(std::move(buffered));
+  }
+  table->schema_written = true;
+  table->num_buffered_rows = 0;
+
+  if (compression_level_ == 0) {
+    return WriteBatch(batch);
+  }
+  absl::MutexLock lock(&mutex_);
+  queued_batches_.push_back(std::move(batch));
+  return absl::Status();
+}
+
+absl::Status ArrowResultsWriter::WriteBatch(const PendingBatch &batch) const {
+  Table *table = batch.table;
+  if (batch.write_schema) {
+    FlatBufferBuilder fbb;
+    std::vector<uint32_t> fields;
+    for (const Column &col : batch.columns) {
+      uint8_t type_type = kTypeUtf8;
+      switch (col.type) {
+        case ColumnType::kUtf8:
+          type_type = kTypeUtf8;
+          break;
+        case ColumnType::kInt64:
+          type_type = kTypeInt;
+          break;
+        case ColumnType::kDouble:
+          type_type = kTypeFloatingPoint;
+          break;
+        case ColumnType::kDoubleList:
+          type_type = kTypeFixedSizeList;
+          break;
+      }
+      fields.push_back(CreateField(&fbb, col.name, type_type,
+                                   static_cast<int32_t>(col.list_size)));
+    }
+    const uint32_t fields_vector = fbb.CreateOffsetVector(fields);
+    fbb.StartTable();
+    fbb.AddOffset(1, fields_vector);
+    const uint32_t schema = fbb.EndTable();
+    WriteMessage(&table->out,
+                 FinishMessage(&fbb, kMessageHeaderSchema, schema, 0), "");
+  }
+
+  if (batch.num_rows > 0) {
+    // Every column has no nulls, so the validity buffers are empty. Each
+    // buffer starts at an aligned offset within the body. A compressed
+    // buffer is prefixed by its uncompressed length, and empty buffers are
+    // left empty.
+    const int64_t num_rows = batch.num_rows;
+    std::string body;
+    std::vector<int64_t> nodes;
+    std::vector<int64_t> buffers;
+    absl::Status compress_status;
+    auto add_buffer = [this, &body, &buffers, &compress_status](
+        const void *data, size_t length) {
+      const size_t offset = body.size();
+      if (compression_level_ > 0 && length > 0) {
+        auto frame = ZstdFrameWriter::CompressFrame(
+            std::string(static_cast<const char *>(data), length),
+            compression_level_);
+        if (!frame.ok()) {
+          compress_status = frame.status();
+          return;
+        }
+        const int64_t uncompressed_length = static_cast<int64_t>(length);
+        body.append(reinterpret_cast<const char *>(&uncompressed_length),
+                    sizeof(uncompressed_length));
+        body.append(frame.value());
+      } else {
+        body.append(static_cast<const char *>(data), length);
+      }
+      buffers.push_back(static_cast<int64_t>(offset));
+      buffers.push_back(static_cast<int64_t>(body.size() - offset));
+      PadToAlignment(&body);
+    };
+    for (const Column &col : batch.columns) {
+      nodes.insert(nodes.end(), {num_rows, 0});
+      add_buffer(nullptr, 0);
+      switch (col.type) {
+        case ColumnType::kUtf8:
+          add_buffer(col.offsets.data(), col.offsets.size() * sizeof(int32_t));
+          add_buffer(col.chars.data(), col.chars.size());
+          break;
+        case ColumnType::kInt64:
+          add_buffer(col.ints.data(), col.ints.size() * sizeof(int64_t));
+          break;
+        case ColumnType::kDouble:
+          add_buffer(col.doubles.data(), col.doubles.size() * sizeof(double));
+          break;
+        case ColumnType::kDoubleList:
+          nodes.insert(nodes.end(),
+                       {num_rows * static_cast<int64_t>(col.list_size), 0});
+          add_buffer(nullptr, 0);
+          add_buffer(col.doubles.data(), col.doubles.size() * sizeof(double));
+          break;
+      }
+    }
+    VISQOL_RETURN_IF_ERROR(compress_status);
+
+    FlatBufferBuilder fbb;
+    const uint32_t nodes_vector = fbb.CreateInt64StructVector(nodes, 2);
+    const uint32_t buffers_vector = fbb.CreateInt64StructVector(buffers, 2);
+    uint32_t compression = 0;
+    if (compression_level_ > 0) {
+      fbb.StartTable();
+      fbb.AddScalar<int8_t>(0, kCompressionTypeZstd);
+      fbb.AddScalar<int8_t>(1, kBodyCompressionMethodBuffer);
+      compression = fbb.EndTable();
+    }
+    fbb.StartTable();
+    fbb.AddScalar<int64_t>(0, num_rows);
+    fbb.AddOffset(1, nodes_vector);
+    fbb.AddOffset(2, buffers_vector);
+    if (compression_level_ > 0) {
+      fbb.AddOffset(3, compression);
+    }
+    const uint32_t record_batch = fbb.EndTable();
+    WriteMessage(&table->out,
+                 FinishMessage(&fbb, kMessageHeaderRecordBatch, record_batch,
+                               static_cast<int64_t>(body.size())),
+                 body);
+  }
+
+  table->out.flush();
+  if (!table->out) {
+    return absl::Status(absl::StatusCode::kInternal,
+                        "Failed to write Arrow output file " +
+                            table->path.Path());
+  }
+  return absl::Status();
+}
+
+void ArrowResultsWriter::EncodeLoop() {
+  auto has_work = [this]() {
+    mutex_.AssertHeld();
+    return closing_ || !queued_batches_.empty();
+  };
+  while (true) {
+    PendingBatch batch;
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.Await(absl::Condition(&has_work));
+      if (queued_batches_.empty()) {
+        return;
+      }
+      batch = std::move(queued_batches_.front());
+      queued_batches_.pop_front();
+      if (!write_status_.ok()) {
+        // Drop the remaining batches once a batch has failed.
+        continue;
+      }
+    }
+    const absl::Status status = WriteBatch(batch);
+    if (!status.ok()) {
+      absl::MutexLock lock(&mutex_);
+      write_status_ = status;
+    }
+  }
+}
+
+absl::Status ArrowResultsWriter::CloseTable(Table *table) {
+  const uint32_t end_of_stream[] = {kContinuationMarker, 0};
+  table->out.write(reinterpret_cast<const char *>(end_of_stream),
+                   sizeof(end_of_stream));
+  table->out.close();
+  if (!table->out) {
+    return absl::Status(absl::StatusCode::kInternal,
+                        "Failed to write Arrow output file " +
+                            table->path.Path());
+  }
+  return absl::Status();
+}
+}  // namespace Visqol
@@ -0,0 +1,167 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "autotuner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+#include "batch_comparison_runner.h"
+#include "resource_probe.h"
+#include "status_macros.h"
+
+namespace Visqol {
+
+const double Autotuner::kDefaultSyntheticDuration = 5.0;
+
+const size_t kAudioSampleRate = 48000;
+const size_t kSpeechSampleRate = 16000;
+const double kNoteDuration = 0.25;
+const size_t kNumHarmonics = 5;
+const double kDegradedDelay = 0.02;
+
+Autotuner::Autotuner(const FilePath &sim_to_quality_mapper_model,
+                     const bool use_speech_mode,
+                     const bool use_unscaled_speech, const int search_window,
+                     const double synthetic_duration)
+    : sim_to_quality_mapper_model_(sim_to_quality_mapper_model),
+      use_speech_mode_(use_speech_mode),
+      use_unscaled_speech_(use_unscaled_speech),
+      search_window_(search_window),
+      synthetic_duration_(synthetic_duration) {}
+
+absl::StatusOr<TuningProfile> Autotuner::Tune() const {
+  const std::vector<size_t> candidates = CandidateWorkerCounts();
+  const size_t sample_rate =
+      use_speech_mode_ ? kSpeechSampleRate : kAudioSampleRate;
+
+  // Use enough pairs to keep every worker of the largest candidate busy.
+  const size_t num_pairs = std::max<size_t>(2, candidates.back());
+  std::vector<AudioSignal> refs;
+  std::vector<AudioSignal> degs;
+  for (size_t i = 0; i < num_pairs; i++) {
+    refs.push_back(MakeSyntheticReference(sample_rate, synthetic_duration_, i));
+    degs.push_back(MakeSyntheticDegraded(refs.back(), i));
+  }
+
+  double best_elapsed = std::numeric_limits<double>::max();
+  TuningProfile profile;
+  profile.host_concurrency = ResourceProbe::Probe().hardware_concurrency;
+
+  for (const size_t num_workers : candidates) {
+    BatchComparisonRunner runner(num_workers);
+    VISQOL_RETURN_IF_ERROR(runner.Init(sim_to_quality_mapper_model_,
+                                       use_speech_mode_, use_unscaled_speech_,
+                                       search_window_));
+
+    absl::Status run_status;
+    const auto start = std::chrono::steady_clock::now();
+    runner.Run(
+        num_pairs,
+        [&refs, &degs](VisqolManager *manager, size_t job_index,
+                       const CancellationToken *cancellation) {
+          // The degraded signal is aligned in place, so work on a copy.
+          AudioSignal deg_signal = degs[job_index];
+          return manager->Run(refs[job_index], deg_signal, cancellation);
+        },
+        [&run_status](size_t job_index,
+                      const absl::StatusOr<SimilarityResultMsg> &result) {
+          if (!result.ok() && run_status.ok()) {
+            run_status = result.status();
+          }
+        });
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    VISQOL_RETURN_IF_ERROR(run_status);
+
+    ABSL_RAW_LOG(INFO, "Autotune: num_workers=%zu took %.3fs for %zu pairs.",
+                 num_workers, elapsed.count(), num_pairs);
+    if (elapsed.count() < best_elapsed) {
+      best_elapsed = elapsed.count();
+      profile.num_workers = num_workers;
+    }
+  }
+  return profile;
+}
+
+std::vector<size_t> Autotuner::CandidateWorkerCounts() {
+  // Candidates beyond the CPU quota or memory limit would oversubscribe.
+  const size_t max_workers =
+      ResourceProbe::DeriveExecutionConfig(ResourceProbe::Probe()).num_workers;
+  std::vector<size_t> candidates;
+  for (size_t n = 1; n < max_workers; n *= 2) {
+    candidates.push_back(n);
+  }
+  candidates.push_back(max_workers);
+  return candidates;
+}
+
+AudioSignal Autotuner::MakeSyntheticReference(const size_t sample_rate,
+                                              const double duration,
+                                              const size_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> fundamental_dist(110.0, 880.0);
+  std::normal_distribution<double> noise_dist(0.0, 0.001);
+
+  const size_t num_samples = static_cast<size_t>(duration * sample_rate);
+  const size_t note_samples = static_cast<size_t>(kNoteDuration * sample_rate);
+  std::vector<double> samples(num_samples);
+  double fundamental = fundamental_dist(rng);
+  for (size_t i = 0; i < num_samples; i++) {
+    const size_t note_pos = i % note_samples;
+    if (note_pos == 0) {
+      fundamental = fundamental_dist(rng);
+    }
+    // Plucked note envelope with a harmonic series that rolls off at 1/h.
+    const double t = static_cast<double>(note_pos) / sample_rate;
+    const double envelope = 0.3 * std::exp(-6.0 * t);
+    double sample = 0.0;
+    for (size_t h = 1; h <= kNumHarmonics; h++) {
+      const double freq = fundamental * h;
+      if (freq < sample_rate / 2.0) {
+        sample += std::sin(2.0 * M_PI * freq * t) / h;
+      }
+    }
+    samples[i] = envelope * sample + noise_dist(rng);
+  }
+  return AudioSignal{AMatrix<double>(samples), sample_rate};
+}
+
+AudioSignal Autotuner::MakeSyntheticDegraded(const AudioSignal &reference,
+                                             const size_t seed) {
+  std::mt19937 rng(seed + 1);
+  std::normal_distribution<double> noise_dist(0.0, 0.005);
+
+  const std::vector<double> ref = reference.data_matrix.ToVector();
+  const size_t delay =
+      static_cast<size_t>(kDegradedDelay * reference.sample_rate);
+  // Vary the low pass cutoff from pair to pair.
+  const double alpha = 0.3 + 0.1 * (seed % 5);
+  std::vector<double> samples(ref.size(), 0.0);
+  double filtered = 0.0;
+  for (size_t i = delay; i < ref.size(); i++) {
+    filtered += alpha * (ref[i - delay] - filtered);
+    samples[i] = filtered + noise_dist(rng);
+  }
+  return AudioSignal{AMatrix<double>(samples), reference.sample_rate};
+}
+}  // namespace Visqol
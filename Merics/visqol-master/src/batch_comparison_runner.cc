@@ -0,0 +1,493 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "batch_comparison_runner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+
+#include "cpu_time_watchdog.h"
+#include "resource_probe.h"
+#include "status_macros.h"
+
+namespace Visqol {
+
+BatchComparisonRunner::BatchComparisonRunner(size_t num_workers) {
+  if (num_workers == 0) {
+    num_workers = 1;
+  }
+  for (size_t i = 0; i < num_workers; i++) {
+    managers_.push_back(absl::make_unique<VisqolManager>());
+  }
+}
+
+absl::Status BatchComparisonRunner::Init(
+    const FilePath &sim_to_quality_mapper_model, const bool use_speech_mode,
+    const bool use_unscaled_speech, const int search_window,
+    const FineAlignmentPolicy &fine_alignment_policy,
+    const PatchSearchPolicy &patch_search_policy) {
+  default_config_.sim_to_quality_mapper_model = sim_to_quality_mapper_model;
+  default_config_.use_speech_mode = use_speech_mode;
+  default_config_.search_window = search_window;
+  use_unscaled_speech_ = use_unscaled_speech;
+  fine_alignment_policy_ = fine_alignment_policy;
+  patch_search_policy_ = patch_search_policy;
+  {
+    absl::MutexLock lock(&pool_mutex_);
+    idle_managers_.clear();
+  }
+  for (auto &manager : managers_) {
+    VISQOL_RETURN_IF_ERROR(manager->Init(sim_to_quality_mapper_model,
+                                         use_speech_mode, use_unscaled_speech,
+                                         search_window, fine_alignment_policy,
+                                         patch_search_policy));
+  }
+  return absl::Status();
+}
+
+void BatchComparisonRunner::SetTimeline(double window_duration,
+                                        double hop_duration) {
+  timeline_window_duration_ = window_duration;
+  timeline_hop_duration_ = hop_duration;
+  for (auto &manager : managers_) {
+    manager->SetTimeline(window_duration, hop_duration);
+  }
+  absl::MutexLock lock(&pool_mutex_);
+  for (auto &config_managers : idle_managers_) {
+    for (auto &manager : config_managers.second) {
+      manager->SetTimeline(window_duration, hop_duration);
+    }
+  }
+}
+
+void BatchComparisonRunner::SetSilenceTrimming(bool trim_silence) {
+  trim_silence_ = trim_silence;
+  for (auto &manager : managers_) {
+    manager->SetSilenceTrimming(trim_silence);
+  }
+  absl::MutexLock lock(&pool_mutex_);
+  for (auto &config_managers : idle_managers_) {
+    for (auto &manager : config_managers.second) {
+      manager->SetSilenceTrimming(trim_silence);
+    }
+  }
+}
+
+void BatchComparisonRunner::SetReferenceFeatureCache(
+    std::shared_ptr<ReferenceFeatureCache> cache) {
+  reference_cache_ = std::move(cache);
+  for (auto &manager : managers_) {
+    manager->SetReferenceFeatureCache(reference_cache_);
+  }
+  absl::MutexLock lock(&pool_mutex_);
+  for (auto &config_managers : idle_managers_) {
+    for (auto &manager : config_managers.second) {
+      manager->SetReferenceFeatureCache(reference_cache_);
+    }
+  }
+}
+
+void BatchComparisonRunner::Run(
+    const std::vector<ReferenceDegradedPathPair> &file_pairs,
+    const ResultCallback &on_result) {
+  std::vector<size_t> job_memory;
+  if (memory_budget_bytes_ > 0) {
+    for (const auto &pair : file_pairs) {
+      job_memory.push_back(ResourceProbe::EstimateComparisonMemory(
+          pair.reference, pair.degraded));
+    }
+  }
+
+  // The headers are only read if the run time or the duration of each pair
+  // is needed. A pair whose headers cannot be read will fail quickly, so is
+  // predicted to cost nothing and is not used for calibration.
+  std::vector<absl::optional<PairCostFeatures>> job_features;
+  std::vector<double> job_cost;
+  std::vector<double> job_audio_seconds;
+  if (cost_model_ != nullptr || progress_reporter_ != nullptr) {
+    for (const auto &pair : file_pairs) {
+      auto features_statusor =
+          CostModel::ReadFeatures(pair.reference, pair.degraded);
+      if (features_statusor.ok()) {
+        job_features.push_back(features_statusor.value());
+        job_audio_seconds.push_back(
+            features_statusor.value().reference_duration);
+      } else {
+        job_features.push_back(absl::nullopt);
+        job_audio_seconds.push_back(0.0);
+      }
+      if (cost_model_ != nullptr) {
+        job_cost.push_back(
+            features_statusor.ok()
+                ? cost_model_->Predict(features_statusor.value())
+                : CostModel::kMinPredictedSeconds);
+      }
+    }
+  }
+  absl::Mutex cost_model_mutex;
+  const std::string default_key = default_config_.Key();
+  Run(
+      file_pairs.size(),
+      [&](VisqolManager *manager, size_t job_index,
+          const CancellationToken *cancellation) {
+        const ReferenceDegradedPathPair &pair = file_pairs[job_index];
+        const bool uses_default = ConfigFor(pair).Key() == default_key;
+        const auto start = std::chrono::steady_clock::now();
+        auto result =
+            RunPairWithSettings(manager, pair, job_index, cancellation);
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        // Extracting spectrograms skips most of the work of a comparison.
+        const bool compared = feature_writer_ == nullptr ||
+            feature_writer_->Stage() != FeatureStage::kSpectrogram;
+        if (cost_model_ != nullptr && result.ok() && uses_default &&
+            compared && job_features[job_index].has_value()) {
+          absl::MutexLock lock(&cost_model_mutex);
+          cost_model_->AddObservation(job_features[job_index].value(),
+                                      elapsed.count());
+        }
+        return result;
+      },
+      on_result, job_memory, job_cost, job_audio_seconds);
+}
+
+void BatchComparisonRunner::RunStream(const PairSource &next_pair,
+                                      const StreamResultCallback &on_result) {
+  const size_t num_threads = managers_.size();
+  std::unique_ptr<CpuTimeWatchdog> watchdog;
+  if (pair_cpu_time_limit_seconds_ > 0.0) {
+    watchdog =
+        absl::make_unique<CpuTimeWatchdog>(pair_cpu_time_limit_seconds_);
+    watchdog->Start(num_threads);
+  }
+  absl::Mutex mutex;
+  std::atomic<size_t> next_index{0};
+  std::atomic<bool> aborted{false};
+
+  auto worker = [&](size_t worker_index) {
+    VisqolManager *manager = managers_[worker_index].get();
+    while (!aborted.load()) {
+      const absl::optional<ReferenceDegradedPathPair> pair = next_pair();
+      if (!pair.has_value()) {
+        break;
+      }
+      CancellationToken cancellation;
+      if (watchdog) {
+        watchdog->Watch(worker_index, &cancellation);
+      }
+      auto result = RunPairWithSettings(manager, pair.value(),
+                                        next_index.fetch_add(1),
+                                        &cancellation);
+      if (watchdog) {
+        watchdog->Unwatch(worker_index);
+      }
+      if (!result.ok() &&
+          result.status().code() == absl::StatusCode::kAborted) {
+        aborted.store(true);
+      }
+      absl::MutexLock lock(&mutex);
+      on_result(pair.value(), result);
+    }
+  };
+
+  if (num_threads <= 1) {
+    worker(0);
+  } else {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; i++) {
+      threads.emplace_back(worker, i);
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+  if (watchdog) {
+    watchdog->Stop();
+  }
+}
+
+absl::StatusOr<SimilarityResultMsg>
+BatchComparisonRunner::RunPairWithSettings(
+    VisqolManager *manager, const ReferenceDegradedPathPair &pair,
+    size_t job_index, const CancellationToken *cancellation) {
+  const ManagerConfig config = ConfigFor(pair);
+  std::unique_ptr<VisqolManager> pooled;
+  if (config.Key() != default_config_.Key()) {
+    auto manager_statusor = AcquireManager(config);
+    if (!manager_statusor.ok()) {
+      return manager_statusor.status();
+    }
+    pooled = std::move(manager_statusor.value());
+    manager = pooled.get();
+  }
+  auto result = RunPair(manager, pair, job_index, cancellation);
+  if (pooled) {
+    ReleaseManager(config, std::move(pooled));
+  }
+  return result;
+}
+
+std::string BatchComparisonRunner::ManagerConfig::Key() const {
+  // The model is not used in speech mode.
+  return std::string(use_speech_mode ? "speech" : "audio") + "," +
+         std::to_string(search_window) + "," +
+         (use_speech_mode ? "" : sim_to_quality_mapper_model.Path());
+}
+
+BatchComparisonRunner::ManagerConfig BatchComparisonRunner::ConfigFor(
+    const ReferenceDegradedPathPair &pair) const {
+  ManagerConfig config = default_config_;
+  if (pair.use_speech_mode.has_value()) {
+    config.use_speech_mode = pair.use_speech_mode.value();
+  }
+  if (pair.sim_to_quality_mapper_model.has_value()) {
+    config.sim_to_quality_mapper_model =
+        pair.sim_to_quality_mapper_model.value();
+  }
+  if (pair.search_window_radius.has_value()) {
+    config.search_window = pair.search_window_radius.value();
+  }
+  return config;
+}
+
+absl::StatusOr<std::unique_ptr<VisqolManager>>
+BatchComparisonRunner::AcquireManager(const ManagerConfig &config) {
+  {
+    absl::MutexLock lock(&pool_mutex_);
+    auto &idle = idle_managers_[config.Key()];
+    if (!idle.empty()) {
+      std::unique_ptr<VisqolManager> manager = std::move(idle.back());
+      idle.pop_back();
+      return manager;
+    }
+  }
+  // Loading the model may be slow, so is done outside of the lock.
+  auto manager = absl::make_unique<VisqolManager>();
+  VISQOL_RETURN_IF_ERROR(manager->Init(
+      config.sim_to_quality_mapper_model, config.use_speech_mode,
+      use_unscaled_speech_, config.search_window, fine_alignment_policy_,
+      patch_search_policy_));
+  manager->SetTimeline(timeline_window_duration_, timeline_hop_duration_);
+  manager->SetSilenceTrimming(trim_silence_);
+  manager->SetReferenceFeatureCache(reference_cache_);
+  return manager;
+}
+
+void BatchComparisonRunner::ReleaseManager(
+    const ManagerConfig &config, std::unique_ptr<VisqolManager> manager) {
+  absl::MutexLock lock(&pool_mutex_);
+  idle_managers_[config.Key()].push_back(std::move(manager));
+}
+
+absl::StatusOr<SimilarityResultMsg> BatchComparisonRunner::RunPair(
+    VisqolManager *manager, const ReferenceDegradedPathPair &pair,
+    size_t job_index, const CancellationToken *cancellation) {
+  if (feature_writer_ == nullptr) {
+    return manager->Run(pair.reference, pair.degraded, cancellation);
+  }
+  if (feature_writer_->Stage() == FeatureStage::kSpectrogram) {
+    auto features = manager->ExtractSpectrograms(pair.reference,
+                                                 pair.degraded);
+    if (!features.ok()) {
+      feature_writer_->AddFailed(job_index, pair, features.status())
+          .IgnoreError();
+      return features.status();
+    }
+    VISQOL_RETURN_IF_ERROR(feature_writer_->AddSpectrograms(
+        job_index, pair, features.value()));
+    SimilarityResultMsg result;
+    result.set_reference_filepath(pair.reference.Path());
+    result.set_degraded_filepath(pair.degraded.Path());
+    return result;
+  }
+  auto result = manager->Run(pair.reference, pair.degraded, cancellation);
+  if (!result.ok()) {
+    feature_writer_->AddFailed(job_index, pair, result.status())
+        .IgnoreError();
+    return result;
+  }
+  VISQOL_RETURN_IF_ERROR(feature_writer_->AddResult(job_index,
+                                                    result.value()));
+  return result;
+}
+
+void BatchComparisonRunner::Run(size_t num_jobs, const Job &job,
+                                const ResultCallback &on_result,
+                                const std::vector<size_t> &job_memory,
+                                const std::vector<double> &job_cost,
+                                const std::vector<double> &job_audio_seconds) {
+  // The order the jobs are started in, which is longest first if their costs
+  // are known.
+  std::vector<size_t> start_order(num_jobs);
+  std::iota(start_order.begin(), start_order.end(), 0);
+  if (!job_cost.empty()) {
+    std::stable_sort(start_order.begin(), start_order.end(),
+                     [&job_cost](size_t a, size_t b) {
+                       return job_cost[a] > job_cost[b];
+                     });
+  }
+  auto cost_of = [&job_cost](size_t job_index) {
+    return job_cost.empty() ? 1.0 : job_cost[job_index];
+  };
+  const size_t num_threads = std::min(managers_.size(), num_jobs);
+  {
+    absl::MutexLock lock(&progress_mutex_);
+    remaining_cost_ = 0.0;
+    for (size_t i = 0; i < num_jobs; i++) {
+      remaining_cost_ += cost_of(i);
+    }
+    finished_cost_ = 0.0;
+    finished_seconds_ = 0.0;
+    run_workers_ = num_threads;
+  }
+  if (progress_reporter_ != nullptr) {
+    progress_reporter_->Start(num_jobs, std::max<size_t>(num_threads, 1),
+                              [this]() { return EstimatedSecondsRemaining(); });
+  }
+  std::unique_ptr<CpuTimeWatchdog> watchdog;
+  if (pair_cpu_time_limit_seconds_ > 0.0) {
+    watchdog =
+        absl::make_unique<CpuTimeWatchdog>(pair_cpu_time_limit_seconds_);
+    watchdog->Start(std::max<size_t>(num_threads, 1));
+  }
+
+  // Results that have completed but cannot be delivered until all of the
+  // jobs before them have been delivered.
+  std::vector<absl::optional<absl::StatusOr<SimilarityResultMsg>>> pending(
+      num_jobs);
+  size_t next_to_deliver = 0;
+  bool delivery_stopped = false;
+  absl::Mutex mutex;
+  std::atomic<size_t> next_job{0};
+  std::atomic<bool> aborted{false};
+  // The estimated memory and number of the jobs currently running.
+  const bool limit_memory = memory_budget_bytes_ > 0 && !job_memory.empty();
+  size_t memory_in_use = 0;
+  size_t jobs_running = 0;
+
+  auto worker = [&](size_t worker_index) {
+    VisqolManager *manager = managers_[worker_index].get();
+    while (!aborted.load()) {
+      const size_t next = next_job.fetch_add(1);
+      if (next >= num_jobs) {
+        break;
+      }
+      const size_t job_index = start_order[next];
+      if (limit_memory) {
+        absl::MutexLock lock(&mutex);
+        const size_t needed = job_memory[job_index];
+        auto fits = [&]() {
+          return jobs_running == 0 ||
+                 memory_in_use + needed <= memory_budget_bytes_;
+        };
+        mutex.Await(absl::Condition(&fits));
+        memory_in_use += needed;
+        jobs_running++;
+      }
+      if (progress_reporter_ != nullptr) {
+        progress_reporter_->JobStarted(worker_index, job_index,
+                                       cost_of(job_index));
+      }
+      CancellationToken cancellation;
+      if (watchdog) {
+        watchdog->Watch(worker_index, &cancellation);
+      }
+      const auto start = std::chrono::steady_clock::now();
+      auto result = job(manager, job_index, &cancellation);
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      if (watchdog) {
+        watchdog->Unwatch(worker_index);
+      }
+      if (progress_reporter_ != nullptr) {
+        progress_reporter_->JobFinished(
+            worker_index, result.ok(),
+            job_audio_seconds.empty() ? 0.0 : job_audio_seconds[job_index]);
+      }
+      {
+        absl::MutexLock lock(&progress_mutex_);
+        remaining_cost_ -= cost_of(job_index);
+        finished_cost_ += cost_of(job_index);
+        finished_seconds_ += elapsed.count();
+      }
+      if (!result.ok() &&
+          result.status().code() == absl::StatusCode::kAborted) {
+        aborted.store(true);
+      }
+
+      absl::MutexLock lock(&mutex);
+      if (limit_memory) {
+        memory_in_use -= job_memory[job_index];
+        jobs_running--;
+      }
+      pending[job_index] = std::move(result);
+      while (!delivery_stopped && next_to_deliver < num_jobs &&
+             pending[next_to_deliver].has_value()) {
+        const auto &ready = pending[next_to_deliver].value();
+        on_result(next_to_deliver, ready);
+        delivery_stopped = !ready.ok() &&
+            ready.status().code() == absl::StatusCode::kAborted;
+        pending[next_to_deliver].reset();
+        next_to_deliver++;
+      }
+    }
+  };
+
+  if (num_threads <= 1) {
+    worker(0);
+  } else {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; i++) {
+      threads.emplace_back(worker, i);
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+  if (watchdog) {
+    watchdog->Stop();
+  }
+  if (progress_reporter_ != nullptr) {
+    progress_reporter_->Finish();
+  }
+
+  absl::MutexLock lock(&progress_mutex_);
+  remaining_cost_ = 0.0;
+  run_workers_ = 0;
+}
+
+double BatchComparisonRunner::EstimatedSecondsRemaining() const {
+  absl::MutexLock lock(&progress_mutex_);
+  if (run_workers_ == 0 || remaining_cost_ <= 0.0) {
+    return 0.0;
+  }
+  // Until a job has finished, the predictions are taken at face value.
+  const double scale =
+      finished_cost_ > 0.0 ? finished_seconds_ / finished_cost_ : 1.0;
+  return remaining_cost_ * scale / run_workers_;
+}
+}  // namespace Visqol
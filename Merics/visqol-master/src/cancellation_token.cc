@@ -0,0 +1,37 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "cancellation_token.h"
+
+#include <string>
+
+namespace Visqol {
+
+absl::Status CancellationToken::Check(const CancellationToken *token) {
+  if (token == nullptr || !token->IsCancelled()) {
+    return absl::Status();
+  }
+  absl::MutexLock lock(&token->mutex_);
+  return absl::Status(absl::StatusCode::kDeadlineExceeded, token->reason_);
+}
+
+void CancellationToken::Cancel(const std::string &reason) {
+  absl::MutexLock lock(&mutex_);
+  if (!cancelled_.load()) {
+    reason_ = reason;
+    cancelled_.store(true);
+  }
+}
+}  // namespace Visqol
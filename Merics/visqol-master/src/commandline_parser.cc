@@ -14,7 +14,9 @@
 
 #include "commandline_parser.h"
 
+#include <algorithm>
 #include <fstream>
+#include <limits>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -26,11 +28,17 @@
 #include "absl/flags/usage.h"
 // Placeholder for runfiles.
 #include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+
+#include "reference_cache_service.h"
+#include "zstd_frame_writer.h"
 
 ABSL_FLAG(std::string, reference_file, "",
-          "The wav file path used as the reference audio.");
+          "The wav file path used as the reference audio, or '-' to read "
+          "it from standard input.");
 ABSL_FLAG(std::string, degraded_file, "",
-          "The wav file path used as the degraded audio.");
+          "The wav file path used as the degraded audio, or '-' to read it "
+          "from standard input.");
 ABSL_FLAG(std::string, batch_input_csv, "",
           "Used to specify a path to a CSV file with the format: \n"
           "------------------\n"
@@ -38,6 +46,8 @@ ABSL_FLAG(std::string, batch_input_csv, "",
           "ref1.wav,deg1.wav\n"
           "ref2.wav,deg2.wav\n"
           "------------------\n"
+          "Optional mode (audio or speech), model and search_window_radius \n"
+          "columns override the command line for each row, if not empty.\n"
           "If the `batch_input_csv` flag is used, the `reference_file` \n"
           "and `degraded_file` flags will be ignored.");
 ABSL_FLAG(std::string, results_csv, "",
@@ -80,12 +90,158 @@ ABSL_FLAG(int, search_window_radius, 60,
           "search to discover patch matches. For a given reference frame, it "
           "will look at 2*search_window_radius + 1 patches to find the most "
           "optimal match.");
+ABSL_FLAG(bool, autotune, false,
+          "Benchmark the execution parameters on this host using synthetic "
+          "signals and write the fastest configuration to the file given by "
+          "--tuning_profile. No comparisons are run in this mode.");
+ABSL_FLAG(std::string, tuning_profile, "",
+          "Path to a tuning profile generated by --autotune. When running "
+          "comparisons, the execution parameters are loaded from this file. "
+          "The tuning profile does not affect the similarity scores.");
+ABSL_FLAG(double, fine_alignment_skip_threshold,
+          std::numeric_limits<double>::infinity(),
+          "Matched patches with a coarse similarity above this threshold keep "
+          "their coarse alignment instead of being finely aligned, which is "
+          "faster but may slightly change the MOS-LQO. By default every patch "
+          "is finely aligned.");
+ABSL_FLAG(bool, approximate_fine_alignment_at_zero_lag, false,
+          "Matched patches that are already aligned to the sample keep their "
+          "coarse alignment instead of having their spectrograms rebuilt. "
+          "This is an approximation that is faster but changes the MOS-LQO, "
+          "as the rebuilt spectrograms differ even without a shift.");
+ABSL_FLAG(bool, exhaustive_patch_search, false,
+          "Measure every degraded patch candidate in the patch search instead "
+          "of pruning those that cannot be part of the best matching. The "
+          "scores are the same, so this is only useful to check the pruning.");
+ABSL_FLAG(std::string, results_arrow, "",
+          "Used to specify a path that the similarity results will be written "
+          "to as an Arrow IPC stream, with one row per pair. The fvnsim, "
+          "fstdnsim and fvdegenergy columns are fixed size lists. Any "
+          "existing file is replaced.");
+ABSL_FLAG(std::string, patch_results_arrow, "",
+          "Used to specify a path that the per patch similarity results will "
+          "be written to as an Arrow IPC stream, with one row per patch. The "
+          "pair_index column is the row of the pair in the --results_arrow "
+          "file. Requires --results_arrow.");
+ABSL_FLAG(std::string, cost_model, "",
+          "Path to a cost model file, used to predict the run time of each "
+          "pair so that the longest pairs are started first and the time "
+          "remaining can be estimated. The model is calibrated with the "
+          "measured run times and written back to this path after the batch, "
+          "creating the file if it does not exist. The cost model does not "
+          "affect the similarity scores.");
+ABSL_FLAG(std::string, progress_output, "",
+          "Used to specify a path that progress reports will be written to "
+          "while the batch runs, one JSON object per line. Each report holds "
+          "the pairs done and total, the throughput in pairs and audio "
+          "seconds per second, the estimated time remaining, the worker "
+          "utilization and any comparisons running much longer than "
+          "expected. Use /dev/fd/<n> to write to an open file descriptor.");
+ABSL_FLAG(double, progress_interval, 10.0,
+          "The time in seconds between the reports written to "
+          "--progress_output. A final report is always written when the "
+          "batch finishes.");
+ABSL_FLAG(std::string, timeline_csv, "",
+          "Used to specify a path that the quality over time of each pair "
+          "will be written to in CSV format, with one row per window of the "
+          "reference signal. The windows reuse the patch matches of the "
+          "comparison, so add almost no work.");
+ABSL_FLAG(double, timeline_window, 10.0,
+          "The duration in seconds of each --timeline_csv window.");
+ABSL_FLAG(double, timeline_hop, 1.0,
+          "The time in seconds between the starts of consecutive "
+          "--timeline_csv windows.");
+ABSL_FLAG(std::string, extract_features, "",
+          "Run the pipeline up to the given stage and write its features to "
+          "--features_dir as NumPy .npy shards, instead of writing the "
+          "results. One of 'spectrogram' (the prepared spectrograms, without "
+          "comparing them), 'patches' (the similarity of each matched patch, "
+          "and the fvnsim features) or 'fvnsim' (the fvnsim, fstdnsim and "
+          "fvdegenergy features of each pair).");
+ABSL_FLAG(std::string, features_dir, "",
+          "The directory that --extract_features writes its shards and "
+          "index.csv to. Created if it does not exist.");
+ABSL_FLAG(int, features_pairs_per_shard, 256,
+          "The number of pairs in each shard written by --extract_features.");
+ABSL_FLAG(int, compression_level, 0,
+          "If greater than 0, compress the --results_csv, --output_debug and "
+          "--timeline_csv outputs as seekable zstd streams, and the "
+          "--results_arrow and --patch_results_arrow buffers with zstd, at "
+          "this level (1 to 22). Compressed text outputs replace any existing "
+          "file rather than appending to it.");
+ABSL_FLAG(double, pair_cpu_time_limit, 0.0,
+          "If greater than 0, the CPU time in seconds each pair may use. A "
+          "pair that exceeds it is cancelled and reported as an error with "
+          "the time spent in each stage so far, so that a pathological pair "
+          "does not hold up the batch. 0 (no limit) by default.");
+ABSL_FLAG(bool, trim_silence, false,
+          "Trim the leading and trailing silence of each reference, keeping "
+          "0.5s of padding, and the same samples of the degraded signal, "
+          "before comparing them. Patch times are still reported relative to "
+          "the start of the files. This is faster for inputs with long "
+          "silences, but changes the scores.");
+
+ABSL_FLAG(std::string, watch_dir, "",
+          "Watch this directory for degraded files, and compare each one with "
+          "its reference as soon as it has been written or moved into the "
+          "directory, until interrupted. Results are written as each "
+          "comparison finishes. The reference of a file is named on the first "
+          "line of its sidecar file, which has the same name with '.ref' "
+          "appended, if there is one, else by --watch_degraded_pattern and "
+          "--watch_reference_pattern. Linux only.");
+ABSL_FLAG(std::string, watch_reference_dir, "",
+          "The directory that holds the references named by "
+          "--watch_reference_pattern. --watch_dir by default, in which case "
+          "the two patterns must differ.");
+ABSL_FLAG(std::string, watch_degraded_pattern, "*.wav",
+          "The pattern that the names of watched degraded files must match, "
+          "where a single '*' matches any text, e.g. 'transcoded_*.wav'.");
+ABSL_FLAG(std::string, watch_reference_pattern, "*.wav",
+          "The name of the reference of a watched degraded file, where '*' is "
+          "replaced by the text it matched in --watch_degraded_pattern.");
+ABSL_FLAG(int, watch_queue_size, 256,
+          "The number of watched files that may wait for a free worker. While "
+          "the queue is full, new files wait in the kernel's event queue.");
+ABSL_FLAG(double, watch_idle_timeout, 0.0,
+          "If greater than 0, stop watching once no file has been written for "
+          "this many seconds. 0 (watch until interrupted) by default.");
+ABSL_FLAG(double, spill_threshold_mb, 0.0,
+          "If greater than 0, intermediate buffers of at least this many MiB, "
+          "such as the patch search tables of long inputs, are kept in memory "
+          "mapped temporary files instead of RAM, so that the kernel can page "
+          "them out. 0 (never spill) by default.");
+ABSL_FLAG(std::string, spill_dir, "",
+          "The directory that --spill_threshold_mb creates its temporary "
+          "files in. The system's temporary directory by default.");
+ABSL_FLAG(std::string, reference_cache, "",
+          "Cache the prepared features of each reference, so that a reference "
+          "compared many times is only prepared once. Either 'local' for a "
+          "cache in memory, or the host:port of a reference_cache_server "
+          "shared by a fleet of nodes, in front of which a cache in memory is "
+          "kept. The scores are unchanged. Disabled by default.");
+ABSL_FLAG(double, reference_cache_local_mb, 256.0,
+          "The size in MiB of the in-memory cache of --reference_cache. "
+          "256 by default.");
+ABSL_FLAG(std::string, reference_cache_secret_file, "",
+          "A file holding a secret of at least 16 bytes shared by the nodes "
+          "of a fleet, which signs the entries on the reference_cache_server "
+          "so that entries stored by anyone else are ignored. Required when "
+          "--reference_cache is a host:port.");
 
 namespace Visqol {
 ABSL_CONST_INIT const char kDefaultAudioModelFile[] =
     "/model/libsvm_nu_svr_model.txt";
 ABSL_CONST_INIT const char kDefaultSpeechModelFile[] =
     "/model/tcdvoip_nu.568_c5.31474325639_g3.17773760038_model.txt";
+ABSL_CONST_INIT const char kDefaultTuningProfileFile[] =
+    "visqol_tuning_profile.txt";
+ABSL_CONST_INIT const char kBatchReferenceColumn[] = "reference";
+ABSL_CONST_INIT const char kBatchDegradedColumn[] = "degraded";
+ABSL_CONST_INIT const char kBatchModeColumn[] = "mode";
+ABSL_CONST_INIT const char kBatchModelColumn[] = "model";
+ABSL_CONST_INIT const char kBatchSearchWindowColumn[] = "search_window_radius";
+ABSL_CONST_INIT const char kLocalReferenceCache[] = "local";
+const double kBytesPerMiB = 1024.0 * 1024.0;
 
 absl::StatusOr<CommandLineArgs> VisqolCommandLineParser::Parse(int argc,
                                                                char **argv) {
@@ -104,16 +260,85 @@ absl::StatusOr<CommandLineArgs> VisqolCommandLineParser::Parse(int argc,
   bool use_speech = false;
   bool use_unscaled_mapping = false;
   int search_window = 60;
+  bool autotune = false;
+  std::string tuning_profile;
+  double fine_align_skip_threshold = std::numeric_limits<double>::infinity();
+  bool approx_fine_align_at_zero_lag = false;
+  std::string results_arrow;
+  std::string patch_results_arrow;
+  std::string cost_model;
+  std::string progress_output;
+  double progress_interval = 10.0;
+  std::string timeline_csv;
+  double timeline_window = 10.0;
+  double timeline_hop = 1.0;
+  absl::optional<FeatureStage> feature_stage;
+  std::string features_dir;
+  int features_per_shard = 256;
+  int compression_level = 0;
+  double pair_cpu_time_limit = 0.0;
+  bool trim_silence = false;
+  std::string watch_dir;
+  WatchNamingRule watch_naming_rule;
+  int watch_queue_size = 256;
+  double watch_idle_timeout = 0.0;
+  double spill_threshold_mb = 0.0;
+  std::string spill_dir;
+  std::string reference_cache;
+  double reference_cache_local_mb = 256.0;
+  std::string reference_cache_secret_file;
+  bool exhaustive_patch_search = false;
 
+  autotune = absl::GetFlag(FLAGS_autotune);
+  tuning_profile = absl::GetFlag(FLAGS_tuning_profile);
   batch_input = absl::GetFlag(FLAGS_batch_input_csv);
-  if (!batch_input.empty()) {
+  watch_dir = absl::GetFlag(FLAGS_watch_dir);
+  if (autotune) {
+    // No input files are needed when autotuning.
+    if (tuning_profile.empty()) {
+      tuning_profile = kDefaultTuningProfileFile;
+    }
+  } else if (!watch_dir.empty()) {
+      // The input files are found as they are written.
+      errorFound |= !FileExists(watch_dir);
+      const std::string reference_dir =
+          absl::GetFlag(FLAGS_watch_reference_dir);
+      watch_naming_rule.reference_dir =
+          reference_dir.empty() ? watch_dir : reference_dir;
+      errorFound |= !FileExists(watch_naming_rule.reference_dir);
+      watch_naming_rule.degraded_pattern =
+          absl::GetFlag(FLAGS_watch_degraded_pattern);
+      watch_naming_rule.reference_pattern =
+          absl::GetFlag(FLAGS_watch_reference_pattern);
+      for (const auto &pattern : {watch_naming_rule.degraded_pattern,
+                                  watch_naming_rule.reference_pattern}) {
+        errorFound |= std::count(pattern.begin(), pattern.end(), '*') > 1;
+      }
+      const auto rule_status = DirectoryWatcher::ValidateNamingRule(
+          FilePath(watch_dir), watch_naming_rule);
+      if (!rule_status.ok()) {
+        ABSL_RAW_LOG(ERROR, "%s", rule_status.ToString().c_str());
+        errorFound = true;
+      }
+      watch_queue_size = absl::GetFlag(FLAGS_watch_queue_size);
+      errorFound |= watch_queue_size <= 0;
+      watch_idle_timeout = absl::GetFlag(FLAGS_watch_idle_timeout);
+      errorFound |= !(watch_idle_timeout >= 0.0);
+  } else if (!batch_input.empty()) {
       errorFound |= !FileExists(batch_input);
   } else {
+      // Standard input is read as it is written, and is never a regular
+      // file, so it can only be given for one of the two.
       ref_file = absl::GetFlag(FLAGS_reference_file);
-      errorFound |= !FileExists(ref_file);
+      errorFound |= !FilePath(ref_file).IsStdin() && !FileExists(ref_file);
 
       deg_file = absl::GetFlag(FLAGS_degraded_file);
-      errorFound |= !FileExists(deg_file);
+      errorFound |= !FilePath(deg_file).IsStdin() && !FileExists(deg_file);
+      if (FilePath(ref_file).IsStdin() && FilePath(deg_file).IsStdin()) {
+        ABSL_RAW_LOG(ERROR, "Standard input can only be read once, so only one"
+                     " of the reference and degraded files can be '-'.");
+        errorFound = true;
+      }
   }
 
   sim_to_qual_model = absl::GetFlag(FLAGS_similarity_to_quality_model);
@@ -127,6 +352,74 @@ absl::StatusOr<CommandLineArgs> VisqolCommandLineParser::Parse(int argc,
   verbose = absl::GetFlag(FLAGS_verbose);
   search_window = absl::GetFlag(FLAGS_search_window_radius);
   debug_output = absl::GetFlag(FLAGS_output_debug);
+  fine_align_skip_threshold =
+      absl::GetFlag(FLAGS_fine_alignment_skip_threshold);
+  approx_fine_align_at_zero_lag =
+      absl::GetFlag(FLAGS_approximate_fine_alignment_at_zero_lag);
+  exhaustive_patch_search = absl::GetFlag(FLAGS_exhaustive_patch_search);
+  results_arrow = absl::GetFlag(FLAGS_results_arrow);
+  patch_results_arrow = absl::GetFlag(FLAGS_patch_results_arrow);
+  errorFound |= !patch_results_arrow.empty() && results_arrow.empty();
+  cost_model = absl::GetFlag(FLAGS_cost_model);
+  progress_output = absl::GetFlag(FLAGS_progress_output);
+  progress_interval = absl::GetFlag(FLAGS_progress_interval);
+  errorFound |= !(progress_interval > 0.0);
+  timeline_csv = absl::GetFlag(FLAGS_timeline_csv);
+  timeline_window = absl::GetFlag(FLAGS_timeline_window);
+  timeline_hop = absl::GetFlag(FLAGS_timeline_hop);
+  errorFound |= !(timeline_window > 0.0) || !(timeline_hop > 0.0);
+  const std::string extract_features = absl::GetFlag(FLAGS_extract_features);
+  features_dir = absl::GetFlag(FLAGS_features_dir);
+  features_per_shard = absl::GetFlag(FLAGS_features_pairs_per_shard);
+  errorFound |= features_per_shard <= 0;
+  if (!extract_features.empty()) {
+    auto stage_statusor = FeatureShardWriter::ParseStage(extract_features);
+    if (stage_statusor.ok()) {
+      feature_stage = stage_statusor.value();
+    } else {
+      ABSL_RAW_LOG(ERROR, "%s", stage_statusor.status().ToString().c_str());
+      errorFound = true;
+    }
+    errorFound |= features_dir.empty();
+    // Shards are numbered by the pairs of a batch, which a watch never ends.
+    errorFound |= !watch_dir.empty();
+  }
+  compression_level = absl::GetFlag(FLAGS_compression_level);
+  errorFound |= compression_level < 0 ||
+                compression_level > ZstdFrameWriter::MaxCompressionLevel();
+  pair_cpu_time_limit = absl::GetFlag(FLAGS_pair_cpu_time_limit);
+  errorFound |= !(pair_cpu_time_limit >= 0.0);
+  trim_silence = absl::GetFlag(FLAGS_trim_silence);
+  spill_threshold_mb = absl::GetFlag(FLAGS_spill_threshold_mb);
+  errorFound |= !(spill_threshold_mb >= 0.0);
+  spill_dir = absl::GetFlag(FLAGS_spill_dir);
+  if (!spill_dir.empty()) {
+    errorFound |= !FileExists(spill_dir);
+  }
+  reference_cache = absl::GetFlag(FLAGS_reference_cache);
+  reference_cache_secret_file =
+      absl::GetFlag(FLAGS_reference_cache_secret_file);
+  if (!reference_cache.empty() && reference_cache != kLocalReferenceCache) {
+    const auto address = ReferenceCacheClient::ParseAddress(reference_cache);
+    if (!address.ok()) {
+      ABSL_RAW_LOG(ERROR, "%s", address.status().ToString().c_str());
+      errorFound = true;
+    }
+    // Anyone who reaches the server can store entries, so the nodes only
+    // trust the ones signed with their shared secret.
+    if (reference_cache_secret_file.empty()) {
+      ABSL_RAW_LOG(ERROR, "A reference cache server needs "
+                   "--reference_cache_secret_file.");
+      errorFound = true;
+    } else {
+      errorFound |= !FileExists(reference_cache_secret_file);
+    }
+  }
+  reference_cache_local_mb = absl::GetFlag(FLAGS_reference_cache_local_mb);
+  errorFound |= !(reference_cache_local_mb >= 0.0);
+  if (!autotune && !tuning_profile.empty()) {
+    errorFound |= !FileExists(tuning_profile);
+  }
 
   if (errorFound) {
     return absl::Status(
@@ -151,7 +444,23 @@ absl::StatusOr<CommandLineArgs> VisqolCommandLineParser::Parse(int argc,
       CommandLineArgs{ref_file,          deg_file,    sim_to_qual_model,
                       result_output_csv, batch_input, verbose,
                       debug_output,      use_speech,  use_unscaled_mapping,
-                      search_window};
+                      search_window,     autotune,    tuning_profile,
+                      fine_align_skip_threshold,  approx_fine_align_at_zero_lag,
+                      results_arrow,     patch_results_arrow, cost_model,
+                      progress_output,   progress_interval, timeline_csv,
+                      timeline_window,   timeline_hop,      feature_stage,
+                      features_dir,
+                      static_cast<size_t>(features_per_shard),
+                      compression_level, pair_cpu_time_limit,
+                      trim_silence,      watch_dir,   watch_naming_rule,
+                      static_cast<size_t>(watch_queue_size),
+                      watch_idle_timeout,
+                      static_cast<size_t>(spill_threshold_mb * kBytesPerMiB),
+                      spill_dir,         reference_cache,
+                      static_cast<size_t>(reference_cache_local_mb *
+                                          kBytesPerMiB),
+                      exhaustive_patch_search,
+                      reference_cache_secret_file};
   return cmd_line_results;
 }
 
@@ -159,27 +468,95 @@ std::vector<ReferenceDegradedPathPair>
 VisqolCommandLineParser::ReadFilesToCompare(
     const FilePath &batch_input_path) {
   std::vector<ReferenceDegradedPathPair> file_paths;
-  std::vector<FilePath> line_file_paths;
   std::ifstream fin(batch_input_path.Path());
-  std::string item, line;
+  std::string line;
   const char delimiter = ',';
 
+  // getline will read up to \n, so in cases where the line ending is \r\n,
+  // we need to manually strip the \r.
+  auto split_line = [delimiter](std::string line) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    std::vector<std::string> items;
+    std::istringstream in(line);
+    std::string item;
+    while (std::getline(in, item, delimiter)) {
+      items.push_back(item);
+    }
+    return items;
+  };
+
   if (fin) {
-    getline(fin, line);  // skip the header
+    // The columns are found by name in the header. A header that names
+    // neither file column is taken to list the reference and degraded files
+    // first.
+    getline(fin, line);
+    const std::vector<std::string> header = split_line(line);
+    auto column = [&header](const std::string &name) {
+      const auto it = std::find(header.begin(), header.end(), name);
+      return it == header.end() ? -1 : static_cast<int>(it - header.begin());
+    };
+    int reference_col = column(kBatchReferenceColumn);
+    int degraded_col = column(kBatchDegradedColumn);
+    if (reference_col < 0 && degraded_col < 0) {
+      reference_col = 0;
+      degraded_col = 1;
+    }
+    const int mode_col = column(kBatchModeColumn);
+    const int model_col = column(kBatchModelColumn);
+    const int search_window_col = column(kBatchSearchWindowColumn);
 
+    size_t line_number = 1;
     while (getline(fin, line)) {
-      // getline will read up to \n, so in cases where the line ending is \r\n,
-      // we need to manually strip the \r.
-      if (line.back() == '\r') {
-        line.pop_back();
+      line_number++;
+      const std::vector<std::string> items = split_line(line);
+      if (items.empty()) {
+        continue;
+      }
+      // A missing trailing cell is read as empty.
+      auto cell = [&items](int col) {
+        return col >= 0 && static_cast<size_t>(col) < items.size()
+                   ? items[col]
+                   : std::string();
+      };
+      if (cell(reference_col).empty() || cell(degraded_col).empty()) {
+        ABSL_RAW_LOG(ERROR, "Skipping line %zu of %s: missing file path.",
+                     line_number, batch_input_path.Path().c_str());
+        continue;
       }
-      std::istringstream in(line);
+      ReferenceDegradedPathPair pair{cell(reference_col), cell(degraded_col)};
 
-      while (std::getline(in, item, delimiter)) {
-        line_file_paths.push_back(item);
+      // Empty per-row settings are left unset, to use the command line.
+      const std::string mode = cell(mode_col);
+      if (mode == "speech") {
+        pair.use_speech_mode = true;
+      } else if (mode == "audio") {
+        pair.use_speech_mode = false;
+      } else if (!mode.empty()) {
+        ABSL_RAW_LOG(ERROR, "Skipping line %zu of %s: unknown mode '%s'.",
+                     line_number, batch_input_path.Path().c_str(),
+                     mode.c_str());
+        continue;
+      }
+      if (!cell(model_col).empty()) {
+        pair.sim_to_quality_mapper_model = FilePath(cell(model_col));
       }
-      file_paths.push_back({line_file_paths[0], line_file_paths[1]});
-      line_file_paths.clear();
+      const std::string search_window = cell(search_window_col);
+      int search_window_radius;
+      if (!search_window.empty()) {
+        if (!absl::SimpleAtoi(search_window, &search_window_radius) ||
+            search_window_radius < 0) {
+          ABSL_RAW_LOG(ERROR,
+                       "Skipping line %zu of %s: invalid search window radius "
+                       "'%s'.",
+                       line_number, batch_input_path.Path().c_str(),
+                       search_window.c_str());
+          continue;
+        }
+        pair.search_window_radius = search_window_radius;
+      }
+      file_paths.push_back(pair);
     }
     fin.close();
   }
@@ -201,8 +578,20 @@ VisqolCommandLineParser::BuildFilePairPaths(
   std::vector<ReferenceDegradedPathPair> pairs;
   if (!cmd_res.batch_input_csv.Path().empty()) {
     pairs = ReadFilesToCompare(cmd_res.batch_input_csv.Path());
-  } else if (cmd_res.reference_signal_path.Exists() &&
-             cmd_res.degraded_signal_path.Exists()) {
+    // The model given on the command line is for the command line's mode, so
+    // a row switched to audio mode without a model uses the default one.
+    for (auto &pair : pairs) {
+      if (cmd_res.use_speech_mode && pair.use_speech_mode.has_value() &&
+          !pair.use_speech_mode.value() &&
+          !pair.sim_to_quality_mapper_model.has_value()) {
+        pair.sim_to_quality_mapper_model =
+            FilePath(FilePath::currentWorkingDir() + kDefaultAudioModelFile);
+      }
+    }
+  } else if ((cmd_res.reference_signal_path.IsStdin() ||
+              cmd_res.reference_signal_path.Exists()) &&
+             (cmd_res.degraded_signal_path.IsStdin() ||
+              cmd_res.degraded_signal_path.Exists())) {
     pairs.push_back({cmd_res.reference_signal_path,
                      cmd_res.degraded_signal_path});
   }
@@ -16,6 +16,9 @@
 
 #include <assert.h>
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include <limits>
 #include <memory>
 #include <utility>
@@ -32,22 +35,31 @@
 #include "absl/status/status.h"
 
 namespace Visqol {
+const double ComparisonPatchesSelector::kPruningTolerance = 1e-6;
+
 ComparisonPatchesSelector::ComparisonPatchesSelector(
-    std::unique_ptr<PatchSimilarityComparator> sim_comparator)
-    : sim_comparator_{std::move(sim_comparator)} {}
+    std::unique_ptr<PatchSimilarityComparator> sim_comparator,
+    const FineAlignmentPolicy& fine_alignment_policy,
+    const PatchSearchPolicy& patch_search_policy)
+    : sim_comparator_{std::move(sim_comparator)},
+      fine_alignment_policy_{fine_alignment_policy},
+      patch_search_policy_{patch_search_policy} {}
 
 void ComparisonPatchesSelector::FindMostOptimalDegPatch(
     const AMatrix<double>& spectrogram_data, const ImagePatch& ref_patch,
     std::vector<ImagePatch>& deg_patches,
-    std::vector<std::vector<double>>& cumulative_similarity_dp,
-    std::vector<std::vector<int>>& backtrace,
+    SpillableTable<double>& cumulative_similarity_dp,
+    SpillableTable<int>& backtrace,
     const std::vector<size_t>& ref_patch_indices, int patch_index,
-    const int search_window) const {
+    const int search_window, PatchSearchPruning& pruning) const {
   // The similarity threshold below which the two patch matches are not a good
   // match.
   int ref_frame_index = ref_patch_indices[patch_index];
   ImagePatch deg_patch;
   PatchSimilarityResult sim_result;
+  // The reference patch is prepared once for every degraded patch it is
+  // compared against, unless the whole search window is pruned.
+  std::unique_ptr<PreparedReferencePatch> prepared_ref_patch;
 
   // For a given reference frame index, this function compares the given
   // reference patch with all possible degraded patches in the search window and
@@ -67,9 +79,6 @@ void ComparisonPatchesSelector::FindMostOptimalDegPatch(
       // nothing left to compare.
       break;
     }
-    deg_patch = deg_patches[slide_offset];
-    sim_result = sim_comparator_->MeasurePatchSimilarity(ref_patch, deg_patch);
-
     int past_slide_offset = -1;
     double highest_sim = std::numeric_limits<double>::lowest();
     // There's no need to backtrace for the first patch index.
@@ -97,20 +106,60 @@ void ComparisonPatchesSelector::FindMostOptimalDegPatch(
           past_slide_offset = back_offset;
         }
       }
+    }
+
+    // Skip measuring the similarity if, even with a perfect similarity for
+    // this and every remaining reference patch, the cumulative score could
+    // not reach the best final score. A pruned offset keeps the score carried
+    // over from the previous patch, which can only be lower than its true
+    // score, so it is never selected over an offset on the best matching.
+    const double carried_sim = (patch_index > 0) ?
+        cumulative_similarity_dp[patch_index - 1][slide_offset] :
+        std::numeric_limits<double>::lowest();
+    if (pruning.enabled) {
+      const double sim_here = pruning.max_similarity +
+          ((patch_index > 0) ? highest_sim : 0.0);
+      // Each later match must start at a later degraded offset.
+      const size_t num_remaining = std::min(
+          pruning.num_patches - 1 - patch_index,
+          spectrogram_data.NumCols() - 1 - slide_offset);
+      const double upper_bound = std::max(sim_here, carried_sim) +
+          num_remaining * (pruning.max_similarity + kPruningTolerance) +
+          kPruningTolerance;
+      if (upper_bound < pruning.score_lower_bound) {
+        cumulative_similarity_dp[patch_index][slide_offset] = carried_sim;
+        backtrace[patch_index][slide_offset] =
+            (patch_index > 0) ? slide_offset : -1;
+        pruning.stats.num_candidates_pruned++;
+        continue;
+      }
+    }
+
+    if (prepared_ref_patch == nullptr) {
+      prepared_ref_patch = sim_comparator_->PrepareReferencePatch(ref_patch);
+    }
+    deg_patch = deg_patches[slide_offset];
+    sim_result = sim_comparator_->MeasurePreparedPatchSimilarity(
+        *prepared_ref_patch, deg_patch);
+    pruning.stats.num_candidates_evaluated++;
+    if (patch_index > 0) {
       sim_result.similarity += highest_sim;
       // If the current reference patch experienced a packet loss, then the
       // cumulative similarity score till the previous patch might be more and
       // in that case no matching patch for the current reference patch is found
       // in the degraded window.
-      if (cumulative_similarity_dp[patch_index - 1][slide_offset] >
-          sim_result.similarity) {
-        sim_result.similarity =
-            cumulative_similarity_dp[patch_index - 1][slide_offset];
+      if (carried_sim > sim_result.similarity) {
+        sim_result.similarity = carried_sim;
         past_slide_offset = slide_offset;
       }
     }
     cumulative_similarity_dp[patch_index][slide_offset] = sim_result.similarity;
     backtrace[patch_index][slide_offset] = past_slide_offset;
+    if (slide_offset >= pruning.carried_first_offset[patch_index] &&
+        slide_offset <= pruning.carried_last_offset[patch_index]) {
+      pruning.score_lower_bound =
+          std::max(pruning.score_lower_bound, sim_result.similarity);
+    }
   }
 }
 
@@ -135,7 +184,37 @@ ComparisonPatchesSelector::FindMostOptimalDegPatches(
     const std::vector<ImagePatch>& ref_patches,
     const std::vector<size_t>& ref_patch_indices,
     const AMatrix<double>& spectrogram_data, const double frame_duration,
-    const int search_window_radius) const {
+    const int search_window_radius, PatchSearchStats* stats,
+    const CancellationToken* cancellation) const {
+  // The full spectrogram is already available.
+  return FindMostOptimalDegPatches(
+      ref_patches, ref_patch_indices, spectrogram_data, frame_duration,
+      search_window_radius, [](size_t, size_t) { return absl::Status(); },
+      stats, cancellation);
+}
+
+absl::StatusOr<std::vector<PatchSimilarityResult>>
+ComparisonPatchesSelector::FindMostOptimalDegPatches(
+    const std::vector<ImagePatch>& ref_patches,
+    const std::vector<size_t>& ref_patch_indices,
+    LazySpectrogramPair* spectrograms, const double frame_duration,
+    const int search_window_radius, PatchSearchStats* stats,
+    const CancellationToken* cancellation) const {
+  return FindMostOptimalDegPatches(
+      ref_patches, ref_patch_indices, spectrograms->DegData(), frame_duration,
+      search_window_radius, [spectrograms](size_t first_col, size_t last_col) {
+        return spectrograms->EnsureColumns(first_col, last_col);
+      }, stats, cancellation);
+}
+
+absl::StatusOr<std::vector<PatchSimilarityResult>>
+ComparisonPatchesSelector::FindMostOptimalDegPatches(
+    const std::vector<ImagePatch>& ref_patches,
+    const std::vector<size_t>& ref_patch_indices,
+    const AMatrix<double>& spectrogram_data, const double frame_duration,
+    const int search_window_radius,
+    const std::function<absl::Status(size_t, size_t)>& ensure_columns,
+    PatchSearchStats* stats, const CancellationToken* cancellation) const {
   const size_t num_frames_per_patch = ref_patches[0].NumCols();
   const size_t num_frames_in_deg_spectro = spectrogram_data.NumCols();
   const double patch_duration = frame_duration * num_frames_per_patch;
@@ -158,26 +237,74 @@ ComparisonPatchesSelector::FindMostOptimalDegPatches(
   }
   // The vector to store the similarity results
   std::vector<PatchSimilarityResult> bestDegPatches(num_patches);
-  std::vector<std::vector<double>> cumulative_similarity_dp(
-      ref_patch_indices.size(),
-      std::vector<double>(spectrogram_data.NumCols()));
-  std::vector<std::vector<int>> backtrace(
-      ref_patch_indices.size(), std::vector<int>(spectrogram_data.NumCols()));
+  // The tables grow with the product of the reference and degraded lengths,
+  // so are spilled to disk for long inputs. Each reference patch fills one
+  // row in order, and the rows are read back in reverse to backtrace.
+  SpillableTable<double> cumulative_similarity_dp(
+      ref_patch_indices.size(), spectrogram_data.NumCols());
+  SpillableTable<int> backtrace(ref_patch_indices.size(),
+                                spectrogram_data.NumCols());
+  // Degraded patches are only built once they fall within the search window
+  // of a reference patch.
   std::vector<ImagePatch> deg_patches(spectrogram_data.NumCols());
-  for (size_t slide_offset = 0; slide_offset < spectrogram_data.NumCols();
-       slide_offset++) {
-    deg_patches[slide_offset] =
-        BuildDegradedPatch(spectrogram_data, slide_offset,
-                           slide_offset + ref_patches[0].NumCols() - 1,
-                           ref_patches[0].NumRows(), ref_patches[0].NumCols());
+  std::vector<bool> deg_patch_built(spectrogram_data.NumCols(), false);
+  // Pruning is only possible if the similarity of a patch is bounded.
+  PatchSearchPruning pruning;
+  pruning.max_similarity = sim_comparator_->MaxSimilarity();
+  pruning.enabled =
+      patch_search_policy_.prune && std::isfinite(pruning.max_similarity);
+  pruning.num_patches = num_patches;
+  pruning.carried_first_offset.assign(num_patches, 0);
+  pruning.carried_last_offset.assign(num_patches,
+                                     std::numeric_limits<int>::max());
+  for (int patch_index = num_patches - 2; patch_index >= 0; patch_index--) {
+    const int next_ref_frame_index = ref_patch_indices[patch_index + 1];
+    pruning.carried_first_offset[patch_index] =
+        std::max(pruning.carried_first_offset[patch_index + 1],
+                 next_ref_frame_index - search_window);
+    pruning.carried_last_offset[patch_index] =
+        std::min(pruning.carried_last_offset[patch_index + 1],
+                 next_ref_frame_index + search_window);
   }
   // Attempt to get a good alignment with backtracking.
   for (size_t patch_index = 0; patch_index < num_patches; patch_index++) {
+    // Each reference patch fills one row of the dynamic programming tables.
+    const auto cancel_status = CancellationToken::Check(cancellation);
+    if (!cancel_status.ok()) {
+      return cancel_status;
+    }
+    const int ref_frame_index = ref_patch_indices[patch_index];
+    const int first_slide_offset = std::max(0, ref_frame_index - search_window);
+    const int last_slide_offset = std::min(
+        static_cast<int>(num_frames_in_deg_spectro) - 1,
+        ref_frame_index + search_window);
+    if (first_slide_offset <= last_slide_offset) {
+      const auto status = ensure_columns(
+          first_slide_offset, last_slide_offset + num_frames_per_patch - 1);
+      if (!status.ok()) {
+        return status;
+      }
+      for (int slide_offset = first_slide_offset; slide_offset <= last_slide_offset;
+           slide_offset++) {
+        if (!deg_patch_built[slide_offset]) {
+          deg_patches[slide_offset] = BuildDegradedPatch(
+              spectrogram_data, slide_offset,
+              slide_offset + num_frames_per_patch - 1,
+              ref_patches[0].NumRows(), num_frames_per_patch);
+          deg_patch_built[slide_offset] = true;
+        }
+      }
+    }
     // Find the best alignment to the ref patch within a distance of
     // search_window on each side of the hard-aligned deg signal.
     FindMostOptimalDegPatch(spectrogram_data, ref_patches[patch_index],
                             deg_patches, cumulative_similarity_dp, backtrace,
-                            ref_patch_indices, patch_index, search_window);
+                            ref_patch_indices, patch_index, search_window,
+                            pruning);
+  }
+  if (stats != nullptr) {
+    stats->num_candidates_evaluated += pruning.stats.num_candidates_evaluated;
+    stats->num_candidates_pruned += pruning.stats.num_candidates_pruned;
   }
   double max_similarity_score = std::numeric_limits<double>::lowest();
   // The patch index for the last reference patch.
@@ -298,19 +425,32 @@ AudioSignal ComparisonPatchesSelector::Slice(
   return sliced_signal;
 }
 
-absl::StatusOr<std::vector<PatchSimilarityResult>>
+absl::StatusOr<PatchSimilarityTable>
 ComparisonPatchesSelector::FinelyAlignAndRecreatePatches(
     const std::vector<PatchSimilarityResult>& sim_results,
     const AudioSignal& ref_signal, const AudioSignal& deg_signal,
-    SpectrogramBuilder* spect_builder, const AnalysisWindow& window) const {
-  std::vector<PatchSimilarityResult> realigned_results(sim_results.size());
+    SpectrogramBuilder* spect_builder, const AnalysisWindow& window,
+    FineAlignmentStats* stats, const CancellationToken* cancellation) const {
+  PatchSimilarityTable realigned_results;
+  FineAlignmentStats local_stats;
 
   // The patches are already matched.  Iterate over each pair.
   for (size_t i = 0; i < sim_results.size(); ++i) {
-    auto sim_result = sim_results[i];
+    const auto cancel_status = CancellationToken::Check(cancellation);
+    if (!cancel_status.ok()) {
+      return cancel_status;
+    }
+    const PatchSimilarityResult &sim_result = sim_results[i];
     if (sim_result.deg_patch_start_time == sim_result.deg_patch_end_time &&
         sim_result.deg_patch_start_time == 0.0) {
-      realigned_results[i] = sim_result;
+      realigned_results.Append(sim_result);
+      continue;
+    }
+    // Coarse matches that are already good enough keep their result.
+    if (sim_result.similarity >
+        fine_alignment_policy_.skip_similarity_threshold) {
+      realigned_results.Append(sim_result);
+      local_stats.num_skipped++;
       continue;
     }
 
@@ -327,6 +467,14 @@ ComparisonPatchesSelector::FinelyAlignAndRecreatePatches(
     AudioSignal ref_audio_aligned = std::get<0>(aligned_result);
     AudioSignal deg_audio_aligned = std::get<1>(aligned_result);
     double lag = std::get<2>(aligned_result);
+    // The patch is already locally aligned to the sample, so the coarse match
+    // is kept as an approximation of the rebuilt one.
+    if (fine_alignment_policy_.approximate_zero_lag && lag == 0.0) {
+      realigned_results.Append(sim_result);
+      local_stats.num_skipped++;
+      continue;
+    }
+    local_stats.num_refined++;
 
     double new_ref_duration = ref_audio_aligned.GetDuration();
     double new_deg_duration = deg_audio_aligned.GetDuration();
@@ -360,7 +508,7 @@ ComparisonPatchesSelector::FinelyAlignAndRecreatePatches(
         new_ref_patch, new_deg_patch);
     // Compare to the old result and take the max.
     if (new_sim_result.similarity < sim_result.similarity) {
-      realigned_results[i] = sim_result;
+      realigned_results.Append(sim_result);
     } else {
       if (lag > 0.) {
         new_sim_result.ref_patch_start_time = sim_result.ref_patch_start_time
@@ -375,9 +523,13 @@ ComparisonPatchesSelector::FinelyAlignAndRecreatePatches(
                                           + new_ref_duration;
       new_sim_result.deg_patch_end_time = new_sim_result.deg_patch_start_time
                                           + new_deg_duration;
-      realigned_results[i] = new_sim_result;
+      realigned_results.Append(new_sim_result);
     }
   }
+  if (stats != nullptr) {
+    stats->num_refined += local_stats.num_refined;
+    stats->num_skipped += local_stats.num_skipped;
+  }
   return realigned_results;
 }
 }  // namespace Visqol
@@ -0,0 +1,295 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cost_model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+
+#include "wav_reader.h"
+
+namespace Visqol {
+
+const int CostModel::kFormatVersion = 1;
+const double CostModel::kMinPredictedSeconds = 1e-3;
+
+// The uncalibrated coefficients, measured with a single worker on 48kHz
+// stereo audio and on speech. The patch search radius made no measurable
+// difference to the run time, so its term starts at 0.
+const std::array<double, CostModel::kNumTerms> kDefaultAudioCoefficients{
+    0.1, 10.8, 58.0, 0.0};
+const std::array<double, CostModel::kNumTerms> kDefaultSpeechCoefficients{
+    0.1, 6.8, 27.0, 0.0};
+
+// The weight of the uncalibrated coefficients in the fit, in units of
+// observations.
+const double kPriorWeight = 1.0;
+
+// The radius that the search window term is normalised to.
+const int kReferenceSearchWindow = 60;
+
+const char *const kModeKeys[] = {"audio", "speech"};
+
+namespace {
+absl::StatusOr<std::pair<double, int>> ReadHeader(const FilePath &path,
+                                                  size_t *num_channels) {
+  // Reading the header of a pipe would take it from the comparison.
+  if (path.IsStream()) {
+    return absl::Status(absl::StatusCode::kFailedPrecondition,
+                        "Cannot read the header of a stream ahead of time: " +
+                            path.Path());
+  }
+  std::ifstream fin(path.Path(), std::ios::binary);
+  if (!fin) {
+    return absl::Status(absl::StatusCode::kNotFound,
+                        "Unable to open audio file: " + path.Path());
+  }
+  WavReader wav_reader(&fin);
+  if (!wav_reader.IsHeaderValid()) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Invalid WAV header: " + path.Path());
+  }
+  *num_channels = wav_reader.GetNumChannels();
+  return std::make_pair(wav_reader.GetDuration(),
+                        wav_reader.GetSampleRateHz());
+}
+
+// Solve the linear system a * x = b using Gaussian elimination with partial
+// pivoting.
+template <size_t N>
+std::array<double, N> Solve(std::array<std::array<double, N>, N> a,
+                            std::array<double, N> b) {
+  for (size_t col = 0; col < N; col++) {
+    size_t pivot = col;
+    for (size_t row = col + 1; row < N; row++) {
+      if (std::abs(a[row][col]) > std::abs(a[pivot][col])) {
+        pivot = row;
+      }
+    }
+    std::swap(a[col], a[pivot]);
+    std::swap(b[col], b[pivot]);
+    for (size_t row = col + 1; row < N; row++) {
+      const double factor = a[row][col] / a[col][col];
+      for (size_t k = col; k < N; k++) {
+        a[row][k] -= factor * a[col][k];
+      }
+      b[row] -= factor * b[col];
+    }
+  }
+  std::array<double, N> x{};
+  for (size_t row = N; row-- > 0;) {
+    double sum = b[row];
+    for (size_t k = row + 1; k < N; k++) {
+      sum -= a[row][k] * x[k];
+    }
+    x[row] = sum / a[row][row];
+  }
+  return x;
+}
+}  // namespace
+
+absl::StatusOr<PairCostFeatures> CostModel::ReadFeatures(
+    const FilePath &reference, const FilePath &degraded) {
+  PairCostFeatures features;
+  const auto ref_statusor = ReadHeader(reference, &features.num_channels);
+  if (!ref_statusor.ok()) {
+    return ref_statusor.status();
+  }
+  size_t deg_channels;
+  const auto deg_statusor = ReadHeader(degraded, &deg_channels);
+  if (!deg_statusor.ok()) {
+    return deg_statusor.status();
+  }
+  features.reference_duration = ref_statusor.value().first;
+  features.sample_rate = ref_statusor.value().second;
+  features.degraded_duration = deg_statusor.value().first;
+  return features;
+}
+
+CostModel::CostModel(bool use_speech_mode, int search_window)
+    : use_speech_mode_(use_speech_mode), search_window_(search_window) {
+  Refit();
+}
+
+absl::Status CostModel::Read(const FilePath &path) {
+  std::ifstream fin(path.Path());
+  if (!fin) {
+    return absl::Status(absl::StatusCode::kNotFound,
+                        "Unable to open cost model: " + path.Path());
+  }
+
+  std::array<Calibration, 2> calibrations;
+  std::string line;
+  while (std::getline(fin, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    const size_t split = line.find('=');
+    if (split == std::string::npos) {
+      return absl::Status(absl::StatusCode::kInvalidArgument,
+                          "Malformed cost model line: " + line);
+    }
+    const std::string key = line.substr(0, split);
+    const std::vector<std::string> values =
+        absl::StrSplit(line.substr(split + 1), ' ', absl::SkipEmpty());
+
+    if (key == "version") {
+      int version;
+      if (values.size() != 1 || !absl::SimpleAtoi(values[0], &version) ||
+          version != kFormatVersion) {
+        return absl::Status(absl::StatusCode::kFailedPrecondition,
+                            "Unsupported cost model version: " +
+                                line.substr(split + 1));
+      }
+      continue;
+    }
+    const auto mode = std::find(std::begin(kModeKeys), std::end(kModeKeys),
+                                key);
+    if (mode == std::end(kModeKeys)) {
+      ABSL_RAW_LOG(WARNING, "Ignoring unknown cost model key: %s",
+                   key.c_str());
+      continue;
+    }
+
+    // The observation count, the upper triangle of the normal matrix and the
+    // right hand side.
+    const size_t num_values = 1 + kNumTerms * (kNumTerms + 1) / 2 + kNumTerms;
+    Calibration &calibration = calibrations[mode - std::begin(kModeKeys)];
+    std::vector<double> parsed(values.size());
+    bool valid = values.size() == num_values &&
+                 absl::SimpleAtoi(values[0], &calibration.num_observations);
+    for (size_t i = 1; valid && i < values.size(); i++) {
+      valid = absl::SimpleAtod(values[i], &parsed[i]) &&
+              std::isfinite(parsed[i]);
+    }
+    if (!valid) {
+      return absl::Status(absl::StatusCode::kInvalidArgument,
+                          "Invalid value for cost model key: " + key);
+    }
+    size_t next = 1;
+    for (size_t row = 0; row < kNumTerms; row++) {
+      for (size_t col = row; col < kNumTerms; col++) {
+        calibration.xtx[row][col] = parsed[next];
+        calibration.xtx[col][row] = parsed[next];
+        next++;
+      }
+    }
+    for (size_t row = 0; row < kNumTerms; row++) {
+      calibration.xty[row] = parsed[next++];
+    }
+  }
+
+  calibrations_ = calibrations;
+  Refit();
+  return absl::Status();
+}
+
+absl::Status CostModel::Write(const FilePath &path) const {
+  std::ofstream fout(path.Path(), std::ios::trunc);
+  if (!fout) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Unable to write cost model: " + path.Path());
+  }
+  fout.precision(std::numeric_limits<double>::max_digits10);
+  fout << "# ViSQOL cost model. Calibrated from measured comparison times.\n";
+  fout << "version=" << kFormatVersion << "\n";
+  for (size_t mode = 0; mode < calibrations_.size(); mode++) {
+    const Calibration &calibration = calibrations_[mode];
+    fout << kModeKeys[mode] << "=" << calibration.num_observations;
+    for (size_t row = 0; row < kNumTerms; row++) {
+      for (size_t col = row; col < kNumTerms; col++) {
+        fout << " " << calibration.xtx[row][col];
+      }
+    }
+    for (size_t row = 0; row < kNumTerms; row++) {
+      fout << " " << calibration.xty[row];
+    }
+    fout << "\n";
+  }
+  fout.close();
+  if (!fout) {
+    return absl::Status(absl::StatusCode::kInternal,
+                        "Failed writing cost model: " + path.Path());
+  }
+  return absl::Status();
+}
+
+double CostModel::Predict(const PairCostFeatures &features) const {
+  const auto terms = Terms(features);
+  double seconds = 0.0;
+  for (size_t i = 0; i < kNumTerms; i++) {
+    seconds += coefficients_[i] * terms[i];
+  }
+  return std::max(seconds, kMinPredictedSeconds);
+}
+
+void CostModel::AddObservation(const PairCostFeatures &features,
+                               double seconds) {
+  const auto terms = Terms(features);
+  Calibration &calibration = calibrations_[use_speech_mode_ ? 1 : 0];
+  for (size_t row = 0; row < kNumTerms; row++) {
+    for (size_t col = 0; col < kNumTerms; col++) {
+      calibration.xtx[row][col] += terms[row] * terms[col];
+    }
+    calibration.xty[row] += terms[row] * seconds;
+  }
+  calibration.num_observations++;
+  Refit();
+}
+
+size_t CostModel::NumObservations() const {
+  return calibrations_[use_speech_mode_ ? 1 : 0].num_observations;
+}
+
+std::array<double, CostModel::kNumTerms> CostModel::Terms(
+    const PairCostFeatures &features) const {
+  // Each signal is filtered once after being downmixed to mono, so the
+  // number of channels only affects the (negligible) cost of the downmix.
+  const double megasamples =
+      (features.reference_duration + features.degraded_duration) *
+      features.sample_rate / 1e6;
+  const double minutes =
+      (features.reference_duration + features.degraded_duration) / 2 / 60;
+  const double search_candidates =
+      (2.0 * search_window_ + 1) / (2.0 * kReferenceSearchWindow + 1);
+  return {1.0, megasamples, minutes * minutes, minutes * search_candidates};
+}
+
+void CostModel::Refit() {
+  const auto &prior = use_speech_mode_ ? kDefaultSpeechCoefficients
+                                       : kDefaultAudioCoefficients;
+  const Calibration &calibration = calibrations_[use_speech_mode_ ? 1 : 0];
+  auto xtx = calibration.xtx;
+  auto xty = calibration.xty;
+  for (size_t i = 0; i < kNumTerms; i++) {
+    xtx[i][i] += kPriorWeight;
+    xty[i] += kPriorWeight * prior[i];
+  }
+  coefficients_ = Solve(xtx, xty);
+}
+}  // namespace Visqol
@@ -0,0 +1,130 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "cpu_time_watchdog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <utility>
+
+#include "absl/time/time.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <time.h>
+#endif
+
+namespace Visqol {
+
+const double CpuTimeWatchdog::kMaxPollIntervalSeconds = 0.1;
+
+namespace {
+// The time on a steady clock in seconds.
+double SteadySeconds() {
+  const std::chrono::duration<double> now =
+      std::chrono::steady_clock::now().time_since_epoch();
+  return now.count();
+}
+
+// Returns a function that reads the CPU time of the calling thread, which may
+// be called from any thread while the calling thread is alive.
+std::function<double()> CurrentThreadCpuClock() {
+#if defined(__linux__)
+  clockid_t clock;
+  if (pthread_getcpuclockid(pthread_self(), &clock) == 0) {
+    return [clock]() {
+      timespec time;
+      if (clock_gettime(clock, &time) != 0) {
+        return 0.0;
+      }
+      return time.tv_sec + time.tv_nsec * 1e-9;
+    };
+  }
+#endif
+  return SteadySeconds;
+}
+}  // namespace
+
+double CpuTimeWatchdog::ThreadCpuSeconds() {
+  return CurrentThreadCpuClock()();
+}
+
+CpuTimeWatchdog::CpuTimeWatchdog(double limit_seconds)
+    : limit_seconds_(limit_seconds) {}
+
+CpuTimeWatchdog::~CpuTimeWatchdog() { Stop(); }
+
+void CpuTimeWatchdog::Start(size_t num_workers) {
+  Stop();
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = false;
+    workers_.assign(num_workers, WatchedComparison());
+  }
+  watch_thread_ = std::thread(&CpuTimeWatchdog::WatchLoop, this);
+}
+
+void CpuTimeWatchdog::Watch(size_t worker, CancellationToken *token) {
+  auto cpu_seconds = CurrentThreadCpuClock();
+  const double start_cpu_seconds = cpu_seconds();
+  absl::MutexLock lock(&mutex_);
+  WatchedComparison &watched = workers_[worker];
+  watched.token = token;
+  watched.cpu_seconds = std::move(cpu_seconds);
+  watched.start_cpu_seconds = start_cpu_seconds;
+}
+
+void CpuTimeWatchdog::Unwatch(size_t worker) {
+  absl::MutexLock lock(&mutex_);
+  workers_[worker] = WatchedComparison();
+}
+
+void CpuTimeWatchdog::Stop() {
+  if (!watch_thread_.joinable()) {
+    return;
+  }
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = true;
+  }
+  watch_thread_.join();
+}
+
+void CpuTimeWatchdog::WatchLoop() {
+  // Poll often enough that a comparison does not overrun a short limit by
+  // much.
+  const double interval_seconds =
+      std::min(kMaxPollIntervalSeconds, limit_seconds_ / 10.0);
+  absl::MutexLock lock(&mutex_);
+  while (!mutex_.AwaitWithTimeout(absl::Condition(&stopping_),
+                                  absl::Seconds(interval_seconds))) {
+    for (WatchedComparison &watched : workers_) {
+      if (watched.token == nullptr || watched.token->IsCancelled()) {
+        continue;
+      }
+      const double used = watched.cpu_seconds() - watched.start_cpu_seconds;
+      if (used > limit_seconds_) {
+        char reason[128];
+        std::snprintf(reason, sizeof(reason),
+                      "The comparison exceeded its CPU time limit of %gs.",
+                      limit_seconds_);
+        watched.token->Cancel(reason);
+      }
+    }
+  }
+}
+}  // namespace Visqol
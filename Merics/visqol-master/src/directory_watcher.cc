@@ -0,0 +1,390 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "directory_watcher.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <utility>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "boost/filesystem.hpp"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Visqol {
+
+const char DirectoryWatcher::kSidecarExtension[] = ".ref";
+const size_t DirectoryWatcher::kDefaultQueueCapacity = 256;
+const double DirectoryWatcher::kPollIntervalSeconds = 0.1;
+const double DirectoryWatcher::kRescanSettleSeconds = 2.0;
+const size_t DirectoryWatcher::kRecentNamesCapacity = 4096;
+
+namespace {
+// The modification time of a file in nanoseconds, or nullopt if it cannot be
+// read. Files written in a burst share the same second, so a finer time is
+// used where there is one.
+absl::optional<int64_t> ModifiedNanos(const std::string &path) {
+#if defined(__linux__)
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    return absl::nullopt;
+  }
+  return int64_t{info.st_mtim.tv_sec} * 1000000000 + info.st_mtim.tv_nsec;
+#else
+  boost::system::error_code error;
+  const std::time_t modified = boost::filesystem::last_write_time(path, error);
+  if (error) {
+    return absl::nullopt;
+  }
+  return int64_t{modified} * 1000000000;
+#endif
+}
+
+// Match a name against a pattern holding a single '*', returning the text the
+// '*' matched.
+absl::optional<std::string> MatchPattern(const std::string &name,
+                                         const std::string &pattern) {
+  const size_t star = pattern.find('*');
+  if (star == std::string::npos) {
+    return name == pattern ? absl::optional<std::string>("") : absl::nullopt;
+  }
+  const std::string prefix = pattern.substr(0, star);
+  const std::string suffix = pattern.substr(star + 1);
+  if (name.size() < prefix.size() + suffix.size() ||
+      !absl::StartsWith(name, prefix) || !absl::EndsWith(name, suffix)) {
+    return absl::nullopt;
+  }
+  return name.substr(prefix.size(),
+                     name.size() - prefix.size() - suffix.size());
+}
+
+// The time on a steady clock in seconds.
+double SteadySeconds() {
+  const std::chrono::duration<double> now =
+      std::chrono::steady_clock::now().time_since_epoch();
+  return now.count();
+}
+}  // namespace
+
+DirectoryWatcher::DirectoryWatcher(const FilePath &degraded_dir,
+                                   const WatchNamingRule &naming_rule,
+                                   size_t queue_capacity,
+                                   double idle_timeout_seconds)
+    : degraded_dir_(degraded_dir),
+      naming_rule_(naming_rule),
+      queue_capacity_(std::max<size_t>(1, queue_capacity)),
+      idle_timeout_seconds_(idle_timeout_seconds) {}
+
+DirectoryWatcher::~DirectoryWatcher() { Stop(); }
+
+absl::Status DirectoryWatcher::Start() {
+  Stop();
+  if (!boost::filesystem::is_directory(degraded_dir_.Path())) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Not a directory: " + degraded_dir_.Path());
+  }
+#if defined(__linux__)
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    return absl::Status(absl::StatusCode::kResourceExhausted,
+                        "Unable to create an inotify instance.");
+  }
+  // Only completed writes and files moved into place are of interest.
+  if (inotify_add_watch(inotify_fd_, degraded_dir_.Path().c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+    close(inotify_fd_);
+    inotify_fd_ = -1;
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Unable to watch directory " + degraded_dir_.Path());
+  }
+  stop_requested_.store(false);
+  {
+    absl::MutexLock lock(&mutex_);
+    stopped_ = false;
+    queue_.clear();
+  }
+  // The files already in the directory are not rescanned. They are listed
+  // after the watch is added, so that no file written in between is missed.
+  existing_names_.clear();
+  recent_queued_.clear();
+  recent_names_.clear();
+  forgotten_modified_nanos_ = 0;
+  unsettled_names_.clear();
+  boost::system::error_code error;
+  for (boost::filesystem::directory_iterator it(degraded_dir_.Path(), error),
+       end; !error && it != end; it.increment(error)) {
+    existing_names_.insert(it->path().filename().string());
+  }
+  watch_thread_ = std::thread(&DirectoryWatcher::WatchLoop, this);
+  return absl::Status();
+#else
+  return absl::Status(absl::StatusCode::kUnimplemented,
+                      "Watching directories is only supported on Linux.");
+#endif
+}
+
+absl::optional<ReferenceDegradedPathPair> DirectoryWatcher::Next() {
+  auto has_pair = [this]() {
+    mutex_.AssertHeld();
+    return stopped_ || !queue_.empty();
+  };
+  absl::MutexLock lock(&mutex_);
+  mutex_.Await(absl::Condition(&has_pair));
+  if (queue_.empty()) {
+    return absl::nullopt;
+  }
+  ReferenceDegradedPathPair pair = std::move(queue_.front());
+  queue_.pop_front();
+  return pair;
+}
+
+void DirectoryWatcher::RequestStop() { stop_requested_.store(true); }
+
+void DirectoryWatcher::Stop() {
+  RequestStop();
+  if (watch_thread_.joinable()) {
+    watch_thread_.join();
+  }
+}
+
+absl::Status DirectoryWatcher::ValidateNamingRule(
+    const FilePath &degraded_dir, const WatchNamingRule &naming_rule) {
+  boost::system::error_code error;
+  if (naming_rule.degraded_pattern == naming_rule.reference_pattern &&
+      boost::filesystem::equivalent(degraded_dir.Path(),
+                                    naming_rule.reference_dir.Path(), error)) {
+    return absl::Status(
+        absl::StatusCode::kInvalidArgument,
+        absl::StrCat("The references of the files in ", degraded_dir.Path(),
+                     " are named by the same pattern '",
+                     naming_rule.reference_pattern,
+                     "' in the same directory, so every file would be its "
+                     "own reference. Give the references another directory "
+                     "or pattern."));
+  }
+  return absl::Status();
+}
+
+absl::StatusOr<ReferenceDegradedPathPair> DirectoryWatcher::Match(
+    const std::string &file_name) const {
+  const boost::filesystem::path dir(degraded_dir_.Path());
+  ReferenceDegradedPathPair pair;
+  pair.degraded = FilePath((dir / file_name).string());
+
+  // A sidecar file takes precedence over the naming rule.
+  std::ifstream sidecar((dir / (file_name + kSidecarExtension)).string());
+  std::string reference_path;
+  if (sidecar && std::getline(sidecar, reference_path)) {
+    while (!reference_path.empty() &&
+           std::isspace(static_cast<unsigned char>(reference_path.back()))) {
+      reference_path.pop_back();
+    }
+    boost::filesystem::path reference(reference_path);
+    pair.reference = FilePath(
+        (reference.is_absolute() ? reference : dir / reference).string());
+  } else {
+    const auto stem = MatchPattern(file_name, naming_rule_.degraded_pattern);
+    if (!stem.has_value()) {
+      return absl::Status(absl::StatusCode::kNotFound,
+                          "No reference rule matches " + file_name);
+    }
+    std::string reference_name = naming_rule_.reference_pattern;
+    const size_t star = reference_name.find('*');
+    if (star != std::string::npos) {
+      reference_name.replace(star, 1, stem.value());
+    }
+    pair.reference = FilePath(
+        (boost::filesystem::path(naming_rule_.reference_dir.Path()) /
+         reference_name).string());
+  }
+  if (!pair.reference.Exists()) {
+    return absl::Status(absl::StatusCode::kFailedPrecondition,
+                        absl::StrCat("The reference ", pair.reference.Path(),
+                                     " of ", pair.degraded.Path(),
+                                     " does not exist."));
+  }
+  boost::system::error_code error;
+  if (boost::filesystem::equivalent(pair.reference.Path(),
+                                    pair.degraded.Path(), error)) {
+    return absl::Status(absl::StatusCode::kFailedPrecondition,
+                        file_name + " is its own reference.");
+  }
+  return pair;
+}
+
+void DirectoryWatcher::WatchLoop() {
+#if defined(__linux__)
+  // The buffer must be aligned for the events read into it.
+  alignas(inotify_event) char buffer[4096];
+  double last_file_seconds = SteadySeconds();
+  while (!stop_requested_.load()) {
+    // The watcher is not idle while rescanned files are waiting to settle.
+    if (idle_timeout_seconds_ > 0.0 && unsettled_names_.empty() &&
+        SteadySeconds() - last_file_seconds > idle_timeout_seconds_) {
+      break;
+    }
+    pollfd poll_fd = {inotify_fd_, POLLIN, 0};
+    const int ready = poll(&poll_fd, 1,
+                           static_cast<int>(kPollIntervalSeconds * 1000));
+    if (!unsettled_names_.empty()) {
+      QueueSettledFiles();
+      last_file_seconds = SteadySeconds();
+    }
+    if (ready <= 0) {
+      continue;
+    }
+    const ssize_t length = read(inotify_fd_, buffer, sizeof(buffer));
+    if (length <= 0) {
+      continue;
+    }
+    for (ssize_t pos = 0; pos < length;) {
+      const auto *event = reinterpret_cast<const inotify_event *>(&buffer[pos]);
+      pos += sizeof(inotify_event) + event->len;
+      if (event->mask & IN_Q_OVERFLOW) {
+        ABSL_RAW_LOG(WARNING, "Events were lost, rescanning %s.",
+                     degraded_dir_.Path().c_str());
+        Rescan();
+      } else if (event->len > 0 && !(event->mask & IN_ISDIR)) {
+        Enqueue(event->name);
+      }
+      last_file_seconds = SteadySeconds();
+    }
+  }
+  close(inotify_fd_);
+  inotify_fd_ = -1;
+#endif
+  absl::MutexLock lock(&mutex_);
+  stopped_ = true;
+}
+
+void DirectoryWatcher::Rescan() {
+  boost::system::error_code error;
+  for (boost::filesystem::directory_iterator it(degraded_dir_.Path(), error),
+       end; !error && it != end; it.increment(error)) {
+    const std::string name = it->path().filename().string();
+    if (!boost::filesystem::is_regular_file(it->status()) ||
+        WasQueued(name)) {
+      continue;
+    }
+    if (IsSettled(name)) {
+      Enqueue(name);
+    } else {
+      unsettled_names_.insert(name);
+    }
+  }
+}
+
+void DirectoryWatcher::QueueSettledFiles() {
+  for (auto it = unsettled_names_.begin(); it != unsettled_names_.end();) {
+    const std::string name = *it;
+    boost::system::error_code error;
+    const bool exists = boost::filesystem::is_regular_file(
+        degraded_dir_.Path() + "/" + name, error);
+    const bool was_queued = exists && WasQueued(name);
+    if (exists && !was_queued && !IsSettled(name)) {
+      ++it;
+      continue;
+    }
+    // The file is settled, was queued by its own event, or is gone.
+    it = unsettled_names_.erase(it);
+    if (exists && !was_queued) {
+      Enqueue(name);
+    }
+  }
+}
+
+bool DirectoryWatcher::IsSettled(const std::string &file_name) const {
+  boost::system::error_code error;
+  const std::time_t modified = boost::filesystem::last_write_time(
+      degraded_dir_.Path() + "/" + file_name, error);
+  return !error &&
+         std::difftime(std::time(nullptr), modified) >= kRescanSettleSeconds;
+}
+
+bool DirectoryWatcher::WasQueued(const std::string &file_name) const {
+  if (existing_names_.count(file_name) > 0 ||
+      recent_names_.count(file_name) > 0) {
+    return true;
+  }
+  if (forgotten_modified_nanos_ == 0) {
+    return false;
+  }
+  const auto modified =
+      ModifiedNanos(degraded_dir_.Path() + "/" + file_name);
+  return modified.has_value() &&
+         modified.value() <= forgotten_modified_nanos_;
+}
+
+void DirectoryWatcher::RememberQueued(const std::string &file_name) {
+  // A file that is already gone cannot be found by a scan.
+  const auto modified =
+      ModifiedNanos(degraded_dir_.Path() + "/" + file_name);
+  recent_queued_.emplace_back(file_name, modified.value_or(0));
+  recent_names_[file_name]++;
+  if (recent_queued_.size() > kRecentNamesCapacity) {
+    const auto &oldest = recent_queued_.front();
+    forgotten_modified_nanos_ =
+        std::max(forgotten_modified_nanos_, oldest.second);
+    const auto name = recent_names_.find(oldest.first);
+    if (--name->second == 0) {
+      recent_names_.erase(name);
+    }
+    recent_queued_.pop_front();
+  }
+}
+
+void DirectoryWatcher::Enqueue(const std::string &file_name) {
+  if (absl::EndsWith(file_name, kSidecarExtension)) {
+    return;
+  }
+  auto pair = Match(file_name);
+  if (!pair.ok()) {
+    if (pair.status().code() != absl::StatusCode::kNotFound) {
+      ABSL_RAW_LOG(WARNING, "Skipping %s: %s", file_name.c_str(),
+                   pair.status().ToString().c_str());
+    }
+    return;
+  }
+
+  // Wait for room in the queue, while still noticing a request to stop.
+  auto has_room = [this]() {
+    mutex_.AssertHeld();
+    return queue_.size() < queue_capacity_;
+  };
+  absl::MutexLock lock(&mutex_);
+  while (!mutex_.AwaitWithTimeout(absl::Condition(&has_room),
+                                  absl::Seconds(kPollIntervalSeconds))) {
+    if (stop_requested_.load()) {
+      ABSL_RAW_LOG(WARNING, "Dropping %s, as the watcher is stopping.",
+                   file_name.c_str());
+      return;
+    }
+  }
+  queue_.push_back(std::move(pair.value()));
+  RememberQueued(file_name);
+}
+}  // namespace Visqol
@@ -45,30 +45,25 @@ AMatrix<std::complex<double>> Envelope::Hilbert(const AMatrix<double> &signal) {
 
   const bool is_odd = signal.NumRows() % 2 == 1;
   const bool is_non_empty = signal.NumRows() > 0;
-  const double kInitVal = 0.0;
-  std::vector<double> hilbert_scaling(freq_domain_signal.NumRows(), kInitVal);
-  hilbert_scaling[0] = 1;
-
-  // even and nonempty, used for scaling
-  if (!is_odd && is_non_empty) {
-    hilbert_scaling[signal.NumRows() / 2] = 1.0;
-  } else if (is_odd && is_non_empty) {
-    hilbert_scaling[signal.NumRows() / 2] = 2.0;
-  }
   const size_t n = (is_odd) ? (freq_domain_signal.NumRows() + 1) / 2 :
                          ((freq_domain_signal.NumRows()) / 2);
-  for (size_t row_index = 1; row_index < n; row_index++) {
-    hilbert_scaling[row_index] = 2.0;
-  }
-
-  AMatrix<std::complex<double>> element_wise_prod(
-      freq_domain_signal.NumElements(),
-      1);
+  // The DC and (for even lengths) Nyquist bins are kept, the positive
+  // frequencies are doubled and the negative frequencies removed. The scaling
+  // is applied in place, rather than through buffers as long as the signal.
+  auto hilbert_scaling = [&](size_t row_index) {
+    if (row_index >= 1 && row_index < n) {
+      return 2.0;
+    }
+    if (is_non_empty && row_index == signal.NumRows() / 2) {
+      return is_odd ? 2.0 : 1.0;
+    }
+    return row_index == 0 ? 1.0 : 0.0;
+  };
   for (size_t i = 0; i < freq_domain_signal.NumRows(); i++) {
-    element_wise_prod(i) = freq_domain_signal(i) * hilbert_scaling[i];
+    freq_domain_signal(i) *= hilbert_scaling(i);
   }
   auto hilbert = FastFourierTransform::Inverse1d(fft_manager,
-                                                 element_wise_prod);
+                                                 freq_domain_signal);
   return hilbert;
 }
 }  // namespace Visqol
@@ -36,9 +36,45 @@ ErbFiltersResult EquivalentRectangularBandwidth::MakeFilters(
         "Falling back to (sample_rate / 2)", sample_rate, high_freq);
     high_freq = sample_rate / 2.;
   }
-  auto cf1 = EquivalentRectangularBandwidth::CalcUniformCenterFreqs(
-      low_freq, high_freq, num_channels);
-  auto cf = ComplexValArray{cf1};
+  return MakeFiltersForCenterFreqs(sample_rate,
+      CalcUniformCenterFreqs(low_freq, high_freq, num_channels));
+}
+
+ErbFiltersResult EquivalentRectangularBandwidth::MakeFixedFilters(
+    std::size_t sample_rate, std::size_t num_channels, double low_freq,
+    double high_freq) {
+  const std::vector<double> center_freqs =
+      CalcUniformCenterFreqs(low_freq, high_freq, num_channels);
+  // The center frequencies are ordered from highest to lowest, so the bands
+  // that can be filtered are the last ones.
+  const auto first_filtered = std::find_if(center_freqs.begin(),
+      center_freqs.end(), [sample_rate](double cf) {
+        return cf < sample_rate / 2.;
+      });
+  const std::size_t num_unfiltered = first_filtered - center_freqs.begin();
+
+  ErbFiltersResult r;
+  if (first_filtered != center_freqs.end()) {
+    r = MakeFiltersForCenterFreqs(sample_rate,
+        std::vector<double>(first_filtered, center_freqs.end()));
+  } else {
+    r.filterCoeffs.assign(10, std::vector<double>());
+  }
+  // Coefficient sets 6 and 9 are the first denominator coefficient and the
+  // gain, which are one for a band that passes nothing.
+  for (std::size_t coeff = 0; coeff < r.filterCoeffs.size(); coeff++) {
+    const double unfiltered = coeff == 6 || coeff == 9 ? 1.0 : 0.0;
+    r.filterCoeffs[coeff].insert(r.filterCoeffs[coeff].begin(),
+                                 num_unfiltered, unfiltered);
+  }
+  r.centerFreqs = center_freqs;
+  return r;
+}
+
+ErbFiltersResult EquivalentRectangularBandwidth::MakeFiltersForCenterFreqs(
+    std::size_t sample_rate, const std::vector<double> &center_freqs) {
+  const std::size_t num_channels = center_freqs.size();
+  auto cf = ComplexValArray{center_freqs};
 
   double earQ = 9.26449;  // Glasberg and Moore Parameters
   double minBW = 24.7;
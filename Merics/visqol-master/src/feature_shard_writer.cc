@@ -0,0 +1,425 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "feature_shard_writer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+
+namespace Visqol {
+
+const size_t FeatureShardWriter::kDefaultPairsPerShard = 256;
+
+namespace {
+// The .npy files are written in version 1.0 of the format, whose data is
+// aligned to this many bytes.
+const size_t kNpyAlignment = 64;
+const char kNpyMagic[] = "\x93NUMPY";
+
+// The number of bytes before the header dict: the magic string, the two
+// version bytes and the two header length bytes.
+const size_t kNpyPreambleSize = 10;
+
+// Append the values of a repeated field to a vector.
+void Append(const google::protobuf::RepeatedField<double> &values,
+            std::vector<double> *out) {
+  out->insert(out->end(), values.begin(), values.end());
+}
+
+// Quote a value for a CSV file, if it contains a separator or quote.
+std::string QuoteCsv(const std::string &value) {
+  if (value.find_first_of(",\"\n") == std::string::npos) {
+    return value;
+  }
+  std::string quoted = "\"";
+  for (const char c : value) {
+    if (c == '"') {
+      quoted += '"';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+}  // namespace
+
+absl::StatusOr<FeatureStage> FeatureShardWriter::ParseStage(
+    const std::string &name) {
+  if (name == "spectrogram") {
+    return FeatureStage::kSpectrogram;
+  } else if (name == "patches") {
+    return FeatureStage::kPatches;
+  } else if (name == "fvnsim") {
+    return FeatureStage::kFvnsim;
+  }
+  return absl::Status(absl::StatusCode::kInvalidArgument,
+                      "Unknown feature stage '" + name + "'. Expected one of "
+                      "spectrogram, patches or fvnsim.");
+}
+
+absl::Status FeatureShardWriter::WriteNpy(const FilePath &path,
+                                          const std::vector<size_t> &shape,
+                                          const std::vector<double> &data) {
+  std::string dims;
+  for (const size_t dim : shape) {
+    dims += std::to_string(dim) + ", ";
+  }
+  if (shape.size() > 1) {
+    // A tuple of more than one element has no trailing comma.
+    dims.resize(dims.size() - 2);
+  } else if (shape.size() == 1) {
+    dims.resize(dims.size() - 1);
+  }
+  std::string header = "{'descr': '<f8', 'fortran_order': False, 'shape': (" +
+                       dims + "), }";
+  // Pad with spaces so that the data after the newline is aligned.
+  const size_t unpadded = kNpyPreambleSize + header.size() + 1;
+  header.append((kNpyAlignment - unpadded % kNpyAlignment) % kNpyAlignment,
+                ' ');
+  header += '\n';
+
+  std::ofstream out(path.Path(), std::ios::binary | std::ios::trunc);
+  out.write(kNpyMagic, sizeof(kNpyMagic) - 1);
+  const char version[] = {1, 0};
+  out.write(version, sizeof(version));
+  const uint16_t header_size = header.size();
+  const char header_size_bytes[] = {static_cast<char>(header_size & 0xFF),
+                                    static_cast<char>(header_size >> 8)};
+  out.write(header_size_bytes, sizeof(header_size_bytes));
+  out.write(header.data(), header.size());
+  // The doubles are written in the byte order of the host, which the
+  // supported platforms all have as little endian.
+  out.write(reinterpret_cast<const char *>(data.data()),
+            data.size() * sizeof(double));
+  out.close();
+  if (!out) {
+    return absl::Status(absl::StatusCode::kInternal,
+                        "Unable to write features: " + path.Path());
+  }
+  return absl::Status();
+}
+
+FeatureShardWriter::FeatureShardWriter(const FilePath &output_dir,
+                                       FeatureStage stage, size_t num_pairs,
+                                       size_t pairs_per_shard)
+    : output_dir_(output_dir),
+      stage_(stage),
+      pairs_per_shard_(std::max(pairs_per_shard, static_cast<size_t>(1))),
+      entries_(num_pairs) {
+  const size_t num_shards =
+      (num_pairs + pairs_per_shard_ - 1) / pairs_per_shard_;
+  shard_num_added_.assign(num_shards, 0);
+  shard_written_.assign(num_shards, false);
+}
+
+absl::Status FeatureShardWriter::Open() {
+  boost::system::error_code error;
+  boost::filesystem::create_directories(output_dir_.Path(), error);
+  if (error) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Unable to create the features directory " +
+                            output_dir_.Path() + ": " + error.message());
+  }
+  return absl::Status();
+}
+
+absl::Status FeatureShardWriter::AddSpectrograms(
+    size_t pair_index, const ReferenceDegradedPathPair &pair,
+    const SpectrogramFeatures &features) {
+  const absl::Status bands_status = CheckBands(features.center_freq_bands);
+  if (!bands_status.ok()) {
+    // Complete the shard regardless, so the other pairs are still written.
+    AddFailed(pair_index, pair, bands_status).IgnoreError();
+    return bands_status;
+  }
+  PairEntry entry;
+  entry.reference = pair.reference.Path();
+  entry.degraded = pair.degraded.Path();
+  entry.error.clear();
+  entry.frame_duration = features.frame_duration;
+  entry.start_time = features.start_time;
+
+  // The spectrograms have a row for each band, but are written with a row
+  // for each frame, so that the frames of a pair are contiguous.
+  const auto transpose = [](const AMatrix<double> &spectrogram,
+                            std::vector<double> *out) {
+    out->reserve(spectrogram.NumRows() * spectrogram.NumCols());
+    for (size_t frame = 0; frame < spectrogram.NumCols(); frame++) {
+      for (size_t band = 0; band < spectrogram.NumRows(); band++) {
+        out->push_back(spectrogram(band, frame));
+      }
+    }
+  };
+  transpose(features.reference, &entry.ref_spectrogram);
+  entry.ref_num_frames = features.reference.NumCols();
+  transpose(features.degraded, &entry.deg_spectrogram);
+  entry.deg_num_frames = features.degraded.NumCols();
+  return Add(pair_index, std::move(entry));
+}
+
+absl::Status FeatureShardWriter::AddResult(
+    size_t pair_index, const SimilarityResultMsg &sim_res_msg) {
+  ReferenceDegradedPathPair pair;
+  pair.reference = FilePath(sim_res_msg.reference_filepath());
+  pair.degraded = FilePath(sim_res_msg.degraded_filepath());
+  const std::vector<double> center_freq_bands(
+      sim_res_msg.center_freq_bands().begin(),
+      sim_res_msg.center_freq_bands().end());
+  const absl::Status bands_status = CheckBands(center_freq_bands);
+  if (!bands_status.ok()) {
+    AddFailed(pair_index, pair, bands_status).IgnoreError();
+    return bands_status;
+  }
+  PairEntry entry;
+  entry.reference = pair.reference.Path();
+  entry.degraded = pair.degraded.Path();
+  entry.error.clear();
+  if (stage_ == FeatureStage::kPatches) {
+    for (const auto &patch : sim_res_msg.patch_sims()) {
+      Append(patch.freq_band_means(), &entry.patch_freq_band_means);
+      entry.patch_times.push_back(patch.ref_patch_start_time());
+      entry.patch_times.push_back(patch.ref_patch_end_time());
+      entry.patch_times.push_back(patch.deg_patch_start_time());
+      entry.patch_times.push_back(patch.deg_patch_end_time());
+      entry.patch_similarity.push_back(patch.similarity());
+    }
+    entry.num_patches = sim_res_msg.patch_sims_size();
+  }
+  Append(sim_res_msg.fvnsim(), &entry.fvnsim);
+  Append(sim_res_msg.fstdnsim(), &entry.fstdnsim);
+  Append(sim_res_msg.fvdegenergy(), &entry.fvdegenergy);
+  entry.moslqo = sim_res_msg.moslqo();
+  entry.vnsim = sim_res_msg.vnsim();
+  return Add(pair_index, std::move(entry));
+}
+
+absl::Status FeatureShardWriter::AddFailed(
+    size_t pair_index, const ReferenceDegradedPathPair &pair,
+    const absl::Status &status) {
+  PairEntry entry;
+  entry.reference = pair.reference.Path();
+  entry.degraded = pair.degraded.Path();
+  entry.error = status.ToString();
+  return Add(pair_index, std::move(entry));
+}
+
+absl::Status FeatureShardWriter::CheckBands(
+    const std::vector<double> &center_freq_bands) {
+  absl::MutexLock lock(&mutex_);
+  if (center_freq_bands_.empty()) {
+    center_freq_bands_ = center_freq_bands;
+  } else if (center_freq_bands_.size() != center_freq_bands.size()) {
+    return absl::Status(
+        absl::StatusCode::kInvalidArgument,
+        "Every pair must have the same number of bands to extract features. "
+        "Expected " + std::to_string(center_freq_bands_.size()) + ", got " +
+            std::to_string(center_freq_bands.size()) + ".");
+  }
+  return absl::Status();
+}
+
+absl::Status FeatureShardWriter::Add(size_t pair_index, PairEntry entry) {
+  const size_t shard = pair_index / pairs_per_shard_;
+  const size_t first = shard * pairs_per_shard_;
+  const size_t last = std::min(first + pairs_per_shard_, entries_.size());
+  std::vector<PairEntry> shard_entries;
+  size_t num_bands;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (pair_index >= entries_.size() || entries_[pair_index].added) {
+      return absl::Status(absl::StatusCode::kInvalidArgument,
+                          "Features added twice, or for an unknown pair: " +
+                              std::to_string(pair_index));
+    }
+    entry.added = true;
+    entries_[pair_index] = std::move(entry);
+    if (++shard_num_added_[shard] < last - first) {
+      return absl::Status();
+    }
+    shard_written_[shard] = true;
+    shard_entries.assign(std::make_move_iterator(entries_.begin() + first),
+                         std::make_move_iterator(entries_.begin() + last));
+    num_bands = center_freq_bands_.size();
+  }
+
+  // The shard is complete, so no other thread uses its entries while it is
+  // written.
+  const absl::Status status = WriteShard(shard, num_bands, &shard_entries);
+  absl::MutexLock lock(&mutex_);
+  std::move(shard_entries.begin(), shard_entries.end(),
+            entries_.begin() + first);
+  return status;
+}
+
+absl::Status FeatureShardWriter::WriteShard(
+    size_t shard, size_t num_bands, std::vector<PairEntry> *entries) const {
+  std::vector<double> ref_spectrogram, deg_spectrogram;
+  std::vector<double> patch_freq_band_means, patch_times, patch_similarity;
+  std::vector<double> fvnsim, fstdnsim, fvdegenergy, moslqo, vnsim;
+  size_t ref_num_frames = 0, deg_num_frames = 0, num_patches = 0;
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  for (PairEntry &entry : *entries) {
+    entry.ref_frame_offset = ref_num_frames;
+    entry.deg_frame_offset = deg_num_frames;
+    entry.patch_offset = num_patches;
+    ref_spectrogram.insert(ref_spectrogram.end(),
+                           entry.ref_spectrogram.begin(),
+                           entry.ref_spectrogram.end());
+    deg_spectrogram.insert(deg_spectrogram.end(),
+                           entry.deg_spectrogram.begin(),
+                           entry.deg_spectrogram.end());
+    ref_num_frames += entry.ref_num_frames;
+    deg_num_frames += entry.deg_num_frames;
+    patch_freq_band_means.insert(patch_freq_band_means.end(),
+                                 entry.patch_freq_band_means.begin(),
+                                 entry.patch_freq_band_means.end());
+    patch_times.insert(patch_times.end(), entry.patch_times.begin(),
+                       entry.patch_times.end());
+    patch_similarity.insert(patch_similarity.end(),
+                            entry.patch_similarity.begin(),
+                            entry.patch_similarity.end());
+    num_patches += entry.num_patches;
+    // A pair that failed has no features, and keeps its row as NaN.
+    const bool has_features = entry.error.empty();
+    const auto append_row = [&](const std::vector<double> &row,
+                                std::vector<double> *out) {
+      if (has_features && row.size() == num_bands) {
+        out->insert(out->end(), row.begin(), row.end());
+      } else {
+        out->insert(out->end(), num_bands, nan);
+      }
+    };
+    append_row(entry.fvnsim, &fvnsim);
+    append_row(entry.fstdnsim, &fstdnsim);
+    append_row(entry.fvdegenergy, &fvdegenergy);
+    moslqo.push_back(has_features ? entry.moslqo : nan);
+    vnsim.push_back(has_features ? entry.vnsim : nan);
+
+    // Only the index of the pair is kept once it is written.
+    entry.ref_spectrogram = std::vector<double>();
+    entry.deg_spectrogram = std::vector<double>();
+    entry.patch_freq_band_means = std::vector<double>();
+    entry.patch_times = std::vector<double>();
+    entry.patch_similarity = std::vector<double>();
+    entry.fvnsim = std::vector<double>();
+    entry.fstdnsim = std::vector<double>();
+    entry.fvdegenergy = std::vector<double>();
+  }
+
+  const size_t num_pairs = entries->size();
+  std::vector<absl::Status> statuses;
+  if (stage_ == FeatureStage::kSpectrogram) {
+    statuses.push_back(WriteNpy(ShardPath(shard, "ref_spectrogram"),
+                                {ref_num_frames, num_bands}, ref_spectrogram));
+    statuses.push_back(WriteNpy(ShardPath(shard, "deg_spectrogram"),
+                                {deg_num_frames, num_bands}, deg_spectrogram));
+    return statuses[0].ok() ? statuses[1] : statuses[0];
+  }
+  if (stage_ == FeatureStage::kPatches) {
+    statuses.push_back(WriteNpy(ShardPath(shard, "patch_freq_band_means"),
+                                {num_patches, num_bands},
+                                patch_freq_band_means));
+    statuses.push_back(WriteNpy(ShardPath(shard, "patch_times"),
+                                {num_patches, 4}, patch_times));
+    statuses.push_back(WriteNpy(ShardPath(shard, "patch_similarity"),
+                                {num_patches}, patch_similarity));
+  }
+  statuses.push_back(WriteNpy(ShardPath(shard, "fvnsim"),
+                              {num_pairs, num_bands}, fvnsim));
+  statuses.push_back(WriteNpy(ShardPath(shard, "fstdnsim"),
+                              {num_pairs, num_bands}, fstdnsim));
+  statuses.push_back(WriteNpy(ShardPath(shard, "fvdegenergy"),
+                              {num_pairs, num_bands}, fvdegenergy));
+  statuses.push_back(WriteNpy(ShardPath(shard, "moslqo"), {num_pairs},
+                              moslqo));
+  statuses.push_back(WriteNpy(ShardPath(shard, "vnsim"), {num_pairs}, vnsim));
+  for (const absl::Status &status : statuses) {
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::Status();
+}
+
+absl::Status FeatureShardWriter::Close() {
+  // Write the shards whose pairs were not all added, for example because the
+  // batch was aborted.
+  absl::Status status;
+  for (size_t shard = 0; shard < shard_written_.size(); shard++) {
+    std::vector<PairEntry> shard_entries;
+    size_t num_bands;
+    const size_t first = shard * pairs_per_shard_;
+    const size_t last = std::min(first + pairs_per_shard_, entries_.size());
+    {
+      absl::MutexLock lock(&mutex_);
+      if (shard_written_[shard]) {
+        continue;
+      }
+      shard_written_[shard] = true;
+      shard_entries.assign(std::make_move_iterator(entries_.begin() + first),
+                           std::make_move_iterator(entries_.begin() + last));
+      num_bands = center_freq_bands_.size();
+    }
+    const absl::Status shard_status =
+        WriteShard(shard, num_bands, &shard_entries);
+    if (status.ok()) {
+      status = shard_status;
+    }
+    absl::MutexLock lock(&mutex_);
+    std::move(shard_entries.begin(), shard_entries.end(),
+              entries_.begin() + first);
+  }
+
+  absl::MutexLock lock(&mutex_);
+  const FilePath index_path(output_dir_.Path() + "/index.csv");
+  std::ofstream index(index_path.Path(), std::ios::trunc);
+  index << "pair_index,reference,degraded,shard,row,frame_duration,"
+           "start_time,ref_frame_offset,ref_num_frames,deg_frame_offset,deg_num_frames,"
+           "patch_offset,num_patches,error" << std::endl;
+  for (size_t i = 0; i < entries_.size(); i++) {
+    const PairEntry &entry = entries_[i];
+    index << i << "," << QuoteCsv(entry.reference) << ","
+          << QuoteCsv(entry.degraded) << "," << i / pairs_per_shard_ << ","
+          << i % pairs_per_shard_ << "," << entry.frame_duration << ","
+          << entry.start_time << ","
+          << entry.ref_frame_offset << "," << entry.ref_num_frames << ","
+          << entry.deg_frame_offset << "," << entry.deg_num_frames << ","
+          << entry.patch_offset << "," << entry.num_patches << ","
+          << QuoteCsv(entry.error) << std::endl;
+  }
+  index.close();
+  if (!index && status.ok()) {
+    status = absl::Status(absl::StatusCode::kInternal,
+                          "Unable to write features: " + index_path.Path());
+  }
+  const absl::Status bands_status =
+      WriteNpy(FilePath(output_dir_.Path() + "/center_freq_bands.npy"),
+               {center_freq_bands_.size()}, center_freq_bands_);
+  return status.ok() ? bands_status : status;
+}
+
+FilePath FeatureShardWriter::ShardPath(size_t shard,
+                                       const std::string &array) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "shard-%05zu.", shard);
+  return FilePath(output_dir_.Path() + "/" + name + array + ".npy");
+}
+}  // namespace Visqol
@@ -60,6 +60,11 @@ std::valarray<double> a1, a2, a3, a4, b;
 
 // Loop over each filter coefficient now to produce a filtered column.
 for (size_t chan = 0; chan < num_bands_; chan++) {
+  // A band with no numerator passes nothing, so is not filtered.
+  if (fltr_coeff_A0_[chan] == 0.0) {
+    output.SetRow(chan, std::valarray<double>(0.0, signal.size()));
+    continue;
+  }
   a1 = {fltr_coeff_A0_[chan] / fltr_coeff_gain_[chan],
         fltr_coeff_A11_[chan] / fltr_coeff_gain_[chan],
         fltr_coeff_A2_[chan] / fltr_coeff_gain_[chan]};
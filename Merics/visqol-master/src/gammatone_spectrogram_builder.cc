@@ -16,6 +16,7 @@
 
 #include <algorithm>
 #include <utility>
+#include <valarray>
 #include <vector>
 
 #include "amatrix.h"
@@ -29,6 +30,29 @@
 namespace Visqol {
 
 const double GammatoneSpectrogramBuilder::kSpeechModeMaxFreq = 8000.0;
+const double GammatoneSpectrogramBuilder::kAudioModeMaxFreq = 24000.0;
+
+namespace {
+// Get the gammatone coefficients of a filter bank. In audio mode the bands do
+// not depend on the sample rate, so signals can be compared at their own
+// sample rate.
+ErbFiltersResult MakeBandFilters(const GammatoneFilterBank &filter_bank,
+                                 bool speech_mode, size_t sample_rate) {
+  return speech_mode ?
+      EquivalentRectangularBandwidth::MakeFilters(
+          sample_rate, filter_bank.GetNumBands(), filter_bank.GetMinFreq(),
+          GammatoneSpectrogramBuilder::kSpeechModeMaxFreq) :
+      EquivalentRectangularBandwidth::MakeFixedFilters(
+          sample_rate, filter_bank.GetNumBands(), filter_bank.GetMinFreq(),
+          GammatoneSpectrogramBuilder::kAudioModeMaxFreq);
+}
+
+// Order the center freq bands from lowest to highest.
+std::vector<double> OrderCenterFreqBands(const ErbFiltersResult &erb_rslt) {
+  return std::vector<double>(erb_rslt.centerFreqs.rbegin(),
+                             erb_rslt.centerFreqs.rend());
+}
+}  // namespace
 
 GammatoneSpectrogramBuilder::GammatoneSpectrogramBuilder(
     const GammatoneFilterBank &filter_bank, const bool use_speech_mode) :
@@ -36,14 +60,51 @@ GammatoneSpectrogramBuilder::GammatoneSpectrogramBuilder(
 
 absl::StatusOr<Spectrogram> GammatoneSpectrogramBuilder::Build(
     const AudioSignal &signal, const AnalysisWindow &window) {
+  const auto num_cols_result = NumColumns(signal, window);
+  if (!num_cols_result.ok()) {
+    return num_cols_result.status();
+  }
+  return BuildColumns(signal, window, 0, num_cols_result.value());
+}
+
+absl::StatusOr<size_t> GammatoneSpectrogramBuilder::NumColumns(
+    const AudioSignal &signal, const AnalysisWindow &window) const {
+  const size_t num_samples = signal.data_matrix.NumRows();
+  // set up the windowing
+  size_t hop_size = window.size * window.overlap;
+
+  // ensure that the signal is large enough.
+  if (num_samples <= window.size) {
+    return absl::Status(
+        absl::StatusCode::kInvalidArgument,
+        "Too few samples (" + std::to_string(num_samples) + ") in signal to "
+        "build spectrogram (" + std::to_string(window.size) +
+        " required minimum).");
+  }
+  return 1 + floor((num_samples - window.size) / hop_size);
+}
+
+absl::StatusOr<Spectrogram> GammatoneSpectrogramBuilder::BuildColumns(
+    const AudioSignal &signal, const AnalysisWindow &window,
+    const size_t first_col, const size_t num_cols) {
   const auto &sig = signal.data_matrix;
   size_t sample_rate = signal.sample_rate;
-  double max_freq = speech_mode_ ? kSpeechModeMaxFreq : sample_rate / 2.0;
 
-  // get gammatone coeffients
-  ErbFiltersResult erb_rslt = EquivalentRectangularBandwidth::MakeFilters(
-      sample_rate, filter_bank_.GetNumBands(), filter_bank_.GetMinFreq(),
-      max_freq);
+  const auto total_cols_result = NumColumns(signal, window);
+  if (!total_cols_result.ok()) {
+    return total_cols_result.status();
+  }
+  if (first_col + num_cols > total_cols_result.value()) {
+    return absl::Status(
+        absl::StatusCode::kOutOfRange,
+        "Requested spectrogram columns [" + std::to_string(first_col) + ", " +
+        std::to_string(first_col + num_cols) + ") exceed the " +
+        std::to_string(total_cols_result.value()) + " available.");
+  }
+
+  // get gammatone coeffients.
+  ErbFiltersResult erb_rslt = MakeBandFilters(filter_bank_, speech_mode_,
+                                              sample_rate);
   AMatrix<double> filter_coeffs = AMatrix<double>(erb_rslt.filterCoeffs);
   filter_coeffs = filter_coeffs.FlipUpDown();
 
@@ -53,20 +114,14 @@ absl::StatusOr<Spectrogram> GammatoneSpectrogramBuilder::Build(
 
   // set up the windowing
   size_t hop_size = window.size * window.overlap;
-
-  // ensure that the signal is large enough.
-  if (sig.NumRows() <= window.size) {
-    return absl::Status(
-        absl::StatusCode::kInvalidArgument,
-        "Too few samples (" + std::to_string(sig.NumRows()) + ") in signal to "
-        "build spectrogram (" + std::to_string(window.size) +
-        " required minimum).");
-  }
-  size_t num_cols = 1 + floor((sig.NumRows() - window.size) / hop_size);
   AMatrix<double> out_matrix(filter_bank_.GetNumBands(), num_cols);
 
-  // run the windowing
-  auto sig_val_arr = sig.GetColumn(0).ToValArray();
+  // run the windowing. Only the samples spanned by the requested columns are
+  // copied out of the signal.
+  const size_t first_sample = first_col * hop_size;
+  const size_t span = num_cols == 0 ? 0 :
+      (num_cols - 1) * hop_size + window.size;
+  const std::valarray<double> sig_val_arr(sig.data() + first_sample, span);
   for (size_t i = 0; i < out_matrix.NumCols(); i++) {
     const size_t start_col = i * hop_size;
     // select the next frame from the input signal to filter.
@@ -85,17 +140,14 @@ absl::StatusOr<Spectrogram> GammatoneSpectrogramBuilder::Build(
     out_matrix.SetColumn(i, std::move(row_means));
   }
 
-  // Order the center freq bands from lowest to highest.
-  std::vector<double> ordered_cfb;
-  ordered_cfb.reserve(erb_rslt.centerFreqs.size());
-  for (auto itr = erb_rslt.centerFreqs.rbegin();
-       itr != erb_rslt.centerFreqs.rend();
-       ++itr) {
-    ordered_cfb.push_back(*itr);
-  }
-
   Spectrogram spectro(std::move(out_matrix));
-  spectro.SetCenterFreqBands(ordered_cfb);
+  spectro.SetCenterFreqBands(OrderCenterFreqBands(erb_rslt));
   return spectro;
 }
+
+std::vector<double> GammatoneSpectrogramBuilder::GetCenterFreqBands(
+    size_t sample_rate) const {
+  return OrderCenterFreqBands(MakeBandFilters(filter_bank_, speech_mode_,
+                                              sample_rate));
+}
 }  // namespace Visqol
@@ -0,0 +1,325 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_ARROW_RESULTS_WRITER_H
+#define VISQOL_INCLUDE_ARROW_RESULTS_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+
+#include "file_path.h"
+#include "similarity_result.pb.h"
+
+namespace Visqol {
+
+/**
+ * This class writes comparison results to files in the Arrow IPC streaming
+ * format, which columnar tools (e.g. pyarrow, pandas, DuckDB or Polars) can
+ * load without parsing text.
+ *
+ * The results table has one row per compared pair, with the columns
+ * reference, degraded, moslqo, vnsim, fvnsim, fstdnsim and fvdegenergy. The
+ * per band columns are fixed size lists, with the list size taken from the
+ * first result. The optional patches table has one row per patch, with the
+ * columns pair_index (the row of the pair in the results table), similarity,
+ * ref_patch_start_time, ref_patch_end_time, deg_patch_start_time,
+ * deg_patch_end_time and freq_band_means.
+ *
+ * Rows are buffered and written as a record batch once a batch is full, so
+ * the memory used does not grow with the number of pairs.
+ *
+ * The record batch buffers may be compressed with zstd, using the Arrow IPC
+ * body compression that Arrow readers decompress themselves. Each buffer is
+ * compressed independently. The compressed batches are encoded and written
+ * by a background thread, so that Append does not wait for the compression.
+ */
+class ArrowResultsWriter {
+ public:
+  /**
+   * The default number of rows written per record batch.
+   */
+  static const size_t kDefaultRowsPerBatch;
+
+  /**
+   * Constructs a writer. No files are opened until Open is called.
+   *
+   * @param results_path The path of the results table file.
+   * @param patches_path The path of the patches table file. If empty, the
+   *    patches table is not written.
+   * @param rows_per_batch The number of rows written per record batch.
+   * @param compression_level If greater than 0, the record batch buffers are
+   *    compressed with zstd at this level.
+   */
+  ArrowResultsWriter(const FilePath &results_path,
+                     const FilePath &patches_path = FilePath(),
+                     const size_t rows_per_batch = kDefaultRowsPerBatch,
+                     const int compression_level = 0);
+
+  /**
+   * Closes the files, if they were not already closed.
+   */
+  ~ArrowResultsWriter();
+
+  /**
+   * Open the output files, replacing any existing contents.
+   *
+   * @return An error status if a file could not be opened.
+   */
+  absl::Status Open();
+
+  /**
+   * Append the result of a comparison to the tables.
+   *
+   * @param sim_res_msg The comparison result to append.
+   *
+   * @return An error status if the number of frequency bands differs from
+   *    the previous results, or if a file could not be written. When
+   *    compressing, a failed write is reported by a later call to Append or
+   *    Close.
+   */
+  absl::Status Append(const SimilarityResultMsg &sim_res_msg);
+
+  /**
+   * Write the buffered rows and the end of stream marker, and close the
+   * files.
+   *
+   * @return An error status if a file could not be written.
+   */
+  absl::Status Close();
+
+ private:
+  /**
+   * The Arrow data types of the table columns.
+   */
+  enum class ColumnType { kUtf8, kInt64, kDouble, kDoubleList };
+
+  /**
+   * A table column and the values buffered for the next record batch.
+   */
+  struct Column {
+    /**
+     * The column name.
+     */
+    std::string name;
+
+    /**
+     * The column data type.
+     */
+    ColumnType type;
+
+    /**
+     * The number of values per row of a kDoubleList column.
+     */
+    size_t list_size = 0;
+
+    /**
+     * The end offset of each kUtf8 value in chars, preceded by 0.
+     */
+    std::vector<int32_t> offsets{0};
+
+    /**
+     * The concatenated kUtf8 values.
+     */
+    std::string chars;
+
+    /**
+     * The kInt64 values.
+     */
+    std::vector<int64_t> ints;
+
+    /**
+     * The kDouble and kDoubleList values.
+     */
+    std::vector<double> doubles;
+  };
+
+  /**
+   * An output table and its stream.
+   */
+  struct Table {
+    /**
+     * The path of the file the table is written to.
+     */
+    FilePath path;
+
+    /**
+     * The file the table is written to.
+     */
+    std::ofstream out;
+
+    /**
+     * The table columns.
+     */
+    std::vector<Column> columns;
+
+    /**
+     * The number of rows buffered for the next record batch.
+     */
+    size_t num_buffered_rows = 0;
+
+    /**
+     * The number of rows appended so far, including the buffered rows.
+     */
+    size_t num_rows = 0;
+
+    /**
+     * True once the schema message has been written.
+     */
+    bool schema_written = false;
+  };
+
+  /**
+   * The buffered rows of a table, taken for encoding as a record batch.
+   */
+  struct PendingBatch {
+    /**
+     * The table the batch is written to.
+     */
+    Table *table = nullptr;
+
+    /**
+     * If true, the schema message is written before the batch.
+     */
+    bool write_schema = false;
+
+    /**
+     * The columns of the table, holding the values of the batch.
+     */
+    std::vector<Column> columns;
+
+    /**
+     * The number of rows in the batch, which may be 0.
+     */
+    int64_t num_rows = 0;
+  };
+
+  /**
+   * Set the list size of a kDoubleList column from the first row, or check
+   * that a later row has the same size.
+   *
+   * @param values The values of the row.
+   * @param first_row True if this is the first row of the table.
+   * @param column The column.
+   *
+   * @return An error status if the size differs from the previous rows.
+   */
+  static absl::Status CheckListSize(
+      const google::protobuf::RepeatedField<double> &values,
+      const bool first_row, Column *column);
+
+  /**
+   * Take the buffered rows of a table, and write them as a record batch,
+   * preceded by the schema if not yet written. When compressing, the batch
+   * is queued for the encoding thread instead.
+   *
+   * @param table The table to flush.
+   *
+   * @return An error status if the file could not be written.
+   */
+  absl::Status Flush(Table *table);
+
+  /**
+   * Write a batch to the file of its table.
+   *
+   * @param batch The batch to write.
+   *
+   * @return An error status if a buffer could not be compressed, or if the
+   *    file could not be written.
+   */
+  absl::Status WriteBatch(const PendingBatch &batch) const;
+
+  /**
+   * Write the queued batches until the writer is closed.
+   */
+  void EncodeLoop();
+
+  /**
+   * Write the end of stream marker of a table and close its file.
+   *
+   * @param table The table to close.
+   *
+   * @return An error status if the file could not be written.
+   */
+  static absl::Status CloseTable(Table *table);
+
+  /**
+   * The table with one row per compared pair.
+   */
+  Table results_;
+
+  /**
+   * The table with one row per patch.
+   */
+  Table patches_;
+
+  /**
+   * If true, the patches table is written.
+   */
+  bool write_patches_;
+
+  /**
+   * The number of rows written per record batch.
+   */
+  size_t rows_per_batch_;
+
+  /**
+   * The zstd compression level of the record batch buffers, or 0 if they are
+   * not compressed.
+   */
+  int compression_level_;
+
+  /**
+   * True while the files are open.
+   */
+  bool is_open_ = false;
+
+  /**
+   * Encodes and writes the compressed batches.
+   */
+  std::thread encode_thread_;
+
+  /**
+   * Guards the members below.
+   */
+  absl::Mutex mutex_;
+
+  /**
+   * True once Close is called, which stops the encoding thread once the
+   * queue is empty.
+   */
+  bool closing_ = false;
+
+  /**
+   * The compressed batches waiting to be written.
+   */
+  std::deque<PendingBatch> queued_batches_;
+
+  /**
+   * The first error the encoding thread failed with.
+   */
+  absl::Status write_status_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_ARROW_RESULTS_WRITER_H
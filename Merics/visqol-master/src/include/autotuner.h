@@ -0,0 +1,128 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_AUTOTUNER_H
+#define VISQOL_INCLUDE_AUTOTUNER_H
+
+#include <cstddef>
+#include <vector>
+
+#include "absl/status/statusor.h"
+
+#include "audio_signal.h"
+#include "file_path.h"
+#include "tuning_profile.h"
+
+namespace Visqol {
+
+/**
+ * This class benchmarks the candidate execution parameters on the current
+ * host and selects the fastest configuration. Benchmarks are run on synthetic
+ * signal pairs shaped like the conformance test data: tonal music-like
+ * content with a band limited, noisy, delayed degraded version.
+ *
+ * Only the number of workers is tuned. Each pair is compared independently by
+ * one worker, so this changes the throughput but never the scores.
+ */
+class Autotuner {
+ public:
+  /**
+   * The default duration (in seconds) of each synthetic signal.
+   */
+  static const double kDefaultSyntheticDuration;
+
+  /**
+   * Constructs an autotuner for the given ViSQOL configuration. See
+   * VisqolManager::Init for a description of the params.
+   *
+   * @param synthetic_duration The duration (in seconds) of each of the
+   *    synthetic signals used for benchmarking.
+   */
+  Autotuner(const FilePath &sim_to_quality_mapper_model,
+            const bool use_speech_mode, const bool use_unscaled_speech,
+            const int search_window,
+            const double synthetic_duration = kDefaultSyntheticDuration);
+
+  /**
+   * Benchmark all candidate configurations and return the fastest.
+   *
+   * @return The selected tuning profile if benchmarking succeeded, else an
+   *    error status.
+   */
+  absl::StatusOr<TuningProfile> Tune() const;
+
+  /**
+   * Generate a deterministic synthetic reference signal.
+   *
+   * @param sample_rate The sample rate of the signal.
+   * @param duration The duration (in seconds) of the signal.
+   * @param seed The seed used to generate the signal content.
+   *
+   * @return The synthetic reference signal.
+   */
+  static AudioSignal MakeSyntheticReference(const size_t sample_rate,
+                                            const double duration,
+                                            const size_t seed);
+
+  /**
+   * Generate a degraded version of a synthetic reference signal. The
+   * degradation consists of a low pass filter, additive noise and a short
+   * leading delay.
+   *
+   * @param reference The reference signal to degrade.
+   * @param seed The seed used to generate the degradation.
+   *
+   * @return The synthetic degraded signal.
+   */
+  static AudioSignal MakeSyntheticDegraded(const AudioSignal &reference,
+                                           const size_t seed);
+
+ private:
+  /**
+   * Build the list of worker counts to benchmark on this host.
+   *
+   * @return The candidate worker counts, in ascending order.
+   */
+  static std::vector<size_t> CandidateWorkerCounts();
+
+  /**
+   * The similarity to quality mapping model used for the benchmark runs.
+   */
+  FilePath sim_to_quality_mapper_model_;
+
+  /**
+   * True if the benchmark runs should use speech mode.
+   */
+  bool use_speech_mode_;
+
+  /**
+   * True if the benchmark runs should use unscaled speech MOS mapping.
+   */
+  bool use_unscaled_speech_;
+
+  /**
+   * The search window radius used for the benchmark runs.
+   */
+  int search_window_;
+
+  /**
+   * The duration (in seconds) of each synthetic signal.
+   */
+  double synthetic_duration_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_AUTOTUNER_H
@@ -0,0 +1,428 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_BATCH_COMPARISON_RUNNER_H
+#define VISQOL_INCLUDE_BATCH_COMPARISON_RUNNER_H
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+
+#include "cancellation_token.h"
+#include "cost_model.h"
+#include "feature_shard_writer.h"
+#include "file_path.h"
+#include "progress_reporter.h"
+#include "reference_feature_cache.h"
+#include "similarity_result.pb.h"  // Generated by cc_proto_library rule
+#include "visqol_manager.h"
+
+namespace Visqol {
+
+/**
+ * This class is used for running a batch of ViSQOL comparisons across a pool
+ * of worker threads. Each worker owns its own VisqolManager, so no state is
+ * shared between concurrently running comparisons. Results are delivered in
+ * job order, regardless of the order in which the workers complete them.
+ *
+ * File pairs may override the settings the runner was initialised with. A
+ * pool of managers is kept for each distinct setting, which grows to at most
+ * one manager per worker, so every pair of a mixed batch is scheduled
+ * together.
+ *
+ * If the cost of each job is known, the most expensive jobs are started
+ * first, so that a long job is not left running alone at the end of the
+ * batch. Note that results completed out of order are held until every job
+ * before them has been delivered.
+ */
+class BatchComparisonRunner {
+ public:
+  /**
+   * A single unit of work. Called with the worker's manager, the index of
+   * the job to run, and a token that is cancelled if the job exceeds the CPU
+   * time limit. The job should stop with a status of deadline exceeded once
+   * the token is cancelled.
+   */
+  using Job = std::function<absl::StatusOr<SimilarityResultMsg>(
+      VisqolManager *manager, size_t job_index,
+      const CancellationToken *cancellation)>;
+
+  /**
+   * Called once per job, in job order, with the result of that job.
+   */
+  using ResultCallback = std::function<void(
+      size_t job_index, const absl::StatusOr<SimilarityResultMsg> &result)>;
+
+  /**
+   * Returns the next file pair to compare, waiting until there is one, or
+   * nullopt once there are no more. Called from many workers at once.
+   */
+  using PairSource = std::function<absl::optional<ReferenceDegradedPathPair>()>;
+
+  /**
+   * Called once per file pair taken from a PairSource, as soon as its
+   * comparison finishes, with the pair and its result.
+   */
+  using StreamResultCallback =
+      std::function<void(const ReferenceDegradedPathPair &pair,
+                         const absl::StatusOr<SimilarityResultMsg> &result)>;
+
+  /**
+   * Constructs a runner that will use the given number of worker threads.
+   *
+   * @param num_workers The number of comparisons to run concurrently. A value
+   *    of 0 is treated as 1.
+   */
+  explicit BatchComparisonRunner(size_t num_workers);
+
+  /**
+   * Initializes one VisqolManager per worker. Must be called before running
+   * any jobs. See VisqolManager::Init for a description of the params.
+   *
+   * @return An 'OK' status if all managers were initialised successfully,
+   *    else an error status.
+   */
+  absl::Status Init(const FilePath &sim_to_quality_mapper_model,
+                    const bool use_speech_mode, const bool use_unscaled_speech,
+                    const int search_window,
+                    const FineAlignmentPolicy &fine_alignment_policy =
+                        FineAlignmentPolicy(),
+                    const PatchSearchPolicy &patch_search_policy =
+                        PatchSearchPolicy());
+
+  /**
+   * Compute the quality over time for each comparison. See
+   * VisqolManager::SetTimeline. Must not be called while jobs are running.
+   */
+  void SetTimeline(double window_duration, double hop_duration);
+
+  /**
+   * Trim the silence around the active region of each reference. See
+   * VisqolManager::SetSilenceTrimming. Must not be called while jobs are
+   * running.
+   */
+  void SetSilenceTrimming(bool trim_silence);
+
+  /**
+   * Share a cache of the prepared reference features between every manager.
+   * See VisqolManager::SetReferenceFeatureCache. Must not be called while
+   * jobs are running.
+   */
+  void SetReferenceFeatureCache(std::shared_ptr<ReferenceFeatureCache> cache);
+
+  /**
+   * Limit the estimated memory used by the jobs running concurrently. A job
+   * is only started once its estimate fits within the budget alongside the
+   * jobs already running, although a job is always started if no other job
+   * is running.
+   *
+   * @param memory_budget_bytes The memory budget in bytes. A value of 0 (the
+   *    default) disables the limit.
+   */
+  void SetMemoryBudget(size_t memory_budget_bytes) {
+    memory_budget_bytes_ = memory_budget_bytes;
+  }
+
+  /**
+   * Limit the CPU time each job may use. A job that exceeds the limit is
+   * cancelled, and its result is a status of deadline exceeded, after which
+   * its worker moves straight on to the next job. Must not be called while
+   * jobs are running.
+   *
+   * @param limit_seconds The CPU time limit in seconds. A value of 0 (the
+   *    default) disables the limit.
+   */
+  void SetPairCpuTimeLimit(double limit_seconds) {
+    pair_cpu_time_limit_seconds_ = limit_seconds;
+  }
+
+  /**
+   * Predict the run time of each file pair with the given cost model, and
+   * calibrate the model with the measured run times. Must not be called
+   * while jobs are running.
+   *
+   * @param cost_model The cost model, which must outlive the runs that use
+   *    it, or null (the default) to not predict run times.
+   */
+  void SetCostModel(CostModel *cost_model) { cost_model_ = cost_model; }
+
+  /**
+   * Report the progress of each run with the given reporter, which is
+   * started and finished by the run. Must not be called while jobs are
+   * running.
+   *
+   * @param progress_reporter The reporter, which must outlive the runs that
+   *    use it, or null (the default) to not report progress.
+   */
+  void SetProgressReporter(ProgressReporter *progress_reporter) {
+    progress_reporter_ = progress_reporter;
+  }
+
+  /**
+   * Extract the features of each file pair to the given writer, from the
+   * worker threads as each pair finishes. For the kSpectrogram stage the
+   * pairs are not compared, and their results only hold their file paths.
+   * Must not be called while jobs are running.
+   * @param feature_writer The writer, which must outlive the runs that use
+   *    it, or null (the default) to not extract features.
+   */
+  void SetFeatureWriter(FeatureShardWriter *feature_writer) {
+    feature_writer_ = feature_writer;
+  }
+
+  /**
+   * Compare each of the given reference/degraded file pairs, with the
+   * settings of each pair where set. The memory needed by each pair is
+   * estimated from the size of its files, and its run time is predicted by
+   * the cost model, if one is set. The cost model is only calibrated with the
+   * pairs that use the runner's settings.
+   *
+   * @param file_pairs The file pairs to compare.
+   * @param on_result Called once per pair, in order, with its result.
+   */
+  void Run(const std::vector<ReferenceDegradedPathPair> &file_pairs,
+           const ResultCallback &on_result);
+
+  /**
+   * Compare the file pairs given by a source until it has no more, with the
+   * settings of each pair where set. Each worker takes the next pair as soon
+   * as it is idle, so the managers stay initialised between pairs. Unlike
+   * the batch Run, the results are delivered in the order the comparisons
+   * finish, and the pairs are not limited by the memory budget, predicted by
+   * the cost model or reported to the progress reporter. No feature writer
+   * may be set. If any pair returns a status of aborted, the workers stop
+   * taking pairs.
+   *
+   * @param next_pair The source of the file pairs.
+   * @param on_result Called once per pair, from one worker at a time, with its
+   *    result.
+   */
+  void RunStream(const PairSource &next_pair,
+                 const StreamResultCallback &on_result);
+
+  /**
+   * Run the given number of jobs across the worker pool. If any job returns a
+   * status of aborted, no further jobs will be started.
+   *
+   * @param num_jobs The number of jobs to run.
+   * @param job The function that runs a single job.
+   * @param on_result Called once per started job, in order, with its result.
+   * @param job_memory The estimated memory in bytes used by each job. If
+   *    empty, the jobs are not limited by the memory budget.
+   * @param job_cost The predicted run time in seconds of each job. The jobs
+   *    are started in order of decreasing cost. If empty, the jobs are
+   *    started in order and are assumed to take equally long.
+   * @param job_audio_seconds The duration of the audio compared by each job,
+   *    which is only used to report progress. If empty, it is not reported.
+   */
+  void Run(size_t num_jobs, const Job &job, const ResultCallback &on_result,
+           const std::vector<size_t> &job_memory = {},
+           const std::vector<double> &job_cost = {},
+           const std::vector<double> &job_audio_seconds = {});
+
+  /**
+   * Estimate the time left until the current run completes. The predicted
+   * costs of the unfinished jobs are scaled by how long the finished jobs
+   * took relative to their predictions, and shared across the workers. Safe
+   * to call from the result callback.
+   *
+   * @return The estimated time remaining in seconds, or 0 if no run is in
+   *    progress.
+   */
+  double EstimatedSecondsRemaining() const;
+
+  /**
+   * @return The number of worker threads used by this runner.
+   */
+  size_t NumWorkers() const { return managers_.size(); }
+
+ private:
+  /**
+   * The settings a manager is initialised with.
+   */
+  struct ManagerConfig {
+    FilePath sim_to_quality_mapper_model;
+    bool use_speech_mode = false;
+    int search_window = 0;
+
+    /**
+     * @return A key that is equal for configs that give equal results.
+     */
+    std::string Key() const;
+  };
+
+  /**
+   * @param pair A file pair.
+   *
+   * @return The settings of the pair, which are the runner's settings where
+   *    the pair does not set them.
+   */
+  ManagerConfig ConfigFor(const ReferenceDegradedPathPair &pair) const;
+
+  /**
+   * Compare a file pair, or extract its features if a feature writer is set.
+   * @param manager The manager to use.
+   * @param pair The file pair.
+   * @param job_index The index of the pair in the batch.
+   * @param cancellation Cancelled if the pair exceeds the CPU time limit.
+   * @return The comparison result, or an error status.
+   */
+  absl::StatusOr<SimilarityResultMsg> RunPair(
+      VisqolManager *manager, const ReferenceDegradedPathPair &pair,
+      size_t job_index, const CancellationToken *cancellation);
+
+  /**
+   * Compare a file pair as RunPair does, with a manager from the pool if the
+   * pair's settings are not the runner's.
+   * @param manager The worker's manager, used for the runner's settings.
+   * @param pair The file pair.
+   * @param job_index The index of the pair in the batch.
+   * @param cancellation Cancelled if the pair exceeds the CPU time limit.
+   * @return The comparison result, or an error status.
+   */
+  absl::StatusOr<SimilarityResultMsg> RunPairWithSettings(
+      VisqolManager *manager, const ReferenceDegradedPathPair &pair,
+      size_t job_index, const CancellationToken *cancellation);
+
+  /**
+   * Take an idle manager for the given settings from the pool, or initialise
+   * a new one if there is none.
+   *
+   * @param config The settings of the manager.
+   *
+   * @return The manager, or an error status if it could not be initialised.
+   */
+  absl::StatusOr<std::unique_ptr<VisqolManager>> AcquireManager(
+      const ManagerConfig &config);
+
+  /**
+   * Return a manager taken by AcquireManager to the pool.
+   *
+   * @param config The settings of the manager.
+   * @param manager The manager.
+   */
+  void ReleaseManager(const ManagerConfig &config,
+                      std::unique_ptr<VisqolManager> manager);
+
+  /**
+   * One manager per worker thread.
+   */
+  std::vector<std::unique_ptr<VisqolManager>> managers_;
+
+  /**
+   * The settings the managers of the workers were initialised with.
+   */
+  ManagerConfig default_config_;
+
+  /**
+   * The settings shared by every manager. See VisqolManager::Init.
+   */
+  bool use_unscaled_speech_ = false;
+  FineAlignmentPolicy fine_alignment_policy_;
+  PatchSearchPolicy patch_search_policy_;
+
+  /**
+   * The timeline settings of every manager. See VisqolManager::SetTimeline.
+   */
+  double timeline_window_duration_ = 0.0;
+  double timeline_hop_duration_ = 0.0;
+
+  /**
+   * True if every manager trims silence. See
+   * VisqolManager::SetSilenceTrimming.
+   */
+  bool trim_silence_ = false;
+
+  /**
+   * The reference feature cache shared by every manager, or null. See
+   * VisqolManager::SetReferenceFeatureCache.
+   */
+  std::shared_ptr<ReferenceFeatureCache> reference_cache_;
+
+  /**
+   * Guards the pool of managers below.
+   */
+  absl::Mutex pool_mutex_;
+
+  /**
+   * The idle managers for settings that are not the runner's own, keyed by
+   * ManagerConfig::Key.
+   */
+  std::map<std::string, std::vector<std::unique_ptr<VisqolManager>>>
+      idle_managers_;
+
+  /**
+   * The memory budget for the jobs running concurrently, or 0 if unlimited.
+   */
+  size_t memory_budget_bytes_ = 0;
+
+  /**
+   * The CPU time limit of each job in seconds, or 0 if unlimited.
+   */
+  double pair_cpu_time_limit_seconds_ = 0.0;
+
+  /**
+   * Predicts the run time of each file pair, or null if not set. Not owned.
+   */
+  CostModel *cost_model_ = nullptr;
+
+  /**
+   * Reports the progress of each run, or null if not set. Not owned.
+   */
+  ProgressReporter *progress_reporter_ = nullptr;
+
+  /**
+   * Extracts the features of each file pair, or null if not set. Not owned.
+   */
+  FeatureShardWriter *feature_writer_ = nullptr;
+
+  /**
+   * Guards the progress of the current run, used to estimate the time
+   * remaining.
+   */
+  mutable absl::Mutex progress_mutex_;
+
+  /**
+   * The predicted cost of the jobs in the current run that have not finished.
+   */
+  double remaining_cost_ = 0.0;
+
+  /**
+   * The predicted cost of the jobs in the current run that have finished.
+   */
+  double finished_cost_ = 0.0;
+
+  /**
+   * The measured run time of the jobs in the current run that have finished.
+   */
+  double finished_seconds_ = 0.0;
+
+  /**
+   * The number of workers used by the current run.
+   */
+  size_t run_workers_ = 0;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_BATCH_COMPARISON_RUNNER_H
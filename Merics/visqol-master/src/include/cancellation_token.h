@@ -0,0 +1,81 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_CANCELLATION_TOKEN_H
+#define VISQOL_INCLUDE_CANCELLATION_TOKEN_H
+
+#include <atomic>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+
+namespace Visqol {
+
+/**
+ * This class is used to cancel a running comparison from another thread.
+ *
+ * Cancellation is cooperative: the comparison checks the token between units
+ * of work, such as each row of the patch search or each patch being finely
+ * aligned, and stops with a status of deadline exceeded once the token has
+ * been cancelled. Checking the token only reads an atomic flag, so it is
+ * cheap enough to do often.
+ */
+class CancellationToken {
+ public:
+  /**
+   * Check whether a comparison should continue.
+   *
+   * @param token The token to check, or null if the comparison cannot be
+   *    cancelled.
+   *
+   * @return An 'OK' status if the token is null or has not been cancelled,
+   *    else a status of deadline exceeded with the reason it was cancelled.
+   */
+  static absl::Status Check(const CancellationToken *token);
+
+  /**
+   * Cancel the comparison. Only the first reason given is kept. May be called
+   * from any thread.
+   *
+   * @param reason The reason the comparison was cancelled.
+   */
+  void Cancel(const std::string &reason);
+
+  /**
+   * @return True if the token has been cancelled.
+   */
+  bool IsCancelled() const { return cancelled_.load(); }
+
+ private:
+  /**
+   * True once the token has been cancelled.
+   */
+  std::atomic<bool> cancelled_{false};
+
+  /**
+   * Guards the reason below.
+   */
+  mutable absl::Mutex mutex_;
+
+  /**
+   * The reason the token was cancelled.
+   */
+  std::string reason_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_CANCELLATION_TOKEN_H
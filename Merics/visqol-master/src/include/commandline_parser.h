@@ -17,12 +17,16 @@
 #ifndef VISQOL_INCLUDE_COMMANDLINE_PARSER_H
 #define VISQOL_INCLUDE_COMMANDLINE_PARSER_H
 
+#include <limits>
 #include <string>
 #include <vector>
 #include <utility>
 
 #include "absl/status/statusor.h"
+#include "absl/types/optional.h"
 
+#include "directory_watcher.h"
+#include "feature_shard_writer.h"
 #include "file_path.h"
 
 namespace Visqol {
@@ -32,6 +36,17 @@ namespace Visqol {
  */
 extern const char kDefaultAudioModelFile[];
 
+/**
+ * The default path that --autotune writes the tuning profile to.
+ */
+extern const char kDefaultTuningProfileFile[];
+
+/**
+ * The --reference_cache value that selects a reference feature cache in
+ * memory only, without a shared server.
+ */
+extern const char kLocalReferenceCache[];
+
 /**
  * This struct is used for storing args provided at the command line.
  */
@@ -98,6 +113,165 @@ struct CommandLineArgs {
    */
   int search_window_radius;
 
+  /**
+   * If true, benchmark the execution parameters on this host and write a
+   * tuning profile instead of running comparisons.
+   */
+  bool autotune;
+
+  /**
+   * The path to the tuning profile. When autotuning this is the path the
+   * profile is written to, else it is the path the profile is loaded from.
+   * Optional.
+   */
+  FilePath tuning_profile_path;
+
+  /**
+   * Matched patches with a coarse similarity above this threshold keep their
+   * coarse alignment instead of being finely aligned.
+   */
+  double fine_alignment_skip_threshold =
+      std::numeric_limits<double>::infinity();
+
+  /**
+   * If true, matched patches with a zero sample local alignment lag keep their
+   * coarse alignment instead of being finely aligned, which approximates the
+   * scores.
+   */
+  bool approximate_fine_alignment_at_zero_lag = false;
+
+  /**
+   * The path to an Arrow IPC stream file for storing similarity results.
+   * Optional.
+   */
+  FilePath results_output_arrow;
+
+  /**
+   * The path to an Arrow IPC stream file for storing per patch similarity
+   * results. Optional, and only used if results_output_arrow is set.
+   */
+  FilePath patch_results_output_arrow;
+
+  /**
+   * The path to the cost model file, which is used to predict the run time of
+   * each pair and is updated with the measured run times. Optional.
+   */
+  FilePath cost_model_path;
+
+  /**
+   * The path that progress reports are written to as JSON lines. Optional.
+   */
+  FilePath progress_output_path;
+
+  /**
+   * The time in seconds between progress reports.
+   */
+  double progress_interval_seconds = 10.0;
+
+  /**
+   * The path that the quality over time of each pair is written to in CSV
+   * format. Optional.
+   */
+  FilePath timeline_output_csv;
+
+  /**
+   * The duration of each timeline window in seconds.
+   */
+  double timeline_window_seconds = 10.0;
+
+  /**
+   * The time between the starts of consecutive timeline windows in seconds.
+   */
+  double timeline_hop_seconds = 1.0;
+
+  /**
+   * The stage to extract features from, instead of writing the results.
+   * Optional.
+   */
+  absl::optional<FeatureStage> feature_stage;
+
+  /**
+   * The directory that extracted features are written to.
+   */
+  FilePath features_output_dir;
+
+  /**
+   * The number of pairs in each shard of extracted features.
+   */
+  size_t features_pairs_per_shard = 256;
+
+  /**
+   * The zstd compression level of the results, debug, timeline and Arrow
+   * outputs, or 0 if they are not compressed.
+   */
+  int compression_level = 0;
+
+  /**
+   * The CPU time in seconds each pair may use, or 0 if unlimited.
+   */
+  double pair_cpu_time_limit_seconds = 0.0;
+
+  /**
+   * True if the silence around the active region of each reference is
+   * trimmed before comparing.
+   */
+  bool trim_silence = false;
+
+  /**
+   * The directory watched for degraded files, which are compared as they are
+   * written. Optional.
+   */
+  FilePath watch_dir;
+
+  /**
+   * The rule that names the reference of each watched degraded file.
+   */
+  WatchNamingRule watch_naming_rule;
+
+  /**
+   * The number of watched files that may wait to be compared.
+   */
+  size_t watch_queue_size = 256;
+
+  /**
+   * The time in seconds without new files after which watching stops, or 0
+   * to watch until interrupted.
+   */
+  double watch_idle_timeout_seconds = 0.0;
+
+  /**
+   * The size in bytes from which intermediate buffers are spilled to memory
+   * mapped files, or 0 to never spill them.
+   */
+  size_t spill_threshold_bytes = 0;
+
+  /**
+   * The directory that spilled buffers are created in. Optional.
+   */
+  FilePath spill_dir;
+
+  /**
+   * The reference feature cache to use: empty for none, kLocalReferenceCache
+   * for a cache in memory only, or the host:port of a shared cache server.
+   */
+  std::string reference_cache;
+
+  /**
+   * The size in bytes of the in-memory reference feature cache.
+   */
+  size_t reference_cache_local_bytes = 0;
+
+  /**
+   * True if the patch search measures every candidate instead of pruning.
+   */
+  bool exhaustive_patch_search = false;
+
+  /**
+   * The file holding the secret that signs the entries on the reference
+   * cache server.
+   */
+  FilePath reference_cache_secret_file;
+
   /**
    * Constructs the parsed command line args struct.
    */
@@ -106,7 +280,36 @@ struct CommandLineArgs {
                      const FilePath &out_csv, const FilePath &batch_in,
                      const bool verbose_mode, const FilePath &debug_out,
                      const bool use_speech, const bool use_unscaled_speech,
-                     const int search_window )
+                     const int search_window, const bool autotune_mode = false,
+                     const FilePath &tuning_profile = FilePath(),
+                     const double fine_align_skip_threshold =
+                         std::numeric_limits<double>::infinity(),
+                     const bool approx_fine_align_at_zero_lag = false,
+                     const FilePath &out_arrow = FilePath(),
+                     const FilePath &patch_out_arrow = FilePath(),
+                     const FilePath &cost_model = FilePath(),
+                     const FilePath &progress_out = FilePath(),
+                     const double progress_interval = 10.0,
+                     const FilePath &timeline_csv = FilePath(),
+                     const double timeline_window = 10.0,
+                     const double timeline_hop = 1.0,
+                     const absl::optional<FeatureStage> &features =
+                         absl::nullopt,
+                     const FilePath &features_dir = FilePath(),
+                     const size_t features_per_shard = 256,
+                     const int zstd_level = 0,
+                     const double pair_cpu_time_limit = 0.0,
+                     const bool trim_silence_mode = false,
+                     const FilePath &watch_directory = FilePath(),
+                     const WatchNamingRule &naming_rule = WatchNamingRule(),
+                     const size_t watch_queue_capacity = 256,
+                     const double watch_idle_timeout = 0.0,
+                     const size_t spill_threshold = 0,
+                     const FilePath &spill_directory = FilePath(),
+                     const std::string &reference_cache_address = "",
+                     const size_t reference_cache_local_size = 0,
+                     const bool exhaustive_search = false,
+                     const FilePath &reference_cache_secret = FilePath())
       : reference_signal_path{ref_sig},
         degraded_signal_path{deg_sig},
         sim_to_quality_mapper_model{sim_to_qual_mapper},
@@ -116,7 +319,35 @@ struct CommandLineArgs {
         verbose{verbose_mode},
         use_speech_mode{use_speech},
         use_unscaled_speech_mos_mapping{use_unscaled_speech},
-        search_window_radius{search_window} {}
+        search_window_radius{search_window},
+        autotune{autotune_mode},
+        tuning_profile_path{tuning_profile},
+        fine_alignment_skip_threshold{fine_align_skip_threshold},
+        approximate_fine_alignment_at_zero_lag{approx_fine_align_at_zero_lag},
+        results_output_arrow{out_arrow},
+        patch_results_output_arrow{patch_out_arrow},
+        cost_model_path{cost_model},
+        progress_output_path{progress_out},
+        progress_interval_seconds{progress_interval},
+        timeline_output_csv{timeline_csv},
+        timeline_window_seconds{timeline_window},
+        timeline_hop_seconds{timeline_hop},
+        feature_stage{features},
+        features_output_dir{features_dir},
+        features_pairs_per_shard{features_per_shard},
+        compression_level{zstd_level},
+        pair_cpu_time_limit_seconds{pair_cpu_time_limit},
+        trim_silence{trim_silence_mode},
+        watch_dir{watch_directory},
+        watch_naming_rule{naming_rule},
+        watch_queue_size{watch_queue_capacity},
+        watch_idle_timeout_seconds{watch_idle_timeout},
+        spill_threshold_bytes{spill_threshold},
+        spill_dir{spill_directory},
+        reference_cache{reference_cache_address},
+        reference_cache_local_bytes{reference_cache_local_size},
+        exhaustive_patch_search{exhaustive_search},
+        reference_cache_secret_file{reference_cache_secret} {}
 
   /**
    * Public no-args constructor needed for StatusOr.
@@ -164,7 +395,10 @@ class VisqolCommandLineParser {
 
   /**
    * Parses a batch CSV file to return a vector of file path pairs
-   * for comparison.
+   * for comparison. The columns are found by name in the header. Besides
+   * the reference and degraded columns, optional mode, model and
+   * search_window_radius columns give settings for each pair, where not
+   * empty. Rows with invalid settings are skipped.
    *
    * @param batch_input_path The path to the batch CSV file.
    *
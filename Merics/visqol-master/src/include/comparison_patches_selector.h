@@ -17,31 +17,124 @@
 #ifndef VISQOL_INCLUDE_COMPARISON_PATCHES_SELECTOR_H
 #define VISQOL_INCLUDE_COMPARISON_PATCHES_SELECTOR_H
 
+#include <functional>
+#include <limits>
 #include <memory>
 #include <vector>
 
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 
 #include "amatrix.h"
+#include "cancellation_token.h"
 #include "image_patch_creator.h"
+#include "lazy_spectrogram_pair.h"
 #include "patch_similarity_comparator.h"
+#include "patch_similarity_table.h"
 #include "spectrogram_builder.h"
+#include "spill_storage.h"
 
 namespace Visqol {
 struct PatchSimilarityResult;
 
+/**
+ * This struct controls which matched patches are finely aligned by
+ * ComparisonPatchesSelector::FinelyAlignAndRecreatePatches. Skipping fine
+ * alignment keeps the coarse match for that patch, which saves rebuilding its
+ * spectrograms but may lower its similarity slightly. The default policy
+ * finely aligns every patch.
+ */
+struct FineAlignmentPolicy {
+  /**
+   * Patches with a coarse similarity above this threshold are not finely
+   * aligned.
+   */
+  double skip_similarity_threshold = std::numeric_limits<double>::infinity();
+
+  /**
+   * If true, patches whose local alignment lag is zero samples keep their
+   * coarse match instead of having their spectrograms rebuilt. This is an
+   * approximation, not an exact shortcut: fine alignment rebuilds the
+   * spectrograms from the patch audio alone, which changes the similarity
+   * of a patch even when it is not shifted.
+   */
+  bool approximate_zero_lag = false;
+};
+
+/**
+ * This struct controls how ComparisonPatchesSelector::FindMostOptimalDegPatches
+ * searches for the best matching. The default policy prunes the search.
+ */
+struct PatchSearchPolicy {
+  /**
+   * If true, degraded patch candidates that cannot be part of the best
+   * matching are skipped, using the similarity upper bound of the comparator.
+   * The pruning is exact, so disabling it only serves to compare against the
+   * exhaustive search.
+   */
+  bool prune = true;
+};
+
+/**
+ * This struct counts the outcome of fine alignment over a set of patches.
+ */
+struct FineAlignmentStats {
+  /**
+   * The number of patches that were finely aligned and re-measured.
+   */
+  size_t num_refined = 0;
+
+  /**
+   * The number of matched patches for which fine alignment was skipped due to
+   * the FineAlignmentPolicy.
+   */
+  size_t num_skipped = 0;
+};
+
+/**
+ * This struct counts the work done by the patch search in
+ * ComparisonPatchesSelector::FindMostOptimalDegPatches.
+ */
+struct PatchSearchStats {
+  /**
+   * The number of degraded patch candidates whose similarity to a reference
+   * patch was measured.
+   */
+  size_t num_candidates_evaluated = 0;
+
+  /**
+   * The number of degraded patch candidates that were skipped because they
+   * could not be part of the best matching.
+   */
+  size_t num_candidates_pruned = 0;
+};
+
 /**
  * This class is used for creating and comparing patches from the degraded
  * spectrogram with a given set of reference patches.
  */
 class ComparisonPatchesSelector {
  public:
+  /**
+   * The slack added to the similarity upper bound of each patch when pruning
+   * the patch search, which absorbs floating point rounding.
+   */
+  static const double kPruningTolerance;
+
   /**
    * Constructor that takes a patch similarity comparator for performing the
    * patch comparison.
+   *
+   * @param sim_comparator The patch similarity comparator.
+   * @param fine_alignment_policy The policy that controls which patches are
+   *    finely aligned.
+   * @param patch_search_policy The policy that controls how the patch search
+   *    is pruned.
    */
   ComparisonPatchesSelector(
-      std::unique_ptr<PatchSimilarityComparator> sim_comparator);
+      std::unique_ptr<PatchSimilarityComparator> sim_comparator,
+      const FineAlignmentPolicy &fine_alignment_policy = FineAlignmentPolicy(),
+      const PatchSearchPolicy &patch_search_policy = PatchSearchPolicy());
 
   /**
    * For each patch provided (from the reference spectrogram) find the most
@@ -61,6 +154,16 @@ class ComparisonPatchesSelector {
    *    should search to discover patch matches. For a given reference frame,
    *    one looks at 2*search_window_radius + 1 patches to find the most
    *    optimal match.
+   * @param stats If not null, the number of evaluated and pruned patch
+   *    candidates are added to this.
+   * @param cancellation If not null, the search stops with a status of
+   *    deadline exceeded once this token is cancelled. It is checked before
+   *    each reference patch is matched.
+   *
+   * If the patch similarity comparator provides a finite MaxSimilarity, then
+   * candidates that cannot be part of the best matching are pruned without
+   * measuring their similarity. The pruning is exact, so the results are
+   * identical to an exhaustive search.
    *
    * @return A vector of similarity results. Each similary result is the result
    *    of the comparison between a patch from the reference spectrogram with
@@ -71,7 +174,39 @@ class ComparisonPatchesSelector {
       const std::vector<size_t> &ref_patch_indices,
       const AMatrix<double> &spectrogram_data,
       const double frame_duration,
-      const int search_window_radius) const;
+      const int search_window_radius,
+      PatchSearchStats *stats = nullptr,
+      const CancellationToken *cancellation = nullptr) const;
+
+  /**
+   * As above, except that the degraded spectrogram is computed lazily. Only
+   * the degraded columns that fall within the search window of at least one
+   * reference patch are computed.
+   *
+   * @param ref_patches A vector containing all of the patches created from the
+   *    reference spectrogram.
+   * @param ref_patch_indices The indices for the set of reference patches.
+   * @param spectrograms The lazily computed reference and degraded
+   *    spectrograms.
+   * @param frame_duration The duration of the frame in seconds.
+   * @param search_window_radius The parameter that determines how far you
+   *    should search to discover patch matches.
+   * @param stats If not null, the number of evaluated and pruned patch
+   *    candidates are added to this.
+   * @param cancellation If not null, the search stops with a status of
+   *    deadline exceeded once this token is cancelled.
+   *
+   * @return A vector of similarity results, identical to those returned when
+   *    the full degraded spectrogram is provided.
+   */
+  absl::StatusOr<std::vector<PatchSimilarityResult>> FindMostOptimalDegPatches(
+      const std::vector<ImagePatch> &ref_patches,
+      const std::vector<size_t> &ref_patch_indices,
+      LazySpectrogramPair *spectrograms,
+      const double frame_duration,
+      const int search_window_radius,
+      PatchSearchStats *stats = nullptr,
+      const CancellationToken *cancellation = nullptr) const;
 
   /**
    * Given roughly aligned ref/deg patches, realign the original audio within
@@ -84,19 +219,72 @@ class ComparisonPatchesSelector {
    *    PatchSimilarityResults.
    * @param spect_builder A pointer to a SpectrogramBuilder.
    * @param window An AnalysisWindow used to create the spectrogram
+   * @param stats If not null, the counts of refined and skipped patches are
+   *    added to this.
+   * @param cancellation If not null, the alignment stops with a status of
+   *    deadline exceeded once this token is cancelled. It is checked before
+   *    each patch is aligned.
    *
-   * @return A StatusOr that may contain a vector of new, finely aligned
-   *    PatchSimilarityResults.
+   * @return A StatusOr that may contain a table of the new, finely aligned
+   *    results, in the order of sim_results.
    */
-  absl::StatusOr<std::vector<PatchSimilarityResult>>
+  absl::StatusOr<PatchSimilarityTable>
       FinelyAlignAndRecreatePatches(
           const std::vector<PatchSimilarityResult>& sim_results,
           const AudioSignal &ref_signal,
           const AudioSignal &deg_signal,
           SpectrogramBuilder *spect_builder,
-          const AnalysisWindow &window) const;
+          const AnalysisWindow &window,
+          FineAlignmentStats *stats = nullptr,
+          const CancellationToken *cancellation = nullptr) const;
 
  private:
+  /**
+   * The state used to prune the patch search. A cumulative similarity score
+   * is pruned if, even with a perfect similarity for every remaining
+   * reference patch, it cannot reach the lower bound on the best final score.
+   */
+  struct PatchSearchPruning {
+    /**
+     * True if the comparator provides a finite similarity upper bound.
+     */
+    bool enabled = false;
+
+    /**
+     * The upper bound on the similarity of a single patch comparison.
+     */
+    double max_similarity = 0.0;
+
+    /**
+     * The number of reference patches being matched.
+     */
+    size_t num_patches = 0;
+
+    /**
+     * A lower bound on the final cumulative similarity score of the best
+     * matching found so far.
+     */
+    double score_lower_bound = std::numeric_limits<double>::lowest();
+
+    /**
+     * For each reference patch, the range of degraded offsets that are also
+     * searched for every later reference patch. The cumulative score at these
+     * offsets is carried forward to the final patch, so it is a lower bound on
+     * the final score.
+     */
+    std::vector<int> carried_first_offset;
+
+    /**
+     * The inclusive end of the range described by carried_first_offset.
+     */
+    std::vector<int> carried_last_offset;
+
+    /**
+     * The number of evaluated and pruned candidates.
+     */
+    PatchSearchStats stats;
+  };
+
   /**
    * Extract a subregion of an audio signal.
    *
@@ -129,6 +317,26 @@ class ComparisonPatchesSelector {
                                 size_t window_height, size_t window_width)
                                 const;
 
+  /**
+   * Shared implementation of the FindMostOptimalDegPatches overloads.
+   *
+   * @param ensure_columns Called with an inclusive range of degraded
+   *    spectrogram columns before they are read from spectrogram_data.
+   * @param stats If not null, the number of evaluated and pruned patch
+   *    candidates are added to this.
+   * @param cancellation If not null, the search stops once this token is
+   *    cancelled.
+   */
+  absl::StatusOr<std::vector<PatchSimilarityResult>> FindMostOptimalDegPatches(
+      const std::vector<ImagePatch> &ref_patches,
+      const std::vector<size_t> &ref_patch_indices,
+      const AMatrix<double> &spectrogram_data,
+      const double frame_duration,
+      const int search_window_radius,
+      const std::function<absl::Status(size_t, size_t)> &ensure_columns,
+      PatchSearchStats *stats,
+      const CancellationToken *cancellation) const;
+
   /**
    * For a given patch from the reference spectrogram, find the most optimal
    * degraded patch, such that it maximizes the cumulative similarity score
@@ -148,9 +356,10 @@ class ComparisonPatchesSelector {
    *    signal.
    * @param ref_patch The reference patch to find the best match for.
    * @param cumulative_similarity_dp A 2D array to record the cumulative
-   *    similarity scores from reference patches to degraded patches.
+   *    similarity scores from reference patches to degraded patches, which is
+   *    spilled to disk for long inputs.
    * @param backtrace A 2D array to record the matching patch information of
-   *    previous patch indices.
+   *    previous patch indices, which is spilled to disk for long inputs.
    * @param ref_patch_indices The indices for the set of reference patches. Each
    *    index corresponds to the index of the column in the reference
    *    spectrogram where this patch starts from.
@@ -159,6 +368,8 @@ class ComparisonPatchesSelector {
    * @param search_window The search space parameter that determines how far you
    *    should search in to discover patch matches. For a given reference frame,
    *    one looks at 2*search_window + 1 frames to find the most optimal match.
+   * @param pruning The pruning state, which is updated with the scores found
+   *    for this reference patch.
    *
    * @return The function returns nothing. It's purpose is to populate the
    *    cumulative_similarity_dp and backtrace vectors.
@@ -166,10 +377,10 @@ class ComparisonPatchesSelector {
   void FindMostOptimalDegPatch(
       const AMatrix<double> &spectrogram_data, const ImagePatch &ref_patch,
       std::vector<ImagePatch> &deg_patches,
-      std::vector<std::vector<double>> &cumulative_similarity_dp,
-      std::vector<std::vector<int>> &backtrace,
+      SpillableTable<double> &cumulative_similarity_dp,
+      SpillableTable<int> &backtrace,
       const std::vector<size_t> &ref_patch_indices, int patch_index,
-      const int search_window) const;
+      const int search_window, PatchSearchPruning &pruning) const;
 
   /**
    * Calculate the maximum number of patches that the degraded spectrogram can
@@ -198,6 +409,16 @@ class ComparisonPatchesSelector {
    * The patch comparator to use for comparisons.
    */
   const std::unique_ptr<PatchSimilarityComparator> sim_comparator_;
+
+  /**
+   * The policy that controls which patches are finely aligned.
+   */
+  const FineAlignmentPolicy fine_alignment_policy_;
+
+  /**
+   * The policy that controls how the patch search is pruned.
+   */
+  const PatchSearchPolicy patch_search_policy_;
 };
 }  // namespace Visqol
 
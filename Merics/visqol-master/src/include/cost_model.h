@@ -0,0 +1,209 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_COST_MODEL_H
+#define VISQOL_INCLUDE_COST_MODEL_H
+
+#include <array>
+#include <cstddef>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+#include "file_path.h"
+
+namespace Visqol {
+
+/**
+ * The properties of a file pair that determine how long it takes to compare.
+ * All of them are read from the WAV headers.
+ */
+struct PairCostFeatures {
+  /**
+   * The duration of the reference signal in seconds.
+   */
+  double reference_duration = 0.0;
+
+  /**
+   * The duration of the degraded signal in seconds.
+   */
+  double degraded_duration = 0.0;
+
+  /**
+   * The sample rate of the reference signal in Hz.
+   */
+  int sample_rate = 0;
+
+  /**
+   * The number of channels of the reference signal.
+   */
+  size_t num_channels = 0;
+};
+
+/**
+ * This class predicts the time taken to compare a file pair, so that a batch
+ * can start its longest pairs first and estimate the time remaining.
+ *
+ * The prediction is a linear model of a fixed cost, the number of samples
+ * filtered (after the downmix to mono), the square of the duration (the
+ * global alignment and patch search grow faster than linearly), and the
+ * number of patch search candidates. The coefficients start at values
+ * measured on a single core, and are calibrated with the measured time of
+ * each comparison. The calibration is kept separately for the audio and
+ * speech modes, and can be persisted between runs.
+ *
+ * This class is not thread safe.
+ */
+class CostModel {
+ public:
+  /**
+   * The number of terms in the linear model.
+   */
+  static const size_t kNumTerms = 4;
+
+  /**
+   * The version of the cost model file format.
+   */
+  static const int kFormatVersion;
+
+  /**
+   * The smallest cost (in seconds) that is ever predicted.
+   */
+  static const double kMinPredictedSeconds;
+
+  /**
+   * Read the cost features of a file pair from the WAV headers, without
+   * reading the audio.
+   *
+   * @param reference The path to the reference audio file.
+   * @param degraded The path to the degraded audio file.
+   *
+   * @return The cost features, or an error status if a header could not be
+   *    read. The headers of pipes and standard input are never read, as the
+   *    comparison could then not read them again.
+   */
+  static absl::StatusOr<PairCostFeatures> ReadFeatures(
+      const FilePath &reference, const FilePath &degraded);
+
+  /**
+   * Constructs an uncalibrated cost model for the given comparison settings.
+   *
+   * @param use_speech_mode If true, the pairs are compared in speech mode.
+   * @param search_window The search window radius of the patch search.
+   */
+  CostModel(bool use_speech_mode, int search_window);
+
+  /**
+   * Load the calibration from a cost model file written by Write.
+   *
+   * @param path The path to the cost model file.
+   *
+   * @return An error status if the file could not be read or is malformed.
+   */
+  absl::Status Read(const FilePath &path);
+
+  /**
+   * Write the calibration to a cost model file, replacing any existing
+   * contents.
+   *
+   * @param path The path to the cost model file.
+   *
+   * @return An error status if the file could not be written.
+   */
+  absl::Status Write(const FilePath &path) const;
+
+  /**
+   * Predict the time taken to compare a file pair.
+   *
+   * @param features The cost features of the pair.
+   *
+   * @return The predicted time in seconds.
+   */
+  double Predict(const PairCostFeatures &features) const;
+
+  /**
+   * Calibrate the model with the measured time of a comparison.
+   *
+   * @param features The cost features of the compared pair.
+   * @param seconds The time taken to compare the pair.
+   */
+  void AddObservation(const PairCostFeatures &features, double seconds);
+
+  /**
+   * @return The number of comparisons the current mode is calibrated with.
+   */
+  size_t NumObservations() const;
+
+ private:
+  /**
+   * The accumulated normal equations of the least squares fit for one mode.
+   */
+  struct Calibration {
+    /**
+     * The sum of the outer products of the terms.
+     */
+    std::array<std::array<double, kNumTerms>, kNumTerms> xtx{};
+
+    /**
+     * The sum of the terms scaled by the measured time.
+     */
+    std::array<double, kNumTerms> xty{};
+
+    /**
+     * The number of observations accumulated.
+     */
+    size_t num_observations = 0;
+  };
+
+  /**
+   * Compute the terms of the linear model for a file pair.
+   *
+   * @param features The cost features of the pair.
+   *
+   * @return The terms.
+   */
+  std::array<double, kNumTerms> Terms(const PairCostFeatures &features) const;
+
+  /**
+   * Fit the coefficients to the calibration of the current mode. The
+   * uncalibrated coefficients act as a prior, so that a term that the
+   * observations do not vary keeps its default coefficient.
+   */
+  void Refit();
+
+  /**
+   * If true, the pairs are compared in speech mode.
+   */
+  bool use_speech_mode_;
+
+  /**
+   * The search window radius of the patch search.
+   */
+  int search_window_;
+
+  /**
+   * The calibration of the audio mode (0) and the speech mode (1).
+   */
+  std::array<Calibration, 2> calibrations_;
+
+  /**
+   * The coefficients of the terms for the current mode.
+   */
+  std::array<double, kNumTerms> coefficients_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_COST_MODEL_H
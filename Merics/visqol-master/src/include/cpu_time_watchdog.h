@@ -0,0 +1,157 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_CPU_TIME_WATCHDOG_H
+#define VISQOL_INCLUDE_CPU_TIME_WATCHDOG_H
+
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+#include "cancellation_token.h"
+
+namespace Visqol {
+
+/**
+ * This class limits the CPU time each comparison of a batch may use.
+ *
+ * Each worker registers its current comparison with the watchdog, along with
+ * a cancellation token. A background thread reads the CPU clock of each
+ * worker thread, and cancels the comparisons that have used more than the
+ * limit, which then stop at their next check of the token. Measuring CPU
+ * time rather than wall time means that a comparison is not cancelled for
+ * being starved of CPU by the rest of the batch.
+ *
+ * Where the CPU clock of a thread cannot be read by another thread, the wall
+ * time of the comparison is used instead.
+ */
+class CpuTimeWatchdog {
+ public:
+  /**
+   * The longest time between two checks of the running comparisons.
+   */
+  static const double kMaxPollIntervalSeconds;
+
+  /**
+   * @return The CPU time used by the calling thread in seconds, or the time
+   *    on a steady clock where the thread's CPU time is not available.
+   */
+  static double ThreadCpuSeconds();
+
+  /**
+   * Constructs a watchdog with the given limit. No thread is started until
+   * Start is called.
+   *
+   * @param limit_seconds The CPU time in seconds each comparison may use.
+   */
+  explicit CpuTimeWatchdog(double limit_seconds);
+
+  CpuTimeWatchdog(const CpuTimeWatchdog &) = delete;
+  CpuTimeWatchdog &operator=(const CpuTimeWatchdog &) = delete;
+
+  /**
+   * Stops the watchdog, if it is running.
+   */
+  ~CpuTimeWatchdog();
+
+  /**
+   * Start watching, with no comparisons registered. Must be followed by a
+   * call to Stop.
+   *
+   * @param num_workers The number of workers that may register comparisons.
+   */
+  void Start(size_t num_workers);
+
+  /**
+   * Register the comparison a worker is about to run. Must be called from
+   * the worker's own thread, whose CPU time is then measured from now.
+   *
+   * @param worker The index of the worker.
+   * @param token The token that is cancelled if the comparison exceeds the
+   *    limit. Must remain valid until Unwatch is called.
+   */
+  void Watch(size_t worker, CancellationToken *token);
+
+  /**
+   * Stop watching a worker's comparison. Once this returns, the watchdog no
+   * longer uses the worker's token.
+   *
+   * @param worker The index of the worker.
+   */
+  void Unwatch(size_t worker);
+
+  /**
+   * Stop the watchdog thread.
+   */
+  void Stop();
+
+ private:
+  /**
+   * The comparison currently run by a worker.
+   */
+  struct WatchedComparison {
+    /**
+     * The token of the comparison, or null if the worker is idle.
+     */
+    CancellationToken *token = nullptr;
+
+    /**
+     * Returns the CPU time in seconds used by the worker thread.
+     */
+    std::function<double()> cpu_seconds;
+
+    /**
+     * The CPU time used by the worker thread when the comparison started.
+     */
+    double start_cpu_seconds = 0.0;
+  };
+
+  /**
+   * Cancel the comparisons that exceed the limit until the watchdog stops.
+   */
+  void WatchLoop();
+
+  /**
+   * The CPU time in seconds each comparison may use.
+   */
+  double limit_seconds_;
+
+  /**
+   * Checks the running comparisons.
+   */
+  std::thread watch_thread_;
+
+  /**
+   * Guards the members below.
+   */
+  absl::Mutex mutex_;
+
+  /**
+   * True once Stop is called, which stops the watchdog thread.
+   */
+  bool stopping_ = false;
+
+  /**
+   * The comparison of each worker.
+   */
+  std::vector<WatchedComparison> workers_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_CPU_TIME_WATCHDOG_H
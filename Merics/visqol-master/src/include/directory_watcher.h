@@ -0,0 +1,339 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_DIRECTORY_WATCHER_H
+#define VISQOL_INCLUDE_DIRECTORY_WATCHER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+
+#include "file_path.h"
+
+namespace Visqol {
+
+/**
+ * The rule that matches a degraded file to its reference by name.
+ */
+struct WatchNamingRule {
+  /**
+   * The directory that holds the references.
+   */
+  FilePath reference_dir;
+
+  /**
+   * The pattern that degraded file names must match, where a single '*'
+   * matches any text, e.g. "transcoded_*.wav".
+   */
+  std::string degraded_pattern = "*.wav";
+
+  /**
+   * The name of the reference, where '*' is replaced by the text it matched
+   * in the degraded file name, e.g. "*.wav".
+   */
+  std::string reference_pattern = "*.wav";
+};
+
+/**
+ * This class watches a directory for degraded files, and queues each one
+ * with its reference for comparison as soon as it has been written.
+ *
+ * A file is picked up when a write to it is closed, or when it is moved into
+ * the directory, so a writer that renames its files into place once complete
+ * is always safe. The reference of each file is given by a sidecar file of
+ * the same name with kSidecarExtension appended, if there is one when the
+ * file is picked up, which holds the path of the reference on its first
+ * line, relative to the watched directory unless absolute. Otherwise, the
+ * reference is named by the naming rule. Files that match neither are
+ * ignored.
+ *
+ * The queue of pairs is bounded, so a burst of files cannot grow it without
+ * limit. While the queue is full the watcher stops reading events, which the
+ * kernel buffers. If the kernel's buffer overflows, the directory is scanned
+ * for the files that have not been queued before, and were not already there
+ * when watching started. As the events that marked them complete were lost,
+ * a file found by the scan is only queued once it has not been modified for
+ * kRescanSettleSeconds, so a file that is still being written is not
+ * compared early. A file that is rewritten after it has been queued is only
+ * queued again by its own event, not by a scan.
+ *
+ * So that a long watch does not grow without limit, the watcher only
+ * remembers the names of the files that were in the directory when watching
+ * started, and of the last kRecentNamesCapacity files queued. A scan treats a
+ * file it does not remember as queued if it was last modified no later than
+ * a file that has been forgotten.
+ *
+ * Watching is only supported on Linux, where inotify is used.
+ */
+class DirectoryWatcher {
+ public:
+  /**
+   * The extension of the sidecar file naming the reference of a degraded
+   * file.
+   */
+  static const char kSidecarExtension[];
+
+  /**
+   * The default number of pairs that may be queued.
+   */
+  static const size_t kDefaultQueueCapacity;
+
+  /**
+   * The longest time between two checks for a request to stop.
+   */
+  static const double kPollIntervalSeconds;
+
+  /**
+   * The time in seconds a file found by a rescan must go unmodified before it
+   * is queued.
+   */
+  static const double kRescanSettleSeconds;
+
+  /**
+   * The number of the most recently queued files whose names are remembered.
+   */
+  static const size_t kRecentNamesCapacity;
+
+  /**
+   * Check that a naming rule can name the reference of a watched file. A rule
+   * that looks in the watched directory with the same pattern for degraded
+   * and reference files names every file as its own reference, so that only
+   * the files with a sidecar would ever be compared.
+   *
+   * @param degraded_dir The directory to watch for degraded files.
+   * @param naming_rule The rule that names the reference of each degraded
+   *    file without a sidecar file.
+   *
+   * @return An error status if the rule names every file as its own
+   *    reference.
+   */
+  static absl::Status ValidateNamingRule(const FilePath &degraded_dir,
+                                         const WatchNamingRule &naming_rule);
+
+  /**
+   * Constructs a watcher. The directory is not watched until Start is
+   * called.
+   *
+   * @param degraded_dir The directory to watch for degraded files.
+   * @param naming_rule The rule that names the reference of each degraded
+   *    file without a sidecar file.
+   * @param queue_capacity The number of pairs that may be queued. A value of
+   *    0 is treated as 1.
+   * @param idle_timeout_seconds If greater than 0, stop watching once no
+   *    file has been written for this long.
+   */
+  DirectoryWatcher(const FilePath &degraded_dir,
+                   const WatchNamingRule &naming_rule,
+                   size_t queue_capacity = kDefaultQueueCapacity,
+                   double idle_timeout_seconds = 0.0);
+
+  DirectoryWatcher(const DirectoryWatcher &) = delete;
+  DirectoryWatcher &operator=(const DirectoryWatcher &) = delete;
+
+  /**
+   * Stops watching, if the watcher is running.
+   */
+  ~DirectoryWatcher();
+
+  /**
+   * Start watching the directory. Files already in the directory are not
+   * queued, unless a write to them is closed or they are replaced after
+   * watching starts.
+   *
+   * @return An error status if the directory could not be watched.
+   */
+  absl::Status Start();
+
+  /**
+   * Take the next pair from the queue, waiting until there is one. May be
+   * called from many threads at once.
+   *
+   * @return The next pair, or nullopt once the watcher has stopped and the
+   *    queue is empty.
+   */
+  absl::optional<ReferenceDegradedPathPair> Next();
+
+  /**
+   * Ask the watcher to stop, which it does within kPollIntervalSeconds. The
+   * pairs already queued are still returned by Next. Safe to call from a
+   * signal handler.
+   */
+  void RequestStop();
+
+  /**
+   * Stop watching, and wait for the watcher thread to finish.
+   */
+  void Stop();
+
+  /**
+   * Find the reference of a degraded file in the watched directory, from its
+   * sidecar file or the naming rule.
+   *
+   * @param file_name The name of the degraded file.
+   *
+   * @return The pair to compare, a status of not found if the file matches
+   *    neither, or a status of failed precondition if its reference does not
+   *    exist or is the file itself.
+   */
+  absl::StatusOr<ReferenceDegradedPathPair> Match(
+      const std::string &file_name) const;
+
+ private:
+  /**
+   * Queue the files written to the directory until the watcher is stopped.
+   */
+  void WatchLoop();
+
+  /**
+   * Queue the files in the directory that have not been queued before, or
+   * mark them as unsettled if they were modified too recently.
+   */
+  void Rescan();
+
+  /**
+   * Queue the unsettled files that have not been modified for
+   * kRescanSettleSeconds.
+   */
+  void QueueSettledFiles();
+
+  /**
+   * @param file_name The name of a file in the watched directory.
+   *
+   * @return True if the file has not been modified for kRescanSettleSeconds.
+   */
+  bool IsSettled(const std::string &file_name) const;
+
+  /**
+   * @param file_name The name of a file in the watched directory.
+   *
+   * @return True if the file was in the directory when watching started, or
+   *    has been queued since, as far as the watcher remembers.
+   */
+  bool WasQueued(const std::string &file_name) const;
+
+  /**
+   * Remember that a file has been queued, forgetting the oldest queued file
+   * once kRecentNamesCapacity are remembered.
+   *
+   * @param file_name The name of the file in the watched directory.
+   */
+  void RememberQueued(const std::string &file_name);
+
+  /**
+   * Match a file to its reference and queue it, waiting while the queue is
+   * full. Files that do not match are skipped.
+   *
+   * @param file_name The name of the file in the watched directory.
+   */
+  void Enqueue(const std::string &file_name);
+
+  /**
+   * The directory watched for degraded files.
+   */
+  FilePath degraded_dir_;
+
+  /**
+   * Names the reference of each degraded file without a sidecar file.
+   */
+  WatchNamingRule naming_rule_;
+
+  /**
+   * The number of pairs that may be queued.
+   */
+  size_t queue_capacity_;
+
+  /**
+   * The time without new files after which watching stops, or 0 to watch
+   * until stopped.
+   */
+  double idle_timeout_seconds_;
+
+  /**
+   * The inotify instance, or -1 if not watching.
+   */
+  int inotify_fd_ = -1;
+
+  /**
+   * Reads the events of the directory.
+   */
+  std::thread watch_thread_;
+
+  /**
+   * Set by RequestStop. Not guarded by the mutex, so that a signal handler
+   * may set it.
+   */
+  std::atomic<bool> stop_requested_{false};
+
+  /**
+   * The names of the files that were in the directory when watching started,
+   * which a rescan skips. Only used by the watcher thread.
+   */
+  std::set<std::string> existing_names_;
+
+  /**
+   * The last kRecentNamesCapacity files queued, with their modification
+   * times in nanoseconds when queued, from the oldest. Only used by the
+   * watcher thread.
+   */
+  std::deque<std::pair<std::string, int64_t>> recent_queued_;
+
+  /**
+   * The number of times each file is in recent_queued_, which a rescan
+   * skips. Only used by the watcher thread.
+   */
+  std::map<std::string, size_t> recent_names_;
+
+  /**
+   * The latest modification time in nanoseconds of a queued file that has
+   * been forgotten, or 0 if none has. Only used by the watcher thread.
+   */
+  int64_t forgotten_modified_nanos_ = 0;
+
+  /**
+   * The names of the files found by a rescan that are waiting to settle.
+   * Only used by the watcher thread.
+   */
+  std::set<std::string> unsettled_names_;
+
+  /**
+   * Guards the members below.
+   */
+  absl::Mutex mutex_;
+
+  /**
+   * True once the watcher thread has stopped reading events.
+   */
+  bool stopped_ = false;
+
+  /**
+   * The pairs waiting to be compared.
+   */
+  std::deque<ReferenceDegradedPathPair> queue_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_DIRECTORY_WATCHER_H
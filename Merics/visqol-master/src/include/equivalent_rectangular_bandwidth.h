@@ -62,7 +62,39 @@ class EquivalentRectangularBandwidth {
   static ErbFiltersResult MakeFilters(std::size_t sample_rate,
       std::size_t num_channels, double low_freq, double high_freq);
 
+  /**
+   * As MakeFilters, but the center frequencies do not depend on the sample
+   * rate, so that each band covers the same frequencies at any sample rate.
+   * A band whose center frequency is not below half the sampling rate cannot
+   * be filtered, so is given filter coefficients that pass nothing: all zero,
+   * apart from a unit denominator and gain.
+   *
+   * @param sample_rate The sample rate of the input signals.
+   * @param num_channels The number of frequency bands desired in the filter
+   *    set.
+   * @param low_freq The value of the lowest center frequency to use in the
+   *    filter set.
+   * @param high_freq The value of the highest center frequency to use in the
+   *    filter set.
+   *
+   * @return The resulting ERB center frequencies and filter coefficients.
+   */
+  static ErbFiltersResult MakeFixedFilters(std::size_t sample_rate,
+      std::size_t num_channels, double low_freq, double high_freq);
+
  private:
+  /**
+   * Calculate the filter coefficients for the given center frequencies, which
+   * must all be below half the sampling rate.
+   *
+   * @param sample_rate The sample rate of the input signals.
+   * @param center_freqs The center frequency of each band.
+   *
+   * @return The resulting ERB center frequencies and filter coefficients.
+   */
+  static ErbFiltersResult MakeFiltersForCenterFreqs(std::size_t sample_rate,
+      const std::vector<double> &center_freqs);
+
   /**
    * Compute N center frequencies that are uniformly spaced between the given
    * highest frequency and the given lowest frequency on an ERB scale.
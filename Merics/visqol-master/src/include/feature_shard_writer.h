@@ -0,0 +1,337 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_FEATURE_SHARD_WRITER_H
+#define VISQOL_INCLUDE_FEATURE_SHARD_WRITER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+
+#include "file_path.h"
+#include "similarity_result.h"
+#include "similarity_result.pb.h"  // Generated by cc_proto_library rule
+
+namespace Visqol {
+
+/**
+ * The stage of the ViSQOL pipeline that features are extracted from.
+ */
+enum class FeatureStage {
+  /**
+   * The prepared reference and degraded spectrograms. The patch search is not
+   * run.
+   */
+  kSpectrogram,
+
+  /**
+   * The similarity of each matched patch, along with the FVNSIM features of
+   * the pair.
+   */
+  kPatches,
+
+  /**
+   * The FVNSIM, FSTDNSIM and FVDEGENERGY features of the pair.
+   */
+  kFvnsim,
+};
+
+/**
+ * This class writes the features extracted from a batch of file pairs to
+ * shards of NumPy .npy files, which numpy can load or memory map directly.
+ *
+ * The pairs are split into shards of consecutive pairs. Each array of a shard
+ * is written to its own file, named shard-NNNNN.<array>.npy, as little endian
+ * doubles in C order:
+ *  - kSpectrogram: ref_spectrogram and deg_spectrogram, with a row for each
+ *    frame and a column for each band. The frames of the pairs of the shard
+ *    are concatenated in pair order.
+ *  - kPatches: patch_freq_band_means with a row for each patch and a column
+ *    for each band, patch_times with the reference start, reference end,
+ *    degraded start and degraded end times of each patch, and
+ *    patch_similarity. The patches of the pairs of the shard are concatenated
+ *    in pair order. The arrays of kFvnsim are also written.
+ *  - kFvnsim: fvnsim, fstdnsim and fvdegenergy with a row for each pair and a
+ *    column for each band, and moslqo and vnsim with a value for each pair.
+ *    The rows of pairs that failed are NaN.
+ * Every pair must have the same number of bands. The center frequency of each
+ * band is written to center_freq_bands.npy.
+ *
+ * The index.csv file has a row for each pair, giving its shard, its row in the
+ * per pair arrays, and the offset and count of its rows in the per frame and
+ * per patch arrays.
+ *
+ * Pairs may be added from many threads at once. A shard is written by the
+ * thread that adds its last pair, so the shards are written in parallel, and
+ * only the shards that are not yet complete are held in memory.
+ */
+class FeatureShardWriter {
+ public:
+  /**
+   * The default number of pairs per shard.
+   */
+  static const size_t kDefaultPairsPerShard;
+
+  /**
+   * Parse the name of a feature stage.
+   *
+   * @param name One of "spectrogram", "patches" or "fvnsim".
+   *
+   * @return The stage, or an error status if the name is not recognised.
+   */
+  static absl::StatusOr<FeatureStage> ParseStage(const std::string &name);
+
+  /**
+   * Write a NumPy .npy file holding an array of doubles in C order. The
+   * header is padded so that the data is 64 byte aligned.
+   *
+   * @param path The path of the file.
+   * @param shape The size of each dimension of the array.
+   * @param data The values of the array, which must number the product of
+   *    the shape.
+   *
+   * @return An error status if the file could not be written.
+   */
+  static absl::Status WriteNpy(const FilePath &path,
+                               const std::vector<size_t> &shape,
+                               const std::vector<double> &data);
+
+  /**
+   * Constructs a writer. No files are written until Open is called.
+   *
+   * @param output_dir The directory the shards and index are written to. It
+   *    is created if it does not exist.
+   * @param stage The stage that features are extracted from.
+   * @param num_pairs The number of pairs in the batch.
+   * @param pairs_per_shard The number of pairs in each shard. A value of 0 is
+   *    treated as 1.
+   */
+  FeatureShardWriter(const FilePath &output_dir, FeatureStage stage,
+                     size_t num_pairs,
+                     size_t pairs_per_shard = kDefaultPairsPerShard);
+
+  /**
+   * Create the output directory.
+   *
+   * @return An error status if the directory could not be created.
+   */
+  absl::Status Open();
+
+  /**
+   * @return The stage that features are extracted from.
+   */
+  FeatureStage Stage() const { return stage_; }
+
+  /**
+   * Add the spectrograms of a pair, for the kSpectrogram stage.
+   *
+   * @param pair_index The index of the pair in the batch.
+   * @param pair The file pair.
+   * @param features The prepared spectrograms of the pair.
+   *
+   * @return An error status if the number of bands differs from the previous
+   *    pairs, or if the shard of the pair could not be written.
+   */
+  absl::Status AddSpectrograms(size_t pair_index,
+                               const ReferenceDegradedPathPair &pair,
+                               const SpectrogramFeatures &features);
+
+  /**
+   * Add the comparison result of a pair, for the kPatches and kFvnsim stages.
+   *
+   * @param pair_index The index of the pair in the batch.
+   * @param sim_res_msg The comparison result of the pair.
+   *
+   * @return An error status if the number of bands differs from the previous
+   *    pairs, or if the shard of the pair could not be written.
+   */
+  absl::Status AddResult(size_t pair_index,
+                         const SimilarityResultMsg &sim_res_msg);
+
+  /**
+   * Record that a pair failed, so that its shard can be completed.
+   *
+   * @param pair_index The index of the pair in the batch.
+   * @param pair The file pair.
+   * @param status The error the pair failed with.
+   *
+   * @return An error status if the shard of the pair could not be written.
+   */
+  absl::Status AddFailed(size_t pair_index,
+                         const ReferenceDegradedPathPair &pair,
+                         const absl::Status &status);
+
+  /**
+   * Write any incomplete shards, whose missing pairs are recorded as not run,
+   * along with the index and the center frequencies.
+   *
+   * @return An error status if a file could not be written.
+   */
+  absl::Status Close();
+
+ private:
+  /**
+   * The features of a pair, and where they are written.
+   */
+  struct PairEntry {
+    /**
+     * True once the pair has been added.
+     */
+    bool added = false;
+
+    /**
+     * The reference and degraded file paths.
+     */
+    std::string reference;
+    std::string degraded;
+
+    /**
+     * An empty string if the features were extracted, else the error.
+     */
+    std::string error = "not run";
+
+    /**
+     * The time in seconds between the starts of consecutive frames, for the
+     * kSpectrogram stage.
+     */
+    double frame_duration = 0.0;
+
+    /**
+     * The time in seconds of the start of the first frame, for the
+     * kSpectrogram stage. This is only non-zero if silence was trimmed.
+     */
+    double start_time = 0.0;
+
+    /**
+     * The spectrograms, in the layout of the shard arrays, and their number
+     * of frames.
+     */
+    std::vector<double> ref_spectrogram;
+    size_t ref_num_frames = 0;
+    std::vector<double> deg_spectrogram;
+    size_t deg_num_frames = 0;
+
+    /**
+     * The patch features, in the layout of the shard arrays, and the number
+     * of patches.
+     */
+    std::vector<double> patch_freq_band_means;
+    std::vector<double> patch_times;
+    std::vector<double> patch_similarity;
+    size_t num_patches = 0;
+
+    /**
+     * The per pair features.
+     */
+    std::vector<double> fvnsim;
+    std::vector<double> fstdnsim;
+    std::vector<double> fvdegenergy;
+    double moslqo = 0.0;
+    double vnsim = 0.0;
+
+    /**
+     * The offset of the pair's frames and patches within its shard, set when
+     * the shard is written.
+     */
+    size_t ref_frame_offset = 0;
+    size_t deg_frame_offset = 0;
+    size_t patch_offset = 0;
+  };
+
+  /**
+   * Check that the features of a pair have the same number of bands as the
+   * previous pairs, and record the center frequencies of the first pair.
+   *
+   * @param center_freq_bands The center frequency of each band of the pair.
+   *
+   * @return An error status if the number of bands differs.
+   */
+  absl::Status CheckBands(const std::vector<double> &center_freq_bands);
+
+  /**
+   * Store the entry of a pair, and write its shard if it is now complete.
+   *
+   * @param pair_index The index of the pair in the batch.
+   * @param entry The entry of the pair.
+   *
+   * @return An error status if the shard could not be written.
+   */
+  absl::Status Add(size_t pair_index, PairEntry entry);
+
+  /**
+   * Write the arrays of a shard, and release the features of its pairs.
+   *
+   * @param shard The index of the shard.
+   * @param num_bands The number of bands of every pair.
+   * @param entries The entries of the pairs of the shard, whose offsets are
+   *    set.
+   *
+   * @return An error status if a file could not be written.
+   */
+  absl::Status WriteShard(size_t shard, size_t num_bands,
+                          std::vector<PairEntry> *entries) const;
+
+  /**
+   * @param shard The index of a shard.
+   * @param array The name of an array.
+   * @return The path of the file the array of the shard is written to.
+   */
+  FilePath ShardPath(size_t shard, const std::string &array) const;
+
+  /**
+   * The directory the shards and index are written to.
+   */
+  FilePath output_dir_;
+
+  /**
+   * The stage that features are extracted from.
+   */
+  FeatureStage stage_;
+
+  /**
+   * The number of pairs in each shard.
+   */
+  size_t pairs_per_shard_;
+
+  /**
+   * Guards the members below.
+   */
+  absl::Mutex mutex_;
+
+  /**
+   * The entry of each pair. The features of a pair are released once its
+   * shard has been written.
+   */
+  std::vector<PairEntry> entries_;
+
+  /**
+   * The number of pairs added to each shard, and whether it was written.
+   */
+  std::vector<size_t> shard_num_added_;
+  std::vector<bool> shard_written_;
+
+  /**
+   * The center frequency of each band, from the first pair added.
+   */
+  std::vector<double> center_freq_bands_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_FEATURE_SHARD_WRITER_H
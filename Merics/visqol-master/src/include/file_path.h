@@ -20,6 +20,7 @@
 #include <fstream>
 #include <string>
 
+#include "absl/types/optional.h"
 #include "boost/filesystem.hpp"
 
 namespace Visqol {
@@ -37,6 +38,24 @@ class FilePath {
 
   bool Exists() const { return ::boost::filesystem::exists(path_); }
 
+  /**
+   * @return True if the path is "-", which stands for standard input.
+   */
+  bool IsStdin() const { return path_ == "-"; }
+
+  /**
+   * @return True if the path is standard input, or a pipe or device such as
+   *    /dev/fd/N, which can only be read once and cannot be seeked.
+   */
+  bool IsStream() const {
+    if (IsStdin()) {
+      return true;
+    }
+    ::boost::system::error_code error;
+    const auto status = ::boost::filesystem::status(path_, error);
+    return !error && ::boost::filesystem::is_other(status);
+  }
+
   static std::string currentWorkingDir() {
     return ::boost::filesystem::current_path().string();
   }
@@ -48,6 +67,14 @@ class FilePath {
 struct ReferenceDegradedPathPair {
   FilePath reference;
   FilePath degraded;
+
+  /**
+   * Settings for comparing this pair that override those of the batch, if
+   * set. See VisqolManager::Init for a description of each.
+   */
+  absl::optional<bool> use_speech_mode;
+  absl::optional<FilePath> sim_to_quality_mapper_model;
+  absl::optional<int> search_window_radius;
 };
 }  // namespace Visqol
 
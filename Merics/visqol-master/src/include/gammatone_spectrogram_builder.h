@@ -17,6 +17,8 @@
 #ifndef VISQOL_INCLUDE_GAMMATONESPECTROGRAMBUILDER_H
 #define VISQOL_INCLUDE_GAMMATONESPECTROGRAMBUILDER_H
 
+#include <vector>
+
 #include "gammatone_filterbank.h"
 #include "spectrogram_builder.h"
 #include "absl/status/statusor.h"
@@ -38,6 +40,13 @@ class GammatoneSpectrogramBuilder : public SpectrogramBuilder {
    */
   static const double kSpeechModeMaxFreq;
 
+  /**
+   * The maximum frequency to be used during audio mode. The bands are the
+   * same at any sample rate, and those above half the sampling rate are
+   * empty, so the band plan of a 48kHz signal is used at any sample rate.
+   */
+  static const double kAudioModeMaxFreq;
+
   /**
    * Constructs an instance of this GammatoneSpectrogramBuilder using the
    * provided GammatoneFilterBank.
@@ -52,6 +61,21 @@ class GammatoneSpectrogramBuilder : public SpectrogramBuilder {
       const AudioSignal &signal,
       const AnalysisWindow &window) override;
 
+  // Docs inherited from parent.
+  absl::StatusOr<size_t> NumColumns(
+      const AudioSignal &signal,
+      const AnalysisWindow &window) const override;
+
+  // Docs inherited from parent.
+  absl::StatusOr<Spectrogram> BuildColumns(
+      const AudioSignal &signal,
+      const AnalysisWindow &window,
+      const size_t first_col,
+      const size_t num_cols) override;
+
+  // Docs inherited from parent.
+  std::vector<double> GetCenterFreqBands(size_t sample_rate) const override;
+
  private:
   /**
    * The gammatone filter bank to apply to the signal.
@@ -75,6 +75,13 @@ class ImagePatchCreator {
       const AMatrix<double> &spectrogram,
       const std::vector<size_t> &patch_indices) const;
 
+  /**
+   * Get the number of frames that each patch contains.
+   *
+   * @return The patch size.
+   */
+  size_t GetPatchSize() const { return patch_size_; }
+
  protected:
   /**
    * The number of frames that each patch should contain. A single frame is
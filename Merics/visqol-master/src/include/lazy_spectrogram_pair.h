@@ -0,0 +1,245 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_LAZY_SPECTROGRAM_PAIR_H
+#define VISQOL_INCLUDE_LAZY_SPECTROGRAM_PAIR_H
+
+#include <cstddef>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+#include "amatrix.h"
+#include "analysis_window.h"
+#include "audio_signal.h"
+#include "cancellation_token.h"
+#include "spectrogram.h"
+#include "spectrogram_builder.h"
+
+namespace Visqol {
+
+/**
+ * This class holds the prepared reference and degraded spectrograms of a
+ * signal pair, computing them lazily in blocks of columns. A block is only
+ * built the first time one of its columns is requested, after which it is
+ * memoized.
+ *
+ * The prepared values are identical to those produced by building both
+ * spectrograms in full and calling
+ * MiscAudio::PrepareSpectrogramsForComparison. The reference and degraded
+ * spectrograms share a per-frame noise floor, so a block is always computed
+ * for both signals at once.
+ */
+class LazySpectrogramPair {
+ public:
+  /**
+   * The number of columns computed together when a column is first requested.
+   */
+  static const size_t kColumnBlockSize;
+
+  /**
+   * Constructs a lazy spectrogram pair. The signals and builder must outlive
+   * this object.
+   *
+   * @param spect_builder The builder used to compute the spectrogram columns.
+   * @param ref_signal The reference signal.
+   * @param deg_signal The degraded signal.
+   * @param window The analysis window used to build the spectrograms.
+   * @param ref_spectrogram If not null, the raw spectrogram of the whole
+   *    reference signal, as returned by the builder's Build. The reference
+   *    columns are then taken from it rather than computed. It must outlive
+   *    this object.
+   */
+  LazySpectrogramPair(SpectrogramBuilder *spect_builder,
+                      const AudioSignal &ref_signal,
+                      const AudioSignal &deg_signal,
+                      const AnalysisWindow &window,
+                      const Spectrogram *ref_spectrogram = nullptr);
+
+  /**
+   * Determine the dimensions of both spectrograms and resolve the global noise
+   * floor used to normalize them. Must be called before any other method.
+   *
+   * @param cancellation If not null, the blocks built to resolve the floor
+   *    stop with a status of deadline exceeded once this token is cancelled.
+   *
+   * @return An OK status on success, else an error status (for example, if a
+   *    signal is too short to build a spectrogram from).
+   */
+  absl::Status Init(const CancellationToken *cancellation = nullptr);
+
+  /**
+   * Ensure that the given inclusive range of columns has been computed in
+   * both spectrograms. Columns beyond the end of either spectrogram are
+   * ignored for that spectrogram.
+   *
+   * @param first_col The first column that is required.
+   * @param last_col The last column that is required.
+   *
+   * @return An OK status if the columns were computed, else an error status.
+   */
+  absl::Status EnsureColumns(size_t first_col, size_t last_col);
+
+  /**
+   * Get the prepared reference spectrogram. Only the columns that have been
+   * requested through EnsureColumns are valid; all other columns hold
+   * unspecified values.
+   *
+   * @return The reference spectrogram data.
+   */
+  const AMatrix<double> &RefData() const { return ref_data_; }
+
+  /**
+   * Get the prepared degraded spectrogram. Only the columns that have been
+   * requested through EnsureColumns are valid; all other columns hold
+   * unspecified values.
+   *
+   * @return The degraded spectrogram data.
+   */
+  const AMatrix<double> &DegData() const { return deg_data_; }
+
+  /**
+   * @return The center frequency bands of the spectrograms, ordered from
+   *    lowest to highest.
+   */
+  const std::vector<double> &GetCenterFreqBands() const {
+    return center_freq_bands_;
+  }
+
+  /**
+   * @return The number of columns (summed over both spectrograms) that have
+   *    been computed so far.
+   */
+  size_t NumColumnsComputed() const { return num_columns_computed_; }
+
+  /**
+   * @return The total number of columns (summed over both spectrograms) that
+   *    an eager build would compute.
+   */
+  size_t NumColumnsTotal() const { return ref_num_cols_ + deg_num_cols_; }
+
+ private:
+  /**
+   * Compute a single block of columns for both spectrograms, applying the
+   * noise floors and, if it has been resolved, the global floor.
+   *
+   * @param block_index The index of the block to compute.
+   *
+   * @return An OK status if the block was computed, else an error status.
+   */
+  absl::Status ComputeBlock(size_t block_index);
+
+  /**
+   * Build the raw columns of a single block of one of the spectrograms.
+   *
+   * @param signal The signal to build the columns from.
+   * @param total_cols The total number of columns for the signal.
+   * @param first_col The first column of the block.
+   *
+   * @return The raw spectrogram columns, which may be empty if the block lies
+   *    past the end of the signal.
+   */
+  absl::StatusOr<Spectrogram> BuildBlock(const AudioSignal &signal,
+                                         size_t total_cols, size_t first_col);
+
+  /**
+   * Copy the columns of a single block from a spectrogram that was built in
+   * full.
+   *
+   * @param spectrogram The raw spectrogram to copy the columns from.
+   * @param first_col The first column of the block.
+   *
+   * @return The raw spectrogram columns, which may be empty if the block lies
+   *    past the end of the spectrogram.
+   */
+  Spectrogram SliceBlock(const Spectrogram &spectrogram,
+                         size_t first_col) const;
+
+  /**
+   * The builder used to compute the spectrogram columns.
+   */
+  SpectrogramBuilder *spect_builder_;
+
+  /**
+   * The reference signal.
+   */
+  const AudioSignal &ref_signal_;
+
+  /**
+   * The degraded signal.
+   */
+  const AudioSignal &deg_signal_;
+
+  /**
+   * The raw spectrogram of the whole reference signal, if it was prepared
+   * before, else null.
+   */
+  const Spectrogram *ref_spectrogram_;
+
+  /**
+   * The analysis window used to build the spectrograms.
+   */
+  const AnalysisWindow window_;
+
+  /**
+   * The number of columns in the reference spectrogram.
+   */
+  size_t ref_num_cols_ = 0;
+
+  /**
+   * The number of columns in the degraded spectrogram.
+   */
+  size_t deg_num_cols_ = 0;
+
+  /**
+   * The global floor subtracted from every value once it has been resolved.
+   */
+  double global_floor_ = 0.0;
+
+  /**
+   * True once the global floor has been resolved.
+   */
+  bool global_floor_resolved_ = false;
+
+  /**
+   * True for each block that has been computed.
+   */
+  std::vector<bool> block_computed_;
+
+  /**
+   * The number of columns (summed over both spectrograms) computed so far.
+   */
+  size_t num_columns_computed_ = 0;
+
+  /**
+   * The prepared reference spectrogram data.
+   */
+  AMatrix<double> ref_data_;
+
+  /**
+   * The prepared degraded spectrogram data.
+   */
+  AMatrix<double> deg_data_;
+
+  /**
+   * The center frequency bands, ordered from lowest to highest.
+   */
+  std::vector<double> center_freq_bands_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_LAZY_SPECTROGRAM_PAIR_H
@@ -32,7 +32,8 @@ class LibSvmTargetObservationConvertor {
  public:
   /**
    * For a given vector of observations, convert them into an array of LIBSVM
-   * nodes.
+   * nodes. The nodes of all observations are held in a single allocation, so
+   * the array must be freed with FreeObservations.
    *
    * @param observations The vector of observations.
    * @param num_features The number of features in each observation. Assumes
@@ -44,6 +45,28 @@ class LibSvmTargetObservationConvertor {
   svm_node** ConvertObservations(const std::vector<MlObservation> &observations,
                                  size_t num_features) const;
 
+  /**
+   * For a dense row-major matrix of observations, convert them into an array
+   * of LIBSVM nodes. The nodes of all observations are held in a single
+   * allocation, so the array must be freed with FreeObservations.
+   *
+   * @param values The observation matrix, with num_features values per row.
+   * @param num_observations The number of observations (rows).
+   * @param num_features The number of features in each observation.
+   *
+   * @return An array of pointers to LIBSVM nodes containing the observation
+   * data.
+   */
+  svm_node** ConvertObservations(const double *values, size_t num_observations,
+                                 size_t num_features) const;
+
+  /**
+   * Free an array of observations returned by ConvertObservations.
+   *
+   * @param observations The array to free. May be null.
+   */
+  void FreeObservations(svm_node** observations) const;
+
   /**
    * For a given observation, convert it into a LIBSVM node.
    *
@@ -17,6 +17,9 @@
 #ifndef VISQOL_INCLUDE_MISCAUDIO_H
 #define VISQOL_INCLUDE_MISCAUDIO_H
 
+#include <istream>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "amatrix.h"
@@ -47,6 +50,24 @@ class MiscAudio {
    */
   static const double kSplReferencePoint;
 
+  /**
+   * The absolute noise floor (in dB) applied to spectrograms before
+   * comparison. No prepared spectrogram value is below this floor.
+   */
+  static const double kNoiseFloorAbsoluteDb;
+
+  /**
+   * The duration in seconds of the frames whose energy is measured to find
+   * the active region of a signal.
+   */
+  static const double kActivityFrameDuration;
+
+  /**
+   * Frames whose energy is below that of the loudest frame by more than this
+   * (in dB) are treated as silence when finding the active region.
+   */
+  static const double kActivityThresholdDb;
+
   /**
    * For a given pair of reference and degraded audio signals, scale the sound
    * pressure level (spl) of the degraded signal so that it matches the spl of
@@ -67,7 +88,9 @@ class MiscAudio {
    *
    * Currently only WAV files are supported.
    *
-   * @param path The path to the audio file to load.
+   * @param path The path to the audio file to load. A path of "-" reads from
+   *    standard input, and pipes such as /dev/fd/N are read as they are
+   *    written.
    *
    * @return The mono audio signal.
    */
@@ -77,16 +100,18 @@ class MiscAudio {
    * For a given audio stream, load it in mono. Audio with more than 1 channel
    * will be downmixed to mono.
    *
-   * Currently only WAV streams are supported.
+   * Currently only WAV streams are supported. The stream does not need to be
+   * seekable, and a WAV data chunk of unknown size is read to the end of the
+   * stream.
    *
-   * @param string_stream Audio stream to load.
+   * @param stream Audio stream to load.
    *
    * @param filepath Optional filepath for logging purposes.
    *
    * @return The mono audio signal.
    */
   static AudioSignal LoadAsMono(
-      std::stringstream *string_stream,
+      std::istream *stream,
       absl::optional<std::string> filepath = absl::nullopt);
 
   /**
@@ -99,6 +124,47 @@ class MiscAudio {
   static void PrepareSpectrogramsForComparison(Spectrogram &reference,
                                                Spectrogram &degraded);
 
+  /**
+   * Applies the decibel conversion and the absolute and per-frame relative
+   * noise floors of PrepareSpectrogramsForComparison, but not the final global
+   * floor normalization. Each column of the output only depends on the same
+   * column of the inputs, so this may be applied to column blocks of the
+   * spectrograms independently.
+   *
+   * @param reference The reference spectrogram.
+   * @param degraded The degraded spectrogram.
+   */
+  static void ApplySpectrogramNoiseFloors(Spectrogram &reference,
+                                          Spectrogram &degraded);
+
+  /**
+   * Find the region of a signal between its first and last active frames,
+   * where a frame is active if its energy is within kActivityThresholdDb of
+   * the loudest frame's.
+   *
+   * @param signal The signal to scan.
+   * @param padding_seconds The silence in seconds to keep on each side of the
+   *    active frames, where the signal has it.
+   *
+   * @return The first sample of the region and the sample after its last. If
+   *    the signal is silent, the whole signal is returned.
+   */
+  static std::pair<size_t, size_t> FindActiveRegion(
+      const AudioSignal &signal, const double padding_seconds);
+
+  /**
+   * Extract a range of samples from a signal.
+   *
+   * @param signal The signal to extract from.
+   * @param start_sample The first sample to extract.
+   * @param end_sample The sample after the last to extract.
+   *
+   * @return The extracted signal, with the same sample rate.
+   */
+  static AudioSignal SliceSamples(const AudioSignal &signal,
+                                  const size_t start_sample,
+                                  const size_t end_sample);
+
  private:
   /**
    * For a given audio signal, downmix it to mono. If already mono, no work is
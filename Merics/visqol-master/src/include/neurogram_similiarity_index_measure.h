@@ -17,6 +17,7 @@
 #ifndef VISQOL_INCLUDE_NEUROGRAMSIMILARITYINDEXMEASURE_H
 #define VISQOL_INCLUDE_NEUROGRAMSIMILARITYINDEXMEASURE_H
 
+#include <memory>
 #include <vector>
 
 #include "amatrix.h"
@@ -37,7 +38,75 @@ class NeurogramSimiliarityIndexMeasure : public PatchSimilarityComparator {
   PatchSimilarityResult MeasurePatchSimilarity(const ImagePatch &ref_patch,
                                                const ImagePatch &deg_patch)
                                                const override;
+
+  // Docs inherited from parent. Computes the local means and variances of the
+  // reference patch, which are the same for every degraded patch.
+  std::unique_ptr<PreparedReferencePatch> PrepareReferencePatch(
+      const ImagePatch &ref_patch) const override;
+
+  // Docs inherited from parent.
+  PatchSimilarityResult MeasurePreparedPatchSimilarity(
+      const PreparedReferencePatch &ref_patch,
+      const ImagePatch &deg_patch) const override;
+
+  // Docs inherited from parent. NSIM is bounded above by 1.
+  double MaxSimilarity() const override;
+
  private:
+  /**
+   * The NSIM statistics of a reference patch, which do not depend on the
+   * degraded patch.
+   */
+  struct NsimReferenceStats {
+    /**
+     * The local means of the reference patch.
+     */
+    AMatrix<double> mu_r;
+
+    /**
+     * The squares of the local means of the reference patch.
+     */
+    AMatrix<double> ref_mu_sq;
+
+    /**
+     * The local variances of the reference patch.
+     */
+    AMatrix<double> sigma_r_sq;
+  };
+
+  /**
+   * A reference patch with its NSIM statistics.
+   */
+  struct NsimReferencePatch : public PreparedReferencePatch {
+    /**
+     * The statistics of the patch.
+     */
+    NsimReferenceStats stats;
+  };
+
+  /**
+   * Compute the NSIM statistics of a reference patch.
+   *
+   * @param ref_patch The reference patch.
+   *
+   * @return The statistics.
+   */
+  static NsimReferenceStats ComputeReferenceStats(const ImagePatch &ref_patch);
+
+  /**
+   * Measure the similarity of a reference patch, whose statistics are
+   * already computed, to a degraded patch.
+   *
+   * @param ref_patch The reference patch.
+   * @param ref_stats The statistics of the reference patch.
+   * @param deg_patch The degraded patch.
+   *
+   * @return The patch comparison similarity result.
+   */
+  PatchSimilarityResult MeasureWithReferenceStats(
+      const ImagePatch &ref_patch, const NsimReferenceStats &ref_stats,
+      const ImagePatch &deg_patch) const;
+
   /**
    * The intensity range used during NSIM calculations.
    */
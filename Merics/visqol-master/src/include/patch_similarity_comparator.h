@@ -17,6 +17,10 @@
 #ifndef VISQOL_INCLUDE_PATCHSIMILARITYCOMPARATOR_H
 #define VISQOL_INCLUDE_PATCHSIMILARITYCOMPARATOR_H
 
+#include <limits>
+#include <memory>
+
+#include "absl/memory/memory.h"
 #include "image_patch_creator.h"
 
 namespace Visqol {
@@ -88,6 +92,23 @@ struct BestPatchSimilarityMatch {
   PatchSimilarityResult result;
 };
 
+/**
+ * A reference patch along with any statistics of it that a comparator can
+ * reuse across comparisons with many degraded patches. Comparators that
+ * precompute statistics extend this with their own fields.
+ */
+struct PreparedReferencePatch {
+  /**
+   * Destructor for the prepared reference patch.
+   */
+  virtual ~PreparedReferencePatch() {}
+
+  /**
+   * The reference patch.
+   */
+  ImagePatch patch;
+};
+
 /**
  * This class provided the logic for comparing two patches.
  */
@@ -108,6 +129,49 @@ class PatchSimilarityComparator {
    */
   virtual PatchSimilarityResult MeasurePatchSimilarity(
       const ImagePatch &ref_patch, const ImagePatch &deg_patch) const = 0;
+
+  /**
+   * Compute the statistics of a reference patch that do not depend on the
+   * degraded patch, so that they are computed once when the reference patch
+   * is compared against many degraded patches.
+   *
+   * @param ref_patch The reference patch.
+   *
+   * @return The prepared reference patch, to be passed to
+   *    MeasurePreparedPatchSimilarity.
+   */
+  virtual std::unique_ptr<PreparedReferencePatch> PrepareReferencePatch(
+      const ImagePatch &ref_patch) const {
+    auto prepared = absl::make_unique<PreparedReferencePatch>();
+    prepared->patch = ref_patch;
+    return prepared;
+  }
+
+  /**
+   * For a prepared reference patch and a degraded patch, measure their
+   * similarity. The result is the same as that of MeasurePatchSimilarity.
+   *
+   * @param ref_patch The reference patch, as returned by
+   *    PrepareReferencePatch of this comparator.
+   * @param deg_patch The degraded patch.
+   *
+   * @return The patch comparison similarity result.
+   */
+  virtual PatchSimilarityResult MeasurePreparedPatchSimilarity(
+      const PreparedReferencePatch &ref_patch,
+      const ImagePatch &deg_patch) const {
+    return MeasurePatchSimilarity(ref_patch.patch, deg_patch);
+  }
+
+  /**
+   * Get an upper bound on the similarity score that MeasurePatchSimilarity can
+   * return for any pair of patches. Used to prune the patch search.
+   *
+   * @return The upper bound, or infinity if the similarity is unbounded.
+   */
+  virtual double MaxSimilarity() const {
+    return std::numeric_limits<double>::infinity();
+  }
 };
 }  // namespace Visqol
 
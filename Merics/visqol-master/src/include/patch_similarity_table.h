@@ -0,0 +1,172 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_PATCH_SIMILARITY_TABLE_H
+#define VISQOL_INCLUDE_PATCH_SIMILARITY_TABLE_H
+
+#include <cstddef>
+#include <vector>
+
+#include "patch_similarity_comparator.h"
+
+namespace Visqol {
+
+/**
+ * The results of comparing each reference patch with its matched degraded
+ * patch, stored as a structure of arrays.
+ *
+ * The per frequency band results of all of the patches are each held in one
+ * contiguous array with a row of bands for each patch, in the order the
+ * patches were appended. The features of a whole signal are then computed
+ * with contiguous loops over the bands, which the compiler can vectorize,
+ * and the table is passed by reference from the fine alignment through to
+ * the results, rather than copying a matrix per patch at each stage.
+ */
+class PatchSimilarityTable {
+ public:
+  /**
+   * Append the result of a patch comparison as the last patch. All of the
+   * patches must have the same number of frequency bands.
+   *
+   * @param result The result of the patch comparison.
+   */
+  void Append(const PatchSimilarityResult &result);
+
+  /**
+   * @return The number of patches.
+   */
+  size_t NumPatches() const;
+
+  /**
+   * @return The number of frequency bands of each patch.
+   */
+  size_t NumFreqBands() const;
+
+  /**
+   * @return The similarity of each frequency band, with a row of
+   *    NumFreqBands() values for each patch. See
+   *    PatchSimilarityResult::freq_band_means.
+   */
+  const std::vector<double> &FreqBandMeans() const;
+
+  /**
+   * @return The standard deviation over time of the similarity of each
+   *    frequency band, laid out as for FreqBandMeans().
+   */
+  const std::vector<double> &FreqBandStdDevs() const;
+
+  /**
+   * @return The mean energy over time of each frequency band of the degraded
+   *    patch, laid out as for FreqBandMeans().
+   */
+  const std::vector<double> &FreqBandDegEnergy() const;
+
+  /**
+   * @return The similarity of each patch.
+   */
+  const std::vector<double> &Similarities() const;
+
+  /**
+   * @return The time (in sec) where each patch starts in the reference
+   *    signal.
+   */
+  const std::vector<double> &RefPatchStartTimes() const;
+
+  /**
+   * @return The time (in sec) where each patch ends in the reference signal.
+   */
+  const std::vector<double> &RefPatchEndTimes() const;
+
+  /**
+   * @return The time (in sec) where each patch starts in the degraded
+   *    signal, or 0 if the patch was not matched.
+   */
+  const std::vector<double> &DegPatchStartTimes() const;
+
+  /**
+   * @return The time (in sec) where each patch ends in the degraded signal,
+   *    or 0 if the patch was not matched.
+   */
+  const std::vector<double> &DegPatchEndTimes() const;
+
+  /**
+   * Shift the times of all of the patches. Patches without a match keep
+   * their zero degraded times.
+   *
+   * @param offset The time (in sec) to add to each time.
+   */
+  void ShiftTimes(double offset);
+
+  /**
+   * Copy a subset of the patches to a new table.
+   *
+   * @param patches The indices of the patches to copy, in the order they are
+   *    to be stored.
+   *
+   * @return The table of the selected patches.
+   */
+  PatchSimilarityTable Select(const std::vector<size_t> &patches) const;
+
+ private:
+  /**
+   * The number of frequency bands of each patch.
+   */
+  size_t num_freq_bands_ = 0;
+
+  /**
+   * The similarity of each frequency band of each patch.
+   */
+  std::vector<double> freq_band_means_;
+
+  /**
+   * The standard deviation of the similarity of each frequency band of each
+   * patch.
+   */
+  std::vector<double> freq_band_stddevs_;
+
+  /**
+   * The mean degraded energy of each frequency band of each patch.
+   */
+  std::vector<double> freq_band_deg_energy_;
+
+  /**
+   * The similarity of each patch.
+   */
+  std::vector<double> similarities_;
+
+  /**
+   * The start time of each patch in the reference signal.
+   */
+  std::vector<double> ref_patch_start_times_;
+
+  /**
+   * The end time of each patch in the reference signal.
+   */
+  std::vector<double> ref_patch_end_times_;
+
+  /**
+   * The start time of each patch in the degraded signal.
+   */
+  std::vector<double> deg_patch_start_times_;
+
+  /**
+   * The end time of each patch in the degraded signal.
+   */
+  std::vector<double> deg_patch_end_times_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_PATCH_SIMILARITY_TABLE_H
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_PROGRESS_REPORTER_H
+#define VISQOL_INCLUDE_PROGRESS_REPORTER_H
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+
+#include "file_path.h"
+#include "progress_report.pb.h"  // Generated by cc_proto_library rule
+
+namespace Visqol {
+
+/**
+ * This class reports the progress of a batch of comparisons as JSON lines,
+ * one ProgressReportMsg per line, so that long batches can be monitored.
+ *
+ * The workers only record when their jobs start and finish. A background
+ * thread summarises those records and writes a report at a fixed interval,
+ * so the reporting rate does not depend on how quickly jobs complete, and
+ * writing never delays a comparison. A final report is written when the
+ * batch finishes.
+ */
+class ProgressReporter {
+ public:
+  /**
+   * A running comparison is reported as a straggler once it has run for this
+   * many times as long as it was expected to take.
+   */
+  static const double kStragglerFactor;
+
+  /**
+   * Constructs a reporter that writes to the given path.
+   *
+   * @param output_path The path the reports are written to. Any existing
+   *    file is replaced. A path such as /dev/stderr or /dev/fd/3 may be used
+   *    to write to an open file descriptor.
+   * @param interval_seconds The time between reports.
+   */
+  ProgressReporter(const FilePath &output_path, double interval_seconds);
+
+  ProgressReporter(const ProgressReporter &) = delete;
+  ProgressReporter &operator=(const ProgressReporter &) = delete;
+
+  /**
+   * Finishes the current batch, if one is in progress.
+   */
+  ~ProgressReporter();
+
+  /**
+   * Open the output for writing.
+   *
+   * @return An error status if the output could not be opened.
+   */
+  absl::Status Open();
+
+  /**
+   * Start reporting on a batch, resetting the progress of any previous
+   * batch. Must be followed by a call to Finish.
+   *
+   * @param num_jobs The number of jobs in the batch.
+   * @param num_workers The number of jobs run concurrently.
+   * @param estimate_remaining Returns the estimated time remaining in
+   *    seconds. Called from the reporting thread.
+   */
+  void Start(size_t num_jobs, size_t num_workers,
+             std::function<double()> estimate_remaining);
+
+  /**
+   * Record that a worker has started a job.
+   *
+   * @param worker The index of the worker.
+   * @param job_index The index of the job.
+   * @param cost The predicted cost of the job, in the same units for every
+   *    job of the batch.
+   */
+  void JobStarted(size_t worker, size_t job_index, double cost);
+
+  /**
+   * Record that a worker has finished its current job.
+   *
+   * @param worker The index of the worker.
+   * @param ok If false, the job failed.
+   * @param audio_seconds The duration of the audio compared by the job.
+   */
+  void JobFinished(size_t worker, bool ok, double audio_seconds);
+
+  /**
+   * Stop the reporting thread and write the final report of the batch.
+   */
+  void Finish();
+
+  /**
+   * @return A report of the current progress of the batch.
+   */
+  ProgressReportMsg Snapshot() const;
+
+ private:
+  /**
+   * The job currently run by a worker.
+   */
+  struct WorkerState {
+    /**
+     * True if the worker is running a job.
+     */
+    bool running = false;
+
+    /**
+     * The index of the job being run.
+     */
+    size_t job_index = 0;
+
+    /**
+     * The predicted cost of the job being run.
+     */
+    double cost = 0.0;
+
+    /**
+     * When the job was started.
+     */
+    std::chrono::steady_clock::time_point start;
+  };
+
+  /**
+   * Write a report every interval until the batch finishes.
+   */
+  void ReportLoop();
+
+  /**
+   * Write a report to the output as a single line of JSON.
+   *
+   * @param report The report to write.
+   */
+  void WriteReport(const ProgressReportMsg &report);
+
+  /**
+   * The path the reports are written to.
+   */
+  FilePath output_path_;
+
+  /**
+   * The time between reports.
+   */
+  double interval_seconds_;
+
+  /**
+   * The output the reports are written to.
+   */
+  std::ofstream output_;
+
+  /**
+   * Writes the reports during a batch.
+   */
+  std::thread report_thread_;
+
+  /**
+   * Returns the estimated time remaining in seconds.
+   */
+  std::function<double()> estimate_remaining_;
+
+  /**
+   * Guards the progress of the batch below.
+   */
+  mutable absl::Mutex mutex_;
+
+  /**
+   * True once the batch has finished, which stops the reporting thread.
+   */
+  bool stopping_ = false;
+
+  /**
+   * When the batch was started.
+   */
+  std::chrono::steady_clock::time_point start_;
+
+  /**
+   * The number of jobs in the batch.
+   */
+  size_t num_jobs_ = 0;
+
+  /**
+   * The number of jobs that have finished, including failures.
+   */
+  size_t jobs_done_ = 0;
+
+  /**
+   * The number of jobs that have failed.
+   */
+  size_t jobs_failed_ = 0;
+
+  /**
+   * The duration of the audio compared by the finished jobs.
+   */
+  double audio_seconds_done_ = 0.0;
+
+  /**
+   * The time the workers have spent running finished jobs.
+   */
+  double busy_seconds_ = 0.0;
+
+  /**
+   * The predicted cost of the finished jobs.
+   */
+  double finished_cost_ = 0.0;
+
+  /**
+   * The job run by each worker.
+   */
+  std::vector<WorkerState> workers_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_PROGRESS_REPORTER_H
@@ -0,0 +1,344 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_REFERENCE_CACHE_SERVICE_H
+#define VISQOL_INCLUDE_REFERENCE_CACHE_SERVICE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+
+namespace Visqol {
+
+/**
+ * A thread safe map from keys to values that holds at most a given number of
+ * bytes, evicting the least recently used entries to make room.
+ */
+class StringLruCache {
+ public:
+  /**
+   * Constructs an empty cache.
+   *
+   * @param capacity_bytes The most bytes of keys and values to hold.
+   */
+  explicit StringLruCache(size_t capacity_bytes);
+
+  /**
+   * Look up a value, marking it as the most recently used.
+   *
+   * @param key The key of the value.
+   *
+   * @return The value, or nullopt if it is not held.
+   */
+  absl::optional<std::string> Get(const std::string &key);
+
+  /**
+   * Store a value, replacing any value with the same key. A value larger than
+   * the capacity is not stored.
+   *
+   * @param key The key of the value.
+   * @param value The value.
+   */
+  void Put(const std::string &key, std::string value);
+
+  /**
+   * @return The number of bytes of keys and values held.
+   */
+  size_t SizeBytes() const;
+
+ private:
+  /**
+   * The most bytes of keys and values to hold.
+   */
+  const size_t capacity_bytes_;
+
+  /**
+   * Guards the members below.
+   */
+  mutable absl::Mutex mutex_;
+
+  /**
+   * The entries, from the most to the least recently used.
+   */
+  std::list<std::pair<std::string, std::string>> entries_;
+
+  /**
+   * The entry of each key.
+   */
+  std::unordered_map<std::string,
+                     std::list<std::pair<std::string, std::string>>::iterator>
+      index_;
+
+  /**
+   * The number of bytes of keys and values held.
+   */
+  size_t size_bytes_ = 0;
+};
+
+/**
+ * A TCP server that holds the prepared reference features published by a
+ * fleet of scoring nodes, so that each reference only needs to be prepared
+ * once across the fleet. It knows nothing of the features, and stores opaque
+ * values by key in memory, evicting the least recently used.
+ *
+ * Each connection carries a single request, and is closed once answered. A
+ * request is a line of text, followed by a value for a PUT:
+ *
+ *  - "GET <key>\n" is answered with "HIT <size>\n" and the value, or with
+ *    "MISS\n".
+ *  - "PUT <key> <size>\n" and the value is answered with "OK\n".
+ *
+ * Any other request is answered with "ERROR <message>\n". The server does not
+ * authenticate its clients, so it listens on the loopback interface unless
+ * given another address, which should only be reachable by the scoring
+ * nodes. Its clients sign the values they store, and ignore values that are
+ * not signed (see ReferenceFeatureCache). Keys are at most
+ * kMaxKeyBytes of printable characters without spaces, and values are at
+ * most kMaxValueBytes. Connections are served by a fixed pool of threads. A
+ * connection that has not sent its request and received the reply within
+ * kIoTimeoutSeconds, plus the time to move its value at kMinBytesPerSecond,
+ * is dropped, however slowly it trickles in, so a stalled client only holds
+ * one thread for that long.
+ *
+ * Only supported on POSIX systems.
+ */
+class ReferenceCacheServer {
+ public:
+  /**
+   * The longest key accepted, in bytes.
+   */
+  static const size_t kMaxKeyBytes;
+
+  /**
+   * The largest value accepted, in bytes.
+   */
+  static const size_t kMaxValueBytes;
+
+  /**
+   * The time in seconds a connection has to send its request and receive the
+   * reply before it is dropped.
+   */
+  static const double kIoTimeoutSeconds;
+
+  /**
+   * The slowest rate in bytes per second a value is allowed to move at. The
+   * time to move a value at this rate is added to the deadlines of the
+   * server and of its clients, so that large values do not time out.
+   */
+  static const double kMinBytesPerSecond;
+
+  /**
+   * The default number of connections served at once.
+   */
+  static const size_t kDefaultNumThreads;
+
+  /**
+   * The time in seconds between checks for a request to stop.
+   */
+  static const double kPollIntervalSeconds;
+
+  /**
+   * Constructs a server. Nothing is served until Start is called.
+   *
+   * @param capacity_bytes The most bytes of keys and values to hold.
+   * @param num_threads The number of connections served at once. A value of
+   *    0 is treated as 1.
+   */
+  explicit ReferenceCacheServer(size_t capacity_bytes,
+                                size_t num_threads = kDefaultNumThreads);
+
+  ReferenceCacheServer(const ReferenceCacheServer &) = delete;
+  ReferenceCacheServer &operator=(const ReferenceCacheServer &) = delete;
+
+  /**
+   * Stops the server, if it is running.
+   */
+  ~ReferenceCacheServer();
+
+  /**
+   * Start listening and serving requests on background threads.
+   *
+   * @param port The TCP port to listen on, or 0 for any free port.
+   * @param bind_address The IPv4 address to listen on. The default only
+   *    listens on the loopback interface.
+   *
+   * @return An error status if the server could not listen on the port.
+   */
+  absl::Status Start(int port, const std::string &bind_address = "127.0.0.1");
+
+  /**
+   * @return The port the server is listening on, or 0 if it is not running.
+   */
+  int Port() const;
+
+  /**
+   * Stop serving and wait for the background threads to finish. The
+   * connections being served are answered or time out first.
+   */
+  void Stop();
+
+ private:
+  /**
+   * Accept and serve connections until stopped. Run by each serving thread.
+   */
+  void ServeLoop();
+
+  /**
+   * Serve the request on a connection, then close it.
+   *
+   * @param fd The connected socket.
+   */
+  void ServeConnection(int fd);
+
+  /**
+   * The stored values.
+   */
+  StringLruCache store_;
+
+  /**
+   * The number of connections served at once.
+   */
+  size_t num_threads_;
+
+  /**
+   * The listening socket, or -1 if not running.
+   */
+  int listen_fd_ = -1;
+
+  /**
+   * The port listened on.
+   */
+  int port_ = 0;
+
+  /**
+   * Set to ask the serving threads to stop.
+   */
+  std::atomic<bool> stopping_{false};
+
+  /**
+   * Each accepts and serves one connection at a time.
+   */
+  std::vector<std::thread> serve_threads_;
+};
+
+/**
+ * A client of a ReferenceCacheServer. Each call makes a new connection, and
+ * gives up with an error status once the server is unreachable or the call
+ * takes longer than the timeout, plus the time to move its value at
+ * ReferenceCacheServer::kMinBytesPerSecond, so callers can fall back to
+ * computing the value.
+ */
+class ReferenceCacheClient {
+ public:
+  /**
+   * The default time in seconds a call may take, from connecting to
+   * receiving the reply, besides the time to move its value.
+   */
+  static const double kDefaultTimeoutSeconds;
+
+  /**
+   * Parse a server address of the form "host:port".
+   *
+   * @param address The address.
+   *
+   * @return The host and port, or an error status if the address is not
+   *    valid.
+   */
+  static absl::StatusOr<std::pair<std::string, int>> ParseAddress(
+      const std::string &address);
+
+  /**
+   * Constructs a client. No connection is made until a value is fetched or
+   * stored.
+   *
+   * @param host The host name or IPv4 address of the server.
+   * @param port The TCP port of the server.
+   * @param timeout_seconds The time a call may take, from connecting to
+   *    receiving the reply, besides the time to move its value.
+   */
+  ReferenceCacheClient(const std::string &host, int port,
+                       double timeout_seconds = kDefaultTimeoutSeconds);
+
+  /**
+   * Fetch a value from the server.
+   *
+   * @param key The key of the value.
+   *
+   * @return The value, nullopt if the server does not hold it, or an error
+   *    status if the server could not be reached.
+   */
+  absl::StatusOr<absl::optional<std::string>> Get(
+      const std::string &key) const;
+
+  /**
+   * Store a value on the server.
+   *
+   * @param key The key of the value.
+   * @param value The value.
+   *
+   * @return An error status if the server could not be reached or refused
+   *    the value.
+   */
+  absl::Status Put(const std::string &key, const std::string &value) const;
+
+  /**
+   * @return The "host:port" address of the server, for logging.
+   */
+  std::string Address() const;
+
+ private:
+  /**
+   * Connect to the server, and send a request.
+   *
+   * @param request The request line and any value.
+   * @param deadline The time by which the call must finish.
+   *
+   * @return The connected socket, or an error status.
+   */
+  absl::StatusOr<int> SendRequest(
+      const std::string &request,
+      std::chrono::steady_clock::time_point deadline) const;
+
+  /**
+   * The host name or address of the server.
+   */
+  std::string host_;
+
+  /**
+   * The TCP port of the server.
+   */
+  int port_;
+
+  /**
+   * The time a call may take, from connecting to receiving the reply,
+   * besides the time to move its value.
+   */
+  double timeout_seconds_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_REFERENCE_CACHE_SERVICE_H
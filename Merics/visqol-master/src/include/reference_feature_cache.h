@@ -0,0 +1,249 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_REFERENCE_FEATURE_CACHE_H
+#define VISQOL_INCLUDE_REFERENCE_FEATURE_CACHE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+
+#include "analysis_window.h"
+#include "audio_signal.h"
+#include "reference_cache_service.h"
+#include "spectrogram.h"
+
+namespace Visqol {
+
+/**
+ * Counts of where the prepared reference features were found.
+ */
+struct ReferenceCacheStats {
+  /**
+   * The lookups answered by the node-local cache.
+   */
+  size_t local_hits = 0;
+
+  /**
+   * The lookups answered by the shared cache server.
+   */
+  size_t remote_hits = 0;
+
+  /**
+   * The lookups that neither cache could answer, so that the features were
+   * computed.
+   */
+  size_t misses = 0;
+
+  /**
+   * The requests to the shared cache server that failed.
+   */
+  size_t remote_errors = 0;
+};
+
+/**
+ * A cache of the prepared features of reference signals, so that a reference
+ * compared against many degraded signals is only prepared once. The prepared
+ * features are the raw spectrogram of the whole reference, before the noise
+ * floors are applied, as those depend on the degraded signal.
+ *
+ * The features are held by content key in a node-local cache in memory, in
+ * front of an optional ReferenceCacheServer shared by a fleet of scoring
+ * nodes. Features found on the server are kept locally, and features a node
+ * computes are published to both. The server accepts entries from anyone who
+ * can reach it, so each entry published to it carries an HMAC-SHA256 of its
+ * key and features under a secret shared by the nodes, and an entry fetched
+ * without a matching code is ignored. A feature that is missing, corrupt,
+ * unsigned or unreachable is simply a miss, and the caller computes it as it
+ * would without the cache. The scores are therefore unchanged as long as the
+ * secret is only held by the scoring nodes. After a failed request the
+ * server is skipped for kRemoteRetrySeconds, so an unreachable server does
+ * not slow every comparison.
+ *
+ * All methods are thread safe, so a single cache may be shared by many
+ * VisqolManager instances.
+ */
+class ReferenceFeatureCache {
+ public:
+  /**
+   * The default size of the node-local cache in bytes.
+   */
+  static const size_t kDefaultLocalCapacityBytes;
+
+  /**
+   * The time in seconds the server is skipped for after a failed request.
+   */
+  static const double kRemoteRetrySeconds;
+
+  /**
+   * The version of the serialized features, which is part of every key. It
+   * must be raised whenever the features computed for a key change, unless
+   * only their band plan changes, which is checked when an entry is used.
+   */
+  static const uint32_t kFormatVersion;
+
+  /**
+   * The shortest secret accepted for signing the entries on the server, in
+   * bytes.
+   */
+  static const size_t kMinSecretBytes;
+
+  /**
+   * Read the secret the entries on the server are signed with from a file.
+   * Trailing whitespace, such as a final newline, is not part of the secret.
+   *
+   * @param path The path of the file.
+   *
+   * @return The secret, or an error status if the file cannot be read or
+   *    holds fewer than kMinSecretBytes.
+   */
+  static absl::StatusOr<std::string> ReadSecret(const std::string &path);
+
+  /**
+   * Compute the content key of the features of a reference signal. The key
+   * covers the SHA-256 digest of the samples and every setting the features
+   * depend on, so that signals and settings that would give different
+   * features never share a key.
+   *
+   * @param signal The reference signal.
+   * @param window The analysis window the features are built with.
+   * @param use_speech_mode True if the features are built for speech mode.
+   *
+   * @return The key.
+   */
+  static std::string ContentKey(const AudioSignal &signal,
+                                const AnalysisWindow &window,
+                                bool use_speech_mode);
+
+  /**
+   * Serialize a spectrogram, with its center frequency bands.
+   *
+   * @param spectrogram The spectrogram.
+   *
+   * @return The serialized bytes.
+   */
+  static std::string Serialize(const Spectrogram &spectrogram);
+
+  /**
+   * Deserialize a spectrogram written by Serialize.
+   *
+   * @param bytes The serialized bytes.
+   *
+   * @return The spectrogram, or an error status if the bytes are not a
+   *    spectrogram of this format version.
+   */
+  static absl::StatusOr<Spectrogram> Deserialize(const std::string &bytes);
+
+  /**
+   * Constructs a cache.
+   *
+   * @param local_capacity_bytes The most bytes of features to hold locally.
+   * @param remote The client of the shared cache server, or null to only
+   *    cache locally.
+   * @param remote_secret The secret shared by the nodes, that the entries on
+   *    the server are signed with.
+   */
+  explicit ReferenceFeatureCache(
+      size_t local_capacity_bytes = kDefaultLocalCapacityBytes,
+      std::unique_ptr<ReferenceCacheClient> remote = nullptr,
+      const std::string &remote_secret = "");
+
+  /**
+   * Look up the features of a reference, first locally, then on the server.
+   *
+   * @param key The content key of the reference.
+   *
+   * @return The features, or nullopt if they must be computed.
+   */
+  absl::optional<Spectrogram> Fetch(const std::string &key);
+
+  /**
+   * Store the features of a reference locally, and publish them to the
+   * server.
+   *
+   * @param key The content key of the reference.
+   * @param spectrogram The features.
+   */
+  void Publish(const std::string &key, const Spectrogram &spectrogram);
+
+  /**
+   * @return The counts of where the features were found so far.
+   */
+  ReferenceCacheStats Stats() const;
+
+ private:
+  /**
+   * @return True if the server is configured and not being skipped after a
+   *    failed request.
+   */
+  bool RemoteAvailable() const;
+
+  /**
+   * Compute the code that signs an entry on the server.
+   *
+   * @param key The content key of the entry.
+   * @param bytes The serialized features.
+   *
+   * @return The code, of Sha256::kDigestBytes.
+   */
+  std::string Sign(const std::string &key, const std::string &bytes) const;
+
+  /**
+   * Record a failed request to the server, and start skipping it.
+   *
+   * @param status The error the request failed with.
+   */
+  void RecordRemoteError(const absl::Status &status);
+
+  /**
+   * The serialized features held locally.
+   */
+  StringLruCache local_;
+
+  /**
+   * The client of the shared cache server, or null.
+   */
+  const std::unique_ptr<ReferenceCacheClient> remote_;
+
+  /**
+   * The secret the entries on the server are signed with.
+   */
+  const std::string remote_secret_;
+
+  /**
+   * Guards the members below.
+   */
+  mutable absl::Mutex mutex_;
+
+  /**
+   * The time before which the server is skipped.
+   */
+  std::chrono::steady_clock::time_point remote_retry_time_;
+
+  /**
+   * The counts of where the features were found.
+   */
+  ReferenceCacheStats stats_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_REFERENCE_FEATURE_CACHE_H
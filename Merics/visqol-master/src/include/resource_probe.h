@@ -0,0 +1,185 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_RESOURCE_PROBE_H
+#define VISQOL_INCLUDE_RESOURCE_PROBE_H
+
+#include <cstddef>
+#include <string>
+
+#include "file_path.h"
+
+namespace Visqol {
+
+/**
+ * The compute resources available to this process.
+ */
+struct ResourceLimits {
+  /**
+   * The number of hardware threads on the host.
+   */
+  size_t hardware_concurrency = 1;
+
+  /**
+   * The number of CPUs the process may use according to its cgroup CPU quota.
+   * A value of 0 means that there is no quota.
+   */
+  double cpu_limit = 0.0;
+
+  /**
+   * The cgroup memory limit in bytes. A value of 0 means that there is no
+   * limit.
+   */
+  size_t memory_limit_bytes = 0;
+};
+
+/**
+ * The execution parameters derived from the available resources.
+ */
+struct ExecutionConfig {
+  /**
+   * The number of comparisons to run concurrently.
+   */
+  size_t num_workers = 1;
+
+  /**
+   * The estimated memory (in bytes) that the comparisons running concurrently
+   * may use between them. A value of 0 means that there is no budget.
+   */
+  size_t memory_budget_bytes = 0;
+};
+
+/**
+ * This class determines the compute resources available to this process. In
+ * a container, the host's hardware concurrency and memory overstate what the
+ * process may use, so the cgroup (v1 or v2) CPU quota and memory limit are
+ * read as well.
+ */
+class ResourceProbe {
+ public:
+  /**
+   * The default mount point of the cgroup filesystem.
+   */
+  static const char kDefaultCgroupRoot[];
+
+  /**
+   * The default path of the file listing the cgroups of this process.
+   */
+  static const char kDefaultProcSelfCgroup[];
+
+  /**
+   * The fraction of the memory limit used as the memory budget. The remainder
+   * is headroom for the rest of the process.
+   */
+  static const double kMemoryBudgetFraction;
+
+  /**
+   * The estimated memory (in bytes) used by a single comparison, excluding
+   * the memory that scales with the size of the input files.
+   */
+  static const size_t kComparisonBaseMemory;
+
+  /**
+   * The estimated memory (in bytes) used by a comparison per byte of input
+   * audio file.
+   */
+  static const size_t kComparisonMemoryPerInputByte;
+
+  /**
+   * Probe the resources available to this process.
+   *
+   * @return The resource limits. Limits that cannot be read are reported as
+   *    unlimited.
+   */
+  static ResourceLimits Probe();
+
+  /**
+   * Probe the resources available to this process, reading the cgroup files
+   * from the given locations.
+   *
+   * @param cgroup_root The mount point of the cgroup filesystem.
+   * @param proc_self_cgroup The file listing the cgroups of this process.
+   * @param hardware_concurrency The number of hardware threads on the host.
+   *
+   * @return The resource limits. Limits that cannot be read are reported as
+   *    unlimited.
+   */
+  static ResourceLimits Probe(const FilePath &cgroup_root,
+                              const FilePath &proc_self_cgroup,
+                              const size_t hardware_concurrency);
+
+  /**
+   * Derive the execution parameters from the given resource limits. The
+   * number of workers is limited by both the CPU quota and the memory budget.
+   *
+   * @param limits The resource limits.
+   *
+   * @return The derived execution parameters.
+   */
+  static ExecutionConfig DeriveExecutionConfig(const ResourceLimits &limits);
+
+  /**
+   * Estimate the memory (in bytes) needed to compare a pair of files. The
+   * size of a pipe or standard input is not known, so is not counted.
+   *
+   * @param reference The path to the reference audio file.
+   * @param degraded The path to the degraded audio file.
+   *
+   * @return The estimated memory use.
+   */
+  static size_t EstimateComparisonMemory(const FilePath &reference,
+                                         const FilePath &degraded);
+
+  /**
+   * Describe the resource limits and derived execution parameters, for
+   * logging.
+   *
+   * @param limits The resource limits.
+   * @param config The derived execution parameters.
+   *
+   * @return A single line description.
+   */
+  static std::string Describe(const ResourceLimits &limits,
+                              const ExecutionConfig &config);
+
+ private:
+  /**
+   * Find the directory of the given cgroup v1 controller, or the cgroup v2
+   * unified hierarchy if controller is empty, for this process.
+   *
+   * @param cgroup_root The mount point of the cgroup filesystem.
+   * @param proc_self_cgroup The file listing the cgroups of this process.
+   * @param controller The cgroup v1 controller name, or empty for cgroup v2.
+   *
+   * @return The directory, or an empty path if it was not found.
+   */
+  static FilePath FindCgroupDir(const FilePath &cgroup_root,
+                                const FilePath &proc_self_cgroup,
+                                const std::string &controller);
+
+  /**
+   * Read the first line of a file.
+   *
+   * @param path The file to read.
+   * @param line Populated with the first line.
+   *
+   * @return True if the line was read.
+   */
+  static bool ReadFirstLine(const FilePath &path, std::string *line);
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_RESOURCE_PROBE_H
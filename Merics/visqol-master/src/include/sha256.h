@@ -0,0 +1,119 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_SHA256_H
+#define VISQOL_INCLUDE_SHA256_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+namespace Visqol {
+
+/**
+ * Computes SHA-256 digests (FIPS 180-4) and HMACs, for naming and checking
+ * content that is shared between hosts.
+ */
+class Sha256 {
+ public:
+  /**
+   * The size of a digest in bytes.
+   */
+  static const size_t kDigestBytes;
+
+  /**
+   * Compute the digest of a block of memory.
+   *
+   * @param data The data.
+   * @param size The size of the data in bytes.
+   *
+   * @return The digest, as kDigestBytes raw bytes.
+   */
+  static std::string Hash(const void *data, size_t size);
+
+  /**
+   * Compute the digest of a string.
+   *
+   * @param data The data.
+   *
+   * @return The digest, as kDigestBytes raw bytes.
+   */
+  static std::string Hash(absl::string_view data);
+
+  /**
+   * Compute the HMAC-SHA256 (RFC 2104) of a message, which only holders of
+   * the secret can produce or check.
+   *
+   * @param secret The secret key.
+   * @param message The message.
+   *
+   * @return The code, as kDigestBytes raw bytes.
+   */
+  static std::string Hmac(absl::string_view secret, absl::string_view message);
+
+  /**
+   * Constructs a hasher of no data.
+   */
+  Sha256();
+
+  /**
+   * Add data to the digest.
+   *
+   * @param data The data.
+   * @param size The size of the data in bytes.
+   */
+  void Update(const void *data, size_t size);
+
+  /**
+   * Finish the digest. The hasher must not be updated afterwards.
+   *
+   * @return The digest of all the data added, as kDigestBytes raw bytes.
+   */
+  std::string Finish();
+
+ private:
+  /**
+   * Mix a 64 byte block into the state.
+   *
+   * @param block The block.
+   */
+  void ProcessBlock(const unsigned char *block);
+
+  /**
+   * The hash state.
+   */
+  uint32_t state_[8];
+
+  /**
+   * The data not yet forming a whole block.
+   */
+  unsigned char buffer_[64];
+
+  /**
+   * The number of bytes held in buffer_.
+   */
+  size_t buffer_size_ = 0;
+
+  /**
+   * The number of bytes added so far.
+   */
+  uint64_t total_bytes_ = 0;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_SHA256_H
@@ -24,11 +24,13 @@
 #include <string>
 
 #include "absl/base/internal/raw_logging.h"
+#include "absl/status/status.h"
 #include "google/protobuf/util/json_util.h"
 
 #include "similarity_result.pb.h"  // Generated by cc_proto_library rule
 #include "conformance.h"
 #include "file_path.h"
+#include "zstd_frame_writer.h"
 
 
 namespace Visqol {
@@ -61,7 +63,203 @@ class SimilarityResultsWriter {
     }
   }
 
+  /**
+   * Write the results of a single ViSQOL comparison to zstd compressed
+   * outputs. Results are also written to console, as for the uncompressed
+   * outputs.
+   *
+   * @param verbose If true, write the results to console.
+   * @param results_output_csv If not null, the basic comparison results will
+   *    be written here in CSV format. The header is written before the first
+   *    row.
+   * @param debug_output If not null, the comparison result will be written
+   *    here in JSON format.
+   * @param sim_res_msg The comparison result to write.
+   */
+  static void Write(const bool verbose,
+                    ZstdFrameWriter *results_output_csv,
+                    ZstdFrameWriter *debug_output,
+                    const SimilarityResultMsg &sim_res_msg,
+                    const bool use_speech_mode) {
+    WriteToConsole(sim_res_msg, verbose, use_speech_mode);
+
+    if (debug_output != nullptr) {
+      std::string debug_json;
+      if (FormatDebugJSON(sim_res_msg, &debug_json)) {
+        LogWriteError(debug_output->Write(debug_json));
+      }
+    }
+
+    if (results_output_csv != nullptr) {
+      LogWriteError(results_output_csv->Write(FormatResultsCSV(
+          sim_res_msg, results_output_csv->BytesWritten() == 0)));
+    }
+  }
+
+  /**
+   * Write the quality over time of a single ViSQOL comparison to a CSV file,
+   * with one row per timeline window.
+   *
+   * @param timeline_output_csv The path to the output CSV file. If the file
+   *    already exists, rows will be appended to it.
+   * @param sim_res_msg The comparison result to write.
+   */
+  static void WriteTimelineToCSV(const FilePath &timeline_output_csv,
+                                 const SimilarityResultMsg &sim_res_msg) {
+    // If this file does not already exist, we need to write the header.
+    const bool write_header = !timeline_output_csv.Exists();
+    std::ofstream out_file;
+    out_file.open(timeline_output_csv.Path(), std::ios_base::app);
+    out_file << FormatTimelineCSV(sim_res_msg, write_header);
+    out_file.close();
+  }
+
+  /**
+   * Write the quality over time of a single ViSQOL comparison to a zstd
+   * compressed CSV output, with one row per timeline window. The header is
+   * written before the first row.
+   *
+   * @param timeline_output_csv The compressed output.
+   * @param sim_res_msg The comparison result to write.
+   */
+  static void WriteTimelineToCSV(ZstdFrameWriter *timeline_output_csv,
+                                 const SimilarityResultMsg &sim_res_msg) {
+    LogWriteError(timeline_output_csv->Write(FormatTimelineCSV(
+        sim_res_msg, timeline_output_csv->BytesWritten() == 0)));
+  }
+
  private:
+  /**
+   * Log the error of a failed write to a compressed output.
+   *
+   * @param status The status of the write.
+   */
+  static void LogWriteError(const absl::Status &status) {
+    if (!status.ok()) {
+      ABSL_RAW_LOG(ERROR, "Error writing compressed output: %s",
+                   status.ToString().c_str());
+    }
+  }
+
+  /**
+   * Format the timeline windows of a comparison as CSV rows.
+   *
+   * @param sim_res_msg The comparison result to format.
+   * @param write_header If true, the rows are preceded by the header.
+   *
+   * @return The formatted rows.
+   */
+  static std::string FormatTimelineCSV(const SimilarityResultMsg &sim_res_msg,
+                                       const bool write_header) {
+    std::stringstream ss;
+    if (write_header) {
+      ss << "reference,degraded,start_time,end_time,moslqo,vnsim,"
+            "num_patches" << std::endl;
+    }
+    for (const auto &window : sim_res_msg.timeline()) {
+      ss << sim_res_msg.reference_filepath() << ","
+         << sim_res_msg.degraded_filepath() << ","
+         << window.start_time() << "," << window.end_time() << ","
+         << window.moslqo() << "," << window.vnsim() << ","
+         << window.num_patches() << std::endl;
+    }
+    return ss.str();
+  }
+
+  /**
+   * Format a comparison result as JSON.
+   *
+   * @param sim_res_msg The comparison result to format.
+   * @param debug_json The string the JSON is written to.
+   *
+   * @return False, after logging the error, if the result could not be
+   *    formatted.
+   */
+  static bool FormatDebugJSON(const SimilarityResultMsg &sim_res_msg,
+                              std::string *debug_json) {
+    if (!google::protobuf::util::MessageToJsonString(sim_res_msg,
+            debug_json).ok()) {
+      ABSL_RAW_LOG(ERROR, "Error writing debug JSON: %s ",
+          sim_res_msg.ShortDebugString().c_str());
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Format the reference and degraded filepath, along with the resulting
+   * MOS-LQO from their comparison, as a CSV row.
+   *
+   * @param sim_res_msg The comparison result to format.
+   * @param write_header If true, the row is preceded by the header.
+   * @param output_moslqo If true, write a column for the mean opinion score.
+   * @param output_fvnsim If true, write a column with the average nsim value
+   *    per frequency.
+   * @param output_stddev If true, write a column with the nsim standard
+   *    deviation per frequency.
+   * @param output_fvdegenergy If true, write a column with the degraded
+   *    energy per frequency.
+   *
+   * @return The formatted row.
+   */
+  static std::string FormatResultsCSV(const SimilarityResultMsg &sim_res_msg,
+                                      const bool write_header,
+                                      const bool output_moslqo = true,
+                                      const bool output_fvnsim = true,
+                                      const bool output_stddev = true,
+                                      const bool output_fvdegenergy = true) {
+    std::stringstream ss;
+    if (write_header) {
+      ss << "reference,degraded";
+      if (output_moslqo) {
+        ss << ",moslqo";
+      }
+
+      if (output_fvnsim) {
+        for (size_t i = 0; i < sim_res_msg.fvnsim_size(); i++) {
+          ss << ",fvnsim" << i;
+        }
+      }
+      if (output_stddev) {
+        for (size_t i = 0; i < sim_res_msg.fstdnsim_size(); i++) {
+          ss << ",fstdnsim" << i;
+        }
+      }
+      if (output_fvdegenergy) {
+        for (size_t i = 0; i < sim_res_msg.fvdegenergy_size(); i++) {
+          ss << ",fvdegenergy" << i;
+        }
+      }
+      ss << std::endl;
+    }
+
+    ss << sim_res_msg.reference_filepath() << ","
+       << sim_res_msg.degraded_filepath();
+
+    if (output_moslqo) {
+      ss << "," << std::setprecision(9) << sim_res_msg.moslqo();
+    }
+
+    if (output_fvnsim) {
+      for (size_t i = 0; i < sim_res_msg.fvnsim_size(); i++) {
+        ss << "," << std::setprecision(9) << sim_res_msg.fvnsim(i);
+      }
+    }
+    if (output_stddev) {
+      for (size_t i = 0; i < sim_res_msg.fstdnsim_size(); i++) {
+        ss << "," << std::setprecision(9) << sim_res_msg.fstdnsim(i);
+      }
+    }
+    if (output_fvdegenergy) {
+      for (size_t i = 0; i < sim_res_msg.fvdegenergy_size(); i++) {
+        ss << "," << std::setprecision(9) << sim_res_msg.fvdegenergy(i);
+      }
+    }
+
+    ss << std::endl;
+    return ss.str();
+  }
+
   /**
    * Write the results of the comparison, along with some basic debug info, to
    * console.
@@ -86,7 +284,46 @@ class SimilarityResultsWriter {
       std::cout << std::endl << FormatFVNSIM(sim_res_msg) << std::endl;
       std::cout << FormatPatchSimilarity(sim_res_msg)
                 << std::endl;
+      std::cout << FormatComputationStats(sim_res_msg) << std::endl;
+    }
+  }
+
+  /**
+   * Format the statistics on the work performed during the comparison.
+   *
+   * @param sim_res_msg The similarity result containing the relevant stats.
+   *
+   * @return A string containing the formatted stats.
+   */
+  static std::string FormatComputationStats(
+      const SimilarityResultMsg &sim_res_msg) {
+    const auto &stats = sim_res_msg.computation_stats();
+    std::stringstream ss;
+    ss << "Spectrogram columns computed:\t"
+       << stats.spectrogram_columns_computed() << " of "
+       << stats.spectrogram_columns_total() << std::endl;
+    ss << "Patches finely aligned:\t" << stats.patches_fine_aligned()
+       << " (skipped " << stats.patches_fine_alignment_skipped() << ")"
+       << std::endl;
+    ss << "Patch candidates pruned:\t" << stats.patch_candidates_pruned()
+       << " of "
+       << stats.patch_candidates_pruned() + stats.patch_candidates_evaluated()
+       << std::endl;
+    ss << std::fixed << std::setprecision(3)
+       << "Stage times (s):\tload " << stats.load_seconds()
+       << ", global alignment " << stats.global_alignment_seconds()
+       << ", preprocessing " << stats.preprocessing_seconds()
+       << ", patch search " << stats.patch_search_seconds()
+       << ", fine alignment " << stats.fine_alignment_seconds()
+       << ", quality mapping " << stats.quality_mapping_seconds()
+       << std::endl;
+    if (stats.leading_silence_trimmed() > 0.0 ||
+        stats.trailing_silence_trimmed() > 0.0) {
+      ss << "Silence trimmed (s):\tleading "
+         << stats.leading_silence_trimmed() << ", trailing "
+         << stats.trailing_silence_trimmed() << std::endl;
     }
+    return ss.str();
   }
 
   /**
@@ -176,15 +413,11 @@ class SimilarityResultsWriter {
   static void WriteDebugJSON(const FilePath &debug_output_path,
       const SimilarityResultMsg &sim_res_msg) {
     std::string debug_json;
-    if (google::protobuf::util::MessageToJsonString(sim_res_msg,
-            &debug_json).ok()) {
+    if (FormatDebugJSON(sim_res_msg, &debug_json)) {
       std::ofstream outFile;
       outFile.open(debug_output_path.Path(), std::ios_base::app);
       outFile << debug_json;
       outFile.close();
-    } else {
-      ABSL_RAW_LOG(ERROR, "Error writing debug JSON: %s ",
-          sim_res_msg.ShortDebugString().c_str());
     }
   }
 
@@ -208,55 +441,9 @@ class SimilarityResultsWriter {
     const bool write_header = !csv_res_path.Exists();
     std::ofstream out_file;
     out_file.open(csv_res_path.Path(), std::ios_base::app);
-
-    if (write_header) {
-      out_file << "reference,degraded";
-      if (output_moslqo) {
-        out_file << ",moslqo";
-      }
-
-      if (output_fvnsim) {
-        for (size_t i = 0; i < sim_res_msg.fvnsim_size(); i++) {
-          out_file << ",fvnsim" << i;
-        }
-      }
-      if (output_stddev) {
-        for (size_t i = 0; i < sim_res_msg.fstdnsim_size(); i++) {
-          out_file << ",fstdnsim" << i;
-        }
-      }
-      if (output_fvdegenergy) {
-        for (size_t i = 0; i < sim_res_msg.fvdegenergy_size(); i++) {
-          out_file << ",fvdegenergy" << i;
-        }
-      }
-      out_file << std::endl;
-    }
-
-    out_file << sim_res_msg.reference_filepath() << ","
-             << sim_res_msg.degraded_filepath();
-
-    if (output_moslqo) {
-      out_file << "," << std::setprecision(9) << sim_res_msg.moslqo();
-    }
-
-    if (output_fvnsim) {
-      for (size_t i = 0; i < sim_res_msg.fvnsim_size(); i++) {
-        out_file << "," << std::setprecision(9) << sim_res_msg.fvnsim(i);
-      }
-    }
-    if (output_stddev) {
-      for (size_t i = 0; i < sim_res_msg.fstdnsim_size(); i++) {
-        out_file << "," << std::setprecision(9) << sim_res_msg.fstdnsim(i);
-      }
-    }
-    if (output_fvdegenergy) {
-      for (size_t i = 0; i < sim_res_msg.fvdegenergy_size(); i++) {
-        out_file << "," << std::setprecision(9) << sim_res_msg.fvdegenergy(i);
-      }
-    }
-
-    out_file << std::endl;
+    out_file << FormatResultsCSV(sim_res_msg, write_header, output_moslqo,
+                                 output_fvnsim, output_stddev,
+                                 output_fvdegenergy);
     out_file.close();
   }
 };
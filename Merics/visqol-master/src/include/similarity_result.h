@@ -20,20 +20,169 @@
 #include <vector>
 
 #include "file_path.h"
-#include "patch_similarity_comparator.h"
+#include "patch_similarity_table.h"
 
 
 namespace Visqol {
+/**
+ * Struct used for storing the wall time spent in each stage of a comparison.
+ */
+struct StageTimes {
+  /**
+   * The wall time in seconds spent loading the signals from their files.
+   */
+  double load_seconds = 0.0;
+
+  /**
+   * The wall time in seconds spent globally aligning the degraded signal.
+   */
+  double global_alignment_seconds = 0.0;
+
+  /**
+   * The wall time in seconds spent matching the signal levels and preparing
+   * the reference spectrogram patches.
+   */
+  double preprocessing_seconds = 0.0;
+
+  /**
+   * The wall time in seconds spent searching for the most similar degraded
+   * patches, including the degraded spectrogram columns computed for it.
+   */
+  double patch_search_seconds = 0.0;
+
+  /**
+   * The wall time in seconds spent finely aligning the matched patches.
+   */
+  double fine_alignment_seconds = 0.0;
+
+  /**
+   * The wall time in seconds spent computing the features and mapping them
+   * to a quality score.
+   */
+  double quality_mapping_seconds = 0.0;
+};
+
 /**
  * Struct used for storing debug information related to a specific
  * similarity comparison result.
  */
 struct SimilarityDebugInfo {
   /**
-   * Vector of results from the comparison of each reference and degraded patch
+   * The results from the comparison of each reference and degraded patch
    * pair.
    */
-  std::vector<PatchSimilarityResult> patch_sims;
+  PatchSimilarityTable patch_sims;
+
+  /**
+   * The number of spectrogram columns (summed over the reference and degraded
+   * spectrograms) that were computed for the patch search.
+   */
+  size_t spectrogram_columns_computed = 0;
+
+  /**
+   * The total number of spectrogram columns (summed over the reference and
+   * degraded spectrograms) that the signals span.
+   */
+  size_t spectrogram_columns_total = 0;
+
+  /**
+   * The number of matched patches that were finely aligned.
+   */
+  size_t patches_fine_aligned = 0;
+
+  /**
+   * The number of matched patches that kept their coarse alignment due to the
+   * fine alignment policy.
+   */
+  size_t patches_fine_alignment_skipped = 0;
+
+  /**
+   * The number of degraded patch candidates whose similarity was measured
+   * during the patch search.
+   */
+  size_t patch_candidates_evaluated = 0;
+
+  /**
+   * The number of degraded patch candidates that the patch search pruned
+   * without measuring their similarity.
+   */
+  size_t patch_candidates_pruned = 0;
+
+  /**
+   * The wall time spent in each stage of the comparison.
+   */
+  StageTimes stage_times;
+};
+
+/**
+ * The similarity result for the patches within one window of the reference
+ * signal.
+ */
+struct TimelineWindow {
+  /**
+   * The time in seconds where this window starts in the reference signal.
+   */
+  double start_time;
+
+  /**
+   * The time in seconds where this window ends in the reference signal.
+   */
+  double end_time;
+
+  /**
+   * The MOS-LQO predicted from the patches within this window.
+   */
+  double moslqo;
+
+  /**
+   * The mean of the FVNSIM values for this window.
+   */
+  double vnsim;
+
+  /**
+   * The mean similarity of the patches within this window for each frequency
+   * band, ordered from the lowest frequency band to the highest.
+   */
+  std::vector<double> fvnsim;
+
+  /**
+   * The number of patches within this window.
+   */
+  size_t num_patches;
+};
+
+/**
+ * The prepared spectrograms of a reference and degraded signal pair, as
+ * compared by the patch search.
+ */
+struct SpectrogramFeatures {
+  /**
+   * The reference spectrogram, with a row for each frequency band and a
+   * column for each frame.
+   */
+  AMatrix<double> reference;
+
+  /**
+   * The degraded spectrogram, with a row for each frequency band and a column
+   * for each frame.
+   */
+  AMatrix<double> degraded;
+
+  /**
+   * The center frequency of each band, from the lowest to the highest.
+   */
+  std::vector<double> center_freq_bands;
+
+  /**
+   * The time in seconds between the starts of consecutive frames.
+   */
+  double frame_duration;
+
+  /**
+   * The time in seconds of the start of the first frame, relative to the
+   * start of the signals. This is only non-zero if silence was trimmed.
+   */
+  double start_time = 0.0;
 };
 
 /**
@@ -81,6 +230,12 @@ struct SimilarityResult {
    */
   SimilarityDebugInfo debug_info;
 
+  /**
+   * The similarity results for sliding windows of the reference signal, in
+   * time order. Empty unless requested.
+   */
+  std::vector<TimelineWindow> timeline;
+
   /**
    * If the reference audio signal was read in from file, this will store the
    * path to this file.
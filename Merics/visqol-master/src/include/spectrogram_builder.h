@@ -17,6 +17,9 @@
 #ifndef VISQOL_INCLUDE_SPECTROGRAMBUILDER_H
 #define VISQOL_INCLUDE_SPECTROGRAMBUILDER_H
 
+#include <cstddef>
+#include <vector>
+
 #include "absl/status/statusor.h"
 
 #include "analysis_window.h"
@@ -53,6 +56,50 @@ class SpectrogramBuilder {
   virtual absl::StatusOr<Spectrogram> Build(
       const AudioSignal &signal,
       const AnalysisWindow &window) = 0;
+
+  /**
+   * Calculate the number of columns (frames) that Build would produce for the
+   * given signal and window.
+   *
+   * @param signal The signal that the spectrogram would be built from.
+   * @param window The analysis window that would be used.
+   *
+   * @return The number of spectrogram columns, or an error status if the
+   *    signal is too short to build a spectrogram from.
+   */
+  virtual absl::StatusOr<size_t> NumColumns(
+      const AudioSignal &signal,
+      const AnalysisWindow &window) const = 0;
+
+  /**
+   * Build a contiguous range of columns of the spectrogram representation of
+   * the given signal. The columns produced are identical to the equivalent
+   * columns produced by Build.
+   *
+   * @param signal The signal to produce a spectrogram representation of.
+   * @param window The analysis window that specifies the length and overlap of
+   *    each Hamming window.
+   * @param first_col The index of the first column to build.
+   * @param num_cols The number of columns to build.
+   *
+   * @return A spectrogram holding only the requested columns.
+   */
+  virtual absl::StatusOr<Spectrogram> BuildColumns(
+      const AudioSignal &signal,
+      const AnalysisWindow &window,
+      const size_t first_col,
+      const size_t num_cols) = 0;
+
+  /**
+   * Calculate the center frequencies of the bands that Build would produce for
+   * a signal of the given sample rate, without building a spectrogram.
+   *
+   * @param sample_rate The sample rate of the signal.
+   *
+   * @return The center frequency of each band, from the lowest to the
+   *    highest.
+   */
+  virtual std::vector<double> GetCenterFreqBands(size_t sample_rate) const = 0;
 };
 }  // namespace Visqol
 
@@ -0,0 +1,206 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_SPILL_STORAGE_H
+#define VISQOL_INCLUDE_SPILL_STORAGE_H
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/status/statusor.h"
+
+#include "file_path.h"
+
+namespace Visqol {
+
+/**
+ * This class holds the process wide settings for spilling large intermediate
+ * buffers to memory mapped temporary files, instead of keeping them in RAM.
+ *
+ * The blocks of a spilled buffer's file are reserved when it is created, so
+ * a full disk makes the buffer fall back to memory instead of faulting when
+ * it is written. Pages that are never written take no memory, and pages that
+ * have been written can be written back and dropped by the kernel under
+ * memory pressure rather than the process being killed. The buffers are mapped
+ * with the normal access hint, as the patch search fills its tables in order
+ * but reads them back in reverse.
+ */
+class SpillStorage {
+ public:
+  /**
+   * Set where and above what size buffers are spilled. Should be called
+   * before any comparisons are run.
+   *
+   * @param dir The directory to create the temporary files in. If empty, the
+   *    system's temporary directory is used.
+   * @param threshold_bytes The size in bytes from which buffers are spilled,
+   *    or 0 to never spill them.
+   */
+  static void Configure(const FilePath &dir, size_t threshold_bytes);
+
+  /**
+   * @param num_bytes The size of a buffer in bytes.
+   *
+   * @return True if a buffer of this size should be spilled.
+   */
+  static bool ShouldSpill(size_t num_bytes);
+
+  /**
+   * @return The directory the temporary files are created in.
+   */
+  static FilePath Directory();
+};
+
+/**
+ * A memory mapping of a temporary file, which is deleted as soon as it is
+ * created, so that its space is released once it is unmapped, even if the
+ * process is killed.
+ */
+class MappedTempFile {
+ public:
+  /**
+   * Create a zero filled temporary file and map it into memory.
+   *
+   * @param dir The directory to create the file in.
+   * @param num_bytes The size of the file. Must be greater than 0.
+   *
+   * @return The mapping, or an error status if the file could not be created,
+   *    its space reserved or mapped, or if mapping files is not supported on
+   *    this platform.
+   */
+  static absl::StatusOr<std::unique_ptr<MappedTempFile>> Create(
+      const FilePath &dir, size_t num_bytes);
+
+  MappedTempFile(const MappedTempFile &) = delete;
+  MappedTempFile &operator=(const MappedTempFile &) = delete;
+
+  /**
+   * Unmaps the file, which releases its space.
+   */
+  ~MappedTempFile();
+
+  /**
+   * @return The start of the mapping.
+   */
+  void *Data() const { return data_; }
+
+  /**
+   * @return The size of the mapping in bytes.
+   */
+  size_t Size() const { return size_; }
+
+ private:
+  MappedTempFile(void *data, size_t size) : data_(data), size_(size) {}
+
+  /**
+   * The start of the mapping.
+   */
+  void *data_;
+
+  /**
+   * The size of the mapping in bytes.
+   */
+  size_t size_;
+};
+
+/**
+ * A zero initialised, row major table of trivially copyable values that is
+ * spilled to a MappedTempFile if SpillStorage::ShouldSpill its size, and
+ * otherwise kept in memory. If the file cannot be created, the table is kept
+ * in memory instead.
+ */
+template <typename T>
+class SpillableTable {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Only trivially copyable values can be spilled.");
+
+ public:
+  /**
+   * Constructs a table of the given size, filled with zeros.
+   *
+   * @param num_rows The number of rows.
+   * @param num_cols The number of columns.
+   */
+  SpillableTable(size_t num_rows, size_t num_cols)
+      : num_rows_(num_rows), num_cols_(num_cols) {
+    const size_t num_bytes = num_rows * num_cols * sizeof(T);
+    if (SpillStorage::ShouldSpill(num_bytes)) {
+      auto mapped = MappedTempFile::Create(SpillStorage::Directory(),
+                                           num_bytes);
+      if (mapped.ok()) {
+        mapped_ = std::move(mapped.value());
+        data_ = static_cast<T *>(mapped_->Data());
+        return;
+      }
+    }
+    heap_.assign(num_rows * num_cols, T());
+    data_ = heap_.data();
+  }
+
+  SpillableTable(const SpillableTable &) = delete;
+  SpillableTable &operator=(const SpillableTable &) = delete;
+
+  /**
+   * @param row The index of a row.
+   *
+   * @return The start of the row.
+   */
+  T *operator[](size_t row) { return data_ + row * num_cols_; }
+  const T *operator[](size_t row) const { return data_ + row * num_cols_; }
+
+  /**
+   * @return The number of rows.
+   */
+  size_t NumRows() const { return num_rows_; }
+
+  /**
+   * @return The number of columns.
+   */
+  size_t NumCols() const { return num_cols_; }
+
+  /**
+   * @return True if the table is held in a memory mapped file.
+   */
+  bool IsSpilled() const { return mapped_ != nullptr; }
+
+ private:
+  /**
+   * The dimensions of the table.
+   */
+  size_t num_rows_;
+  size_t num_cols_;
+
+  /**
+   * The mapped file holding the table, if spilled.
+   */
+  std::unique_ptr<MappedTempFile> mapped_;
+
+  /**
+   * The table, if not spilled.
+   */
+  std::vector<T> heap_;
+
+  /**
+   * The start of the table.
+   */
+  T *data_ = nullptr;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_SPILL_STORAGE_H
@@ -17,6 +17,7 @@
 #ifndef VISQOL_INCLUDE_SUPPORTVECTORREGRESSIONMODEL_H
 #define VISQOL_INCLUDE_SUPPORTVECTORREGRESSIONMODEL_H
 
+#include <cstddef>
 #include <vector>
 
 #include "file_path.h"
@@ -62,6 +63,20 @@ class SupportVectorRegressionModel {
   void Init(const std::vector<MlObservation> &observations,
             const std::vector<MlTarget> &targets);
 
+  /**
+   * Initialize the SVR model using a dense matrix of observations and a
+   * vector of targets, e.g. as mapped from a training matrix file. These are
+   * used to train the SVR model and save it for prediction usage. The
+   * matrix is copied, so it need not outlive the model.
+   *
+   * @param observations The row-major observation matrix.
+   * @param targets The target of each observation.
+   * @param num_observations The number of observations (rows).
+   * @param num_features The number of features in each observation.
+   */
+  void Init(const double *observations, const MlTarget *targets,
+            size_t num_observations, size_t num_features);
+
   /**
    * Using the SVR model, predict a quality value for the given observation.
    *
@@ -71,6 +86,17 @@ class SupportVectorRegressionModel {
    */
   double Predict(const MlObservation &observation) const;
 
+  /**
+   * Write the SVR model to a model file, which can later be loaded with
+   * Init or passed to ViSQOL with --similarity_to_quality_model.
+   *
+   * @param model_path The path to write the SVR model file to.
+   *
+   * @return An OK status if the model was written. Else, an error status is
+   * returned.
+   */
+  absl::Status Save(const FilePath &model_path) const;
+
  private:
   /**
    * The svm model provided by the LIBSVM library.
@@ -87,6 +113,7 @@ class SupportVectorRegressionModel {
   /**
    * Pointer to an array of pointers used by the model for training.
    * As per the docs, this memory can't be freed while the model is used.
+   * Allocated by LibSvmTargetObservationConvertor::ConvertObservations.
    */
   svm_node **observations_ptr_;
 
@@ -95,6 +122,14 @@ class SupportVectorRegressionModel {
    */
   size_t num_observations_;
 
+  /**
+   * Train the SVR model on the observations held in observations_ptr_.
+   *
+   * @param targets The target of each observation.
+   * @param num_features The number of features in each observation.
+   */
+  void Train(const MlTarget *targets, size_t num_features);
+
 };
 }  // namespace Visqol
 
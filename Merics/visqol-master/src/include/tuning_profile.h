@@ -0,0 +1,86 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_TUNING_PROFILE_H
+#define VISQOL_INCLUDE_TUNING_PROFILE_H
+
+#include <cstddef>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+#include "file_path.h"
+
+namespace Visqol {
+
+/**
+ * This struct holds the machine dependent execution parameters selected by
+ * the autotuner. None of these parameters alter the similarity score produced
+ * for a signal pair; they only affect how quickly it is produced.
+ */
+struct TuningProfile {
+  /**
+   * The number of hardware threads reported by the host when the profile was
+   * generated. A warning is logged when the profile is loaded on a host with a
+   * different number.
+   */
+  size_t host_concurrency = 0;
+
+  /**
+   * The number of signal pairs that are compared concurrently in batch mode.
+   */
+  size_t num_workers = 1;
+};
+
+/**
+ * This class is used for reading and writing tuning profiles to disk. The
+ * file format is a plain text list of 'key=value' lines. Lines starting with
+ * '#' are treated as comments.
+ */
+class TuningProfileFile {
+ public:
+  /**
+   * The version of the tuning profile file format.
+   */
+  static const int kFormatVersion;
+
+  /**
+   * Read a tuning profile from the given file. Keys that are not recognised
+   * are ignored with a warning, so that profiles written by newer versions
+   * can still be loaded.
+   *
+   * @param path The path to the tuning profile file.
+   *
+   * @return The parsed tuning profile if the file was read successfully, else
+   *    an error status.
+   */
+  static absl::StatusOr<TuningProfile> Read(const FilePath &path);
+
+  /**
+   * Write a tuning profile to the given file, replacing any existing contents.
+   *
+   * @param path The path to write the tuning profile to.
+   * @param profile The tuning profile to write.
+   *
+   * @return An OK status if the profile was written successfully, else an
+   *    error status.
+   */
+  static absl::Status Write(const FilePath &path,
+                            const TuningProfile &profile);
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_TUNING_PROFILE_H
@@ -23,9 +23,11 @@
 
 #include "analysis_window.h"
 #include "audio_signal.h"
+#include "cancellation_token.h"
 #include "comparison_patches_selector.h"
 #include "file_path.h"
 #include "image_patch_creator.h"
+#include "patch_similarity_table.h"
 #include "similarity_result.h"
 #include "similarity_to_quality_mapper.h"
 #include "spectrogram.h"
@@ -57,6 +59,15 @@ class Visqol {
    *    score.
    * @param search_window This parameter is used to determine how far the
    *    algorithm will search in order to find the most optimal match.
+   * @param cancellation If not null, the comparison stops with a status of
+   *    deadline exceeded once this token is cancelled.
+   * @param stage_times If not null, the time of each stage is written here as
+   *    soon as the stage ends, so that the times of the stages that ran are
+   *    available even if the comparison fails or is cancelled.
+   * @param ref_spectrogram If not null, the raw spectrogram of the whole
+   *    reference signal built by spect_builder, such as one fetched from a
+   *    ReferenceFeatureCache. The reference columns are taken from it rather
+   *    than computed, which gives the same result.
    *
    * @return If the comparison was successful, return the similarity result and
    *    associated debug info. Else, return an error status.
@@ -67,7 +78,52 @@ class Visqol {
       const ImagePatchCreator *patch_creator,
       const ComparisonPatchesSelector *comparison_patches_selector,
       const SimilarityToQualityMapper *sim_to_qual_mapper,
-      const int search_window) const;
+      const int search_window,
+      const CancellationToken *cancellation = nullptr,
+      StageTimes *stage_times = nullptr,
+      const Spectrogram *ref_spectrogram = nullptr) const;
+
+  /**
+   * Build the spectrograms of two audio signals and prepare them for
+   * comparison, as CalculateSimilarity does, without comparing them. The
+   * whole of both spectrograms is computed.
+   *
+   * @param ref_signal The reference signal.
+   * @param deg_signal The degraded signal, which is scaled to match the sound
+   *    pressure level of the reference signal.
+   * @param spect_builder The spectrogram builder used for building
+   *    spectrograms from the above input signals.
+   * @param window The Hamming window used for analysis of the signals.
+   *
+   * @return If successful, the prepared spectrograms. Else, return an error
+   *    status.
+   */
+  absl::StatusOr<SpectrogramFeatures> CalculateSpectrograms(
+      const AudioSignal &ref_signal, AudioSignal &deg_signal,
+      SpectrogramBuilder *spect_builder, const AnalysisWindow &window) const;
+
+  /**
+   * Compute the quality over time from the patch comparison results of a
+   * single comparison, so that no signal processing is repeated. Each window
+   * holds the patches whose midpoint in the reference signal falls within it,
+   * and its quality is predicted from their mean similarity, as for the whole
+   * signal. Windows that would extend beyond the last patch are not included,
+   * unless the signal is shorter than a single window, in which case the one
+   * window covers all of the patches. Windows without patches are skipped.
+   *
+   * @param patch_sims The patch comparison results.
+   * @param sim_to_qual_mapper Used to convert a similarity score to a quality
+   *    score.
+   * @param window_duration The duration of each window in seconds.
+   * @param hop_duration The time in seconds between the starts of
+   *    consecutive windows.
+   *
+   * @return The similarity result of each window, in time order.
+   */
+  std::vector<TimelineWindow> CalculateTimeline(
+      const PatchSimilarityTable &patch_sims,
+      const SimilarityToQualityMapper *sim_to_qual_mapper,
+      const double window_duration, const double hop_duration) const;
 
  private:
   /**
@@ -94,7 +150,7 @@ class Visqol {
    * @return The resulting set of FVNSIM scores.
    */
   AMatrix<double> CalcPerPatchMeanFreqBandMeans(
-      const std::vector<PatchSimilarityResult> &sim_match_info) const;
+      const PatchSimilarityTable &sim_match_info) const;
 
   /**
    * Produces a set of FVNSIM scores' stddev in similarity between
@@ -107,7 +163,7 @@ class Visqol {
    * @return The resulting set of FSTDNSIM scores.
    */
   AMatrix<double> CalcPerPatchMeanFreqBandStdDevs(
-      const std::vector<PatchSimilarityResult> &sim_match_info,
+      const PatchSimilarityTable &sim_match_info,
       const double frame_duration) const;
 
   /**
@@ -118,7 +174,7 @@ class Visqol {
    * @return The resulting set of per frequency energies.
    */
   AMatrix<double> CalcPerPatchMeanFreqBandDegradedEnergy(
-      const std::vector<PatchSimilarityResult> &sim_match_info) const;
+      const PatchSimilarityTable &sim_match_info) const;
 
   /**
    * This function alters the resulting MOS-LQO score in cases where the audio
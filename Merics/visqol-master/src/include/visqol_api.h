@@ -31,8 +31,7 @@ namespace Visqol {
 class VisqolApi {
  public:
   /**
-   * Currently, 48k is the only sample rate supported by ViSQOL Audio. This
-   * constant is used to check for that.
+   * The sample rate ViSQOL Audio was trained with.
    */
   static const size_t k48kSampleRate;
 
@@ -70,7 +69,7 @@ class VisqolApi {
   /**
    * The instance of ViSQOL that will be used for comparing the signals.
    */
-  Visqol::VisqolManager visqol_;
+  VisqolManager visqol_;
 
   /**
    * The sample rate of the input signals to be compared.
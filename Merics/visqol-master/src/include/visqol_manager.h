@@ -21,10 +21,12 @@
 #include <utility>
 #include <vector>
 
+#include "cancellation_token.h"
 #include "comparison_patches_selector.h"
 #include "file_path.h"
 #include "gammatone_spectrogram_builder.h"
 #include "image_patch_creator.h"
+#include "reference_feature_cache.h"
 #include "similarity_result.h"
 #include "similarity_result.pb.h"  // Generated by cc_proto_library rule
 #include "svr_similarity_to_quality_mapper.h"
@@ -77,6 +79,13 @@ class VisqolManager {
    */
   static const double kDurationMismatchTolerance;
 
+  /**
+   * The silence (measured in seconds) kept on each side of the active region
+   * of the reference when trimming silence. This is the padding recommended
+   * around the audible part of the input signals.
+   */
+  static const double kSilenceTrimPadding;
+
   /**
    * Initializes an instance for use with the given similarity to quality
    * mapping model. Must be called before running comparisons.
@@ -90,36 +99,106 @@ class VisqolManager {
    * @param search_window The search_window parameter determines how far the
    *    comparison algorithm will search to discover the most optimal match for
    *    a given reference patch.
+   * @param fine_alignment_policy Controls which matched patches are finely
+   *    aligned. The default policy finely aligns every patch.
+   * @param patch_search_policy Controls how the patch search is pruned. The
+   *    default policy prunes it.
    *
    * @return An 'OK' status if initialised successfully, else an error status.
    */
   absl::Status Init(const FilePath sim_to_quality_mapper_model,
                     const bool use_speech_mode, const bool use_unscaled_speech,
-                    const int search_window );
+                    const int search_window,
+                    const FineAlignmentPolicy &fine_alignment_policy =
+                        FineAlignmentPolicy(),
+                    const PatchSearchPolicy &patch_search_policy =
+                        PatchSearchPolicy());
+
+  /**
+   * Compute the quality over time for each comparison, from sliding windows
+   * of its patch comparison results. See Visqol::CalculateTimeline.
+   *
+   * @param window_duration The duration of each window in seconds. A value
+   *    of 0 (the default) disables the timeline.
+   * @param hop_duration The time in seconds between the starts of
+   *    consecutive windows.
+   */
+  void SetTimeline(double window_duration, double hop_duration) {
+    timeline_window_duration_ = window_duration;
+    timeline_hop_duration_ = hop_duration;
+  }
+
+  /**
+   * Trim the leading and trailing silence of the reference before each
+   * comparison. The active region of the reference is found with
+   * MiscAudio::FindActiveRegion, with kSilenceTrimPadding seconds of padding,
+   * and the same samples are removed from both signals before they are
+   * aligned. The reported patch times are relative to the start of the
+   * untrimmed signals. Trimming changes the scores slightly, as the level
+   * matching and the patches no longer include the trimmed silence.
+   *
+   * @param trim_silence True to trim the silence. False (the default)
+   *    compares the whole signals.
+   */
+  void SetSilenceTrimming(bool trim_silence) { trim_silence_ = trim_silence; }
+
+  /**
+   * Fetch the prepared features of each reference from a cache, and publish
+   * the features computed on a miss, so that a reference compared many
+   * times, here or on other nodes sharing the cache server, is only prepared
+   * once. The scores are identical with or without the cache.
+   *
+   * @param cache The cache, which may be shared by many managers, or null
+   *    (the default) to always compute the features.
+   */
+  void SetReferenceFeatureCache(std::shared_ptr<ReferenceFeatureCache> cache) {
+    reference_cache_ = std::move(cache);
+  }
 
   /**
    * Perform a comparison on a single reference/degraded audio file pair.
    *
    * @param ref_signal_path The path to the reference audio file.
    * @param deg_signal_path The path to the degraded audio file.
+   * @param cancellation If not null, the comparison stops once this token is
+   *    cancelled. The status of deadline exceeded that is then returned
+   *    gives the time spent in each stage that ran.
    *
    * @return A StatusOr object that will contain a SimilarityResultMsg if the
    *    comparison was successful, else it will contain the error Status.
    */
   absl::StatusOr<SimilarityResultMsg> Run(
-      const FilePath& ref_signal_path, const FilePath& deg_signal_path);
+      const FilePath& ref_signal_path, const FilePath& deg_signal_path,
+      const CancellationToken* cancellation = nullptr);
 
   /**
    * Perform a comparison on a single reference/degraded audio signal pair.
    *
    * @param ref_signal The reference audio signal.
    * @param deg_signal The degraded audio signal.
+   * @param cancellation If not null, the comparison stops once this token is
+   *    cancelled, as above.
    *
    * @return A StatusOr object that will contain a SimilarityResultMsg if the
    *    comparison was successful, else it will contain the error Status.
    */
   absl::StatusOr<SimilarityResultMsg> Run(
-      const AudioSignal& ref_signal, AudioSignal& deg_signal);
+      const AudioSignal& ref_signal, AudioSignal& deg_signal,
+      const CancellationToken* cancellation = nullptr);
+
+  /**
+   * Build the prepared spectrograms of a single reference/degraded audio file
+   * pair, as they would be compared by Run, without comparing them. If
+   * silence trimming is enabled, the spectrograms cover the trimmed signals.
+   *
+   * @param ref_signal_path The path to the reference audio file.
+   * @param deg_signal_path The path to the degraded audio file.
+   *
+   * @return A StatusOr object that will contain the spectrograms if they were
+   *    built successfully, else it will contain the error Status.
+   */
+  absl::StatusOr<SpectrogramFeatures> ExtractSpectrograms(
+      const FilePath& ref_signal_path, const FilePath& deg_signal_path);
 
  private:
   /**
@@ -144,6 +223,38 @@ class VisqolManager {
   */
   int search_window_ = 60;
 
+  /**
+   * Controls which matched patches are finely aligned.
+   */
+  FineAlignmentPolicy fine_alignment_policy_;
+
+  /**
+   * Controls how the patch search is pruned.
+   */
+  PatchSearchPolicy patch_search_policy_;
+
+  /**
+   * True if the silence around the active region of the reference is
+   * trimmed before each comparison.
+   */
+  bool trim_silence_ = false;
+
+  /**
+   * The cache of the prepared reference features, or null.
+   */
+  std::shared_ptr<ReferenceFeatureCache> reference_cache_;
+
+  /**
+   * The duration of the timeline windows in seconds, or 0 if the timeline is
+   * disabled.
+   */
+  double timeline_window_duration_ = 0.0;
+
+  /**
+   * The time between the starts of consecutive timeline windows in seconds.
+   */
+  double timeline_hop_duration_ = 0.0;
+
   /**
    * Used for creating the patches from both the reference and degraded signals
    * for comparison.
@@ -198,6 +309,76 @@ class VisqolManager {
    */
   absl::Status ErrorIfNotInitialized();
 
+  /**
+   * The samples of the reference that are kept for a comparison.
+   */
+  struct TrimmedReference {
+    /**
+     * The trimmed reference, or nullopt if nothing was trimmed.
+     */
+    absl::optional<AudioSignal> signal;
+
+    /**
+     * The first sample of the untrimmed reference that is kept.
+     */
+    size_t start = 0;
+
+    /**
+     * One past the last sample of the untrimmed reference that is kept.
+     */
+    size_t end = 0;
+  };
+
+  /**
+   * Validate a reference/degraded audio signal pair, trim their silence if
+   * enabled, and globally align the degraded signal to the reference. Both
+   * the comparison and the spectrogram extraction go through here, so they
+   * prepare the signals the same way.
+   *
+   * @param ref_signal The reference audio signal.
+   * @param deg_signal The degraded audio signal, which is trimmed and
+   *    aligned in place.
+   * @param cancellation If not null, an error status is returned once this
+   *    token is cancelled.
+   * @param stage_times Records the time spent on the global alignment.
+   *
+   * @return The samples of the reference that are kept, or an error status.
+   */
+  absl::StatusOr<TrimmedReference> AlignSignals(
+      const AudioSignal& ref_signal, AudioSignal& deg_signal,
+      const CancellationToken* cancellation, StageTimes* stage_times);
+
+  /**
+   * Compare a reference/degraded audio signal pair, recording the time spent
+   * in each stage as it ends.
+   *
+   * @param ref_signal The reference audio signal.
+   * @param deg_signal The degraded audio signal.
+   * @param cancellation If not null, the comparison stops once this token is
+   *    cancelled.
+   * @param stage_times The stage times, which may already hold the time
+   *    spent loading the signals.
+   *
+   * @return The similarity result in protobuf format, or an error status.
+   */
+  absl::StatusOr<SimilarityResultMsg> Compare(
+      const AudioSignal& ref_signal, AudioSignal& deg_signal,
+      const CancellationToken* cancellation, StageTimes* stage_times);
+
+  /**
+   * Fetch the raw spectrogram of a reference from the reference feature
+   * cache, or build and publish it on a miss.
+   *
+   * @param ref_signal The reference audio signal, after any trimming.
+   * @param window The analysis window of the comparison.
+   *
+   * @return The spectrogram, or nullopt if no cache is set or it could not be
+   *    built, in which case the comparison computes the reference columns
+   *    itself.
+   */
+  absl::optional<Spectrogram> PrepareReference(const AudioSignal& ref_signal,
+                                               const AnalysisWindow& window);
+
   /**
    * For a given ViSQOL similarity result, populate a similarity result
    * protobuf message for return.
@@ -46,10 +46,20 @@ class WavReader {
 
   /**
   * Returns the total number of samples defined in the WAV header. Note that
-  * the actual number of samples in the file can differ.
+  * the actual number of samples in the file can differ. Returns 0 if the
+  * length is not known.
   */
   size_t GetNumTotalSamples() const;
 
+  /**
+  * True if the number of samples is known before they are read. Writers that
+  * stream to a pipe cannot go back to fill in the size of the data chunk, and
+  * leave it as 0xFFFFFFFF. If the stream cannot be seeked either, the samples
+  * run to the end of the stream, and must be read until ReadSamples returns
+  * fewer than were asked for.
+  */
+  bool IsLengthKnown() const;
+
   /**
   * Returns number of channels.
   */
@@ -78,7 +88,8 @@ class WavReader {
   /**
    * Calculate the total number of bytes in the data stream.
    *
-   * @return The total number of bytes in the data stream.
+   * @return The total number of bytes in the data stream, or -1 if the
+   *    stream cannot be seeked, such as a pipe.
    */
   int64_t GetCountOfBytesInStream();
 
@@ -98,6 +109,15 @@ class WavReader {
   */
   size_t ReadBinaryDataFromStream(void* target_ptr, size_t size);
 
+  /**
+  * Helper method to skip over data in the input stream. Reads rather than
+  * seeks, so that it also works on pipes.
+  *
+  * @param size Number of bytes to skip.
+  * @return Number of bytes skipped.
+  */
+  size_t SkipBinaryDataInStream(size_t size);
+
   /**
   * Binary input stream.
   */
@@ -123,6 +143,11 @@ class WavReader {
   */
   size_t num_total_samples_;
 
+  /**
+  * Flag indicating if the total number of samples is known.
+  */
+  bool length_known_;
+
   /**
   * Number of remaining samples in WAV file.
   */
@@ -139,9 +164,14 @@ class WavReader {
   uint64_t pcm_offset_bytes_;
 
   /**
-   * Total number of bytes in data stream.
+   * Total number of bytes in data stream, or -1 if it is not known.
    */
   int64_t bytes_in_stream_;
+
+  /**
+   * Number of bytes read from the data stream so far.
+   */
+  uint64_t stream_position_;
 };
 
 }  // namespace Visqol
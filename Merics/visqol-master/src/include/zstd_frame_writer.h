@@ -0,0 +1,219 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_ZSTD_FRAME_WRITER_H
+#define VISQOL_INCLUDE_ZSTD_FRAME_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+
+#include "file_path.h"
+
+namespace Visqol {
+
+/**
+ * This class writes a text or binary stream to a file in the zstd seekable
+ * format.
+ *
+ * The stream is cut into frames of a fixed uncompressed size, and each frame
+ * is compressed independently, so that any frame can be decompressed without
+ * the frames before it. The file ends with a seek table, in a skippable frame
+ * that ordinary zstd decoders ignore, giving the compressed and decompressed
+ * size of every frame. Tools that understand the seekable format can then
+ * read any part of the stream, while `zstd -d` still decompresses the whole
+ * file.
+ *
+ * Writes only append to the current frame. A background thread compresses
+ * and writes the completed frames, so the callers never wait for the
+ * compression or the disk.
+ */
+class ZstdFrameWriter {
+ public:
+  /**
+   * The default uncompressed size of each frame.
+   */
+  static const size_t kDefaultFrameSize;
+
+  /**
+   * The magic number that starts the skippable frame holding the seek table.
+   */
+  static const uint32_t kSkippableFrameMagic;
+
+  /**
+   * The magic number that ends the seek table.
+   */
+  static const uint32_t kSeekTableFooterMagic;
+
+  /**
+   * @return The highest compression level supported.
+   */
+  static int MaxCompressionLevel();
+
+  /**
+   * Compress data into a single zstd frame, which records its decompressed
+   * size.
+   *
+   * @param data The data to compress.
+   * @param level The compression level, from 1 to MaxCompressionLevel().
+   *
+   * @return The compressed frame, or an error status if the data could not
+   *    be compressed.
+   */
+  static absl::StatusOr<std::string> CompressFrame(const std::string &data,
+                                                   int level);
+
+  /**
+   * Constructs a writer. No file is opened until Open is called.
+   *
+   * @param path The path of the compressed file.
+   * @param level The compression level, from 1 to MaxCompressionLevel().
+   * @param frame_size The uncompressed size of each frame. A value of 0 is
+   *    treated as 1.
+   */
+  ZstdFrameWriter(const FilePath &path, int level,
+                  size_t frame_size = kDefaultFrameSize);
+
+  ZstdFrameWriter(const ZstdFrameWriter &) = delete;
+  ZstdFrameWriter &operator=(const ZstdFrameWriter &) = delete;
+
+  /**
+   * Closes the file, if it was not already closed.
+   */
+  ~ZstdFrameWriter();
+
+  /**
+   * Open the file, replacing any existing contents, and start the
+   * compression thread.
+   *
+   * @return An error status if the file could not be opened.
+   */
+  absl::Status Open();
+
+  /**
+   * Append data to the stream. May be called from many threads at once.
+   *
+   * @param data The data to append.
+   *
+   * @return An error status if the writer is not open, or if an earlier
+   *    frame could not be compressed or written.
+   */
+  absl::Status Write(const std::string &data);
+
+  /**
+   * @return The number of uncompressed bytes written to the stream so far.
+   */
+  size_t BytesWritten() const;
+
+  /**
+   * Compress and write the remaining data, then write the seek table and
+   * close the file.
+   *
+   * @return An error status if a frame or the seek table could not be
+   *    written.
+   */
+  absl::Status Close();
+
+ private:
+  /**
+   * Compress and write the queued frames until the writer is closed.
+   */
+  void CompressLoop();
+
+  /**
+   * @return The seek table frame for the frames written.
+   */
+  std::string SeekTable() const;
+
+  /**
+   * The path of the compressed file.
+   */
+  FilePath path_;
+
+  /**
+   * The compression level.
+   */
+  int level_;
+
+  /**
+   * The uncompressed size of each frame.
+   */
+  size_t frame_size_;
+
+  /**
+   * The compressed file. Only written by the compression thread while open.
+   */
+  std::ofstream out_;
+
+  /**
+   * Compresses and writes the frames.
+   */
+  std::thread compress_thread_;
+
+  /**
+   * The compressed and decompressed size of each frame written. Only used by
+   * the compression thread while open.
+   */
+  std::vector<std::pair<uint32_t, uint32_t>> frame_sizes_;
+
+  /**
+   * Guards the members below.
+   */
+  mutable absl::Mutex mutex_;
+
+  /**
+   * True while the file is open.
+   */
+  bool is_open_ = false;
+
+  /**
+   * True once Close is called, which stops the compression thread once the
+   * queue is empty.
+   */
+  bool closing_ = false;
+
+  /**
+   * The data of the frame that is not yet complete.
+   */
+  std::string current_frame_;
+
+  /**
+   * The completed frames waiting to be compressed.
+   */
+  std::deque<std::string> queued_frames_;
+
+  /**
+   * The number of uncompressed bytes written to the stream so far.
+   */
+  size_t bytes_written_ = 0;
+
+  /**
+   * The first error the compression thread failed with.
+   */
+  absl::Status write_status_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_ZSTD_FRAME_WRITER_H
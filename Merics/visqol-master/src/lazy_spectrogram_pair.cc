@@ -0,0 +1,181 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lazy_spectrogram_pair.h"
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+#include "misc_audio.h"
+#include "status_macros.h"
+
+namespace Visqol {
+
+const size_t LazySpectrogramPair::kColumnBlockSize = 32;
+
+LazySpectrogramPair::LazySpectrogramPair(SpectrogramBuilder *spect_builder,
+                                         const AudioSignal &ref_signal,
+                                         const AudioSignal &deg_signal,
+                                         const AnalysisWindow &window,
+                                         const Spectrogram *ref_spectrogram)
+    : spect_builder_(spect_builder),
+      ref_signal_(ref_signal),
+      deg_signal_(deg_signal),
+      ref_spectrogram_(ref_spectrogram),
+      window_(window) {}
+
+absl::Status LazySpectrogramPair::Init(
+    const CancellationToken *cancellation) {
+  VISQOL_ASSIGN_OR_RETURN(ref_num_cols_,
+                          spect_builder_->NumColumns(ref_signal_, window_));
+  VISQOL_ASSIGN_OR_RETURN(deg_num_cols_,
+                          spect_builder_->NumColumns(deg_signal_, window_));
+  if (ref_spectrogram_ != nullptr &&
+      ref_spectrogram_->Data().NumCols() != ref_num_cols_) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "The prepared reference spectrogram has " +
+                        std::to_string(ref_spectrogram_->Data().NumCols()) +
+                        " columns, but the reference signal has " +
+                        std::to_string(ref_num_cols_) + ".");
+  }
+  const size_t max_cols = std::max(ref_num_cols_, deg_num_cols_);
+  block_computed_.assign((max_cols + kColumnBlockSize - 1) / kColumnBlockSize,
+                         false);
+
+  // Every prepared value is raised to at least the absolute noise floor, so
+  // the global minimum is known as soon as any value sits on that floor. In
+  // practice this happens in the first block. Otherwise, keep computing
+  // blocks until either it does, or the whole spectrogram has been computed
+  // and the minimum is exact anyway.
+  double lowest_floor = std::numeric_limits<double>::max();
+  for (size_t block = 0; block < block_computed_.size(); block++) {
+    VISQOL_RETURN_IF_ERROR(CancellationToken::Check(cancellation));
+    VISQOL_RETURN_IF_ERROR(ComputeBlock(block));
+    const size_t first_col = block * kColumnBlockSize;
+    const size_t ref_cols =
+        std::min(kColumnBlockSize, ref_num_cols_ - std::min(ref_num_cols_,
+                                                            first_col));
+    const size_t deg_cols =
+        std::min(kColumnBlockSize, deg_num_cols_ - std::min(deg_num_cols_,
+                                                            first_col));
+    if (ref_cols > 0) {
+      const auto cols = ref_data_.GetColumns(first_col,
+                                             first_col + ref_cols - 1);
+      lowest_floor = std::min(lowest_floor,
+                              *std::min_element(cols.cbegin(), cols.cend()));
+    }
+    if (deg_cols > 0) {
+      const auto cols = deg_data_.GetColumns(first_col,
+                                             first_col + deg_cols - 1);
+      lowest_floor = std::min(lowest_floor,
+                              *std::min_element(cols.cbegin(), cols.cend()));
+    }
+    if (lowest_floor <= MiscAudio::kNoiseFloorAbsoluteDb) {
+      break;
+    }
+  }
+
+  // Normalize the blocks computed so far. Blocks computed later are
+  // normalized as they are built.
+  global_floor_ = lowest_floor;
+  global_floor_resolved_ = true;
+  ref_data_ = ref_data_ - global_floor_;
+  deg_data_ = deg_data_ - global_floor_;
+  return absl::Status();
+}
+
+absl::Status LazySpectrogramPair::EnsureColumns(size_t first_col,
+                                                size_t last_col) {
+  const size_t max_cols = std::max(ref_num_cols_, deg_num_cols_);
+  if (max_cols == 0 || first_col > last_col) {
+    return absl::Status();
+  }
+  last_col = std::min(last_col, max_cols - 1);
+  for (size_t block = first_col / kColumnBlockSize;
+       block <= last_col / kColumnBlockSize; block++) {
+    if (!block_computed_[block]) {
+      VISQOL_RETURN_IF_ERROR(ComputeBlock(block));
+    }
+  }
+  return absl::Status();
+}
+
+absl::Status LazySpectrogramPair::ComputeBlock(size_t block_index) {
+  const size_t first_col = block_index * kColumnBlockSize;
+  Spectrogram ref_block;
+  if (ref_spectrogram_ != nullptr) {
+    ref_block = SliceBlock(*ref_spectrogram_, first_col);
+  } else {
+    VISQOL_ASSIGN_OR_RETURN(ref_block,
+                            BuildBlock(ref_signal_, ref_num_cols_, first_col));
+  }
+  Spectrogram deg_block;
+  VISQOL_ASSIGN_OR_RETURN(deg_block,
+                          BuildBlock(deg_signal_, deg_num_cols_, first_col));
+
+  // Allocate the output on the first block, now the band count is known.
+  if (center_freq_bands_.empty()) {
+    const auto &bands = ref_block.GetCenterFreqBands().empty() ?
+        deg_block.GetCenterFreqBands() : ref_block.GetCenterFreqBands();
+    center_freq_bands_ = bands;
+    ref_data_ = AMatrix<double>::Filled(bands.size(), ref_num_cols_, 0.0);
+    deg_data_ = AMatrix<double>::Filled(bands.size(), deg_num_cols_, 0.0);
+  }
+
+  MiscAudio::ApplySpectrogramNoiseFloors(ref_block, deg_block);
+  if (global_floor_resolved_) {
+    ref_block.SubtractFloor(global_floor_);
+    deg_block.SubtractFloor(global_floor_);
+  }
+
+  for (size_t i = 0; i < ref_block.Data().NumCols(); i++) {
+    ref_data_.SetColumn(first_col + i, ref_block.Data().GetColumn(i));
+  }
+  for (size_t i = 0; i < deg_block.Data().NumCols(); i++) {
+    deg_data_.SetColumn(first_col + i, deg_block.Data().GetColumn(i));
+  }
+  num_columns_computed_ +=
+      ref_block.Data().NumCols() + deg_block.Data().NumCols();
+  block_computed_[block_index] = true;
+  return absl::Status();
+}
+
+absl::StatusOr<Spectrogram> LazySpectrogramPair::BuildBlock(
+    const AudioSignal &signal, size_t total_cols, size_t first_col) {
+  if (first_col >= total_cols) {
+    return Spectrogram();
+  }
+  const size_t num_cols = std::min(kColumnBlockSize, total_cols - first_col);
+  return spect_builder_->BuildColumns(signal, window_, first_col, num_cols);
+}
+
+Spectrogram LazySpectrogramPair::SliceBlock(const Spectrogram &spectrogram,
+                                            size_t first_col) const {
+  const size_t total_cols = spectrogram.Data().NumCols();
+  if (first_col >= total_cols) {
+    return Spectrogram();
+  }
+  const size_t num_cols = std::min(kColumnBlockSize, total_cols - first_col);
+  Spectrogram block(
+      spectrogram.Data().GetColumns(first_col, first_col + num_cols - 1));
+  block.SetCenterFreqBands(spectrogram.GetCenterFreqBands());
+  return block;
+}
+}  // namespace Visqol
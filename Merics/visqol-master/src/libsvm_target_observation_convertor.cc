@@ -20,21 +20,50 @@
 namespace Visqol {
 svm_node** LibSvmTargetObservationConvertor::ConvertObservations(
     const std::vector<MlObservation> &observations, size_t num_features) const {
-  svm_node** svm_observations = reinterpret_cast<svm_node**>(
-      malloc(sizeof(svm_node*) * observations.size()));
+  svm_node** svm_observations =
+      ConvertObservations(nullptr, observations.size(), num_features);
   for (size_t row_i = 0; row_i < observations.size(); row_i++) {
-    svm_node* row = reinterpret_cast<svm_node*>(
-        malloc(sizeof(svm_node) * (num_features + 1)));
+    for (size_t col_i = 0; col_i < num_features; col_i++) {
+      svm_observations[row_i][col_i].value = observations[row_i][col_i];
+    }
+  }
+  return svm_observations;
+}
+
+svm_node** LibSvmTargetObservationConvertor::ConvertObservations(
+    const double *values, size_t num_observations, size_t num_features) const {
+  // One arena holds the rows back to back, each terminated by an index of -1.
+  // A null values leaves the node values to be filled in by the caller.
+  const size_t row_size = num_features + 1;
+  svm_node** svm_observations = reinterpret_cast<svm_node**>(
+      malloc(sizeof(svm_node*) * (num_observations + 1)));
+  svm_node* arena = reinterpret_cast<svm_node*>(
+      malloc(sizeof(svm_node) * row_size * num_observations));
+  for (size_t row_i = 0; row_i < num_observations; row_i++) {
+    svm_node* row = arena + row_i * row_size;
     for (size_t col_i = 0; col_i < num_features; col_i++) {
       row[col_i].index = col_i + 1;
-      row[col_i].value = observations[row_i][col_i];
+      row[col_i].value =
+          values == nullptr ? 0.0 : values[row_i * num_features + col_i];
     }
     row[num_features].index = -1;
     svm_observations[row_i] = row;
   }
+  // The arena is also recorded after the last row, so that it can be freed
+  // when there are no rows.
+  svm_observations[num_observations] = arena;
   return svm_observations;
 }
 
+void LibSvmTargetObservationConvertor::FreeObservations(
+    svm_node** observations) const {
+  if (observations == nullptr) {
+    return;
+  }
+  free(observations[0]);
+  free(observations);
+}
+
 svm_node* LibSvmTargetObservationConvertor::ConvertObservation(
     const MlObservation &observation) const {
   size_t num_features = observation.size();
@@ -12,13 +12,46 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <memory>
+#include <string>
+#include <utility>
+
 #include "absl/base/internal/raw_logging.h"
+#include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 
+#include "arrow_results_writer.h"
+#include "autotuner.h"
+#include "batch_comparison_runner.h"
 #include "commandline_parser.h"
+#include "cost_model.h"
+#include "directory_watcher.h"
+#include "feature_shard_writer.h"
+#include "progress_reporter.h"
+#include "reference_cache_service.h"
+#include "reference_feature_cache.h"
+#include "resource_probe.h"
 #include "sim_results_writer.h"
-#include "visqol_manager.h"
+#include "spill_storage.h"
+#include "tuning_profile.h"
+#include "zstd_frame_writer.h"
+
+namespace {
+// The watcher to stop when interrupted, or null if not watching.
+std::atomic<Visqol::DirectoryWatcher *> active_watcher{nullptr};
+
+// Stop watching, letting the comparisons already queued finish.
+void StopWatching(int) {
+  Visqol::DirectoryWatcher *watcher = active_watcher.load();
+  if (watcher != nullptr) {
+    watcher->RequestStop();
+  }
+}
+}  // namespace
 
 int main(int argc, char **argv) {
   // Parse the command line args.
@@ -29,39 +62,313 @@ int main(int argc, char **argv) {
     return -1;
   }
   Visqol::CommandLineArgs cmd_args = parse_statusor.value();
+  Visqol::SpillStorage::Configure(cmd_args.spill_dir,
+                                  cmd_args.spill_threshold_bytes);
+
+  if (cmd_args.autotune) {
+    // Benchmark this host and persist the fastest configuration.
+    const Visqol::Autotuner autotuner(cmd_args.sim_to_quality_mapper_model,
+        cmd_args.use_speech_mode, cmd_args.use_unscaled_speech_mos_mapping,
+        cmd_args.search_window_radius);
+    auto profile_statusor = autotuner.Tune();
+    if (!profile_statusor.ok()) {
+      ABSL_RAW_LOG(ERROR, "%s",
+          profile_statusor.status().ToString().c_str());
+      return -1;
+    }
+    auto write_status = Visqol::TuningProfileFile::Write(
+        cmd_args.tuning_profile_path, profile_statusor.value());
+    if (!write_status.ok()) {
+      ABSL_RAW_LOG(ERROR, "%s", write_status.ToString().c_str());
+      return -1;
+    }
+    return 0;
+  }
+
+  // Size the worker pool and memory budget to the resources this process may
+  // use, which in a container can be far less than the host has.
+  const Visqol::ResourceLimits limits = Visqol::ResourceProbe::Probe();
+  const Visqol::ExecutionConfig exec_config =
+      Visqol::ResourceProbe::DeriveExecutionConfig(limits);
+  ABSL_RAW_LOG(INFO, "%s",
+      Visqol::ResourceProbe::Describe(limits, exec_config).c_str());
+
+  // Load the execution parameters from the tuning profile, if provided. The
+  // profile may not exceed the available resources.
+  Visqol::TuningProfile profile;
+  profile.num_workers = exec_config.num_workers;
+  if (!cmd_args.tuning_profile_path.Path().empty()) {
+    auto profile_statusor =
+        Visqol::TuningProfileFile::Read(cmd_args.tuning_profile_path);
+    if (profile_statusor.ok()) {
+      profile = profile_statusor.value();
+      if (profile.host_concurrency != 0 &&
+          profile.host_concurrency != limits.hardware_concurrency) {
+        ABSL_RAW_LOG(WARNING,
+            "The tuning profile was generated on a host with %zu threads, "
+            "but this host has %zu. Rerun with --autotune to retune.",
+            profile.host_concurrency, limits.hardware_concurrency);
+      }
+      profile.num_workers =
+          std::min(profile.num_workers, exec_config.num_workers);
+    } else {
+      ABSL_RAW_LOG(WARNING, "Ignoring tuning profile: %s",
+          profile_statusor.status().ToString().c_str());
+    }
+  }
   auto files_to_compare = Visqol::VisqolCommandLineParser::BuildFilePairPaths(
       cmd_args);
 
   // Init ViSQOL.
-  Visqol::VisqolManager visqol;
+  Visqol::FineAlignmentPolicy fine_alignment_policy;
+  fine_alignment_policy.skip_similarity_threshold =
+      cmd_args.fine_alignment_skip_threshold;
+  fine_alignment_policy.approximate_zero_lag =
+      cmd_args.approximate_fine_alignment_at_zero_lag;
+  Visqol::PatchSearchPolicy patch_search_policy;
+  patch_search_policy.prune = !cmd_args.exhaustive_patch_search;
+  Visqol::BatchComparisonRunner visqol(profile.num_workers);
+  visqol.SetMemoryBudget(exec_config.memory_budget_bytes);
+  visqol.SetPairCpuTimeLimit(cmd_args.pair_cpu_time_limit_seconds);
   auto init_status = visqol.Init(cmd_args.sim_to_quality_mapper_model,
       cmd_args.use_speech_mode,
-      cmd_args.use_unscaled_speech_mos_mapping, cmd_args.search_window_radius);
+      cmd_args.use_unscaled_speech_mos_mapping, cmd_args.search_window_radius,
+      fine_alignment_policy, patch_search_policy);
   if (!init_status.ok()) {
     ABSL_RAW_LOG(ERROR, "%s",
         init_status.ToString().c_str());
     return -1;
   }
 
-  // Iterate over all signal pairs to compare.
-  for (const auto& signal_pair : files_to_compare) {
-    // Run comparison on a single signal pair.
-    auto status_or = visqol.Run(signal_pair.reference, signal_pair.degraded);
-    // If successful write value, else log an error.
-    if (status_or.ok()) {
-      Visqol::SimilarityResultsWriter::Write(
-          cmd_args.verbose, cmd_args.results_output_csv,
-          cmd_args.debug_output_path, status_or.value(), cmd_args.use_speech_mode);
-    } else {
+  // Predict the run time of each pair, so that the longest pairs are started
+  // first. The calibration from previous runs is loaded, if provided.
+  Visqol::CostModel cost_model(cmd_args.use_speech_mode,
+                               cmd_args.search_window_radius);
+  if (!cmd_args.cost_model_path.Path().empty()) {
+    auto read_status = cost_model.Read(cmd_args.cost_model_path);
+    if (!read_status.ok() &&
+        read_status.code() != absl::StatusCode::kNotFound) {
+      ABSL_RAW_LOG(WARNING, "Ignoring cost model: %s",
+          read_status.ToString().c_str());
+      cost_model = Visqol::CostModel(cmd_args.use_speech_mode,
+                                     cmd_args.search_window_radius);
+    }
+  }
+  visqol.SetCostModel(&cost_model);
+  visqol.SetSilenceTrimming(cmd_args.trim_silence);
+  if (!cmd_args.reference_cache.empty()) {
+    // Share the prepared reference features between the workers and, with a
+    // server, across the fleet.
+    std::unique_ptr<Visqol::ReferenceCacheClient> remote;
+    std::string secret;
+    if (cmd_args.reference_cache != Visqol::kLocalReferenceCache) {
+      const auto address = Visqol::ReferenceCacheClient::ParseAddress(
+          cmd_args.reference_cache);
+      remote = absl::make_unique<Visqol::ReferenceCacheClient>(
+          address.value().first, address.value().second);
+      auto read_secret = Visqol::ReferenceFeatureCache::ReadSecret(
+          cmd_args.reference_cache_secret_file.Path());
+      if (!read_secret.ok()) {
+        ABSL_RAW_LOG(ERROR, "%s", read_secret.status().ToString().c_str());
+        return -1;
+      }
+      secret = std::move(read_secret).value();
+    }
+    visqol.SetReferenceFeatureCache(
+        std::make_shared<Visqol::ReferenceFeatureCache>(
+            cmd_args.reference_cache_local_bytes, std::move(remote), secret));
+  }
+  if (!cmd_args.timeline_output_csv.Path().empty()) {
+    visqol.SetTimeline(cmd_args.timeline_window_seconds,
+                       cmd_args.timeline_hop_seconds);
+  }
+
+  // Report the progress of the batch, if requested.
+  std::unique_ptr<Visqol::ProgressReporter> progress_reporter;
+  if (!cmd_args.progress_output_path.Path().empty()) {
+    progress_reporter = absl::make_unique<Visqol::ProgressReporter>(
+        cmd_args.progress_output_path, cmd_args.progress_interval_seconds);
+    auto open_status = progress_reporter->Open();
+    if (!open_status.ok()) {
+      ABSL_RAW_LOG(ERROR, "%s", open_status.ToString().c_str());
+      return -1;
+    }
+    visqol.SetProgressReporter(progress_reporter.get());
+  }
+
+  // Open the columnar results output, if requested.
+  std::unique_ptr<Visqol::ArrowResultsWriter> arrow_writer;
+  if (!cmd_args.results_output_arrow.Path().empty()) {
+    arrow_writer = absl::make_unique<Visqol::ArrowResultsWriter>(
+        cmd_args.results_output_arrow, cmd_args.patch_results_output_arrow,
+        Visqol::ArrowResultsWriter::kDefaultRowsPerBatch,
+        cmd_args.compression_level);
+    auto open_status = arrow_writer->Open();
+    if (!open_status.ok()) {
+      ABSL_RAW_LOG(ERROR, "%s", open_status.ToString().c_str());
+      return -1;
+    }
+  }
+
+  // Compress the text outputs, if requested. Each output is compressed by its
+  // own background thread, so delivering a result only formats it.
+  std::unique_ptr<Visqol::ZstdFrameWriter> results_zstd;
+  std::unique_ptr<Visqol::ZstdFrameWriter> debug_zstd;
+  std::unique_ptr<Visqol::ZstdFrameWriter> timeline_zstd;
+  if (cmd_args.compression_level > 0) {
+    for (auto output : {std::make_pair(&cmd_args.results_output_csv,
+                                       &results_zstd),
+                        std::make_pair(&cmd_args.debug_output_path,
+                                       &debug_zstd),
+                        std::make_pair(&cmd_args.timeline_output_csv,
+                                       &timeline_zstd)}) {
+      if (output.first->Path().empty()) {
+        continue;
+      }
+      *output.second = absl::make_unique<Visqol::ZstdFrameWriter>(
+          *output.first, cmd_args.compression_level);
+      auto open_status = (*output.second)->Open();
+      if (!open_status.ok()) {
+        ABSL_RAW_LOG(ERROR, "%s", open_status.ToString().c_str());
+        return -1;
+      }
+    }
+  }
+
+  // Extract features instead of writing the results, if requested. The
+  // workers write the features as each shard is completed.
+  std::unique_ptr<Visqol::FeatureShardWriter> feature_writer;
+  if (cmd_args.feature_stage.has_value()) {
+    feature_writer = absl::make_unique<Visqol::FeatureShardWriter>(
+        cmd_args.features_output_dir, cmd_args.feature_stage.value(),
+        files_to_compare.size(), cmd_args.features_pairs_per_shard);
+    auto open_status = feature_writer->Open();
+    if (!open_status.ok()) {
+      ABSL_RAW_LOG(ERROR, "%s", open_status.ToString().c_str());
+      return -1;
+    }
+    visqol.SetFeatureWriter(feature_writer.get());
+  }
+
+  // If successful write the result, else log an error. The pair's mode may
+  // differ from the command line's. When extracting features, the worker has
+  // already written them instead.
+  auto write_result = [&cmd_args, &arrow_writer, &feature_writer,
+      &results_zstd, &debug_zstd, &timeline_zstd](bool use_speech_mode,
+      const absl::StatusOr<Visqol::SimilarityResultMsg>& status_or) {
+    if (!status_or.ok()) {
       ABSL_RAW_LOG(ERROR, "Error executing ViSQOL: %s.",
                    status_or.status().ToString().c_str());
-      // A status of aborted gets thrown when visqol hasn't been init'd.
-      // So if that happens we want to quit processing.
-      if (status_or.status().code() == absl::StatusCode::kAborted) {
-        break;
+    } else if (!feature_writer) {
+      if (cmd_args.compression_level > 0) {
+        Visqol::SimilarityResultsWriter::Write(
+            cmd_args.verbose, results_zstd.get(), debug_zstd.get(),
+            status_or.value(), use_speech_mode);
+        if (timeline_zstd) {
+          Visqol::SimilarityResultsWriter::WriteTimelineToCSV(
+              timeline_zstd.get(), status_or.value());
+        }
+      } else {
+        Visqol::SimilarityResultsWriter::Write(
+            cmd_args.verbose, cmd_args.results_output_csv,
+            cmd_args.debug_output_path, status_or.value(), use_speech_mode);
+        if (!cmd_args.timeline_output_csv.Path().empty()) {
+          Visqol::SimilarityResultsWriter::WriteTimelineToCSV(
+              cmd_args.timeline_output_csv, status_or.value());
+        }
+      }
+      if (arrow_writer) {
+        auto append_status = arrow_writer->Append(status_or.value());
+        if (!append_status.ok()) {
+          ABSL_RAW_LOG(ERROR, "Error writing Arrow results: %s.",
+                       append_status.ToString().c_str());
+        }
       }
     }
+  };
+
+  if (!cmd_args.watch_dir.Path().empty()) {
+    // Compare each file written to the watched directory as soon as a worker
+    // is free, until interrupted. Results are delivered as they finish.
+    Visqol::DirectoryWatcher watcher(cmd_args.watch_dir,
+        cmd_args.watch_naming_rule, cmd_args.watch_queue_size,
+        cmd_args.watch_idle_timeout_seconds);
+    auto start_status = watcher.Start();
+    if (!start_status.ok()) {
+      ABSL_RAW_LOG(ERROR, "%s", start_status.ToString().c_str());
+      return -1;
+    }
+    active_watcher.store(&watcher);
+    std::signal(SIGINT, StopWatching);
+    std::signal(SIGTERM, StopWatching);
+    ABSL_RAW_LOG(INFO, "Watching %s for degraded files.",
+                 cmd_args.watch_dir.Path().c_str());
+    visqol.RunStream([&watcher]() { return watcher.Next(); },
+        [&cmd_args, &watcher, &write_result](
+            const Visqol::ReferenceDegradedPathPair& pair,
+            const absl::StatusOr<Visqol::SimilarityResultMsg>& status_or) {
+      write_result(pair.use_speech_mode.value_or(cmd_args.use_speech_mode),
+                   status_or);
+      if (!status_or.ok() &&
+          status_or.status().code() == absl::StatusCode::kAborted) {
+        watcher.RequestStop();
+      }
+    });
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    active_watcher.store(nullptr);
+    watcher.Stop();
+  } else {
+    // Run all signal pair comparisons. Results are delivered in input order.
+    // A status of aborted gets thrown when visqol hasn't been init'd, and
+    // stops any further processing.
+    visqol.Run(files_to_compare, [&cmd_args, &write_result, &visqol,
+        &files_to_compare](size_t job_index,
+        const absl::StatusOr<Visqol::SimilarityResultMsg>& status_or) {
+      write_result(files_to_compare[job_index].use_speech_mode.value_or(
+                       cmd_args.use_speech_mode),
+                   status_or);
+      if (cmd_args.verbose && files_to_compare.size() > 1) {
+        ABSL_RAW_LOG(INFO,
+                     "Compared %zu of %zu pairs, about %.0fs remaining.",
+                     job_index + 1, files_to_compare.size(),
+                     visqol.EstimatedSecondsRemaining());
+      }
+    });
+  }
+
+  if (!cmd_args.cost_model_path.Path().empty()) {
+    auto write_status = cost_model.Write(cmd_args.cost_model_path);
+    if (!write_status.ok()) {
+      ABSL_RAW_LOG(WARNING, "%s", write_status.ToString().c_str());
+    }
+  }
+
+  if (feature_writer) {
+    auto close_status = feature_writer->Close();
+    if (!close_status.ok()) {
+      ABSL_RAW_LOG(ERROR, "%s", close_status.ToString().c_str());
+      return -1;
+    }
   }
 
+  if (arrow_writer) {
+    auto close_status = arrow_writer->Close();
+    if (!close_status.ok()) {
+      ABSL_RAW_LOG(ERROR, "%s", close_status.ToString().c_str());
+      return -1;
+    }
+  }
+
+  for (auto *zstd_writer : {results_zstd.get(), debug_zstd.get(),
+                            timeline_zstd.get()}) {
+    if (zstd_writer != nullptr) {
+      auto close_status = zstd_writer->Close();
+      if (!close_status.ok()) {
+        ABSL_RAW_LOG(ERROR, "%s", close_status.ToString().c_str());
+        return -1;
+      }
+    }
+  }
   return 0;
 }
@@ -19,7 +19,9 @@
 #include <algorithm>
 #include <cmath>
 #include <fstream>
+#include <iostream>
 #include <memory>
+#include <numeric>
 #include <sstream>
 #include <utility>
 #include <vector>
@@ -34,7 +36,11 @@ const size_t MiscAudio::kNumChanMono = 1;
 const double MiscAudio::kZeroSample = 0.0;
 const double MiscAudio::kSplReferencePoint = 0.00002;
 const double kNoiseFloorRelativeToPeakDb = 45.;
-const double kNoiseFloorAbsoluteDb = -45.;
+const double MiscAudio::kNoiseFloorAbsoluteDb = -45.;
+const double MiscAudio::kActivityFrameDuration = 0.02;
+const double MiscAudio::kActivityThresholdDb = -45.;
+// The number of samples to read at a time from a stream of unknown length.
+const size_t kStreamReadBlockSamples = 1 << 16;
 
 AudioSignal MiscAudio::ScaleToMatchSoundPressureLevel(
     const AudioSignal &reference, const AudioSignal &degraded) {
@@ -55,6 +61,61 @@ double MiscAudio::CalcSoundPressureLevel(const AudioSignal &signal) {
   return 20 * std::log10(sound_pressure / kSplReferencePoint);
 }
 
+std::pair<size_t, size_t> MiscAudio::FindActiveRegion(
+    const AudioSignal &signal, const double padding_seconds) {
+  const size_t num_samples = signal.data_matrix.NumRows();
+  const size_t frame_size = std::max<size_t>(
+      1, static_cast<size_t>(kActivityFrameDuration * signal.sample_rate));
+  const size_t num_frames = (num_samples + frame_size - 1) / frame_size;
+
+  // The energy of each frame, summed over the channels. The samples of a
+  // channel are contiguous, so each sum is a single pass over memory.
+  std::vector<double> frame_energy(num_frames, 0.0);
+  const double *samples = signal.data_matrix.data();
+  for (size_t chan = 0; chan < signal.data_matrix.NumCols(); chan++) {
+    const double *channel = samples + chan * num_samples;
+    for (size_t frame = 0; frame < num_frames; frame++) {
+      const size_t begin = frame * frame_size;
+      const size_t end = std::min(begin + frame_size, num_samples);
+      frame_energy[frame] += std::inner_product(
+          channel + begin, channel + end, channel + begin, 0.0);
+    }
+  }
+  const double max_energy =
+      num_frames == 0
+          ? 0.0
+          : *std::max_element(frame_energy.begin(), frame_energy.end());
+  if (max_energy <= 0.0) {
+    return std::make_pair(0, num_samples);
+  }
+
+  const double threshold = max_energy * std::pow(10, kActivityThresholdDb / 10);
+  size_t first_frame = 0;
+  while (frame_energy[first_frame] < threshold) {
+    first_frame++;
+  }
+  size_t last_frame = num_frames - 1;
+  while (frame_energy[last_frame] < threshold) {
+    last_frame--;
+  }
+  const size_t padding =
+      static_cast<size_t>(padding_seconds * signal.sample_rate);
+  const size_t first_active = first_frame * frame_size;
+  const size_t end_active =
+      std::min((last_frame + 1) * frame_size, num_samples);
+  return std::make_pair(first_active > padding ? first_active - padding : 0,
+                        std::min(end_active + padding, num_samples));
+}
+
+AudioSignal MiscAudio::SliceSamples(const AudioSignal &signal,
+                                    const size_t start_sample,
+                                    const size_t end_sample) {
+  // The end row of GetRows is inclusive.
+  AudioSignal sliced{signal.data_matrix.GetRows(start_sample, end_sample - 1),
+                     signal.sample_rate};
+  return sliced;
+}
+
 // Combines the data from all channels into a single channel.
 AMatrix<double> MiscAudio::ToMono(const AMatrix<double> &signal) {
   // If already Mono, nothing to do.
@@ -87,8 +148,15 @@ AudioSignal MiscAudio::ToMono(const AudioSignal &signal) {
 }
 
 AudioSignal MiscAudio::LoadAsMono(const FilePath &path) {
+  // Standard input and pipes are decoded as they are read, rather than being
+  // buffered whole first, so that decoding overlaps with the writer.
+  if (path.IsStdin()) {
+    return LoadAsMono(&std::cin, path.Path());
+  }
   std::ifstream wav_file(path.Path().c_str(), std::ios::binary);
-  if (wav_file) {
+  if (wav_file && path.IsStream()) {
+    return LoadAsMono(&wav_file, path.Path());
+  } else if (wav_file) {
     std::stringstream wav_string_stream;
     wav_string_stream << wav_file.rdbuf();
     wav_file.close();
@@ -100,24 +168,43 @@ AudioSignal MiscAudio::LoadAsMono(const FilePath &path) {
   }
 }
 
-AudioSignal MiscAudio::LoadAsMono(std::stringstream *string_stream,
+AudioSignal MiscAudio::LoadAsMono(std::istream *stream,
                                   absl::optional<std::string> filepath) {
   AudioSignal sig;
-  WavReader wav_reader(string_stream);
+  WavReader wav_reader(stream);
   const size_t num_total_samples = wav_reader.GetNumTotalSamples();
 
-  if (wav_reader.IsHeaderValid() && num_total_samples != 0) {
-    std::vector<int16_t> interleaved_samples(num_total_samples);
-    const auto num_samp_read =
-        wav_reader.ReadSamples(num_total_samples, &interleaved_samples[0]);
-
-    // Certain wav files are 'mostly valid' and have a slight difference with
-    // the reported file length.  Warn for these.
-    if (num_samp_read != num_total_samples) {
-      ABSL_RAW_LOG(WARNING,
-                   "Number of samples read (%lu) was less than the expected"
-                   " number (%lu).",
-                   num_samp_read, num_total_samples);
+  if (wav_reader.IsHeaderValid() &&
+      (num_total_samples != 0 || !wav_reader.IsLengthKnown())) {
+    std::vector<int16_t> interleaved_samples;
+    size_t num_samp_read = 0;
+    if (wav_reader.IsLengthKnown()) {
+      interleaved_samples.resize(num_total_samples);
+      num_samp_read =
+          wav_reader.ReadSamples(num_total_samples, &interleaved_samples[0]);
+
+      // Certain wav files are 'mostly valid' and have a slight difference
+      // with the reported file length.  Warn for these.
+      if (num_samp_read != num_total_samples) {
+        ABSL_RAW_LOG(WARNING,
+                     "Number of samples read (%lu) was less than the expected"
+                     " number (%lu).",
+                     num_samp_read, num_total_samples);
+      }
+    } else {
+      // Read a block at a time until the writer closes the stream.
+      while (true) {
+        interleaved_samples.resize(num_samp_read + kStreamReadBlockSamples);
+        const size_t num_block_samples = wav_reader.ReadSamples(
+            kStreamReadBlockSamples, &interleaved_samples[num_samp_read]);
+        num_samp_read += num_block_samples;
+        if (num_block_samples < kStreamReadBlockSamples) {
+          break;
+        }
+      }
+      // Drop the last frame if the writer stopped part way through it.
+      num_samp_read -= num_samp_read % wav_reader.GetNumChannels();
+      interleaved_samples.resize(num_samp_read);
     }
     if (num_samp_read > 0) {
       const auto interleaved_norm_vec =
@@ -170,6 +257,19 @@ std::vector<std::vector<double>> MiscAudio::ExtractMultiChannel(
 
 void MiscAudio::PrepareSpectrogramsForComparison(
     Spectrogram &reference, Spectrogram &degraded) {
+  ApplySpectrogramNoiseFloors(reference, degraded);
+
+  // Normalize to a 0dB global floor (which is probably kNoiseFloorAbsoluteDb).
+  double ref_floor = reference.Minimum();
+  double deg_floor = degraded.Minimum();
+  double lowest_floor = std::min(ref_floor, deg_floor);
+
+  reference.SubtractFloor(lowest_floor);
+  degraded.SubtractFloor(lowest_floor);
+}
+
+void MiscAudio::ApplySpectrogramNoiseFloors(
+    Spectrogram &reference, Spectrogram &degraded) {
   reference.ConvertToDb();
   degraded.ConvertToDb();
 
@@ -181,12 +281,5 @@ void MiscAudio::PrepareSpectrogramsForComparison(
   // here are each the RMS of a band filter output on the time domain signal.
   reference.RaiseFloorPerFrame(kNoiseFloorRelativeToPeakDb,
                                degraded);
-  // Normalize to a 0dB global floor (which is probably kNoiseFloorAbsoluteDb).
-  double ref_floor = reference.Minimum();
-  double deg_floor = degraded.Minimum();
-  double lowest_floor = std::min(ref_floor, deg_floor);
-
-  reference.SubtractFloor(lowest_floor);
-  degraded.SubtractFloor(lowest_floor);
 }
 }  // namespace Visqol
@@ -15,34 +15,83 @@
 #include "neurogram_similiarity_index_measure.h"
 
 #include <algorithm>
+#include <memory>
 #include <utility>
 #include <vector>
 
+#include "absl/memory/memory.h"
 #include "convolution_2d.h"
 
 namespace Visqol {
-PatchSimilarityResult NeurogramSimiliarityIndexMeasure::MeasurePatchSimilarity(
-    const ImagePatch &ref_patch, const ImagePatch &deg_patch) const {
+namespace {
+// The gaussian window that the local statistics are computed over.
+AMatrix<double> NsimWindow() {
   const std::vector<double> w = {
       0.0113033910173052, 0.0838251475442633, 0.0113033910173052,
       0.0838251475442633, 0.619485845753726,  0.0838251475442633,
       0.0113033910173052, 0.0838251475442633, 0.0113033910173052};
-  AMatrix<double> window(3, 3, std::move(w));
+  return AMatrix<double>(3, 3, std::move(w));
+}
+}  // namespace
+
+PatchSimilarityResult NeurogramSimiliarityIndexMeasure::MeasurePatchSimilarity(
+    const ImagePatch &ref_patch, const ImagePatch &deg_patch) const {
+  // The reference patch is borrowed rather than copied into a prepared patch.
+  return MeasureWithReferenceStats(ref_patch, ComputeReferenceStats(ref_patch),
+                                   deg_patch);
+}
+
+std::unique_ptr<PreparedReferencePatch>
+NeurogramSimiliarityIndexMeasure::PrepareReferencePatch(
+    const ImagePatch &ref_patch) const {
+  auto prepared = absl::make_unique<NsimReferencePatch>();
+  prepared->patch = ref_patch;
+  prepared->stats = ComputeReferenceStats(ref_patch);
+  return prepared;
+}
+
+PatchSimilarityResult
+NeurogramSimiliarityIndexMeasure::MeasurePreparedPatchSimilarity(
+    const PreparedReferencePatch &prepared_ref_patch,
+    const ImagePatch &deg_patch) const {
+  // The prepared patch always comes from PrepareReferencePatch above.
+  const auto &prepared =
+      static_cast<const NsimReferencePatch &>(prepared_ref_patch);
+  return MeasureWithReferenceStats(prepared.patch, prepared.stats, deg_patch);
+}
+
+NeurogramSimiliarityIndexMeasure::NsimReferenceStats
+NeurogramSimiliarityIndexMeasure::ComputeReferenceStats(
+    const ImagePatch &ref_patch) {
+  static const AMatrix<double> window = NsimWindow();
+  NsimReferenceStats stats;
+  stats.mu_r =
+      Convolution2D<double>::Valid2DConvWithBoundary(window, ref_patch);
+  stats.ref_mu_sq = stats.mu_r.PointWiseProduct(stats.mu_r);
+  auto ref_neuro_sq = ref_patch.PointWiseProduct(ref_patch);
+  auto conv2_ref_neuro_sq =
+      Convolution2D<double>::Valid2DConvWithBoundary(window, ref_neuro_sq);
+  stats.sigma_r_sq = conv2_ref_neuro_sq - stats.ref_mu_sq;
+  return stats;
+}
+
+PatchSimilarityResult
+NeurogramSimiliarityIndexMeasure::MeasureWithReferenceStats(
+    const ImagePatch &ref_patch, const NsimReferenceStats &ref_stats,
+    const ImagePatch &deg_patch) const {
+  const auto &mu_r = ref_stats.mu_r;
+  const auto &ref_mu_sq = ref_stats.ref_mu_sq;
+  const auto &sigma_r_sq = ref_stats.sigma_r_sq;
+  static const AMatrix<double> window = NsimWindow();
 
   std::vector<double> k{0.01, 0.03};
   double c1 = pow(k[0] * intensity_range_, 2);
   double c3 = pow(k[1] * intensity_range_, 2) / 2;
 
-  auto mu_r = Convolution2D<double>::Valid2DConvWithBoundary(window, ref_patch);
   auto mu_d = Convolution2D<double>::Valid2DConvWithBoundary(window, deg_patch);
-  auto ref_mu_sq = mu_r.PointWiseProduct(mu_r);
   auto deg_mu_sq = mu_d.PointWiseProduct(mu_d);
   auto mu_r_mu_d = mu_r.PointWiseProduct(mu_d);
-  auto ref_neuro_sq = ref_patch.PointWiseProduct(ref_patch);
   auto deg_neuro_sq = deg_patch.PointWiseProduct(deg_patch);
-  auto conv2_ref_neuro_sq =
-      Convolution2D<double>::Valid2DConvWithBoundary(window, ref_neuro_sq);
-  auto sigma_r_sq = conv2_ref_neuro_sq - ref_mu_sq;
   auto conv2_deg_neuro_sq =
       Convolution2D<double>::Valid2DConvWithBoundary(window, deg_neuro_sq);
   auto sigma_d_sq = conv2_deg_neuro_sq - deg_mu_sq;
@@ -87,4 +136,8 @@ PatchSimilarityResult NeurogramSimiliarityIndexMeasure::MeasurePatchSimilarity(
   r.freq_band_stddevs = std::move(freq_band_stddevs);
   return r;
 }
+
+double NeurogramSimiliarityIndexMeasure::MaxSimilarity() const {
+  return 1.0;
+}
 }  // namespace Visqol
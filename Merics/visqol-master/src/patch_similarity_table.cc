@@ -0,0 +1,121 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "patch_similarity_table.h"
+
+#include <assert.h>
+
+#include <vector>
+
+namespace Visqol {
+
+void PatchSimilarityTable::Append(const PatchSimilarityResult &result) {
+  if (similarities_.empty()) {
+    num_freq_bands_ = result.freq_band_means.NumElements();
+  }
+  assert(result.freq_band_means.NumElements() == num_freq_bands_);
+  assert(result.freq_band_stddevs.NumElements() == num_freq_bands_);
+  assert(result.freq_band_deg_energy.NumElements() == num_freq_bands_);
+  freq_band_means_.insert(freq_band_means_.end(),
+                          result.freq_band_means.cbegin(),
+                          result.freq_band_means.cend());
+  freq_band_stddevs_.insert(freq_band_stddevs_.end(),
+                            result.freq_band_stddevs.cbegin(),
+                            result.freq_band_stddevs.cend());
+  freq_band_deg_energy_.insert(freq_band_deg_energy_.end(),
+                               result.freq_band_deg_energy.cbegin(),
+                               result.freq_band_deg_energy.cend());
+  similarities_.push_back(result.similarity);
+  ref_patch_start_times_.push_back(result.ref_patch_start_time);
+  ref_patch_end_times_.push_back(result.ref_patch_end_time);
+  deg_patch_start_times_.push_back(result.deg_patch_start_time);
+  deg_patch_end_times_.push_back(result.deg_patch_end_time);
+}
+
+size_t PatchSimilarityTable::NumPatches() const {
+  return similarities_.size();
+}
+
+size_t PatchSimilarityTable::NumFreqBands() const { return num_freq_bands_; }
+
+const std::vector<double> &PatchSimilarityTable::FreqBandMeans() const {
+  return freq_band_means_;
+}
+
+const std::vector<double> &PatchSimilarityTable::FreqBandStdDevs() const {
+  return freq_band_stddevs_;
+}
+
+const std::vector<double> &PatchSimilarityTable::FreqBandDegEnergy() const {
+  return freq_band_deg_energy_;
+}
+
+const std::vector<double> &PatchSimilarityTable::Similarities() const {
+  return similarities_;
+}
+
+const std::vector<double> &PatchSimilarityTable::RefPatchStartTimes() const {
+  return ref_patch_start_times_;
+}
+
+const std::vector<double> &PatchSimilarityTable::RefPatchEndTimes() const {
+  return ref_patch_end_times_;
+}
+
+const std::vector<double> &PatchSimilarityTable::DegPatchStartTimes() const {
+  return deg_patch_start_times_;
+}
+
+const std::vector<double> &PatchSimilarityTable::DegPatchEndTimes() const {
+  return deg_patch_end_times_;
+}
+
+void PatchSimilarityTable::ShiftTimes(double offset) {
+  for (size_t patch = 0; patch < NumPatches(); patch++) {
+    ref_patch_start_times_[patch] += offset;
+    ref_patch_end_times_[patch] += offset;
+    if (deg_patch_start_times_[patch] != 0.0 ||
+        deg_patch_end_times_[patch] != 0.0) {
+      deg_patch_start_times_[patch] += offset;
+      deg_patch_end_times_[patch] += offset;
+    }
+  }
+}
+
+PatchSimilarityTable PatchSimilarityTable::Select(
+    const std::vector<size_t> &patches) const {
+  PatchSimilarityTable selected;
+  selected.num_freq_bands_ = num_freq_bands_;
+  for (const size_t patch : patches) {
+    const size_t row_start = patch * num_freq_bands_;
+    const size_t row_end = row_start + num_freq_bands_;
+    selected.freq_band_means_.insert(selected.freq_band_means_.end(),
+                                     freq_band_means_.begin() + row_start,
+                                     freq_band_means_.begin() + row_end);
+    selected.freq_band_stddevs_.insert(selected.freq_band_stddevs_.end(),
+                                       freq_band_stddevs_.begin() + row_start,
+                                       freq_band_stddevs_.begin() + row_end);
+    selected.freq_band_deg_energy_.insert(
+        selected.freq_band_deg_energy_.end(),
+        freq_band_deg_energy_.begin() + row_start,
+        freq_band_deg_energy_.begin() + row_end);
+    selected.similarities_.push_back(similarities_[patch]);
+    selected.ref_patch_start_times_.push_back(ref_patch_start_times_[patch]);
+    selected.ref_patch_end_times_.push_back(ref_patch_end_times_[patch]);
+    selected.deg_patch_start_times_.push_back(deg_patch_start_times_[patch]);
+    selected.deg_patch_end_times_.push_back(deg_patch_end_times_[patch]);
+  }
+  return selected;
+}
+}  // namespace Visqol
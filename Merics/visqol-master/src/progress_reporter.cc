@@ -0,0 +1,189 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "progress_reporter.h"
+
+#include <string>
+#include <utility>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/time/time.h"
+#include "google/protobuf/util/json_util.h"
+
+namespace Visqol {
+
+const double ProgressReporter::kStragglerFactor = 3.0;
+
+ProgressReporter::ProgressReporter(const FilePath &output_path,
+                                   double interval_seconds)
+    : output_path_(output_path), interval_seconds_(interval_seconds) {}
+
+ProgressReporter::~ProgressReporter() { Finish(); }
+
+absl::Status ProgressReporter::Open() {
+  output_.open(output_path_.Path(), std::ios::trunc);
+  if (!output_) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Unable to write progress reports: " +
+                            output_path_.Path());
+  }
+  return absl::Status();
+}
+
+void ProgressReporter::Start(size_t num_jobs, size_t num_workers,
+                             std::function<double()> estimate_remaining) {
+  Finish();
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = false;
+    start_ = std::chrono::steady_clock::now();
+    num_jobs_ = num_jobs;
+    jobs_done_ = 0;
+    jobs_failed_ = 0;
+    audio_seconds_done_ = 0.0;
+    busy_seconds_ = 0.0;
+    finished_cost_ = 0.0;
+    workers_.assign(num_workers, WorkerState());
+  }
+  estimate_remaining_ = std::move(estimate_remaining);
+  report_thread_ = std::thread(&ProgressReporter::ReportLoop, this);
+}
+
+void ProgressReporter::JobStarted(size_t worker, size_t job_index,
+                                  double cost) {
+  absl::MutexLock lock(&mutex_);
+  WorkerState &state = workers_[worker];
+  state.running = true;
+  state.job_index = job_index;
+  state.cost = cost;
+  state.start = std::chrono::steady_clock::now();
+}
+
+void ProgressReporter::JobFinished(size_t worker, bool ok,
+                                   double audio_seconds) {
+  absl::MutexLock lock(&mutex_);
+  WorkerState &state = workers_[worker];
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - state.start;
+  state.running = false;
+  jobs_done_++;
+  if (!ok) {
+    jobs_failed_++;
+  }
+  audio_seconds_done_ += audio_seconds;
+  busy_seconds_ += elapsed.count();
+  finished_cost_ += state.cost;
+}
+
+void ProgressReporter::Finish() {
+  if (!report_thread_.joinable()) {
+    return;
+  }
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = true;
+  }
+  report_thread_.join();
+  ProgressReportMsg report = Snapshot();
+  report.set_finished(true);
+  WriteReport(report);
+}
+
+ProgressReportMsg ProgressReporter::Snapshot() const {
+  // The estimate may take the caller's own locks, so it is made outside of
+  // this reporter's lock.
+  const double eta = estimate_remaining_ ? estimate_remaining_() : 0.0;
+
+  absl::MutexLock lock(&mutex_);
+  const auto now = std::chrono::steady_clock::now();
+  const std::chrono::duration<double> elapsed = now - start_;
+  ProgressReportMsg report;
+  report.set_elapsed_seconds(elapsed.count());
+  report.set_pairs_done(jobs_done_);
+  report.set_pairs_failed(jobs_failed_);
+  report.set_pairs_total(num_jobs_);
+  report.set_eta_seconds(eta);
+  report.set_num_workers(workers_.size());
+
+  // Include the time spent on the jobs still running in the utilization.
+  double busy_seconds = busy_seconds_;
+  size_t workers_busy = 0;
+  for (const auto &state : workers_) {
+    if (state.running) {
+      const std::chrono::duration<double> running = now - state.start;
+      busy_seconds += running.count();
+      workers_busy++;
+    }
+  }
+  report.set_workers_busy(workers_busy);
+  if (elapsed.count() > 0.0) {
+    report.set_pairs_per_second(jobs_done_ / elapsed.count());
+    report.set_audio_seconds_per_second(audio_seconds_done_ /
+                                        elapsed.count());
+    if (!workers_.empty()) {
+      report.set_worker_utilization(busy_seconds /
+                                    (elapsed.count() * workers_.size()));
+    }
+  }
+
+  // A job is expected to take its cost scaled by the time the finished jobs
+  // took per unit of cost. Until a job has finished there is no baseline.
+  if (finished_cost_ > 0.0) {
+    const double seconds_per_cost = busy_seconds_ / finished_cost_;
+    for (size_t worker = 0; worker < workers_.size(); worker++) {
+      const WorkerState &state = workers_[worker];
+      if (!state.running) {
+        continue;
+      }
+      const std::chrono::duration<double> running = now - state.start;
+      const double expected = state.cost * seconds_per_cost;
+      if (running.count() > kStragglerFactor * expected) {
+        auto *straggler = report.add_stragglers();
+        straggler->set_pair_index(state.job_index);
+        straggler->set_worker(worker);
+        straggler->set_running_seconds(running.count());
+        straggler->set_expected_seconds(expected);
+      }
+    }
+  }
+  return report;
+}
+
+void ProgressReporter::ReportLoop() {
+  while (true) {
+    {
+      absl::MutexLock lock(&mutex_);
+      if (mutex_.AwaitWithTimeout(absl::Condition(&stopping_),
+                                  absl::Seconds(interval_seconds_))) {
+        return;
+      }
+    }
+    WriteReport(Snapshot());
+  }
+}
+
+void ProgressReporter::WriteReport(const ProgressReportMsg &report) {
+  google::protobuf::util::JsonPrintOptions options;
+  options.always_print_primitive_fields = true;
+  options.preserve_proto_field_names = true;
+  std::string json;
+  if (google::protobuf::util::MessageToJsonString(report, &json, options)
+          .ok()) {
+    output_ << json << std::endl;
+  } else {
+    ABSL_RAW_LOG(ERROR, "Error writing progress report: %s",
+                 report.ShortDebugString().c_str());
+  }
+}
+}  // namespace Visqol
@@ -0,0 +1,85 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Serves the prepared reference features shared by a fleet of visqol nodes
+// run with --reference_cache=<host>:<port>.
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <string>
+#include <thread>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+
+#include "reference_cache_service.h"
+
+ABSL_FLAG(int, port, 7431, "The TCP port to listen on.");
+ABSL_FLAG(std::string, bind_address, "127.0.0.1",
+          "The IPv4 address to listen on. Only the loopback interface by "
+          "default. Anyone who can reach the server can store entries, so "
+          "only listen on a network reachable by the scoring nodes.");
+ABSL_FLAG(double, capacity_mb, 4096.0,
+          "The most MiB of reference features to hold, after which the least "
+          "recently used are evicted.");
+ABSL_FLAG(int, threads, 8,
+          "The number of connections served at once. A client that stalls "
+          "only holds one of them, for at most 5 seconds plus a second for "
+          "every 4 MiB of features it moves.");
+
+namespace {
+// Set when interrupted, to stop serving.
+std::atomic<bool> stop_requested{false};
+
+void RequestStop(int) { stop_requested = true; }
+}  // namespace
+
+int main(int argc, char **argv) {
+  absl::SetProgramUsageMessage(
+      "Serves the reference features shared by a fleet of ViSQOL nodes");
+  absl::ParseCommandLine(argc, argv);
+
+  const double capacity_mb = absl::GetFlag(FLAGS_capacity_mb);
+  if (!(capacity_mb > 0.0)) {
+    ABSL_RAW_LOG(ERROR, "--capacity_mb must be greater than 0.");
+    return -1;
+  }
+  const int threads = absl::GetFlag(FLAGS_threads);
+  if (threads <= 0) {
+    ABSL_RAW_LOG(ERROR, "--threads must be greater than 0.");
+    return -1;
+  }
+  Visqol::ReferenceCacheServer server(
+      static_cast<size_t>(capacity_mb * 1024.0 * 1024.0), threads);
+  const auto status = server.Start(absl::GetFlag(FLAGS_port),
+                                   absl::GetFlag(FLAGS_bind_address));
+  if (!status.ok()) {
+    ABSL_RAW_LOG(ERROR, "%s", status.ToString().c_str());
+    return -1;
+  }
+  ABSL_RAW_LOG(INFO, "Serving reference features on port %d until "
+               "interrupted.", server.Port());
+
+  std::signal(SIGINT, RequestStop);
+  std::signal(SIGTERM, RequestStop);
+  while (!stop_requested) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  }
+  server.Stop();
+  return 0;
+}
@@ -0,0 +1,528 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reference_cache_service.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace Visqol {
+
+const size_t ReferenceCacheServer::kMaxKeyBytes = 256;
+const size_t ReferenceCacheServer::kMaxValueBytes = 64 << 20;
+const double ReferenceCacheServer::kIoTimeoutSeconds = 5.0;
+const double ReferenceCacheServer::kPollIntervalSeconds = 0.1;
+const double ReferenceCacheServer::kMinBytesPerSecond = 4 << 20;
+const size_t ReferenceCacheServer::kDefaultNumThreads = 8;
+const double ReferenceCacheClient::kDefaultTimeoutSeconds = 1.0;
+
+StringLruCache::StringLruCache(size_t capacity_bytes)
+    : capacity_bytes_(capacity_bytes) {}
+
+absl::optional<std::string> StringLruCache::Get(const std::string &key) {
+  absl::MutexLock lock(&mutex_);
+  const auto it = index_.find(key);
+  if (it == index_.end()) {
+    return absl::nullopt;
+  }
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->second;
+}
+
+void StringLruCache::Put(const std::string &key, std::string value) {
+  const size_t entry_bytes = key.size() + value.size();
+  absl::MutexLock lock(&mutex_);
+  const auto it = index_.find(key);
+  if (it != index_.end()) {
+    size_bytes_ -= it->second->first.size() + it->second->second.size();
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+  if (entry_bytes > capacity_bytes_) {
+    return;
+  }
+  while (size_bytes_ + entry_bytes > capacity_bytes_) {
+    const auto &oldest = entries_.back();
+    size_bytes_ -= oldest.first.size() + oldest.second.size();
+    index_.erase(oldest.first);
+    entries_.pop_back();
+  }
+  entries_.emplace_front(key, std::move(value));
+  index_[key] = entries_.begin();
+  size_bytes_ += entry_bytes;
+}
+
+size_t StringLruCache::SizeBytes() const {
+  absl::MutexLock lock(&mutex_);
+  return size_bytes_;
+}
+
+namespace {
+// True if a key is one the protocol can carry.
+bool IsValidKey(const std::string &key) {
+  if (key.empty() || key.size() > ReferenceCacheServer::kMaxKeyBytes) {
+    return false;
+  }
+  for (const char c : key) {
+    if (!std::isgraph(static_cast<unsigned char>(c))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifndef _WIN32
+#ifdef MSG_NOSIGNAL
+// A peer that closes early must not kill the process with SIGPIPE.
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;
+#endif
+
+// Closes a socket when it goes out of scope.
+class ScopedSocket {
+ public:
+  explicit ScopedSocket(int fd) : fd_(fd) {}
+  ~ScopedSocket() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+  int fd() const { return fd_; }
+
+ private:
+  int fd_;
+};
+
+using Deadline = std::chrono::steady_clock::time_point;
+
+Deadline DeadlineAfter(double seconds) {
+  return std::chrono::steady_clock::now() +
+         std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+             std::chrono::duration<double>(seconds));
+}
+
+// The time allowed to move a value, at the slowest accepted rate.
+std::chrono::steady_clock::duration TransferTime(size_t value_bytes) {
+  return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(
+          value_bytes / ReferenceCacheServer::kMinBytesPerSecond));
+}
+
+// Wait until a socket is ready for the given events, returning false once the
+// deadline has passed or on an error.
+bool WaitUntil(int fd, short events, Deadline deadline) {
+  while (true) {
+    const auto remaining = std::chrono::duration_cast<
+        std::chrono::milliseconds>(deadline -
+                                   std::chrono::steady_clock::now());
+    if (remaining.count() <= 0) {
+      return false;
+    }
+    pollfd poll_fd = {fd, events, 0};
+    const int ready = poll(&poll_fd, 1, static_cast<int>(remaining.count()));
+    if (ready < 0 && errno == EINTR) {
+      continue;
+    }
+    return ready > 0;
+  }
+}
+
+// Make the reads and writes of a socket return rather than block, so that
+// each one waits for the socket with the deadline of the connection.
+void SetNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// True if a failed read or write should wait for the socket and retry.
+bool ShouldRetry(ssize_t n) {
+  return n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+absl::Status TimedOut() {
+  return absl::Status(absl::StatusCode::kDeadlineExceeded,
+                      "Timed out talking to the reference cache.");
+}
+
+absl::Status SendAll(int fd, const std::string &data, Deadline deadline) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    if (!WaitUntil(fd, POLLOUT, deadline)) {
+      return TimedOut();
+    }
+    const ssize_t n = send(fd, data.data() + sent, data.size() - sent,
+                           kSendFlags);
+    if (ShouldRetry(n)) {
+      continue;
+    }
+    if (n <= 0) {
+      return absl::Status(absl::StatusCode::kUnavailable,
+                          "Failed to send to the reference cache.");
+    }
+    sent += n;
+  }
+  return absl::Status();
+}
+
+absl::StatusOr<std::string> RecvExact(int fd, size_t size,
+                                      Deadline deadline) {
+  std::string data(size, '\0');
+  size_t received = 0;
+  while (received < size) {
+    if (!WaitUntil(fd, POLLIN, deadline)) {
+      return TimedOut();
+    }
+    const ssize_t n = recv(fd, &data[received], size - received, 0);
+    if (ShouldRetry(n)) {
+      continue;
+    }
+    if (n <= 0) {
+      return absl::Status(absl::StatusCode::kUnavailable,
+                          "Failed to receive from the reference cache.");
+    }
+    received += n;
+  }
+  return data;
+}
+
+// Receive a line, without its newline. The lines are short, so are read a
+// byte at a time rather than buffering past the end of the line.
+absl::StatusOr<std::string> RecvLine(int fd, size_t max_size,
+                                     Deadline deadline) {
+  std::string line;
+  while (true) {
+    if (!WaitUntil(fd, POLLIN, deadline)) {
+      return TimedOut();
+    }
+    char c;
+    const ssize_t n = recv(fd, &c, 1, 0);
+    if (ShouldRetry(n)) {
+      continue;
+    }
+    if (n <= 0) {
+      return absl::Status(absl::StatusCode::kUnavailable,
+                          "Failed to receive from the reference cache.");
+    }
+    if (c == '\n') {
+      return line;
+    }
+    if (line.size() == max_size) {
+      return absl::Status(absl::StatusCode::kInvalidArgument,
+                          "The reference cache request line is too long.");
+    }
+    line += c;
+  }
+}
+#endif
+}  // namespace
+
+ReferenceCacheServer::ReferenceCacheServer(size_t capacity_bytes,
+                                           size_t num_threads)
+    : store_(capacity_bytes), num_threads_(std::max<size_t>(1, num_threads)) {}
+
+ReferenceCacheServer::~ReferenceCacheServer() { Stop(); }
+
+absl::Status ReferenceCacheServer::Start(int port,
+                                         const std::string &bind_address) {
+#ifndef _WIN32
+  if (listen_fd_ >= 0) {
+    return absl::Status(absl::StatusCode::kFailedPrecondition,
+                        "The reference cache server is already running.");
+  }
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  if (port < 0 || port > 65535 ||
+      inet_pton(AF_INET, bind_address.c_str(), &addr.sin_addr) != 1) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        absl::StrCat("Invalid reference cache address ",
+                                     bind_address, ":", port));
+  }
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return absl::Status(absl::StatusCode::kInternal,
+                        "Unable to create the reference cache socket.");
+  }
+  const int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  socklen_t addr_size = sizeof(addr);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &addr_size) != 0) {
+    close(fd);
+    return absl::Status(absl::StatusCode::kUnavailable,
+                        absl::StrCat("Unable to listen on ", bind_address,
+                                     ":", port, " for the reference cache."));
+  }
+  // Every serving thread waits on the socket, so accepting must not block
+  // the threads that lose the race for a connection.
+  SetNonBlocking(fd);
+  listen_fd_ = fd;
+  port_ = ntohs(addr.sin_port);
+  stopping_ = false;
+  for (size_t i = 0; i < num_threads_; i++) {
+    serve_threads_.emplace_back(&ReferenceCacheServer::ServeLoop, this);
+  }
+  return absl::Status();
+#else
+  return absl::Status(absl::StatusCode::kUnimplemented,
+                      "The reference cache server is not supported on this "
+                      "platform.");
+#endif
+}
+
+int ReferenceCacheServer::Port() const { return listen_fd_ >= 0 ? port_ : 0; }
+
+void ReferenceCacheServer::Stop() {
+#ifndef _WIN32
+  if (listen_fd_ < 0) {
+    return;
+  }
+  stopping_ = true;
+  for (auto &thread : serve_threads_) {
+    thread.join();
+  }
+  serve_threads_.clear();
+  close(listen_fd_);
+  listen_fd_ = -1;
+  port_ = 0;
+#endif
+}
+
+void ReferenceCacheServer::ServeLoop() {
+#ifndef _WIN32
+  while (!stopping_) {
+    if (!WaitUntil(listen_fd_, POLLIN, DeadlineAfter(kPollIntervalSeconds))) {
+      continue;
+    }
+    const int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd >= 0) {
+      ServeConnection(fd);
+    }
+  }
+#endif
+}
+
+void ReferenceCacheServer::ServeConnection(int fd) {
+#ifndef _WIN32
+  const ScopedSocket socket(fd);
+  // The whole exchange shares one deadline, so a client cannot hold the
+  // connection open by trickling its request in a byte at a time. It is
+  // extended by the time to move the value, once its size is known.
+  Deadline deadline = DeadlineAfter(kIoTimeoutSeconds);
+  SetNonBlocking(fd);
+  const auto line = RecvLine(fd, kMaxKeyBytes + 32, deadline);
+  if (!line.ok()) {
+    return;
+  }
+  const std::vector<std::string> parts = absl::StrSplit(line.value(), ' ');
+  std::string reply;
+  absl::optional<std::string> value_reply;
+  size_t value_size = 0;
+  if (parts.size() == 2 && parts[0] == "GET" && IsValidKey(parts[1])) {
+    value_reply = store_.Get(parts[1]);
+    if (value_reply.has_value()) {
+      reply = absl::StrCat("HIT ", value_reply->size(), "\n");
+      deadline += TransferTime(value_reply->size());
+    } else {
+      reply = "MISS\n";
+    }
+  } else if (parts.size() == 3 && parts[0] == "PUT" &&
+             IsValidKey(parts[1]) && absl::SimpleAtoi(parts[2], &value_size) &&
+             value_size <= kMaxValueBytes) {
+    deadline += TransferTime(value_size);
+    auto value = RecvExact(fd, value_size, deadline);
+    if (!value.ok()) {
+      return;
+    }
+    store_.Put(parts[1], std::move(value).value());
+    reply = "OK\n";
+  } else {
+    reply = "ERROR invalid request\n";
+  }
+  if (SendAll(fd, reply, deadline).ok() && value_reply.has_value()) {
+    SendAll(fd, value_reply.value(), deadline).IgnoreError();
+  }
+#endif
+}
+
+absl::StatusOr<std::pair<std::string, int>> ReferenceCacheClient::ParseAddress(
+    const std::string &address) {
+  const size_t colon = address.rfind(':');
+  int port;
+  if (colon == std::string::npos || colon == 0 ||
+      !absl::SimpleAtoi(address.substr(colon + 1), &port) || port <= 0 ||
+      port > 65535) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Expected a reference cache address of the form "
+                        "host:port, not '" + address + "'.");
+  }
+  return std::make_pair(address.substr(0, colon), port);
+}
+
+ReferenceCacheClient::ReferenceCacheClient(const std::string &host, int port,
+                                           double timeout_seconds)
+    : host_(host), port_(port), timeout_seconds_(timeout_seconds) {}
+
+std::string ReferenceCacheClient::Address() const {
+  return absl::StrCat(host_, ":", port_);
+}
+
+absl::StatusOr<int> ReferenceCacheClient::SendRequest(
+    const std::string &request,
+    std::chrono::steady_clock::time_point deadline) const {
+#ifndef _WIN32
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = nullptr;
+  if (getaddrinfo(host_.c_str(), std::to_string(port_).c_str(), &hints,
+                  &addresses) != 0 || addresses == nullptr) {
+    return absl::Status(absl::StatusCode::kUnavailable,
+                        "Unable to resolve the reference cache " + Address());
+  }
+  const int fd = socket(addresses->ai_family, addresses->ai_socktype,
+                        addresses->ai_protocol);
+  if (fd < 0) {
+    freeaddrinfo(addresses);
+    return absl::Status(absl::StatusCode::kInternal,
+                        "Unable to create a reference cache socket.");
+  }
+  // Connect without blocking, so that an unreachable server times out.
+  SetNonBlocking(fd);
+  int connect_error = 0;
+  if (connect(fd, addresses->ai_addr, addresses->ai_addrlen) != 0) {
+    connect_error = errno;
+    if (connect_error == EINPROGRESS && WaitUntil(fd, POLLOUT, deadline)) {
+      socklen_t error_size = sizeof(connect_error);
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &connect_error, &error_size);
+    } else if (connect_error == EINPROGRESS) {
+      connect_error = ETIMEDOUT;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (connect_error != 0) {
+    close(fd);
+    return absl::Status(absl::StatusCode::kUnavailable,
+                        "Unable to connect to the reference cache " +
+                            Address());
+  }
+  const absl::Status status = SendAll(fd, request, deadline);
+  if (!status.ok()) {
+    close(fd);
+    return status;
+  }
+  return fd;
+#else
+  return absl::Status(absl::StatusCode::kUnimplemented,
+                      "The reference cache client is not supported on this "
+                      "platform.");
+#endif
+}
+
+absl::StatusOr<absl::optional<std::string>> ReferenceCacheClient::Get(
+    const std::string &key) const {
+#ifndef _WIN32
+  if (!IsValidKey(key)) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Invalid reference cache key: " + key);
+  }
+  Deadline deadline = DeadlineAfter(timeout_seconds_);
+  const auto fd = SendRequest("GET " + key + "\n", deadline);
+  if (!fd.ok()) {
+    return fd.status();
+  }
+  const ScopedSocket socket(fd.value());
+  const auto line = RecvLine(socket.fd(), ReferenceCacheServer::kMaxKeyBytes,
+                             deadline);
+  if (!line.ok()) {
+    return line.status();
+  }
+  if (line.value() == "MISS") {
+    return absl::optional<std::string>();
+  }
+  size_t value_size;
+  if (line.value().compare(0, 4, "HIT ") != 0 ||
+      !absl::SimpleAtoi(line.value().substr(4), &value_size) ||
+      value_size > ReferenceCacheServer::kMaxValueBytes) {
+    return absl::Status(absl::StatusCode::kInternal,
+                        "Unexpected reply from the reference cache " +
+                            Address() + ": " + line.value());
+  }
+  deadline += TransferTime(value_size);
+  auto value = RecvExact(socket.fd(), value_size, deadline);
+  if (!value.ok()) {
+    return value.status();
+  }
+  return absl::optional<std::string>(std::move(value).value());
+#else
+  return absl::Status(absl::StatusCode::kUnimplemented,
+                      "The reference cache client is not supported on this "
+                      "platform.");
+#endif
+}
+
+absl::Status ReferenceCacheClient::Put(const std::string &key,
+                                       const std::string &value) const {
+#ifndef _WIN32
+  if (!IsValidKey(key) || value.size() > ReferenceCacheServer::kMaxValueBytes) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Invalid reference cache entry: " + key);
+  }
+  const Deadline deadline =
+      DeadlineAfter(timeout_seconds_) + TransferTime(value.size());
+  const auto fd = SendRequest(
+      absl::StrCat("PUT ", key, " ", value.size(), "\n", value), deadline);
+  if (!fd.ok()) {
+    return fd.status();
+  }
+  const ScopedSocket socket(fd.value());
+  const auto line = RecvLine(socket.fd(), ReferenceCacheServer::kMaxKeyBytes,
+                             deadline);
+  if (!line.ok()) {
+    return line.status();
+  }
+  if (line.value() != "OK") {
+    return absl::Status(absl::StatusCode::kInternal,
+                        "The reference cache " + Address() +
+                            " refused the entry: " + line.value());
+  }
+  return absl::Status();
+#else
+  return absl::Status(absl::StatusCode::kUnimplemented,
+                      "The reference cache client is not supported on this "
+                      "platform.");
+#endif
+}
+}  // namespace Visqol
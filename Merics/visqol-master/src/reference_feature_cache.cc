@@ -0,0 +1,241 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reference_feature_cache.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
+
+#include "sha256.h"
+
+namespace Visqol {
+
+const size_t ReferenceFeatureCache::kDefaultLocalCapacityBytes = 256 << 20;
+const double ReferenceFeatureCache::kRemoteRetrySeconds = 30.0;
+const uint32_t ReferenceFeatureCache::kFormatVersion = 2;
+const size_t ReferenceFeatureCache::kMinSecretBytes = 16;
+
+namespace {
+// The bytes that start every serialized spectrogram.
+const char kMagic[] = "VQRF";
+const size_t kMagicSize = 4;
+
+// True if two codes are equal, taking the same time wherever they differ.
+bool CodesEqual(const char *a, const char *b, size_t size) {
+  unsigned char difference = 0;
+  for (size_t i = 0; i < size; i++) {
+    difference |= static_cast<unsigned char>(a[i] ^ b[i]);
+  }
+  return difference == 0;
+}
+
+template <typename T>
+void AppendRaw(const T *values, size_t count, std::string *bytes) {
+  bytes->append(reinterpret_cast<const char *>(values), count * sizeof(T));
+}
+
+template <typename T>
+bool ReadRaw(const std::string &bytes, size_t count, size_t *pos, T *values) {
+  if (count > (bytes.size() - *pos) / sizeof(T)) {
+    return false;
+  }
+  std::memcpy(values, &bytes[*pos], count * sizeof(T));
+  *pos += count * sizeof(T);
+  return true;
+}
+}  // namespace
+
+std::string ReferenceFeatureCache::ContentKey(const AudioSignal &signal,
+                                              const AnalysisWindow &window,
+                                              bool use_speech_mode) {
+  const size_t num_samples = signal.data_matrix.NumRows();
+  // The key names the features across the fleet, so the samples are hashed
+  // with a digest that different signals cannot be made to share.
+  const std::string digest = Sha256::Hash(signal.data_matrix.data(),
+                                          num_samples * sizeof(double));
+  return absl::StrCat("v", kFormatVersion, "-",
+                      use_speech_mode ? "speech" : "audio", "-",
+                      signal.sample_rate, "-", window.size, "-",
+                      window.overlap, "-", num_samples, "-",
+                      absl::BytesToHexString(digest));
+}
+
+std::string ReferenceFeatureCache::Serialize(const Spectrogram &spectrogram) {
+  const AMatrix<double> &data = spectrogram.Data();
+  const std::vector<double> bands = spectrogram.GetCenterFreqBands();
+  const uint64_t header[] = {data.NumRows(), data.NumCols(), bands.size()};
+  std::string bytes(kMagic, kMagicSize);
+  AppendRaw(&kFormatVersion, 1, &bytes);
+  AppendRaw(header, 3, &bytes);
+  AppendRaw(data.data(), data.NumRows() * data.NumCols(), &bytes);
+  AppendRaw(bands.data(), bands.size(), &bytes);
+  return bytes;
+}
+
+absl::StatusOr<Spectrogram> ReferenceFeatureCache::Deserialize(
+    const std::string &bytes) {
+  size_t pos = kMagicSize;
+  uint32_t version = 0;
+  uint64_t header[3];
+  if (bytes.compare(0, kMagicSize, kMagic) != 0 ||
+      !ReadRaw(bytes, 1, &pos, &version) || version != kFormatVersion ||
+      !ReadRaw(bytes, 3, &pos, header)) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Not a serialized reference spectrogram.");
+  }
+  const uint64_t rows = header[0];
+  const uint64_t cols = header[1];
+  const uint64_t num_bands = header[2];
+  const size_t remaining = (bytes.size() - pos) / sizeof(double);
+  if ((cols > 0 && rows > remaining / cols) ||
+      rows * cols + num_bands != remaining ||
+      (bytes.size() - pos) % sizeof(double) != 0) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "The serialized reference spectrogram is truncated.");
+  }
+  std::vector<double> values(rows * cols);
+  std::vector<double> bands(num_bands);
+  ReadRaw(bytes, values.size(), &pos, values.data());
+  ReadRaw(bytes, bands.size(), &pos, bands.data());
+  Spectrogram spectrogram(AMatrix<double>(rows, cols, std::move(values)));
+  spectrogram.SetCenterFreqBands(bands);
+  return spectrogram;
+}
+
+absl::StatusOr<std::string> ReferenceFeatureCache::ReadSecret(
+    const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  if (!file) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Unable to read the reference cache secret " + path);
+  }
+  std::string secret = contents.str();
+  secret.erase(secret.find_last_not_of(" \t\r\n") + 1);
+  if (secret.size() < kMinSecretBytes) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        absl::StrCat("The reference cache secret ", path,
+                                     " must hold at least ", kMinSecretBytes,
+                                     " bytes."));
+  }
+  return secret;
+}
+
+ReferenceFeatureCache::ReferenceFeatureCache(
+    size_t local_capacity_bytes, std::unique_ptr<ReferenceCacheClient> remote,
+    const std::string &remote_secret)
+    : local_(local_capacity_bytes),
+      remote_(std::move(remote)),
+      remote_secret_(remote_secret) {}
+
+absl::optional<Spectrogram> ReferenceFeatureCache::Fetch(
+    const std::string &key) {
+  const auto local = local_.Get(key);
+  if (local.has_value()) {
+    auto spectrogram = Deserialize(local.value());
+    if (spectrogram.ok()) {
+      absl::MutexLock lock(&mutex_);
+      stats_.local_hits++;
+      return std::move(spectrogram).value();
+    }
+  }
+  if (RemoteAvailable()) {
+    auto remote = remote_->Get(key);
+    if (!remote.ok()) {
+      RecordRemoteError(remote.status());
+    } else if (remote.value().has_value()) {
+      // The entry is the serialized features followed by their code.
+      std::string bytes = std::move(remote.value()).value();
+      const size_t code_size = Sha256::kDigestBytes;
+      const size_t size = bytes.size() < code_size ? 0
+                                                   : bytes.size() - code_size;
+      if (bytes.size() >= code_size &&
+          CodesEqual(Sign(key, bytes.substr(0, size)).data(), &bytes[size],
+                     code_size)) {
+        bytes.resize(size);
+        auto spectrogram = Deserialize(bytes);
+        if (spectrogram.ok()) {
+          local_.Put(key, std::move(bytes));
+          absl::MutexLock lock(&mutex_);
+          stats_.remote_hits++;
+          return std::move(spectrogram).value();
+        }
+      }
+      ABSL_RAW_LOG(WARNING,
+                   "Ignoring unsigned or invalid reference features %s from "
+                   "%s",
+                   key.c_str(), remote_->Address().c_str());
+    }
+  }
+  absl::MutexLock lock(&mutex_);
+  stats_.misses++;
+  return absl::nullopt;
+}
+
+void ReferenceFeatureCache::Publish(const std::string &key,
+                                    const Spectrogram &spectrogram) {
+  std::string bytes = Serialize(spectrogram);
+  if (RemoteAvailable()) {
+    const absl::Status status =
+        remote_->Put(key, absl::StrCat(bytes, Sign(key, bytes)));
+    if (!status.ok()) {
+      RecordRemoteError(status);
+    }
+  }
+  local_.Put(key, std::move(bytes));
+}
+
+ReferenceCacheStats ReferenceFeatureCache::Stats() const {
+  absl::MutexLock lock(&mutex_);
+  return stats_;
+}
+
+std::string ReferenceFeatureCache::Sign(const std::string &key,
+                                        const std::string &bytes) const {
+  // The key is signed with the features, so that a signed entry cannot be
+  // replayed under another key. Keys have no newlines.
+  return Sha256::Hmac(remote_secret_, absl::StrCat(key, "\n", bytes));
+}
+
+bool ReferenceFeatureCache::RemoteAvailable() const {
+  if (remote_ == nullptr) {
+    return false;
+  }
+  absl::MutexLock lock(&mutex_);
+  return std::chrono::steady_clock::now() >= remote_retry_time_;
+}
+
+void ReferenceFeatureCache::RecordRemoteError(const absl::Status &status) {
+  ABSL_RAW_LOG(WARNING,
+               "Reference cache %s failed, computing features locally for "
+               "%.0f seconds: %s",
+               remote_->Address().c_str(), kRemoteRetrySeconds,
+               status.ToString().c_str());
+  absl::MutexLock lock(&mutex_);
+  stats_.remote_errors++;
+  remote_retry_time_ =
+      std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(kRemoteRetrySeconds));
+}
+}  // namespace Visqol
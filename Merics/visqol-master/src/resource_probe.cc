@@ -0,0 +1,257 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "resource_probe.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+
+namespace Visqol {
+
+const char ResourceProbe::kDefaultCgroupRoot[] = "/sys/fs/cgroup";
+const char ResourceProbe::kDefaultProcSelfCgroup[] = "/proc/self/cgroup";
+const double ResourceProbe::kMemoryBudgetFraction = 0.75;
+const size_t ResourceProbe::kComparisonBaseMemory = 32 * 1024 * 1024;
+const size_t ResourceProbe::kComparisonMemoryPerInputByte = 40;
+
+// cgroup v1 reports an unlimited memory limit as a value close to the max
+// int64, rounded down to the page size.
+const size_t kUnlimitedMemoryThreshold = size_t{1} << 62;
+const size_t kBytesPerMiB = 1024 * 1024;
+
+ResourceLimits ResourceProbe::Probe() {
+  return Probe(FilePath(kDefaultCgroupRoot), FilePath(kDefaultProcSelfCgroup),
+               std::thread::hardware_concurrency());
+}
+
+ResourceLimits ResourceProbe::Probe(const FilePath &cgroup_root,
+                                    const FilePath &proc_self_cgroup,
+                                    const size_t hardware_concurrency) {
+  ResourceLimits limits;
+  limits.hardware_concurrency = std::max<size_t>(1, hardware_concurrency);
+  auto apply_cpu_limit = [&limits](double cpus) {
+    if (cpus > 0.0 &&
+        (limits.cpu_limit == 0.0 || cpus < limits.cpu_limit)) {
+      limits.cpu_limit = cpus;
+    }
+  };
+  auto apply_memory_limit = [&limits](size_t bytes) {
+    if (bytes > 0 && bytes < kUnlimitedMemoryThreshold &&
+        (limits.memory_limit_bytes == 0 || bytes < limits.memory_limit_bytes)) {
+      limits.memory_limit_bytes = bytes;
+    }
+  };
+
+  // A limit set on any ancestor cgroup also applies, so walk up from this
+  // process's cgroup to the root of the hierarchy.
+  auto for_each_ancestor = [](const FilePath &dir, const FilePath &base,
+                              const std::function<void(const std::string &)>
+                                  &visit) {
+    std::string path = dir.Path();
+    while (true) {
+      visit(path);
+      const size_t split = path.find_last_of('/');
+      if (path.size() <= base.Path().size() || split == std::string::npos) {
+        break;
+      }
+      path = path.substr(0, split);
+    }
+  };
+
+  // cgroup v2: cpu.max holds "<quota> <period>" or "max <period>", and
+  // memory.max holds a byte count or "max".
+  const FilePath v2_dir = FindCgroupDir(cgroup_root, proc_self_cgroup, "");
+  if (!v2_dir.Path().empty()) {
+    for_each_ancestor(v2_dir, cgroup_root, [&](const std::string &dir) {
+      std::string line;
+      if (ReadFirstLine(FilePath(dir + "/cpu.max"), &line)) {
+        std::vector<std::string> fields =
+            absl::StrSplit(line, ' ', absl::SkipEmpty());
+        double quota, period;
+        if (fields.size() == 2 && absl::SimpleAtod(fields[0], &quota) &&
+            absl::SimpleAtod(fields[1], &period) && period > 0.0) {
+          apply_cpu_limit(quota / period);
+        }
+      }
+      size_t bytes;
+      if (ReadFirstLine(FilePath(dir + "/memory.max"), &line) &&
+          absl::SimpleAtoi(line, &bytes)) {
+        apply_memory_limit(bytes);
+      }
+    });
+  }
+
+  // cgroup v1: the CPU quota is split across two files, with a quota of -1
+  // meaning unlimited.
+  const FilePath cpu_dir = FindCgroupDir(cgroup_root, proc_self_cgroup, "cpu");
+  if (!cpu_dir.Path().empty()) {
+    for_each_ancestor(cpu_dir, cgroup_root, [&](const std::string &dir) {
+      std::string quota_line, period_line;
+      double quota, period;
+      if (ReadFirstLine(FilePath(dir + "/cpu.cfs_quota_us"), &quota_line) &&
+          ReadFirstLine(FilePath(dir + "/cpu.cfs_period_us"), &period_line) &&
+          absl::SimpleAtod(quota_line, &quota) &&
+          absl::SimpleAtod(period_line, &period) && period > 0.0) {
+        apply_cpu_limit(quota / period);
+      }
+    });
+  }
+  const FilePath memory_dir =
+      FindCgroupDir(cgroup_root, proc_self_cgroup, "memory");
+  if (!memory_dir.Path().empty()) {
+    for_each_ancestor(memory_dir, cgroup_root, [&](const std::string &dir) {
+      std::string line;
+      size_t bytes;
+      if (ReadFirstLine(FilePath(dir + "/memory.limit_in_bytes"), &line) &&
+          absl::SimpleAtoi(line, &bytes)) {
+        apply_memory_limit(bytes);
+      }
+    });
+  }
+  return limits;
+}
+
+ExecutionConfig ResourceProbe::DeriveExecutionConfig(
+    const ResourceLimits &limits) {
+  ExecutionConfig config;
+  // Round a fractional CPU quota down, so that the workers never exceed it.
+  size_t cpus = limits.hardware_concurrency;
+  if (limits.cpu_limit > 0.0) {
+    cpus = std::min(cpus, static_cast<size_t>(
+                              std::max(1.0, std::floor(limits.cpu_limit))));
+  }
+  config.num_workers = std::max<size_t>(1, cpus);
+
+  if (limits.memory_limit_bytes > 0) {
+    config.memory_budget_bytes = static_cast<size_t>(
+        limits.memory_limit_bytes * kMemoryBudgetFraction);
+    // Every worker needs at least the base memory of a comparison.
+    const size_t max_workers = std::max<size_t>(
+        1, config.memory_budget_bytes / kComparisonBaseMemory);
+    config.num_workers = std::min(config.num_workers, max_workers);
+  }
+  return config;
+}
+
+size_t ResourceProbe::EstimateComparisonMemory(const FilePath &reference,
+                                               const FilePath &degraded) {
+  size_t input_bytes = 0;
+  for (const FilePath *path : {&reference, &degraded}) {
+    if (path->IsStream()) {
+      continue;
+    }
+    std::ifstream fin(path->Path(), std::ios::binary | std::ios::ate);
+    if (fin) {
+      input_bytes += static_cast<size_t>(fin.tellg());
+    }
+  }
+  return kComparisonBaseMemory + input_bytes * kComparisonMemoryPerInputByte;
+}
+
+std::string ResourceProbe::Describe(const ResourceLimits &limits,
+                                    const ExecutionConfig &config) {
+  std::stringstream ss;
+  ss << "Resources: " << limits.hardware_concurrency << " host threads, CPU "
+     << "quota ";
+  if (limits.cpu_limit > 0.0) {
+    ss << limits.cpu_limit;
+  } else {
+    ss << "none";
+  }
+  ss << ", memory limit ";
+  if (limits.memory_limit_bytes > 0) {
+    ss << limits.memory_limit_bytes / kBytesPerMiB << " MiB";
+  } else {
+    ss << "none";
+  }
+  ss << ". Using " << config.num_workers << " worker(s) with a memory budget "
+     << "of ";
+  if (config.memory_budget_bytes > 0) {
+    ss << config.memory_budget_bytes / kBytesPerMiB << " MiB.";
+  } else {
+    ss << "none.";
+  }
+  return ss.str();
+}
+
+FilePath ResourceProbe::FindCgroupDir(const FilePath &cgroup_root,
+                                      const FilePath &proc_self_cgroup,
+                                      const std::string &controller) {
+  std::ifstream fin(proc_self_cgroup.Path());
+  std::string line;
+  while (std::getline(fin, line)) {
+    // Each line has the format "<id>:<controllers>:<path>". The cgroup v2
+    // hierarchy has the id 0 and no controllers.
+    std::vector<std::string> fields =
+        absl::StrSplit(line, absl::MaxSplits(':', 2));
+    if (fields.size() != 3) {
+      continue;
+    }
+    std::vector<std::string> base_candidates;
+    if (controller.empty()) {
+      if (fields[0] != "0" || !fields[1].empty()) {
+        continue;
+      }
+      // The unified hierarchy is mounted either at the root or, on hybrid
+      // hosts, in a subdirectory.
+      base_candidates = {cgroup_root.Path(), cgroup_root.Path() + "/unified"};
+    } else {
+      std::vector<std::string> controllers = absl::StrSplit(fields[1], ',');
+      if (std::find(controllers.begin(), controllers.end(), controller) ==
+          controllers.end()) {
+        continue;
+      }
+      base_candidates = {cgroup_root.Path() + "/" + fields[1],
+                         cgroup_root.Path() + "/" + controller};
+    }
+    for (const auto &base : base_candidates) {
+      // The v2 root always has cgroup.controllers. The v1 controller
+      // directories always have cgroup.procs.
+      const std::string marker =
+          controller.empty() ? "/cgroup.controllers" : "/cgroup.procs";
+      if (!FilePath(base + marker).Exists()) {
+        continue;
+      }
+      // Inside a container, the cgroup namespace root is usually mounted
+      // directly, so the path from /proc/self/cgroup may not exist.
+      const std::string path = fields[2] == "/" ? "" : fields[2];
+      if (!path.empty() && FilePath(base + path).Exists()) {
+        return FilePath(base + path);
+      }
+      return FilePath(base);
+    }
+  }
+  return FilePath();
+}
+
+bool ResourceProbe::ReadFirstLine(const FilePath &path, std::string *line) {
+  std::ifstream fin(path.Path());
+  if (!fin || !std::getline(fin, *line)) {
+    return false;
+  }
+  if (!line->empty() && line->back() == '\r') {
+    line->pop_back();
+  }
+  return true;
+}
+}  // namespace Visqol
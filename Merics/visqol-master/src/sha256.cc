@@ -0,0 +1,174 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sha256.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace Visqol {
+
+const size_t Sha256::kDigestBytes = 32;
+
+namespace {
+// The round constants: the first 32 bits of the fractional parts of the cube
+// roots of the first 64 primes.
+const uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+// The initial state: the first 32 bits of the fractional parts of the square
+// roots of the first 8 primes.
+const uint32_t kInitialState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                   0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                   0x1f83d9ab, 0x5be0cd19};
+
+const size_t kBlockBytes = 64;
+
+uint32_t RotateRight(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+}  // namespace
+
+std::string Sha256::Hash(const void *data, size_t size) {
+  Sha256 hasher;
+  hasher.Update(data, size);
+  return hasher.Finish();
+}
+
+std::string Sha256::Hash(absl::string_view data) {
+  return Hash(data.data(), data.size());
+}
+
+std::string Sha256::Hmac(absl::string_view secret,
+                         absl::string_view message) {
+  // Secrets longer than a block are replaced by their digest, and shorter
+  // ones are padded with zeros.
+  std::string block_key = secret.size() > kBlockBytes ? Hash(secret)
+                                                      : std::string(secret);
+  block_key.resize(kBlockBytes, '\0');
+  std::string inner_pad(kBlockBytes, '\0');
+  std::string outer_pad(kBlockBytes, '\0');
+  for (size_t i = 0; i < kBlockBytes; i++) {
+    inner_pad[i] = static_cast<char>(block_key[i] ^ 0x36);
+    outer_pad[i] = static_cast<char>(block_key[i] ^ 0x5c);
+  }
+  Sha256 inner;
+  inner.Update(inner_pad.data(), inner_pad.size());
+  inner.Update(message.data(), message.size());
+  const std::string inner_digest = inner.Finish();
+  Sha256 outer;
+  outer.Update(outer_pad.data(), outer_pad.size());
+  outer.Update(inner_digest.data(), inner_digest.size());
+  return outer.Finish();
+}
+
+Sha256::Sha256() { std::memcpy(state_, kInitialState, sizeof(state_)); }
+
+void Sha256::Update(const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  total_bytes_ += size;
+  if (buffer_size_ > 0) {
+    const size_t take = std::min(size, kBlockBytes - buffer_size_);
+    std::memcpy(buffer_ + buffer_size_, bytes, take);
+    buffer_size_ += take;
+    bytes += take;
+    size -= take;
+    if (buffer_size_ < kBlockBytes) {
+      return;
+    }
+    ProcessBlock(buffer_);
+    buffer_size_ = 0;
+  }
+  for (; size >= kBlockBytes; bytes += kBlockBytes, size -= kBlockBytes) {
+    ProcessBlock(bytes);
+  }
+  std::memcpy(buffer_, bytes, size);
+  buffer_size_ = size;
+}
+
+std::string Sha256::Finish() {
+  // Pad with a one bit, then zeros up to the last 8 bytes of a block, which
+  // hold the length of the data in bits, big endian.
+  const uint64_t total_bits = total_bytes_ * 8;
+  unsigned char padding[kBlockBytes * 2] = {0x80};
+  const size_t padding_size =
+      (buffer_size_ < kBlockBytes - 8 ? kBlockBytes : kBlockBytes * 2) -
+      buffer_size_;
+  for (int i = 0; i < 8; i++) {
+    padding[padding_size - 1 - i] =
+        static_cast<unsigned char>(total_bits >> (8 * i));
+  }
+  Update(padding, padding_size);
+
+  std::string digest(kDigestBytes, '\0');
+  for (size_t i = 0; i < kDigestBytes; i++) {
+    digest[i] = static_cast<char>(state_[i / 4] >> (24 - 8 * (i % 4)));
+  }
+  return digest;
+}
+
+void Sha256::ProcessBlock(const unsigned char *block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    const unsigned char *word = block + 4 * i;
+    w[i] = (uint32_t{word[0]} << 24) | (uint32_t{word[1]} << 16) |
+           (uint32_t{word[2]} << 8) | uint32_t{word[3]};
+  }
+  for (int i = 16; i < 64; i++) {
+    const uint32_t s0 = RotateRight(w[i - 15], 7) ^
+                        RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const uint32_t s1 = RotateRight(w[i - 2], 17) ^
+                        RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+  uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+  for (int i = 0; i < 64; i++) {
+    const uint32_t s1 =
+        RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+    const uint32_t choice = (e & f) ^ (~e & g);
+    const uint32_t t1 = h + s1 + choice + kRoundConstants[i] + w[i];
+    const uint32_t s0 =
+        RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+    const uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+    const uint32_t t2 = s0 + majority;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+  state_[5] += f;
+  state_[6] += g;
+  state_[7] += h;
+}
+}  // namespace Visqol
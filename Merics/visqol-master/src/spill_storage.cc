@@ -0,0 +1,113 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "spill_storage.h"
+
+#include <string>
+
+#include "absl/base/const_init.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "boost/filesystem.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace Visqol {
+
+namespace {
+// Guards the settings below.
+ABSL_CONST_INIT absl::Mutex settings_mutex(absl::kConstInit);
+
+// The directory to spill to, or null for the system's temporary directory.
+std::string *spill_dir = nullptr;
+
+// The size from which buffers are spilled, or 0 to never spill them.
+size_t spill_threshold_bytes = 0;
+}  // namespace
+
+void SpillStorage::Configure(const FilePath &dir, size_t threshold_bytes) {
+  absl::MutexLock lock(&settings_mutex);
+  delete spill_dir;
+  spill_dir = dir.Path().empty() ? nullptr : new std::string(dir.Path());
+  spill_threshold_bytes = threshold_bytes;
+}
+
+bool SpillStorage::ShouldSpill(size_t num_bytes) {
+  absl::MutexLock lock(&settings_mutex);
+  return spill_threshold_bytes > 0 && num_bytes >= spill_threshold_bytes;
+}
+
+FilePath SpillStorage::Directory() {
+  {
+    absl::MutexLock lock(&settings_mutex);
+    if (spill_dir != nullptr) {
+      return FilePath(*spill_dir);
+    }
+  }
+  boost::system::error_code error;
+  const auto temp_dir = boost::filesystem::temp_directory_path(error);
+  return FilePath(error ? std::string("/tmp") : temp_dir.string());
+}
+
+absl::StatusOr<std::unique_ptr<MappedTempFile>> MappedTempFile::Create(
+    const FilePath &dir, size_t num_bytes) {
+#ifndef _WIN32
+  std::string path = dir.Path() + "/visqol_spill_XXXXXX";
+  const int fd = mkstemp(&path[0]);
+  if (fd < 0) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Unable to create a spill file in " + dir.Path());
+  }
+  // The file is only reachable through the mapping from here on.
+  unlink(path.c_str());
+  // Reserve the blocks of the whole file now. A sparse file would only take
+  // its blocks when a page is first written, and if the disk is then full
+  // that write raises SIGBUS, which kills the process rather than failing
+  // this buffer.
+  if (posix_fallocate(fd, 0, static_cast<off_t>(num_bytes)) != 0) {
+    close(fd);
+    return absl::Status(absl::StatusCode::kResourceExhausted,
+                        "Unable to reserve space for a spill file in " +
+                            dir.Path());
+  }
+  void *data = mmap(nullptr, num_bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return absl::Status(absl::StatusCode::kResourceExhausted,
+                        "Unable to map the spill file in " + dir.Path());
+  }
+  // The tables are filled in order but read back in reverse to backtrace,
+  // so the default access hint is kept. A sequential hint would read ahead in
+  // the wrong direction and drop the pages that are about to be read.
+  madvise(data, num_bytes, MADV_NORMAL);
+  return absl::WrapUnique(new MappedTempFile(data, num_bytes));
+#else
+  return absl::Status(absl::StatusCode::kUnimplemented,
+                      "Spilling to mapped files is not supported on Windows.");
+#endif
+}
+
+MappedTempFile::~MappedTempFile() {
+#ifndef _WIN32
+  munmap(data_, size_);
+#endif
+}
+}  // namespace Visqol
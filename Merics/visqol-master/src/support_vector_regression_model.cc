@@ -28,6 +28,7 @@ namespace Visqol {
 absl::Mutex SupportVectorRegressionModel::load_model_mutex_{};
 
 SupportVectorRegressionModel::SupportVectorRegressionModel():
+    model_{nullptr},
     observations_ptr_{nullptr},
     num_observations_{0}
 {
@@ -38,12 +39,10 @@ SupportVectorRegressionModel::~SupportVectorRegressionModel() {
   if (model_) {
     svm_free_model_content(model_);
     svm_free_and_destroy_model(&model_);
-    // Free the 2D array of observations.
-    for (size_t i = 0; i < num_observations_; ++i) {
-      free(observations_ptr_[i]);
-    }
-    free(observations_ptr_);
   }
+  // Free the 2D array of observations.
+  const LibSvmTargetObservationConvertor conv;
+  conv.FreeObservations(observations_ptr_);
 }
 
 void SupportVectorRegressionModel::Init(
@@ -52,17 +51,30 @@ void SupportVectorRegressionModel::Init(
   // Assumes all observations have same number of features
   size_t num_features = observations[0].size();
 
-  double *targets_ptr = const_cast<double *>(&targets[0]);
-
   const LibSvmTargetObservationConvertor conv;
   observations_ptr_ =
       conv.ConvertObservations(observations, num_features);
   num_observations_ = observations.size();
+  Train(&targets[0], num_features);
+}
+
+void SupportVectorRegressionModel::Init(const double *observations,
+                                        const MlTarget *targets,
+                                        size_t num_observations,
+                                        size_t num_features) {
+  const LibSvmTargetObservationConvertor conv;
+  observations_ptr_ =
+      conv.ConvertObservations(observations, num_observations, num_features);
+  num_observations_ = num_observations;
+  Train(targets, num_features);
+}
 
-  // Setup the SVM problem.
+void SupportVectorRegressionModel::Train(const MlTarget *targets,
+                                         size_t num_features) {
+  // Setup the SVM problem. LIBSVM does not modify the targets.
   svm_problem problem;
-  problem.l = targets.size();
-  problem.y = targets_ptr;
+  problem.l = num_observations_;
+  problem.y = const_cast<double *>(targets);
   problem.x = observations_ptr_;
 
   // Setup the SVM parameters.
@@ -115,4 +127,18 @@ absl::Status SupportVectorRegressionModel::Init(
   return absl::Status();
 }
 
+absl::Status SupportVectorRegressionModel::Save(
+    const FilePath &model_path) const {
+  if (model_ == nullptr) {
+    return absl::Status(absl::StatusCode::kFailedPrecondition,
+                        "The SVR model has not been initialized.");
+  }
+  if (svm_save_model(model_path.Path().c_str(), model_) != 0) {
+    return absl::Status(
+        absl::StatusCode::kInternal,
+        "Failed to write the SVR model file: " + model_path.Path());
+  }
+  return absl::Status();
+}
+
 }  // namespace Visqol
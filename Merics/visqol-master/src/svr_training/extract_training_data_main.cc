@@ -0,0 +1,129 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Builds SVR training data from a corpus of file pairs labelled with
+// subjective scores, and optionally trains a model on it.
+
+#include <string>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/flags/declare.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+
+#include "commandline_parser.h"
+#include "file_path.h"
+#include "resource_probe.h"
+#include "support_vector_regression_model.h"
+#include "training_data_extractor.h"
+#include "training_matrix_file.h"
+
+ABSL_FLAG(std::string, training_manifest_csv, "",
+          "Path to a CSV file listing the file pairs to compare along with "
+          "the subjective score (MOS-LQS) of each degraded file, in the "
+          "format:\n"
+          "------------------\n"
+          "reference,degraded,moslqs\n"
+          "ref1.wav,deg1.wav,4.25\n"
+          "ref2.wav,deg2.wav,2.5\n");
+ABSL_FLAG(std::string, observations_output, "training_fvnsims.txt",
+          "Path that the FVNSIM observations are written to.");
+ABSL_FLAG(std::string, targets_output, "training_moslqs.txt",
+          "Path that the MOS-LQS targets are written to.");
+ABSL_FLAG(std::string, training_matrix_output, "",
+          "If set, the observations and targets are also written to this path "
+          "as a binary training matrix file, which loads much faster than "
+          "the text files.");
+ABSL_FLAG(std::string, trained_model_output, "",
+          "If set, an SVR model is trained on the extracted data and written "
+          "to this path, for use with --similarity_to_quality_model.");
+
+// The comparison options are shared with the visqol binary.
+ABSL_DECLARE_FLAG(std::string, similarity_to_quality_model);
+ABSL_DECLARE_FLAG(bool, use_speech_mode);
+ABSL_DECLARE_FLAG(bool, use_unscaled_speech_mos_mapping);
+ABSL_DECLARE_FLAG(int, search_window_radius);
+
+int main(int argc, char **argv) {
+  absl::SetProgramUsageMessage(
+      "Extracts SVR training data for ViSQOL from a labelled corpus");
+  absl::ParseCommandLine(argc, argv);
+
+  auto pairs_statusor = Visqol::TrainingDataExtractor::ReadManifest(
+      absl::GetFlag(FLAGS_training_manifest_csv));
+  if (!pairs_statusor.ok()) {
+    ABSL_RAW_LOG(ERROR, "%s", pairs_statusor.status().ToString().c_str());
+    return -1;
+  }
+
+  // The SVR model does not affect the FVNSIM, but audio mode still needs a
+  // model to initialize.
+  const bool use_speech_mode = absl::GetFlag(FLAGS_use_speech_mode);
+  std::string model = absl::GetFlag(FLAGS_similarity_to_quality_model);
+  if (model.empty() && !use_speech_mode) {
+    model = Visqol::FilePath::currentWorkingDir() +
+        Visqol::kDefaultAudioModelFile;
+  }
+
+  const Visqol::ExecutionConfig exec_config =
+      Visqol::ResourceProbe::DeriveExecutionConfig(
+          Visqol::ResourceProbe::Probe());
+  Visqol::TrainingDataExtractor extractor(exec_config.num_workers);
+  auto init_status = extractor.Init(model, use_speech_mode,
+      absl::GetFlag(FLAGS_use_unscaled_speech_mos_mapping),
+      absl::GetFlag(FLAGS_search_window_radius));
+  if (!init_status.ok()) {
+    ABSL_RAW_LOG(ERROR, "%s", init_status.ToString().c_str());
+    return -1;
+  }
+
+  const Visqol::TrainingData data = extractor.Extract(pairs_statusor.value());
+  ABSL_RAW_LOG(INFO, "Extracted %zu of %zu labelled pairs.",
+               data.observations.size(), pairs_statusor.value().size());
+  if (data.observations.empty()) {
+    ABSL_RAW_LOG(ERROR, "No training data was extracted.");
+    return -1;
+  }
+  auto write_status = Visqol::TrainingDataExtractor::Write(data,
+      absl::GetFlag(FLAGS_observations_output),
+      absl::GetFlag(FLAGS_targets_output));
+  if (!write_status.ok()) {
+    ABSL_RAW_LOG(ERROR, "%s", write_status.ToString().c_str());
+    return -1;
+  }
+
+  const std::string matrix_output =
+      absl::GetFlag(FLAGS_training_matrix_output);
+  if (!matrix_output.empty()) {
+    auto matrix_status = Visqol::TrainingMatrixFile::Write(matrix_output,
+        data.observations, data.targets);
+    if (!matrix_status.ok()) {
+      ABSL_RAW_LOG(ERROR, "%s", matrix_status.ToString().c_str());
+      return -1;
+    }
+  }
+
+  const std::string model_output = absl::GetFlag(FLAGS_trained_model_output);
+  if (!model_output.empty()) {
+    Visqol::SupportVectorRegressionModel trained_model;
+    trained_model.Init(data.observations, data.targets);
+    auto save_status = trained_model.Save(model_output);
+    if (!save_status.ok()) {
+      ABSL_RAW_LOG(ERROR, "%s", save_status.ToString().c_str());
+      return -1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,124 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "training_data_extractor.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+
+namespace Visqol {
+
+// Matches the precision of the training files written by the Matlab
+// training script.
+const int kTrainingDataPrecision = 15;
+
+absl::StatusOr<std::vector<LabeledFilePair>>
+TrainingDataExtractor::ReadManifest(const FilePath &manifest_path) {
+  std::ifstream fin(manifest_path.Path());
+  if (!fin) {
+    return absl::Status(absl::StatusCode::kNotFound,
+                        "Could not open manifest " + manifest_path.Path());
+  }
+  std::vector<LabeledFilePair> pairs;
+  std::string line;
+  getline(fin, line);  // skip the header
+  size_t line_number = 1;
+  while (getline(fin, line)) {
+    line_number++;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty()) {
+      continue;
+    }
+    // The subjective score is the last column, so the manifest may hold
+    // extra columns between the file paths and the score.
+    std::vector<std::string> columns = absl::StrSplit(line, ',');
+    LabeledFilePair pair;
+    if (columns.size() < 3 ||
+        !absl::SimpleAtod(columns.back(), &pair.moslqs)) {
+      return absl::Status(absl::StatusCode::kInvalidArgument,
+                          "Malformed row " + std::to_string(line_number) +
+                              " in manifest " + manifest_path.Path());
+    }
+    pair.files = {FilePath(columns[0]), FilePath(columns[1])};
+    pairs.push_back(pair);
+  }
+  return pairs;
+}
+
+absl::Status TrainingDataExtractor::Write(const TrainingData &data,
+                                          const FilePath &observations_path,
+                                          const FilePath &targets_path) {
+  std::ofstream observations_out(observations_path.Path());
+  std::ofstream targets_out(targets_path.Path());
+  observations_out.precision(kTrainingDataPrecision);
+  targets_out.precision(kTrainingDataPrecision);
+  for (size_t i = 0; i < data.observations.size(); i++) {
+    for (size_t j = 0; j < data.observations[i].size(); j++) {
+      observations_out << (j == 0 ? "" : ",") << data.observations[i][j];
+    }
+    observations_out << "\n";
+    targets_out << data.targets[i] << "\n";
+  }
+  observations_out.close();
+  targets_out.close();
+  if (!observations_out || !targets_out) {
+    return absl::Status(absl::StatusCode::kInternal,
+                        "Failed to write the training data to " +
+                            observations_path.Path() + " and " +
+                            targets_path.Path());
+  }
+  return absl::Status();
+}
+
+TrainingDataExtractor::TrainingDataExtractor(size_t num_workers)
+    : runner_(num_workers) {}
+
+absl::Status TrainingDataExtractor::Init(
+    const FilePath &sim_to_quality_mapper_model, const bool use_speech_mode,
+    const bool use_unscaled_speech, const int search_window) {
+  return runner_.Init(sim_to_quality_mapper_model, use_speech_mode,
+                      use_unscaled_speech, search_window);
+}
+
+TrainingData TrainingDataExtractor::Extract(
+    const std::vector<LabeledFilePair> &pairs) {
+  std::vector<ReferenceDegradedPathPair> file_pairs;
+  file_pairs.reserve(pairs.size());
+  for (const auto &pair : pairs) {
+    file_pairs.push_back(pair.files);
+  }
+
+  TrainingData data;
+  runner_.Run(file_pairs, [&pairs, &data](size_t index,
+      const absl::StatusOr<SimilarityResultMsg> &status_or) {
+    if (!status_or.ok()) {
+      ABSL_RAW_LOG(WARNING, "Leaving %s out of the training data: %s",
+                   pairs[index].files.degraded.Path().c_str(),
+                   status_or.status().ToString().c_str());
+      return;
+    }
+    const auto &fvnsim = status_or.value().fvnsim();
+    data.observations.emplace_back(fvnsim.begin(), fvnsim.end());
+    data.targets.push_back(pairs[index].moslqs);
+  });
+  return data;
+}
+}  // namespace Visqol
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_TRAINING_DATA_EXTRACTOR_H
+#define VISQOL_INCLUDE_TRAINING_DATA_EXTRACTOR_H
+
+#include <cstddef>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+#include "batch_comparison_runner.h"
+#include "file_path.h"
+#include "machine_learning.h"
+
+namespace Visqol {
+
+/**
+ * A reference/degraded file pair and the subjective score (MOS-LQS) of the
+ * degraded file.
+ */
+struct LabeledFilePair {
+  /**
+   * The files to compare.
+   */
+  ReferenceDegradedPathPair files;
+
+  /**
+   * The subjective score of the degraded file.
+   */
+  MlTarget moslqs;
+};
+
+/**
+ * The observations and targets used to train the SVR model. Row i of the
+ * observations corresponds to row i of the targets.
+ */
+struct TrainingData {
+  /**
+   * The FVNSIM of each compared pair.
+   */
+  std::vector<MlObservation> observations;
+
+  /**
+   * The subjective score of each compared pair.
+   */
+  std::vector<MlTarget> targets;
+};
+
+/**
+ * This class builds SVR training data from a corpus of file pairs labelled
+ * with subjective scores. The pairs are compared in parallel, and the FVNSIM
+ * of each pair is used as its observation.
+ *
+ * The corpus is listed in a manifest CSV file, which has the same format as
+ * the --batch_input_csv file with an extra column holding the MOS-LQS:
+ *   reference,degraded,moslqs
+ *   ref1.wav,deg1.wav,4.25
+ *   ref2.wav,deg2.wav,2.5
+ *
+ * The training data is written in the format read by TrainingDataFileReader,
+ * and can be passed to SupportVectorRegressionModel::Init.
+ */
+class TrainingDataExtractor {
+ public:
+  /**
+   * Read the file pairs and their subjective scores from a manifest file.
+   *
+   * @param manifest_path The path to the manifest CSV file.
+   *
+   * @return The labelled file pairs, in manifest order, or an error status if
+   *    the manifest could not be read or a row is malformed.
+   */
+  static absl::StatusOr<std::vector<LabeledFilePair>> ReadManifest(
+      const FilePath &manifest_path);
+
+  /**
+   * Write the training data to an observations file and a targets file, in
+   * the format read by TrainingDataFileReader with a comma delimiter.
+   *
+   * @param data The training data to write.
+   * @param observations_path The path of the observations file.
+   * @param targets_path The path of the targets file.
+   *
+   * @return An error status if a file could not be written.
+   */
+  static absl::Status Write(const TrainingData &data,
+                            const FilePath &observations_path,
+                            const FilePath &targets_path);
+
+  /**
+   * Constructs an extractor that compares the given number of pairs
+   * concurrently.
+   *
+   * @param num_workers The number of comparisons to run concurrently.
+   */
+  explicit TrainingDataExtractor(size_t num_workers);
+
+  /**
+   * Initializes the comparison workers. Must be called before Extract. See
+   * VisqolManager::Init for a description of the params.
+   *
+   * @return An 'OK' status if the workers were initialised successfully,
+   *    else an error status.
+   */
+  absl::Status Init(const FilePath &sim_to_quality_mapper_model,
+                    const bool use_speech_mode, const bool use_unscaled_speech,
+                    const int search_window);
+
+  /**
+   * Compare each of the given file pairs and collect the training data. Pairs
+   * that fail to compare are logged and left out of the training data.
+   *
+   * @param pairs The labelled file pairs to compare.
+   *
+   * @return The training data, in the order of the given pairs.
+   */
+  TrainingData Extract(const std::vector<LabeledFilePair> &pairs);
+
+ private:
+  /**
+   * Runs the comparisons across the workers.
+   */
+  BatchComparisonRunner runner_;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_TRAINING_DATA_EXTRACTOR_H
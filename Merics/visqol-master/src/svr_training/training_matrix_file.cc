@@ -0,0 +1,183 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "training_matrix_file.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Visqol {
+
+const char TrainingMatrixFile::kMagic[] = "VQTM";
+const uint32_t TrainingMatrixFile::kVersion = 1;
+
+// The header is the magic, version, row count and column count. Its size
+// keeps the doubles that follow 8 byte aligned.
+const size_t kMagicSize = 4;
+const size_t kHeaderSize =
+    kMagicSize + sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+absl::Status TrainingMatrixFile::Write(
+    const FilePath &path, const std::vector<MlObservation> &observations,
+    const std::vector<MlTarget> &targets) {
+  const uint64_t num_rows = observations.size();
+  const uint64_t num_cols = observations.empty() ? 0 : observations[0].size();
+  if (targets.size() != num_rows) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "There are " + std::to_string(num_rows) +
+                            " observations but " +
+                            std::to_string(targets.size()) + " targets.");
+  }
+  for (const auto &row : observations) {
+    if (row.size() != num_cols) {
+      return absl::Status(absl::StatusCode::kInvalidArgument,
+                          "Every observation must have " +
+                              std::to_string(num_cols) + " features.");
+    }
+  }
+
+  std::ofstream out(path.Path(), std::ios::binary | std::ios::trunc);
+  out.write(kMagic, kMagicSize);
+  out.write(reinterpret_cast<const char *>(&kVersion), sizeof(kVersion));
+  out.write(reinterpret_cast<const char *>(&num_rows), sizeof(num_rows));
+  out.write(reinterpret_cast<const char *>(&num_cols), sizeof(num_cols));
+  out.write(reinterpret_cast<const char *>(targets.data()),
+            targets.size() * sizeof(MlTarget));
+  for (const auto &row : observations) {
+    out.write(reinterpret_cast<const char *>(row.data()),
+              row.size() * sizeof(double));
+  }
+  out.close();
+  if (!out) {
+    return absl::Status(absl::StatusCode::kInternal,
+                        "Failed to write the training matrix file " +
+                            path.Path());
+  }
+  return absl::Status();
+}
+
+TrainingMatrixFile::~TrainingMatrixFile() { Close(); }
+
+absl::Status TrainingMatrixFile::Open(const FilePath &path) {
+  Close();
+#ifdef _WIN32
+  // Without mmap, the file is read into a single buffer instead.
+  FILE *file = fopen(path.Path().c_str(), "rb");
+  if (file == nullptr) {
+    return absl::Status(absl::StatusCode::kNotFound,
+                        "Could not open the training matrix file " +
+                            path.Path());
+  }
+  fseek(file, 0, SEEK_END);
+  mapping_size_ = static_cast<size_t>(ftell(file));
+  fseek(file, 0, SEEK_SET);
+  mapping_ = malloc(mapping_size_);
+  const size_t num_read = fread(mapping_, 1, mapping_size_, file);
+  fclose(file);
+  if (num_read != mapping_size_) {
+    Close();
+    return absl::Status(absl::StatusCode::kInternal,
+                        "Failed to read the training matrix file " +
+                            path.Path());
+  }
+#else
+  const int fd = open(path.Path().c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::Status(absl::StatusCode::kNotFound,
+                        "Could not open the training matrix file " +
+                            path.Path());
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return absl::Status(absl::StatusCode::kInternal,
+                        "Could not stat the training matrix file " +
+                            path.Path());
+  }
+  mapping_size_ = static_cast<size_t>(file_stat.st_size);
+  void *mapping = mapping_size_ == 0
+                      ? MAP_FAILED
+                      : mmap(nullptr, mapping_size_, PROT_READ, MAP_PRIVATE,
+                             fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    mapping_size_ = 0;
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Could not map the training matrix file " +
+                            path.Path());
+  }
+  mapping_ = mapping;
+#endif
+
+  // Validate the header, and that the file holds exactly the data it
+  // describes.
+  const char *bytes = static_cast<const char *>(mapping_);
+  uint32_t version = 0;
+  uint64_t num_rows = 0;
+  uint64_t num_cols = 0;
+  if (mapping_size_ >= kHeaderSize) {
+    std::memcpy(&version, bytes + kMagicSize, sizeof(version));
+    std::memcpy(&num_rows, bytes + kMagicSize + sizeof(version),
+                sizeof(num_rows));
+    std::memcpy(&num_cols,
+                bytes + kMagicSize + sizeof(version) + sizeof(num_rows),
+                sizeof(num_cols));
+  }
+  const uint64_t max_values =
+      (std::numeric_limits<uint64_t>::max() - kHeaderSize) / sizeof(double);
+  if (mapping_size_ < kHeaderSize ||
+      std::memcmp(bytes, kMagic, kMagicSize) != 0 || version != kVersion ||
+      num_cols >= max_values ||
+      (num_rows != 0 && num_rows > max_values / (num_cols + 1)) ||
+      mapping_size_ != kHeaderSize + num_rows * (num_cols + 1) *
+                                         sizeof(double)) {
+    Close();
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        path.Path() + " is not a valid training matrix file.");
+  }
+  num_observations_ = static_cast<size_t>(num_rows);
+  num_features_ = static_cast<size_t>(num_cols);
+  targets_ = reinterpret_cast<const MlTarget *>(bytes + kHeaderSize);
+  observations_ = targets_ + num_observations_;
+  return absl::Status();
+}
+
+void TrainingMatrixFile::Close() {
+  if (mapping_ != nullptr) {
+#ifdef _WIN32
+    free(mapping_);
+#else
+    munmap(mapping_, mapping_size_);
+#endif
+  }
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+  num_observations_ = 0;
+  num_features_ = 0;
+  targets_ = nullptr;
+  observations_ = nullptr;
+}
+}  // namespace Visqol
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2019 Google LLC, Andrew Hines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISQOL_INCLUDE_TRAINING_MATRIX_FILE_H
+#define VISQOL_INCLUDE_TRAINING_MATRIX_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+
+#include "file_path.h"
+#include "machine_learning.h"
+
+namespace Visqol {
+
+/**
+ * This class reads and writes SVR training data in a binary dense matrix
+ * format. Unlike the text files read by TrainingDataFileReader, the file is
+ * memory mapped rather than parsed, so loading a large corpus is
+ * effectively free and the observations can be passed straight to
+ * SupportVectorRegressionModel::Init.
+ *
+ * The file holds, in host (little endian) byte order:
+ *   char[4]  magic "VQTM"
+ *   uint32   format version
+ *   uint64   number of observations (rows)
+ *   uint64   number of features per observation (columns)
+ *   double   targets[rows]
+ *   double   observations[rows][columns], row-major
+ */
+class TrainingMatrixFile {
+ public:
+  /**
+   * The magic number at the start of every training matrix file.
+   */
+  static const char kMagic[];
+
+  /**
+   * The version of the format written by this class.
+   */
+  static const uint32_t kVersion;
+
+  /**
+   * Write training data to a training matrix file.
+   *
+   * @param path The path of the file to write.
+   * @param observations The observations. All rows must have the same number
+   *    of features.
+   * @param targets The target of each observation.
+   *
+   * @return An error status if the rows differ in size, the number of
+   *    targets does not match, or the file could not be written.
+   */
+  static absl::Status Write(const FilePath &path,
+                            const std::vector<MlObservation> &observations,
+                            const std::vector<MlTarget> &targets);
+
+  TrainingMatrixFile() = default;
+
+  TrainingMatrixFile(const TrainingMatrixFile &) = delete;
+  TrainingMatrixFile &operator=(const TrainingMatrixFile &) = delete;
+
+  /**
+   * Unmaps the file, if one is open.
+   */
+  ~TrainingMatrixFile();
+
+  /**
+   * Map a training matrix file into memory.
+   *
+   * @param path The path of the file to map.
+   *
+   * @return An error status if the file could not be mapped, or it is not a
+   *    valid training matrix file.
+   */
+  absl::Status Open(const FilePath &path);
+
+  /**
+   * @return The number of observations (rows).
+   */
+  size_t NumObservations() const { return num_observations_; }
+
+  /**
+   * @return The number of features per observation (columns).
+   */
+  size_t NumFeatures() const { return num_features_; }
+
+  /**
+   * @return The row-major observation matrix. Valid while this file is open.
+   */
+  const double *Observations() const { return observations_; }
+
+  /**
+   * @return The target of each observation. Valid while this file is open.
+   */
+  const MlTarget *Targets() const { return targets_; }
+
+ private:
+  /**
+   * Unmap the file, if one is open.
+   */
+  void Close();
+
+  /**
+   * The start of the mapped file, or null if no file is open.
+   */
+  void *mapping_ = nullptr;
+
+  /**
+   * The size of the mapped file in bytes.
+   */
+  size_t mapping_size_ = 0;
+
+  /**
+   * The number of observations (rows).
+   */
+  size_t num_observations_ = 0;
+
+  /**
+   * The number of features per observation (columns).
+   */
+  size_t num_features_ = 0;
+
+  /**
+   * The targets within the mapped file.
+   */
+  const MlTarget *targets_ = nullptr;
+
+  /**
+   * The observations within the mapped file.
+   */
+  const double *observations_ = nullptr;
+};
+}  // namespace Visqol
+
+#endif  // VISQOL_INCLUDE_TRAINING_MATRIX_FILE_H
@@ -0,0 +1,99 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tuning_profile.h"
+
+#include <fstream>
+#include <string>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+
+namespace Visqol {
+
+const int TuningProfileFile::kFormatVersion = 1;
+
+absl::StatusOr<TuningProfile> TuningProfileFile::Read(const FilePath &path) {
+  std::ifstream fin(path.Path());
+  if (!fin) {
+    return absl::Status(absl::StatusCode::kNotFound,
+                        "Unable to open tuning profile: " + path.Path());
+  }
+
+  TuningProfile profile;
+  std::string line;
+  while (std::getline(fin, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    const size_t split = line.find('=');
+    if (split == std::string::npos) {
+      return absl::Status(absl::StatusCode::kInvalidArgument,
+                          "Malformed tuning profile line: " + line);
+    }
+    const std::string key = line.substr(0, split);
+    const std::string value = line.substr(split + 1);
+
+    size_t parsed;
+    if (!absl::SimpleAtoi(value, &parsed)) {
+      return absl::Status(absl::StatusCode::kInvalidArgument,
+                          "Invalid value for tuning profile key: " + key);
+    }
+
+    if (key == "version") {
+      if (parsed != static_cast<size_t>(kFormatVersion)) {
+        return absl::Status(absl::StatusCode::kFailedPrecondition,
+                            "Unsupported tuning profile version: " + value);
+      }
+    } else if (key == "host_concurrency") {
+      profile.host_concurrency = parsed;
+    } else if (key == "num_workers") {
+      profile.num_workers = parsed;
+    } else {
+      ABSL_RAW_LOG(WARNING, "Ignoring unknown tuning profile key: %s",
+                   key.c_str());
+    }
+  }
+
+  if (profile.num_workers == 0) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Tuning profile num_workers must be at least 1.");
+  }
+  return profile;
+}
+
+absl::Status TuningProfileFile::Write(const FilePath &path,
+                                      const TuningProfile &profile) {
+  std::ofstream fout(path.Path(), std::ios::trunc);
+  if (!fout) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Unable to write tuning profile: " + path.Path());
+  }
+  fout << "# ViSQOL tuning profile. Generated by 'visqol --autotune'.\n";
+  fout << "version=" << kFormatVersion << "\n";
+  fout << "host_concurrency=" << profile.host_concurrency << "\n";
+  fout << "num_workers=" << profile.num_workers << "\n";
+  fout.close();
+  if (!fout) {
+    return absl::Status(absl::StatusCode::kInternal,
+                        "Failed writing tuning profile: " + path.Path());
+  }
+  return absl::Status();
+}
+}  // namespace Visqol
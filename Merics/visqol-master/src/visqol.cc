@@ -14,58 +14,92 @@
 
 #include "visqol.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <numeric>
 #include <utility>
 #include <vector>
 
 #include "amatrix.h"
+#include "cancellation_token.h"
 #include "comparison_patches_selector.h"
 #include "file_path.h"
 #include "image_patch_creator.h"
+#include "lazy_spectrogram_pair.h"
 #include "misc_audio.h"
 #include "patch_similarity_comparator.h"
+#include "patch_similarity_table.h"
 #include "similarity_result.h"
 #include "similarity_to_quality_mapper.h"
 #include "spectrogram.h"
 #include "spectrogram_builder.h"
+#include "status_macros.h"
 #include "absl/base/internal/raw_logging.h"
 #include "absl/status/statusor.h"
 
 namespace Visqol {
+
+namespace {
+// The wall time in seconds since the given time point.
+double SecondsSince(const std::chrono::steady_clock::time_point &start) {
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Sum a patches x bands array over the patches. Each patch adds one
+// contiguous row, so the loop over the bands vectorizes.
+AMatrix<double> SumOverPatches(const std::vector<double> &values,
+                               const size_t num_patches,
+                               const size_t num_freq_bands) {
+  std::vector<double> sums(num_freq_bands, 0.0);
+  double *sums_data = sums.data();
+  const double *row = values.data();
+  for (size_t patch = 0; patch < num_patches; patch++) {
+    for (size_t band = 0; band < num_freq_bands; band++) {
+      sums_data[band] += row[band];
+    }
+    row += num_freq_bands;
+  }
+  return AMatrix<double>(sums);
+}
+}  // namespace
 absl::StatusOr<SimilarityResult> Visqol::CalculateSimilarity(
     const AudioSignal &ref_signal, AudioSignal &deg_signal,
     SpectrogramBuilder *spect_builder, const AnalysisWindow &window,
     const ImagePatchCreator *patch_creator,
     const ComparisonPatchesSelector *comparison_patches_selector,
     const SimilarityToQualityMapper *sim_to_qual_mapper,
-    const int search_window) const {
+    const int search_window, const CancellationToken *cancellation,
+    StageTimes *stage_times, const Spectrogram *ref_spectrogram) const {
+  // The time of each stage is recorded as soon as it ends, so that the times
+  // of the stages run are known even if a later stage fails.
+  StageTimes local_stage_times;
+  StageTimes *times =
+      stage_times != nullptr ? stage_times : &local_stage_times;
+
   /////////////////// Stage 1: Preprocessing ///////////////////
+  auto stage_start = std::chrono::steady_clock::now();
   deg_signal = MiscAudio::ScaleToMatchSoundPressureLevel(ref_signal,
       deg_signal);
 
-  // build the reference spectrogram.
-  const auto ref_spectro_result = spect_builder->Build(ref_signal, window);
-  if (!ref_spectro_result.ok()) {
-    ABSL_RAW_LOG(ERROR, "Error building reference spectrogram: %s",
-                 ref_spectro_result.status().ToString().c_str());
-    return ref_spectro_result.status();
+  // The spectrograms are computed lazily, so that degraded columns that are
+  // never within the search window of a reference patch are not computed.
+  LazySpectrogramPair spectrograms(spect_builder, ref_signal, deg_signal,
+                                   window, ref_spectrogram);
+  const auto spectro_status = spectrograms.Init(cancellation);
+  if (!spectro_status.ok()) {
+    ABSL_RAW_LOG(ERROR, "Error building spectrograms: %s",
+                 spectro_status.ToString().c_str());
+    return spectro_status;
   }
 
-  // build the degraded spectrogram.
-  const auto deg_spectro_result = spect_builder->Build(deg_signal, window);
-  if (!deg_spectro_result.ok()) {
-    ABSL_RAW_LOG(ERROR, "Error building degraded spectrogram: %s",
-                 deg_spectro_result.status().ToString().c_str());
-    return deg_spectro_result.status();
-  }
-
-  Spectrogram ref_spectrogram = ref_spectro_result.value();
-  Spectrogram deg_spectrogram = deg_spectro_result.value();
-  MiscAudio::PrepareSpectrogramsForComparison(ref_spectrogram, deg_spectrogram);
-
   /////////////// Stage 2: Feature selection and similarity measure ////////////
+  // Only the dimensions of the reference spectrogram are used to create the
+  // patch indices.
   auto ref_patch_result = patch_creator->CreateRefPatchIndices(
-      ref_spectrogram.Data(), ref_signal, window);
+      spectrograms.RefData(), ref_signal, window);
   if (!ref_patch_result.ok()) {
     ABSL_RAW_LOG(ERROR, "Error creating reference patch indices: %s",
                  ref_patch_result.status().ToString().c_str());
@@ -75,29 +109,48 @@ absl::StatusOr<SimilarityResult> Visqol::CalculateSimilarity(
   const double frame_duration = CalcFrameDuration(window.size * window.overlap,
                                                   ref_signal.sample_rate);
 
+  const size_t patch_size = patch_creator->GetPatchSize();
+  for (const size_t ref_patch_index : ref_patch_indices) {
+    const auto status = spectrograms.EnsureColumns(
+        ref_patch_index, ref_patch_index + patch_size - 1);
+    if (!status.ok()) {
+      return status;
+    }
+  }
   auto ref_patches = patch_creator->CreatePatchesFromIndices(
-      ref_spectrogram.Data(), ref_patch_indices);
+      spectrograms.RefData(), ref_patch_indices);
+  times->preprocessing_seconds = SecondsSince(stage_start);
+  VISQOL_RETURN_IF_ERROR(CancellationToken::Check(cancellation));
+
+  stage_start = std::chrono::steady_clock::now();
+  PatchSearchStats search_stats;
   auto most_sim_patch_result =
       comparison_patches_selector->FindMostOptimalDegPatches(
-          ref_patches, ref_patch_indices, deg_spectrogram.Data(),
-          frame_duration, search_window);
+          ref_patches, ref_patch_indices, &spectrograms,
+          frame_duration, search_window, &search_stats, cancellation);
+  times->patch_search_seconds = SecondsSince(stage_start);
   if (!most_sim_patch_result.ok()) {
     return most_sim_patch_result.status();
   }
-  auto sim_match_info = most_sim_patch_result.value();
+  const std::vector<PatchSimilarityResult> matched_patches =
+      std::move(most_sim_patch_result).value();
 
   // Realign the patches in time domain subsignals that start at the coarse
   // patch times.
+  stage_start = std::chrono::steady_clock::now();
+  FineAlignmentStats fine_alignment_stats;
   auto realign_result =
       comparison_patches_selector->FinelyAlignAndRecreatePatches(
-          sim_match_info, ref_signal, deg_signal, spect_builder,
-          window);
+          matched_patches, ref_signal, deg_signal, spect_builder,
+          window, &fine_alignment_stats, cancellation);
+  times->fine_alignment_seconds = SecondsSince(stage_start);
   if (!realign_result.ok()) {
     return realign_result.status();
   }
 
-  sim_match_info = realign_result.value();
+  PatchSimilarityTable sim_match_info = std::move(realign_result).value();
 
+  stage_start = std::chrono::steady_clock::now();
   AMatrix<double> fvnsim = CalcPerPatchMeanFreqBandMeans(sim_match_info);
   AMatrix<double> fstdnsim =
       CalcPerPatchMeanFreqBandStdDevs(sim_match_info, frame_duration);
@@ -117,6 +170,14 @@ absl::StatusOr<SimilarityResult> Visqol::CalculateSimilarity(
   // gather results
   SimilarityDebugInfo d;
   d.patch_sims = std::move(sim_match_info);
+  d.spectrogram_columns_computed = spectrograms.NumColumnsComputed();
+  d.spectrogram_columns_total = spectrograms.NumColumnsTotal();
+  d.patches_fine_aligned = fine_alignment_stats.num_refined;
+  d.patches_fine_alignment_skipped = fine_alignment_stats.num_skipped;
+  d.patch_candidates_evaluated = search_stats.num_candidates_evaluated;
+  d.patch_candidates_pruned = search_stats.num_candidates_pruned;
+  times->quality_mapping_seconds = SecondsSince(stage_start);
+  d.stage_times = *times;
   SimilarityResult r;
   r.vnsim = vnsim;
   r.fvnsim = fvnsim.ToVector();
@@ -124,10 +185,89 @@ absl::StatusOr<SimilarityResult> Visqol::CalculateSimilarity(
   r.fvdegenergy = fvdegenergy.ToVector();
   r.moslqo = moslqo;
   r.debug_info = std::move(d);
-  r.center_freq_bands = ref_spectrogram.GetCenterFreqBands();
+  r.center_freq_bands = spectrograms.GetCenterFreqBands();
   return r;
 }
 
+absl::StatusOr<SpectrogramFeatures> Visqol::CalculateSpectrograms(
+    const AudioSignal &ref_signal, AudioSignal &deg_signal,
+    SpectrogramBuilder *spect_builder, const AnalysisWindow &window) const {
+  deg_signal = MiscAudio::ScaleToMatchSoundPressureLevel(ref_signal,
+      deg_signal);
+
+  // The lazy pair is used so that the spectrograms are prepared exactly as
+  // they are for the patch search.
+  LazySpectrogramPair spectrograms(spect_builder, ref_signal, deg_signal,
+                                   window);
+  VISQOL_RETURN_IF_ERROR(spectrograms.Init());
+  const size_t num_cols = std::max(spectrograms.RefData().NumCols(),
+                                   spectrograms.DegData().NumCols());
+  if (num_cols == 0) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "The signals are too short to build a spectrogram.");
+  }
+  VISQOL_RETURN_IF_ERROR(spectrograms.EnsureColumns(0, num_cols - 1));
+
+  SpectrogramFeatures features;
+  features.reference = spectrograms.RefData();
+  features.degraded = spectrograms.DegData();
+  features.center_freq_bands = spectrograms.GetCenterFreqBands();
+  features.frame_duration = CalcFrameDuration(window.size * window.overlap,
+                                              ref_signal.sample_rate);
+  return features;
+}
+
+std::vector<TimelineWindow> Visqol::CalculateTimeline(
+    const PatchSimilarityTable &patch_sims,
+    const SimilarityToQualityMapper *sim_to_qual_mapper,
+    const double window_duration, const double hop_duration) const {
+  std::vector<TimelineWindow> timeline;
+  if (patch_sims.NumPatches() == 0 || window_duration <= 0.0 ||
+      hop_duration <= 0.0) {
+    return timeline;
+  }
+  const std::vector<double> &ref_starts = patch_sims.RefPatchStartTimes();
+  const std::vector<double> &ref_ends = patch_sims.RefPatchEndTimes();
+  double signal_end = 0.0;
+  for (const double ref_end : ref_ends) {
+    signal_end = std::max(signal_end, ref_end);
+  }
+  const size_t num_windows = signal_end <= window_duration ? 1 :
+      1 + static_cast<size_t>(
+          std::floor((signal_end - window_duration) / hop_duration));
+
+  std::vector<size_t> window_patches;
+  for (size_t i = 0; i < num_windows; i++) {
+    const double start = i * hop_duration;
+    const double end = num_windows == 1 ?
+        std::max(window_duration, signal_end) : start + window_duration;
+    window_patches.clear();
+    for (size_t patch = 0; patch < patch_sims.NumPatches(); patch++) {
+      const double midpoint = (ref_starts[patch] + ref_ends[patch]) / 2.0;
+      if (midpoint >= start && midpoint < end) {
+        window_patches.push_back(patch);
+      }
+    }
+    if (window_patches.empty()) {
+      continue;
+    }
+
+    const AMatrix<double> fvnsim =
+        CalcPerPatchMeanFreqBandMeans(patch_sims.Select(window_patches));
+    const double sum = std::accumulate(fvnsim.cbegin(), fvnsim.cend(), 0.0);
+    TimelineWindow window;
+    window.start_time = start;
+    window.end_time = std::min(end, signal_end);
+    window.vnsim = sum / fvnsim.NumRows();
+    window.moslqo = AlterForSimilarityExtremes(
+        window.vnsim, PredictMos(fvnsim, sim_to_qual_mapper));
+    window.fvnsim = fvnsim.ToVector();
+    window.num_patches = window_patches.size();
+    timeline.push_back(std::move(window));
+  }
+  return timeline;
+}
+
 double Visqol::PredictMos(const AMatrix<double> &fvnsim,
                                const SimilarityToQualityMapper *mapper) const {
   double predicted_quality = mapper->PredictQuality(fvnsim.ToVector());
@@ -136,65 +276,57 @@ double Visqol::PredictMos(const AMatrix<double> &fvnsim,
 
 // calc fvnsim
 AMatrix<double> Visqol::CalcPerPatchMeanFreqBandMeans(
-    const std::vector<PatchSimilarityResult> &sim_match_info) const {
-  size_t num_freq_bands = sim_match_info[0].freq_band_means.NumRows();
-  auto fvnsim = AMatrix<double>::Filled(num_freq_bands, 1, 0.0);
-  for (const PatchSimilarityResult &patch : sim_match_info) {
-    for (size_t band = 0; band < patch.freq_band_means.NumRows(); band++) {
-      fvnsim(band) += patch.freq_band_means(band);
-    }
-  }
-  return fvnsim / sim_match_info.size();
+    const PatchSimilarityTable &sim_match_info) const {
+  const AMatrix<double> fvnsim =
+      SumOverPatches(sim_match_info.FreqBandMeans(),
+                     sim_match_info.NumPatches(),
+                     sim_match_info.NumFreqBands());
+  return fvnsim / sim_match_info.NumPatches();
 }
 
 AMatrix<double> Visqol::CalcPerPatchMeanFreqBandDegradedEnergy(
-    const std::vector<PatchSimilarityResult> &sim_match_info) const {
-  // All patches have the same number of frequency bands.
-  size_t num_freq_bands = sim_match_info[0].freq_band_deg_energy.NumRows();
-  // Create an empty matrix to accumulate the energy over the patches.
-  AMatrix<double> total_fvdegenergy = AMatrix<double>::Filled(
-      num_freq_bands, 1, 0.0);
-  for (const PatchSimilarityResult &patch : sim_match_info) {
-    for (size_t band = 0; band < patch.freq_band_deg_energy.NumRows(); band++) {
-      total_fvdegenergy(band) += patch.freq_band_deg_energy(band);
-    }
-  }
-  return total_fvdegenergy / sim_match_info.size();
+    const PatchSimilarityTable &sim_match_info) const {
+  const AMatrix<double> total_fvdegenergy =
+      SumOverPatches(sim_match_info.FreqBandDegEnergy(),
+                     sim_match_info.NumPatches(),
+                     sim_match_info.NumFreqBands());
+  return total_fvdegenergy / sim_match_info.NumPatches();
 }
 
 AMatrix<double> Visqol::CalcPerPatchMeanFreqBandStdDevs(
-    const std::vector<PatchSimilarityResult> &sim_match_info,
+    const PatchSimilarityTable &sim_match_info,
     const double frame_duration) const {
-  const size_t num_freq_bands = sim_match_info[0].freq_band_means.NumRows();
-  AMatrix<double> fvnsim = AMatrix<double>::Filled(num_freq_bands, 1, 0.0);
-
-  AMatrix<double> contribution =
-      AMatrix<double>::Filled(num_freq_bands, 1, 0.0);
-  for (const PatchSimilarityResult &patch : sim_match_info) {
-    for (size_t band = 0; band < patch.freq_band_means.NumRows(); band++) {
-      fvnsim(band) += patch.freq_band_means(band);
-    }
-  }
-  fvnsim = fvnsim / sim_match_info.size();
+  const size_t num_patches = sim_match_info.NumPatches();
+  const size_t num_freq_bands = sim_match_info.NumFreqBands();
+  const AMatrix<double> fvnsim =
+      CalcPerPatchMeanFreqBandMeans(sim_match_info);
 
   // Now that we have the global mean, we can compute the combined
   // variance/stddev.
+  std::vector<double> contribution_sums(num_freq_bands, 0.0);
+  double *contribution_data = contribution_sums.data();
+  const double *means = sim_match_info.FreqBandMeans().data();
+  const double *stddevs = sim_match_info.FreqBandStdDevs().data();
+  const std::vector<double> &ref_starts = sim_match_info.RefPatchStartTimes();
+  const std::vector<double> &ref_ends = sim_match_info.RefPatchEndTimes();
   int total_frame_count = 0;
-  for (const PatchSimilarityResult &patch : sim_match_info) {
-    const double secs_in_patch = (patch.ref_patch_end_time -
-                                  patch.ref_patch_start_time);
+  for (size_t patch = 0; patch < num_patches; patch++) {
+    const double secs_in_patch = ref_ends[patch] - ref_starts[patch];
     const int frame_count = static_cast<int>(
         std::ceil(secs_in_patch / frame_duration));
     total_frame_count += frame_count;
-    for (size_t band = 0; band < patch.freq_band_means.NumRows(); band++) {
+    for (size_t band = 0; band < num_freq_bands; band++) {
       // Calculate the total variance by combining mean and stddev for each
       // patch. https://en.wikipedia.org/wiki/Pooled_variance
-      const double stddev = patch.freq_band_stddevs(band);
-      const double mean = patch.freq_band_means(band);
-      contribution(band) += (frame_count - 1) * stddev * stddev;
-      contribution(band) += frame_count * mean * mean;
+      const double stddev = stddevs[band];
+      const double mean = means[band];
+      contribution_data[band] += (frame_count - 1) * stddev * stddev;
+      contribution_data[band] += frame_count * mean * mean;
     }
+    means += num_freq_bands;
+    stddevs += num_freq_bands;
   }
+  const AMatrix<double> contribution(contribution_sums);
 
   AMatrix<double> result =
       ((contribution - (fvnsim.PointWiseProduct(fvnsim) * total_frame_count)) /
@@ -71,14 +71,9 @@ absl::Status VisqolApi::Create(const VisqolConfig config) {
     }
   }
 
-  // ViSQOL Audio currently supports 48k sample rates only.
-  //
-  // TODO We also will support speech mode which should support other sample
-  // rates, so we should allow some flexibility to handle that. Speech mode
-  // supports non-48k by explicitly setting the equivalent rectangular bands to
-  // specific frequencies (the bands are independent of sample rate, unlike how
-  // visqolaudio works). It seems like if we did this for Visqol we could
-  // support arbitrary sample rates.
+  // ViSQOL Audio uses the 48k band plan at any sample rate, but the bands
+  // above half the sample rate are empty and score as perfect matches, so
+  // other rates still need the override.
   if (sample_rate_ != k48kSampleRate &&
       speech_mode == false  &&
       allow_sr_override == false) {
@@ -14,8 +14,12 @@
 
 #include "visqol_manager.h"
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include "alignment.h"
@@ -34,11 +38,33 @@
 #include "status_macros.h"
 #include "vad_patch_creator.h"
 #include "visqol.h"
+#include "visqol_api.h"
 
 namespace Visqol {
 
+namespace {
+// Add the times of the stages that ran to the message of a cancelled
+// comparison, so that it shows where the time went. Other errors are returned
+// unchanged.
+absl::Status WithStageTimes(const absl::Status& status,
+                            const StageTimes& stage_times) {
+  if (status.code() != absl::StatusCode::kDeadlineExceeded) {
+    return status;
+  }
+  std::ostringstream message;
+  message << status.message()
+          << " Stage times (s): load " << stage_times.load_seconds
+          << ", global alignment " << stage_times.global_alignment_seconds
+          << ", preprocessing " << stage_times.preprocessing_seconds
+          << ", patch search " << stage_times.patch_search_seconds
+          << ", fine alignment " << stage_times.fine_alignment_seconds
+          << ", quality mapping " << stage_times.quality_mapping_seconds
+          << ".";
+  return absl::Status(status.code(), message.str());
+}
+}  // namespace
+
 const size_t k16kSampleRate = 16000;
-const size_t k48kSampleRate = 48000;
 const size_t VisqolManager::kPatchSize = 30;
 const size_t VisqolManager::kPatchSizeSpeech = 20;
 const size_t VisqolManager::kNumBandsAudio = 32;
@@ -46,14 +72,18 @@ const size_t VisqolManager::kNumBandsSpeech = 21;
 const double VisqolManager::kMinimumFreq = 50;  // wideband
 const double VisqolManager::kOverlap = 0.25;    // 25% overlap
 const double VisqolManager::kDurationMismatchTolerance = 1.0;
+const double VisqolManager::kSilenceTrimPadding = 0.5;
 
-absl::Status VisqolManager::Init(const FilePath sim_to_quality_mapper_model,
-                                 const bool use_speech_mode,
-                                 const bool use_unscaled_speech,
-                                 const int search_window) {
+absl::Status VisqolManager::Init(
+    const FilePath sim_to_quality_mapper_model, const bool use_speech_mode,
+    const bool use_unscaled_speech, const int search_window,
+    const FineAlignmentPolicy &fine_alignment_policy,
+    const PatchSearchPolicy &patch_search_policy) {
   use_speech_mode_ = use_speech_mode;
   use_unscaled_speech_mos_mapping_ = use_unscaled_speech;
   search_window_ = search_window;
+  fine_alignment_policy_ = fine_alignment_policy;
+  patch_search_policy_ = patch_search_policy;
   InitPatchCreator();
   InitPatchSelector();
   InitSpectrogramBuilder();
@@ -79,7 +109,8 @@ void VisqolManager::InitPatchCreator() {
 void VisqolManager::InitPatchSelector() {
   // Setup the patch similarity comparator to use the Neurogram.
   patch_selector_ = absl::make_unique<ComparisonPatchesSelector>(
-      absl::make_unique<NeurogramSimiliarityIndexMeasure>());
+      absl::make_unique<NeurogramSimiliarityIndexMeasure>(),
+      fine_alignment_policy_, patch_search_policy_);
 }
 
 void VisqolManager::InitSpectrogramBuilder() {
@@ -105,35 +136,106 @@ absl::Status VisqolManager::InitSimilarityToQualityMapper(
 }
 
 absl::StatusOr<SimilarityResultMsg> VisqolManager::Run(
-    const FilePath& ref_signal_path, const FilePath& deg_signal_path) {
+    const FilePath& ref_signal_path, const FilePath& deg_signal_path,
+    const CancellationToken* cancellation) {
   // Ensure the initialization succeeded.
   VISQOL_RETURN_IF_ERROR(ErrorIfNotInitialized());
 
   // Load the wav audio files as mono.
+  StageTimes stage_times;
+  const auto load_start = std::chrono::steady_clock::now();
   const AudioSignal ref_signal = MiscAudio::LoadAsMono(ref_signal_path);
   AudioSignal deg_signal = MiscAudio::LoadAsMono(deg_signal_path);
+  const std::chrono::duration<double> load_time =
+      std::chrono::steady_clock::now() - load_start;
+  stage_times.load_seconds = load_time.count();
 
   // If the sim result was successfully calculated, set the signal file paths.
   // Else, return the StatusOr failure.
-  SimilarityResultMsg sim_result_msg;
-  VISQOL_ASSIGN_OR_RETURN(sim_result_msg, Run(ref_signal, deg_signal));
-  sim_result_msg.set_reference_filepath(ref_signal_path.Path());
-  sim_result_msg.set_degraded_filepath(deg_signal_path.Path());
+  auto sim_result_msg = Compare(ref_signal, deg_signal, cancellation,
+                                &stage_times);
+  if (!sim_result_msg.ok()) {
+    return WithStageTimes(sim_result_msg.status(), stage_times);
+  }
+  sim_result_msg.value().set_reference_filepath(ref_signal_path.Path());
+  sim_result_msg.value().set_degraded_filepath(deg_signal_path.Path());
   return sim_result_msg;
 }
 
 absl::StatusOr<SimilarityResultMsg> VisqolManager::Run(
-    const AudioSignal& ref_signal, AudioSignal& deg_signal) {
-  // Ensure the initialization succeeded.
-  VISQOL_RETURN_IF_ERROR(ErrorIfNotInitialized());
+    const AudioSignal& ref_signal, AudioSignal& deg_signal,
+    const CancellationToken* cancellation) {
+  StageTimes stage_times;
+  auto sim_result_msg = Compare(ref_signal, deg_signal, cancellation,
+                                &stage_times);
+  if (!sim_result_msg.ok()) {
+    return WithStageTimes(sim_result_msg.status(), stage_times);
+  }
+  return sim_result_msg;
+}
 
+absl::StatusOr<VisqolManager::TrimmedReference> VisqolManager::AlignSignals(
+    const AudioSignal& ref_signal, AudioSignal& deg_signal,
+    const CancellationToken* cancellation, StageTimes* stage_times) {
   VISQOL_RETURN_IF_ERROR(ValidateInputAudio(ref_signal, deg_signal));
-
-  // Adjust for codec initial padding.
-  auto alignment_result = Alignment::GloballyAlign(ref_signal, deg_signal);
+  VISQOL_RETURN_IF_ERROR(CancellationToken::Check(cancellation));
+
+  // Trim the silence around the active region of the reference from both
+  // signals, so that it is neither aligned nor compared. The same samples are
+  // removed from the start of both signals, which keeps them aligned.
+  const size_t ref_num_samples = ref_signal.data_matrix.NumRows();
+  TrimmedReference trimmed;
+  trimmed.end = ref_num_samples;
+  if (trim_silence_) {
+    size_t trim_start;
+    size_t trim_end;
+    std::tie(trim_start, trim_end) =
+        MiscAudio::FindActiveRegion(ref_signal, kSilenceTrimPadding);
+    const size_t deg_end =
+        std::min(trim_end, deg_signal.data_matrix.NumRows());
+    if (trim_start < deg_end &&
+        (trim_start > 0 || trim_end < ref_num_samples)) {
+      trimmed.signal =
+          MiscAudio::SliceSamples(ref_signal, trim_start, trim_end);
+      trimmed.start = trim_start;
+      trimmed.end = trim_end;
+      deg_signal = MiscAudio::SliceSamples(deg_signal, trim_start, deg_end);
+    }
+  }
+  const AudioSignal& ref =
+      trimmed.signal.has_value() ? trimmed.signal.value() : ref_signal;
+
+  // Adjust for codec initial padding. Global alignment cross-correlates the
+  // whole signals, so the token is checked on both sides of it.
+  VISQOL_RETURN_IF_ERROR(CancellationToken::Check(cancellation));
+  const auto alignment_start = std::chrono::steady_clock::now();
+  auto alignment_result = Alignment::GloballyAlign(ref, deg_signal);
   deg_signal = std::get<0>(alignment_result);
+  const std::chrono::duration<double> alignment_time =
+      std::chrono::steady_clock::now() - alignment_start;
+  stage_times->global_alignment_seconds = alignment_time.count();
+  VISQOL_RETURN_IF_ERROR(CancellationToken::Check(cancellation));
+  return trimmed;
+}
+
+absl::StatusOr<SimilarityResultMsg> VisqolManager::Compare(
+    const AudioSignal& ref_signal, AudioSignal& deg_signal,
+    const CancellationToken* cancellation, StageTimes* stage_times) {
+  // Ensure the initialization succeeded.
+  VISQOL_RETURN_IF_ERROR(ErrorIfNotInitialized());
+
+  TrimmedReference trimmed;
+  VISQOL_ASSIGN_OR_RETURN(trimmed, AlignSignals(ref_signal, deg_signal,
+                                                cancellation, stage_times));
+  const AudioSignal* ref =
+      trimmed.signal.has_value() ? &trimmed.signal.value() : &ref_signal;
+  const size_t ref_num_samples = ref_signal.data_matrix.NumRows();
+  const size_t trim_start = trimmed.start;
+  const size_t trim_end = trimmed.end;
 
-  const AnalysisWindow window{ref_signal.sample_rate, kOverlap};
+  const AnalysisWindow window{ref->sample_rate, kOverlap};
+  const absl::optional<Spectrogram> ref_spectrogram =
+      PrepareReference(*ref, window);
 
   // If the sim result is successfully calculated, populate the protobuf msg.
   // Else, return the StatusOr failure.
@@ -141,10 +243,92 @@ absl::StatusOr<SimilarityResultMsg> VisqolManager::Run(
   SimilarityResult sim_result;
   VISQOL_ASSIGN_OR_RETURN(sim_result,
                    visqol.CalculateSimilarity(
-                       ref_signal, deg_signal, spectrogram_builder_.get(),
+                       *ref, deg_signal, spectrogram_builder_.get(),
                        window, patch_creator_.get(), patch_selector_.get(),
-                       sim_to_qual_.get(), search_window_));
-  return PopulateSimResultMsg(sim_result);
+                       sim_to_qual_.get(), search_window_, cancellation,
+                       stage_times,
+                       ref_spectrogram.has_value() ? &ref_spectrogram.value()
+                                                   : nullptr));
+
+  // Report the patch times relative to the start of the untrimmed signals.
+  // Patches without a match keep their zero degraded times.
+  const double trim_offset =
+      trim_start / static_cast<double>(ref_signal.sample_rate);
+  if (trim_start > 0) {
+    sim_result.debug_info.patch_sims.ShiftTimes(trim_offset);
+  }
+  if (timeline_window_duration_ > 0.0) {
+    sim_result.timeline = visqol.CalculateTimeline(
+        sim_result.debug_info.patch_sims, sim_to_qual_.get(),
+        timeline_window_duration_, timeline_hop_duration_);
+  }
+  SimilarityResultMsg sim_result_msg = PopulateSimResultMsg(sim_result);
+  sim_result_msg.mutable_computation_stats()->set_leading_silence_trimmed(
+      trim_offset);
+  sim_result_msg.mutable_computation_stats()->set_trailing_silence_trimmed(
+      (ref_num_samples - trim_end) /
+      static_cast<double>(ref_signal.sample_rate));
+  return sim_result_msg;
+}
+
+absl::optional<Spectrogram> VisqolManager::PrepareReference(
+    const AudioSignal& ref_signal, const AnalysisWindow& window) {
+  if (reference_cache_ == nullptr) {
+    return absl::nullopt;
+  }
+  const auto num_cols = spectrogram_builder_->NumColumns(ref_signal, window);
+  if (!num_cols.ok()) {
+    // The comparison reports the error.
+    return absl::nullopt;
+  }
+  const std::string key = ReferenceFeatureCache::ContentKey(
+      ref_signal, window, use_speech_mode_);
+  auto cached = reference_cache_->Fetch(key);
+  if (cached.has_value()) {
+    // The key identifies the samples, window and mode, and an entry is only
+    // used if it also has the shape and band plan this builder would give.
+    // Any other change to the features must change the key's format version.
+    const std::vector<double> bands =
+        spectrogram_builder_->GetCenterFreqBands(ref_signal.sample_rate);
+    if (cached->Data().NumCols() == num_cols.value() &&
+        cached->Data().NumRows() == bands.size() &&
+        cached->GetCenterFreqBands() == bands) {
+      return cached;
+    }
+    ABSL_RAW_LOG(WARNING, "Ignoring mismatched reference features %s",
+                 key.c_str());
+  }
+  auto built = spectrogram_builder_->Build(ref_signal, window);
+  if (!built.ok()) {
+    return absl::nullopt;
+  }
+  reference_cache_->Publish(key, built.value());
+  return std::move(built).value();
+}
+
+absl::StatusOr<SpectrogramFeatures> VisqolManager::ExtractSpectrograms(
+    const FilePath& ref_signal_path, const FilePath& deg_signal_path) {
+  // Ensure the initialization succeeded.
+  VISQOL_RETURN_IF_ERROR(ErrorIfNotInitialized());
+
+  // The signals are loaded, trimmed and aligned as in Run.
+  const AudioSignal ref_signal = MiscAudio::LoadAsMono(ref_signal_path);
+  AudioSignal deg_signal = MiscAudio::LoadAsMono(deg_signal_path);
+  StageTimes stage_times;
+  TrimmedReference trimmed;
+  VISQOL_ASSIGN_OR_RETURN(trimmed, AlignSignals(ref_signal, deg_signal,
+                                                nullptr, &stage_times));
+  const AudioSignal& ref =
+      trimmed.signal.has_value() ? trimmed.signal.value() : ref_signal;
+
+  const AnalysisWindow window{ref.sample_rate, kOverlap};
+  const Visqol visqol;
+  SpectrogramFeatures features;
+  VISQOL_ASSIGN_OR_RETURN(features, visqol.CalculateSpectrograms(
+      ref, deg_signal, spectrogram_builder_.get(), window));
+  features.start_time =
+      trimmed.start / static_cast<double>(ref_signal.sample_rate);
+  return features;
 }
 
 SimilarityResultMsg VisqolManager::PopulateSimResultMsg(
@@ -169,16 +353,57 @@ SimilarityResultMsg VisqolManager::PopulateSimResultMsg(
     sim_result_msg.add_fvdegenergy(val);
   }
 
-  for (const PatchSimilarityResult& patch : sim_result.debug_info.patch_sims) {
+  SimilarityResultMsg_ComputationStatsMsg* stats_msg =
+      sim_result_msg.mutable_computation_stats();
+  stats_msg->set_spectrogram_columns_computed(
+      sim_result.debug_info.spectrogram_columns_computed);
+  stats_msg->set_spectrogram_columns_total(
+      sim_result.debug_info.spectrogram_columns_total);
+  stats_msg->set_patches_fine_aligned(
+      sim_result.debug_info.patches_fine_aligned);
+  stats_msg->set_patches_fine_alignment_skipped(
+      sim_result.debug_info.patches_fine_alignment_skipped);
+  stats_msg->set_patch_candidates_evaluated(
+      sim_result.debug_info.patch_candidates_evaluated);
+  stats_msg->set_patch_candidates_pruned(
+      sim_result.debug_info.patch_candidates_pruned);
+  const StageTimes& stage_times = sim_result.debug_info.stage_times;
+  stats_msg->set_load_seconds(stage_times.load_seconds);
+  stats_msg->set_global_alignment_seconds(
+      stage_times.global_alignment_seconds);
+  stats_msg->set_preprocessing_seconds(stage_times.preprocessing_seconds);
+  stats_msg->set_patch_search_seconds(stage_times.patch_search_seconds);
+  stats_msg->set_fine_alignment_seconds(stage_times.fine_alignment_seconds);
+  stats_msg->set_quality_mapping_seconds(
+      stage_times.quality_mapping_seconds);
+
+  for (const TimelineWindow& window : sim_result.timeline) {
+    SimilarityResultMsg_TimelineWindowMsg* window_msg =
+        sim_result_msg.add_timeline();
+    window_msg->set_start_time(window.start_time);
+    window_msg->set_end_time(window.end_time);
+    window_msg->set_moslqo(window.moslqo);
+    window_msg->set_vnsim(window.vnsim);
+    for (double val : window.fvnsim) {
+      window_msg->add_fvnsim(val);
+    }
+    window_msg->set_num_patches(window.num_patches);
+  }
+
+  const PatchSimilarityTable& patch_sims = sim_result.debug_info.patch_sims;
+  const size_t num_freq_bands = patch_sims.NumFreqBands();
+  for (size_t patch = 0; patch < patch_sims.NumPatches(); patch++) {
     SimilarityResultMsg_PatchSimilarityMsg* patch_msg =
         sim_result_msg.add_patch_sims();
-    patch_msg->set_similarity(patch.similarity);
-    patch_msg->set_ref_patch_start_time(patch.ref_patch_start_time);
-    patch_msg->set_ref_patch_end_time(patch.ref_patch_end_time);
-    patch_msg->set_deg_patch_start_time(patch.deg_patch_start_time);
-    patch_msg->set_deg_patch_end_time(patch.deg_patch_end_time);
-    for (double each_fbm : patch.freq_band_means.ToVector()) {
-      patch_msg->add_freq_band_means(each_fbm);
+    patch_msg->set_similarity(patch_sims.Similarities()[patch]);
+    patch_msg->set_ref_patch_start_time(patch_sims.RefPatchStartTimes()[patch]);
+    patch_msg->set_ref_patch_end_time(patch_sims.RefPatchEndTimes()[patch]);
+    patch_msg->set_deg_patch_start_time(patch_sims.DegPatchStartTimes()[patch]);
+    patch_msg->set_deg_patch_end_time(patch_sims.DegPatchEndTimes()[patch]);
+    const double* freq_band_means =
+        patch_sims.FreqBandMeans().data() + patch * num_freq_bands;
+    for (size_t band = 0; band < num_freq_bands; band++) {
+      patch_msg->add_freq_band_means(freq_band_means[band]);
     }
   }
 
@@ -227,12 +452,13 @@ absl::Status VisqolManager::ValidateInputAudio(const AudioSignal& ref_signal,
                    " resampling to 16kHz.");
     }
   } else {
-    // Warn if the signals' sample rate is not 48k for full audio mode.
-    if (ref_signal.sample_rate != k48kSampleRate) {
+    // Warn if input sample rate is not 48khz. The bands above half the
+    // sample rate are empty, and report a perfect similarity.
+    if (ref_signal.sample_rate != VisqolApi::k48kSampleRate) {
       ABSL_RAW_LOG(WARNING,
-                   "Input audio does not have the expected sample"
-                   " rate of 48kHz! This may negatively effect the prediction"
-                   " of the MOS-LQO  score.");
+                   "Input audio does not have the expected sample rate of"
+                   " 48kHz! This may negatively effect the prediction of the"
+                   " MOS-LQO  score.");
     }
   }
 
@@ -17,6 +17,7 @@
 #include <assert.h>
 
 #include <algorithm>
+#include <limits>
 #include <string>
 #include <utility>
 
@@ -69,6 +70,13 @@ const size_t kWavHeaderSize = 44;
 static_assert(sizeof(WavHeader) == kWavHeaderSize,
               "Padding in WavHeader struct detected");
 
+// The data chunk size left by writers that stream to a pipe, and so cannot go
+// back to fill in the size once they know it.
+const uint32_t kUnknownDataSize = 0xFFFFFFFF;
+
+// The number of bytes to read at a time when skipping over a chunk.
+const size_t kSkipBufferSize = 4096;
+
 // Supported WAV encoding formats.
 static const uint16_t kExtensibleWavFormat = 0xfffe;
 static const uint16_t kPcmFormat = 0x1;
@@ -79,9 +87,11 @@ WavReader::WavReader(std::istream* binary_stream)
       num_channels_(0),
       sample_rate_hz_(-1),
       num_total_samples_(0),
+      length_known_(true),
       num_remaining_samples_(0),
       pcm_offset_bytes_(0),
-      bytes_in_stream_(GetCountOfBytesInStream()) {
+      bytes_in_stream_(GetCountOfBytesInStream()),
+      stream_position_(0) {
   init_ = ParseHeader();
 }
 
@@ -90,16 +100,43 @@ size_t WavReader::ReadBinaryDataFromStream(void* target_ptr, size_t size) {
     return 0;
   }
   binary_stream_->read(static_cast<char*>(target_ptr), size);
-  return static_cast<size_t>(binary_stream_->gcount());
+  const size_t num_bytes_read = static_cast<size_t>(binary_stream_->gcount());
+  stream_position_ += num_bytes_read;
+  return num_bytes_read;
+}
+
+size_t WavReader::SkipBinaryDataInStream(size_t size) {
+  char buffer[kSkipBufferSize];
+  size_t num_bytes_skipped = 0;
+  while (num_bytes_skipped < size) {
+    const size_t num_bytes_to_read =
+        std::min(kSkipBufferSize, size - num_bytes_skipped);
+    const size_t num_bytes_read =
+        ReadBinaryDataFromStream(buffer, num_bytes_to_read);
+    num_bytes_skipped += num_bytes_read;
+    if (num_bytes_read != num_bytes_to_read) {
+      break;
+    }
+  }
+  return num_bytes_skipped;
 }
 
 int64_t WavReader::GetCountOfBytesInStream() {
   if (!binary_stream_->good()) {
     return 0;
   }
+  // Pipes cannot be seeked, and report their position as -1.
+  if (binary_stream_->tellg() < 0) {
+    binary_stream_->clear();
+    return -1;
+  }
   binary_stream_->seekg(0, std::ios::end);
   int64_t count_of_bytes = binary_stream_->tellg();
   binary_stream_->seekg(0, std::ios::beg);
+  if (count_of_bytes < 0) {
+    binary_stream_->clear();
+    return -1;
+  }
   return count_of_bytes;
 }
 
@@ -184,15 +221,16 @@ bool WavReader::ParseHeader() {
   }
   while (std::string(header.data.header.id, 4) != "data") {
     if (!binary_stream_->good() ||
-        (static_cast<int64_t>(binary_stream_->tellg()) +
-            static_cast<int64_t>(header.data.header.size)) > bytes_in_stream_) {
+        (bytes_in_stream_ >= 0 &&
+         (static_cast<int64_t>(stream_position_) +
+          static_cast<int64_t>(header.data.header.size)) > bytes_in_stream_) ||
+        SkipBinaryDataInStream(header.data.header.size) !=
+            header.data.header.size) {
       ABSL_RAW_LOG(ERROR, "Error parsing WAV Header - Could not find data chunk"
         " in WAV file header.");
       return false;
     }
 
-    binary_stream_->seekg(header.data.header.size, std::ios::cur);
-
     if (ReadBinaryDataFromStream(&header.data, sizeof(header.data)) !=
                                  sizeof(header.data)) {
       ABSL_RAW_LOG(ERROR, "Error parsing WAV Header - Could not find data chunk"
@@ -201,11 +239,24 @@ bool WavReader::ParseHeader() {
     }
   }
 
-  const size_t bytes_in_payload = header.data.header.size;
+  size_t bytes_in_payload = header.data.header.size;
+  if (header.data.header.size == kUnknownDataSize) {
+    if (bytes_in_stream_ >= 0) {
+      // The data runs to the end of the stream, which is known.
+      bytes_in_payload = static_cast<size_t>(bytes_in_stream_) -
+          static_cast<size_t>(stream_position_);
+      bytes_in_payload -= bytes_in_payload % bytes_per_sample_;
+    } else {
+      length_known_ = false;
+      bytes_in_payload = 0;
+    }
+  }
   num_total_samples_ = bytes_in_payload / bytes_per_sample_;
-  num_remaining_samples_ = num_total_samples_;
+  num_remaining_samples_ =
+      length_known_ ? num_total_samples_ : std::numeric_limits<size_t>::max();
 
-  if (header.format.num_channels == 0 || num_total_samples_ == 0 ||
+  if (header.format.num_channels == 0 ||
+      (length_known_ && num_total_samples_ == 0) ||
       bytes_in_payload % bytes_per_sample_ != 0 ||
       (header.format.format_tag != kPcmFormat &&
        header.format.format_tag != kExtensibleWavFormat) ||
@@ -217,12 +268,7 @@ bool WavReader::ParseHeader() {
     return false;
   }
 
-  int64_t current_position = binary_stream_->tellg();
-  if (current_position < 0) {
-    ABSL_RAW_LOG(ERROR, "Error parsing WAV Header.");
-    return false;
-  }
-  pcm_offset_bytes_ = static_cast<uint64_t>(current_position);
+  pcm_offset_bytes_ = stream_position_;
   return true;
 }
 
@@ -233,7 +279,8 @@ size_t WavReader::ReadSamples(size_t num_samples, int16_t* target_buffer) {
     return 0;
   }
   const size_t num_bytes_read =
-      ReadBinaryDataFromStream(target_buffer, num_samples * sizeof(int16_t));
+      ReadBinaryDataFromStream(target_buffer,
+                               num_samples_to_read * bytes_per_sample_);
   const size_t num_samples_read = num_bytes_read / bytes_per_sample_;
 
   num_remaining_samples_ -= num_samples_read;
@@ -242,6 +289,8 @@ size_t WavReader::ReadSamples(size_t num_samples, int16_t* target_buffer) {
 
 size_t WavReader::GetNumTotalSamples() const { return num_total_samples_; }
 
+bool WavReader::IsLengthKnown() const { return length_known_; }
+
 size_t WavReader::GetNumChannels() const { return num_channels_; }
 
 int WavReader::GetSampleRateHz() const { return sample_rate_hz_; }
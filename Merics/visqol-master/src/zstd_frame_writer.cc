@@ -0,0 +1,222 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zstd_frame_writer.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include "absl/base/internal/raw_logging.h"
+#include "zstd.h"
+
+namespace Visqol {
+
+const size_t ZstdFrameWriter::kDefaultFrameSize = 1 << 20;
+const uint32_t ZstdFrameWriter::kSkippableFrameMagic = 0x184D2A5E;
+const uint32_t ZstdFrameWriter::kSeekTableFooterMagic = 0x8F92EAB1;
+
+namespace {
+// Append a little endian integer to a string.
+template <typename T>
+void AppendLittleEndian(T value, std::string *bytes) {
+  for (size_t i = 0; i < sizeof(T); i++) {
+    bytes->push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+}  // namespace
+
+int ZstdFrameWriter::MaxCompressionLevel() { return ZSTD_maxCLevel(); }
+
+absl::StatusOr<std::string> ZstdFrameWriter::CompressFrame(
+    const std::string &data, int level) {
+  std::string frame(ZSTD_compressBound(data.size()), '\0');
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+  if (cctx == nullptr) {
+    return absl::Status(absl::StatusCode::kResourceExhausted,
+                        "Unable to create a zstd compression context.");
+  }
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_contentSizeFlag, 1);
+  const size_t size = ZSTD_compress2(cctx, &frame[0], frame.size(),
+                                     data.data(), data.size());
+  ZSTD_freeCCtx(cctx);
+  if (ZSTD_isError(size)) {
+    return absl::Status(absl::StatusCode::kInternal,
+                        std::string("zstd compression failed: ") +
+                            ZSTD_getErrorName(size));
+  }
+  frame.resize(size);
+  return frame;
+}
+
+ZstdFrameWriter::ZstdFrameWriter(const FilePath &path, int level,
+                                 size_t frame_size)
+    : path_(path),
+      level_(level),
+      frame_size_(std::max<size_t>(1, frame_size)) {}
+
+ZstdFrameWriter::~ZstdFrameWriter() {
+  const absl::Status status = Close();
+  if (!status.ok()) {
+    ABSL_RAW_LOG(ERROR, "%s", status.ToString().c_str());
+  }
+}
+
+absl::Status ZstdFrameWriter::Open() {
+  absl::MutexLock lock(&mutex_);
+  if (is_open_) {
+    return absl::Status(absl::StatusCode::kFailedPrecondition,
+                        "The zstd output is already open: " + path_.Path());
+  }
+  out_.open(path_.Path(), std::ios::binary | std::ios::out | std::ios::trunc);
+  if (!out_) {
+    return absl::Status(absl::StatusCode::kInvalidArgument,
+                        "Could not open compressed output file " +
+                            path_.Path());
+  }
+  is_open_ = true;
+  closing_ = false;
+  current_frame_.clear();
+  queued_frames_.clear();
+  frame_sizes_.clear();
+  bytes_written_ = 0;
+  write_status_ = absl::Status();
+  compress_thread_ = std::thread(&ZstdFrameWriter::CompressLoop, this);
+  return absl::Status();
+}
+
+absl::Status ZstdFrameWriter::Write(const std::string &data) {
+  absl::MutexLock lock(&mutex_);
+  if (!is_open_ || closing_) {
+    return absl::Status(absl::StatusCode::kFailedPrecondition,
+                        "The zstd output is not open: " + path_.Path());
+  }
+  if (!write_status_.ok()) {
+    return write_status_;
+  }
+  // Cut the data into whole frames, keeping the remainder for the next write.
+  size_t pos = 0;
+  while (pos < data.size()) {
+    const size_t length =
+        std::min(frame_size_ - current_frame_.size(), data.size() - pos);
+    current_frame_.append(data, pos, length);
+    pos += length;
+    if (current_frame_.size() == frame_size_) {
+      queued_frames_.push_back(std::move(current_frame_));
+      current_frame_.clear();
+    }
+  }
+  bytes_written_ += data.size();
+  return absl::Status();
+}
+
+size_t ZstdFrameWriter::BytesWritten() const {
+  absl::MutexLock lock(&mutex_);
+  return bytes_written_;
+}
+
+absl::Status ZstdFrameWriter::Close() {
+  {
+    absl::MutexLock lock(&mutex_);
+    if (!is_open_ || closing_) {
+      return absl::Status();
+    }
+    if (!current_frame_.empty()) {
+      queued_frames_.push_back(std::move(current_frame_));
+      current_frame_.clear();
+    }
+    closing_ = true;
+  }
+  compress_thread_.join();
+
+  absl::MutexLock lock(&mutex_);
+  is_open_ = false;
+  if (write_status_.ok()) {
+    const std::string seek_table = SeekTable();
+    out_.write(seek_table.data(), seek_table.size());
+  }
+  out_.close();
+  if (write_status_.ok() && !out_) {
+    write_status_ = absl::Status(absl::StatusCode::kInternal,
+                                 "Failed to write compressed output file " +
+                                     path_.Path());
+  }
+  return write_status_;
+}
+
+void ZstdFrameWriter::CompressLoop() {
+  auto has_work = [this]() {
+    mutex_.AssertHeld();
+    return closing_ || !queued_frames_.empty();
+  };
+  while (true) {
+    std::string frame;
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.Await(absl::Condition(&has_work));
+      if (queued_frames_.empty()) {
+        return;
+      }
+      frame = std::move(queued_frames_.front());
+      queued_frames_.pop_front();
+      if (!write_status_.ok()) {
+        // Drop the remaining frames once a frame has failed.
+        continue;
+      }
+    }
+
+    // Compress and write outside of the lock, so that writes can continue.
+    absl::Status status;
+    auto compressed = CompressFrame(frame, level_);
+    if (!compressed.ok()) {
+      status = compressed.status();
+    } else {
+      out_.write(compressed.value().data(), compressed.value().size());
+      if (!out_) {
+        status = absl::Status(absl::StatusCode::kInternal,
+                              "Failed to write compressed output file " +
+                                  path_.Path());
+      }
+      frame_sizes_.emplace_back(
+          static_cast<uint32_t>(compressed.value().size()),
+          static_cast<uint32_t>(frame.size()));
+    }
+    if (!status.ok()) {
+      absl::MutexLock lock(&mutex_);
+      write_status_ = status;
+    }
+  }
+}
+
+std::string ZstdFrameWriter::SeekTable() const {
+  // The skippable frame header, the size of each frame without checksums,
+  // and the footer with the number of frames, the descriptor and the magic
+  // number.
+  const uint32_t table_size =
+      static_cast<uint32_t>(frame_sizes_.size() * 8 + 9);
+  std::string table;
+  AppendLittleEndian<uint32_t>(kSkippableFrameMagic, &table);
+  AppendLittleEndian<uint32_t>(table_size, &table);
+  for (const auto &sizes : frame_sizes_) {
+    AppendLittleEndian<uint32_t>(sizes.first, &table);
+    AppendLittleEndian<uint32_t>(sizes.second, &table);
+  }
+  AppendLittleEndian<uint32_t>(static_cast<uint32_t>(frame_sizes_.size()),
+                               &table);
+  AppendLittleEndian<uint8_t>(0, &table);
+  AppendLittleEndian<uint32_t>(kSeekTableFooterMagic, &table);
+  return table;
+}
+}  // namespace Visqol
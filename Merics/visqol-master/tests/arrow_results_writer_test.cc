@@ -0,0 +1,231 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "arrow_results_writer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "zstd.h"
+
+#include "similarity_result.pb.h"
+
+namespace Visqol {
+namespace {
+
+const uint8_t kSchemaMessage = 1;
+const uint8_t kRecordBatchMessage = 3;
+const size_t kNumBands = 4;
+const size_t kPatchesPerPair = 2;
+
+// The header type, metadata and body of a message read back from a stream.
+struct Message {
+  uint8_t header_type;
+  std::string metadata;
+  std::string body;
+};
+
+template <typename T>
+T ReadScalar(const std::string &bytes, size_t pos) {
+  T value;
+  std::memcpy(&value, &bytes[pos], sizeof(T));
+  return value;
+}
+
+// Read the field with the given id from a FlatBuffers table, or return
+// default_value if the field is not present.
+template <typename T>
+T ReadTableField(const std::string &fb, size_t table, uint16_t field_id,
+                 T default_value) {
+  const size_t vtable = table - ReadScalar<int32_t>(fb, table);
+  const uint16_t vtable_size = ReadScalar<uint16_t>(fb, vtable);
+  const size_t entry = 4 + 2 * field_id;
+  if (entry >= vtable_size) {
+    return default_value;
+  }
+  const uint16_t field_offset = ReadScalar<uint16_t>(fb, vtable + entry);
+  return field_offset == 0 ? default_value
+                           : ReadScalar<T>(fb, table + field_offset);
+}
+
+// Return the position of the table or vector referenced by the offset field
+// with the given id of a FlatBuffers table.
+size_t ReadTableOffset(const std::string &fb, size_t table,
+                       uint16_t field_id) {
+  const size_t vtable = table - ReadScalar<int32_t>(fb, table);
+  const size_t field =
+      table + ReadScalar<uint16_t>(fb, vtable + 4 + 2 * field_id);
+  return field + ReadScalar<uint32_t>(fb, field);
+}
+
+// Split an Arrow IPC stream into its messages, checking the framing.
+std::vector<Message> ReadStream(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  const std::string stream((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+  std::vector<Message> messages;
+  size_t pos = 0;
+  while (true) {
+    EXPECT_LE(pos + 8, stream.size());
+    EXPECT_EQ(0xFFFFFFFF, ReadScalar<uint32_t>(stream, pos));
+    const int32_t metadata_length = ReadScalar<int32_t>(stream, pos + 4);
+    pos += 8;
+    if (metadata_length == 0) {
+      break;
+    }
+    EXPECT_EQ(0, metadata_length % 8);
+    const std::string metadata = stream.substr(pos, metadata_length);
+    pos += metadata_length;
+    const size_t message = ReadScalar<uint32_t>(metadata, 0);
+    EXPECT_EQ(4, ReadTableField<int16_t>(metadata, message, 0, 0));
+    Message msg;
+    msg.header_type = ReadTableField<uint8_t>(metadata, message, 1, 0);
+    msg.metadata = metadata;
+    const int64_t body_length =
+        ReadTableField<int64_t>(metadata, message, 3, 0);
+    EXPECT_EQ(0, body_length % 8);
+    msg.body = stream.substr(pos, body_length);
+    pos += body_length;
+    messages.push_back(msg);
+  }
+  EXPECT_EQ(stream.size(), pos);
+  return messages;
+}
+
+bool BodyContains(const Message &msg, double value) {
+  return msg.body.find(std::string(reinterpret_cast<const char *>(&value),
+                                   sizeof(value))) != std::string::npos;
+}
+
+SimilarityResultMsg MakeResult(int index, size_t num_bands) {
+  SimilarityResultMsg result;
+  result.set_reference_filepath("ref" + std::to_string(index) + ".wav");
+  result.set_degraded_filepath("deg" + std::to_string(index) + ".wav");
+  result.set_moslqo(1.25 + index);
+  result.set_vnsim(0.5 + index / 8.0);
+  for (size_t band = 0; band < num_bands; band++) {
+    result.add_fvnsim(0.75);
+    result.add_fstdnsim(0.125);
+    result.add_fvdegenergy(10.0);
+  }
+  for (size_t patch = 0; patch < kPatchesPerPair; patch++) {
+    auto *patch_sim = result.add_patch_sims();
+    patch_sim->set_similarity(0.0625 * (index * kPatchesPerPair + patch + 1));
+    for (size_t band = 0; band < num_bands; band++) {
+      patch_sim->add_freq_band_means(0.5);
+    }
+  }
+  return result;
+}
+
+// Results are written as a schema followed by one record batch per full
+// batch of rows, with the remainder written on Close.
+TEST(ArrowResultsWriterTest, WritesRecordBatches) {
+  const std::string results_path = ::testing::TempDir() + "/results.arrow";
+  const std::string patches_path = ::testing::TempDir() + "/patches.arrow";
+  {
+    ArrowResultsWriter writer{FilePath(results_path), FilePath(patches_path),
+                              2};
+    ASSERT_TRUE(writer.Open().ok());
+    for (int i = 0; i < 3; i++) {
+      ASSERT_TRUE(writer.Append(MakeResult(i, kNumBands)).ok());
+    }
+    ASSERT_TRUE(writer.Close().ok());
+  }
+
+  const std::vector<Message> results = ReadStream(results_path);
+  ASSERT_EQ(3, results.size());
+  EXPECT_EQ(kSchemaMessage, results[0].header_type);
+  EXPECT_EQ(kRecordBatchMessage, results[1].header_type);
+  EXPECT_EQ(kRecordBatchMessage, results[2].header_type);
+  EXPECT_TRUE(BodyContains(results[1], 1.25));
+  EXPECT_TRUE(BodyContains(results[1], 2.25));
+  EXPECT_FALSE(BodyContains(results[1], 3.25));
+  EXPECT_TRUE(BodyContains(results[2], 3.25));
+  EXPECT_NE(std::string::npos, results[2].body.find("ref2.wav"));
+
+  // 3 pairs of 2 patches make 3 full batches.
+  const std::vector<Message> patches = ReadStream(patches_path);
+  ASSERT_EQ(4, patches.size());
+  EXPECT_EQ(kSchemaMessage, patches[0].header_type);
+  EXPECT_TRUE(BodyContains(patches[3], 0.0625 * 5));
+  EXPECT_TRUE(BodyContains(patches[3], 0.0625 * 6));
+}
+
+// A result with a different number of bands is rejected, and leaves the
+// stream valid.
+TEST(ArrowResultsWriterTest, RejectsMismatchedBands) {
+  const std::string results_path = ::testing::TempDir() + "/mismatched.arrow";
+  ArrowResultsWriter writer{FilePath(results_path)};
+  ASSERT_TRUE(writer.Open().ok());
+  ASSERT_TRUE(writer.Append(MakeResult(0, kNumBands)).ok());
+  const absl::Status status = writer.Append(MakeResult(1, kNumBands + 1));
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument, status.code());
+  ASSERT_TRUE(writer.Close().ok());
+
+  const std::vector<Message> results = ReadStream(results_path);
+  ASSERT_EQ(2, results.size());
+  EXPECT_TRUE(BodyContains(results[1], 1.25));
+  EXPECT_FALSE(BodyContains(results[1], 2.25));
+}
+
+// Compressed record batches declare zstd body compression, and each buffer is
+// a zstd frame prefixed by its uncompressed length.
+TEST(ArrowResultsWriterTest, CompressesBuffers) {
+  const std::string results_path = ::testing::TempDir() + "/compressed.arrow";
+  {
+    ArrowResultsWriter writer{FilePath(results_path), FilePath(), 2, 3};
+    ASSERT_TRUE(writer.Open().ok());
+    for (int i = 0; i < 2; i++) {
+      ASSERT_TRUE(writer.Append(MakeResult(i, kNumBands)).ok());
+    }
+    ASSERT_TRUE(writer.Close().ok());
+  }
+
+  const std::vector<Message> results = ReadStream(results_path);
+  ASSERT_EQ(2, results.size());
+  const Message &batch = results[1];
+  const size_t message = ReadScalar<uint32_t>(batch.metadata, 0);
+  const size_t record_batch = ReadTableOffset(batch.metadata, message, 2);
+  const size_t compression = ReadTableOffset(batch.metadata, record_batch, 3);
+  EXPECT_EQ(1, ReadTableField<int8_t>(batch.metadata, compression, 0, 0));
+
+  // The moslqo values are the eighth buffer, after the validity, offsets and
+  // chars buffers of the two path columns and the moslqo validity buffer.
+  const size_t buffer = ReadTableOffset(batch.metadata, record_batch, 2) +
+                        sizeof(uint32_t) + 7 * 2 * sizeof(int64_t);
+  const int64_t offset = ReadScalar<int64_t>(batch.metadata, buffer);
+  const int64_t length =
+      ReadScalar<int64_t>(batch.metadata, buffer + sizeof(int64_t));
+  ASSERT_EQ(2 * sizeof(double), ReadScalar<int64_t>(batch.body, offset));
+  std::vector<double> moslqo(2);
+  ASSERT_EQ(2 * sizeof(double),
+            ZSTD_decompress(moslqo.data(), 2 * sizeof(double),
+                            &batch.body[offset + sizeof(int64_t)],
+                            length - sizeof(int64_t)));
+  EXPECT_EQ(std::vector<double>({1.25, 2.25}), moslqo);
+}
+
+TEST(ArrowResultsWriterTest, AppendBeforeOpenFails) {
+  ArrowResultsWriter writer{FilePath(::testing::TempDir() + "/unopened")};
+  EXPECT_EQ(absl::StatusCode::kFailedPrecondition,
+            writer.Append(MakeResult(0, kNumBands)).code());
+}
+}  // namespace
+}  // namespace Visqol
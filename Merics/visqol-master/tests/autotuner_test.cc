@@ -0,0 +1,67 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "autotuner.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "commandline_parser.h"
+#include "visqol_manager.h"
+
+namespace Visqol {
+namespace {
+
+const double kSyntheticDuration = 1.0;
+const size_t kSampleRate = 48000;
+
+const FilePath kDefaultModel =
+    FilePath(FilePath::currentWorkingDir() + kDefaultAudioModelFile);
+
+// Ensure that the synthetic signals are deterministic and that the degraded
+// signal scores lower than an identical comparison.
+TEST(Autotuner, SyntheticSignals) {
+  const AudioSignal ref =
+      Autotuner::MakeSyntheticReference(kSampleRate, kSyntheticDuration, 0);
+  const AudioSignal ref_again =
+      Autotuner::MakeSyntheticReference(kSampleRate, kSyntheticDuration, 0);
+  ASSERT_EQ(kSampleRate * kSyntheticDuration, ref.data_matrix.NumRows());
+  ASSERT_TRUE(ref.data_matrix == ref_again.data_matrix);
+
+  VisqolManager manager;
+  ASSERT_TRUE(manager.Init(kDefaultModel, false, false, 60).ok());
+  AudioSignal identical = ref;
+  auto identical_result = manager.Run(ref, identical);
+  ASSERT_TRUE(identical_result.ok());
+  AudioSignal deg = Autotuner::MakeSyntheticDegraded(ref, 0);
+  auto deg_result = manager.Run(ref, deg);
+  ASSERT_TRUE(deg_result.ok());
+  ASSERT_LT(deg_result.value().moslqo(), identical_result.value().moslqo());
+}
+
+// Ensure that tuning selects a valid worker count for this host.
+TEST(Autotuner, Tune) {
+  const Autotuner autotuner(kDefaultModel, false, false, 60,
+                            kSyntheticDuration);
+  auto profile_statusor = autotuner.Tune();
+  ASSERT_TRUE(profile_statusor.ok());
+  ASSERT_GE(profile_statusor.value().num_workers, 1);
+  ASSERT_LE(profile_statusor.value().num_workers,
+            std::max<size_t>(1, std::thread::hardware_concurrency()));
+}
+
+}  // namespace
+}  // namespace Visqol
@@ -0,0 +1,145 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "batch_comparison_runner.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "autotuner.h"
+#include "commandline_parser.h"
+
+namespace Visqol {
+namespace {
+
+const double kSyntheticDuration = 1.0;
+const size_t kSampleRate = 48000;
+const size_t kNumJobs = 3;
+
+const FilePath kDefaultModel =
+    FilePath(FilePath::currentWorkingDir() + kDefaultAudioModelFile);
+
+// Ensure that the batch runner delivers results in job order.
+TEST(BatchComparisonRunnerTest, DeliversInOrder) {
+  BatchComparisonRunner runner(2);
+  ASSERT_TRUE(runner.Init(kDefaultModel, false, false, 60).ok());
+  const AudioSignal ref =
+      Autotuner::MakeSyntheticReference(kSampleRate, kSyntheticDuration, 1);
+  std::vector<size_t> delivered;
+  runner.Run(
+      kNumJobs,
+      [&ref](VisqolManager *manager, size_t, const CancellationToken *) {
+        AudioSignal deg = ref;
+        return manager->Run(ref, deg);
+      },
+      [&delivered](size_t job_index,
+                   const absl::StatusOr<SimilarityResultMsg> &result) {
+        ASSERT_TRUE(result.ok());
+        delivered.push_back(job_index);
+      });
+  ASSERT_EQ(std::vector<size_t>({0, 1, 2}), delivered);
+}
+
+// Jobs whose combined memory estimate exceeds the budget must not run
+// concurrently, even with idle workers.
+TEST(BatchComparisonRunnerTest, RespectsMemoryBudget) {
+  const size_t kJobMemory = 60;
+  const size_t kMemoryBudget = 100;
+  BatchComparisonRunner runner(2);
+  runner.SetMemoryBudget(kMemoryBudget);
+  std::atomic<size_t> running{0};
+  std::atomic<size_t> max_running{0};
+  std::vector<size_t> delivered;
+  runner.Run(
+      kNumJobs,
+      [&running, &max_running](VisqolManager *, size_t,
+                               const CancellationToken *) {
+        const size_t now_running = ++running;
+        size_t prev_max = max_running.load();
+        while (now_running > prev_max &&
+               !max_running.compare_exchange_weak(prev_max, now_running)) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        running--;
+        return absl::StatusOr<SimilarityResultMsg>(SimilarityResultMsg());
+      },
+      [&delivered](size_t job_index,
+                   const absl::StatusOr<SimilarityResultMsg> &) {
+        delivered.push_back(job_index);
+      },
+      std::vector<size_t>(kNumJobs, kJobMemory));
+  ASSERT_EQ(std::vector<size_t>({0, 1, 2}), delivered);
+  ASSERT_EQ(1, max_running.load());
+}
+
+// Jobs with a known cost are started longest first, but are still delivered
+// in job order.
+TEST(BatchComparisonRunnerTest, StartsLongestJobFirst) {
+  BatchComparisonRunner runner(1);
+  std::vector<size_t> started;
+  std::vector<size_t> delivered;
+  runner.Run(
+      kNumJobs,
+      [&started](VisqolManager *, size_t job_index,
+                   const CancellationToken *) {
+        started.push_back(job_index);
+        return absl::StatusOr<SimilarityResultMsg>(SimilarityResultMsg());
+      },
+      [&delivered, &runner](size_t job_index,
+                            const absl::StatusOr<SimilarityResultMsg> &) {
+        delivered.push_back(job_index);
+        ASSERT_GE(runner.EstimatedSecondsRemaining(), 0.0);
+      },
+      {}, {1.0, 3.0, 2.0});
+  ASSERT_EQ(std::vector<size_t>({1, 2, 0}), started);
+  ASSERT_EQ(std::vector<size_t>({0, 1, 2}), delivered);
+  ASSERT_EQ(0.0, runner.EstimatedSecondsRemaining());
+}
+
+// File pairs that override the runner's settings are compared with a manager
+// initialised with those settings, within the same batch.
+TEST(BatchComparisonRunnerTest, UsesPerPairSettings) {
+  const FilePath ref("testdata/clean_speech/CA01_01.wav");
+  const FilePath deg("testdata/clean_speech/transcoded_CA01_01.wav");
+  BatchComparisonRunner runner(2);
+  ASSERT_TRUE(runner.Init(kDefaultModel, false, false, 60).ok());
+  std::vector<ReferenceDegradedPathPair> pairs(3, {ref, deg});
+  pairs[1].use_speech_mode = true;
+  pairs[2].sim_to_quality_mapper_model = FilePath("missing_model.txt");
+  std::vector<absl::StatusOr<SimilarityResultMsg>> results;
+  runner.Run(pairs, [&results](size_t,
+      const absl::StatusOr<SimilarityResultMsg> &result) {
+    results.push_back(result);
+  });
+  ASSERT_EQ(3, results.size());
+
+  VisqolManager speech_manager;
+  ASSERT_TRUE(speech_manager.Init(kDefaultModel, true, false, 60).ok());
+  const auto speech_result = speech_manager.Run(ref, deg);
+  ASSERT_TRUE(speech_result.ok());
+  ASSERT_TRUE(results[0].ok());
+  ASSERT_TRUE(results[1].ok());
+  ASSERT_EQ(speech_result.value().moslqo(), results[1].value().moslqo());
+  ASSERT_NE(results[0].value().moslqo(), results[1].value().moslqo());
+  // A pair whose manager cannot be initialised fails alone.
+  ASSERT_FALSE(results[2].ok());
+  ASSERT_NE(absl::StatusCode::kAborted, results[2].status().code());
+}
+
+}  // namespace
+}  // namespace Visqol
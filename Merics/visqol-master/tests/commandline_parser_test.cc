@@ -42,6 +42,58 @@ TEST(BuildFilePairPaths, BatchFile) {
   ASSERT_EQ(file_pairs[0].degraded.Path(), kDegFile1);
   ASSERT_EQ(file_pairs[1].reference.Path(), kRefFile2);
   ASSERT_EQ(file_pairs[1].degraded.Path(), kDegFile2);
+  ASSERT_FALSE(file_pairs[0].use_speech_mode.has_value());
+  ASSERT_FALSE(file_pairs[0].sim_to_quality_mapper_model.has_value());
+  ASSERT_FALSE(file_pairs[0].search_window_radius.has_value());
+}
+
+// Test that the optional per-row columns of a batch file are parsed by name,
+// and that rows with invalid settings are skipped.
+TEST(BuildFilePairPaths, MixedBatchFile) {
+  const Visqol::CommandLineArgs cmd_args = CommandLineArgsHelper(
+      "",
+      "",
+      "testdata/example_batch/mixed_batch_input.csv");
+  std::vector<ReferenceDegradedPathPair> file_pairs =
+      VisqolCommandLineParser::BuildFilePairPaths(cmd_args);
+  ASSERT_EQ(4, file_pairs.size());
+  ASSERT_EQ(kRefFile1, file_pairs[0].reference.Path());
+  ASSERT_EQ(kDegFile1, file_pairs[0].degraded.Path());
+  ASSERT_FALSE(file_pairs[0].use_speech_mode.has_value());
+  ASSERT_FALSE(file_pairs[0].sim_to_quality_mapper_model.has_value());
+  ASSERT_FALSE(file_pairs[0].search_window_radius.has_value());
+
+  ASSERT_EQ(kRefFile2, file_pairs[1].reference.Path());
+  ASSERT_TRUE(file_pairs[1].use_speech_mode.value());
+  ASSERT_FALSE(file_pairs[1].sim_to_quality_mapper_model.has_value());
+  ASSERT_EQ(30, file_pairs[1].search_window_radius.value());
+
+  ASSERT_EQ("ref_3.wav", file_pairs[2].reference.Path());
+  ASSERT_FALSE(file_pairs[2].use_speech_mode.value());
+  ASSERT_EQ("audio_model.txt",
+            file_pairs[2].sim_to_quality_mapper_model.value().Path());
+  ASSERT_FALSE(file_pairs[2].search_window_radius.has_value());
+
+  ASSERT_FALSE(file_pairs[3].use_speech_mode.value());
+  ASSERT_FALSE(file_pairs[3].sim_to_quality_mapper_model.has_value());
+}
+
+// Test that a row switched to audio mode in a speech mode batch uses the
+// default audio model, rather than the speech model.
+TEST(BuildFilePairPaths, AudioRowInSpeechBatch) {
+  const Visqol::CommandLineArgs cmd_args = CommandLineArgsHelper(
+      "",
+      "",
+      "testdata/example_batch/mixed_batch_input.csv", true);
+  std::vector<ReferenceDegradedPathPair> file_pairs =
+      VisqolCommandLineParser::BuildFilePairPaths(cmd_args);
+  ASSERT_EQ(4, file_pairs.size());
+  ASSERT_FALSE(file_pairs[0].sim_to_quality_mapper_model.has_value());
+  ASSERT_FALSE(file_pairs[1].sim_to_quality_mapper_model.has_value());
+  ASSERT_EQ("audio_model.txt",
+            file_pairs[2].sim_to_quality_mapper_model.value().Path());
+  ASSERT_EQ(FilePath::currentWorkingDir() + kDefaultAudioModelFile,
+            file_pairs[3].sim_to_quality_mapper_model.value().Path());
 }
 
 
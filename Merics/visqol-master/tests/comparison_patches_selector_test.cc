@@ -64,6 +64,20 @@ class ComparisonPatchesSelectorTest : public ::testing::Test {
   ComparisonPatchesSelectorTest() {}
 };
 
+// NSIM without a similarity upper bound, which disables search pruning.
+class UnboundedNeurogramSimiliarityIndexMeasure
+    : public PatchSimilarityComparator {
+ public:
+  PatchSimilarityResult MeasurePatchSimilarity(const ImagePatch& ref_patch,
+                                               const ImagePatch& deg_patch)
+                                               const override {
+    return nsim_.MeasurePatchSimilarity(ref_patch, deg_patch);
+  }
+
+ private:
+  NeurogramSimiliarityIndexMeasure nsim_;
+};
+
 TEST_F(ComparisonPatchesSelectorTest, EndPatches) {
   ComparisonPatchesSelector selector(nullptr);
   ComparisonPatchesSelectorPeer selectorPeer(&selector);
@@ -288,5 +302,120 @@ TEST_F(ComparisonPatchesSelectorTest, BigExample) {
   EXPECT_DOUBLE_EQ(best_patches[5].deg_patch_start_time, 22);
 }
 
+// Check that pruning the patch search returns exactly the same matches as
+// an exhaustive search, while measuring fewer patch similarities.
+TEST_F(ComparisonPatchesSelectorTest, PrunedSearchMatchesExhaustiveSearch) {
+  const size_t num_rows = 8;
+  const size_t num_cols = 600;
+  const size_t lag = 4;
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<double> content(0.0, 50.0);
+  std::uniform_real_distribution<double> noise(0.0, 5.0);
+  auto ref_matrix = AMatrix<double>::Filled(num_rows, num_cols, 0.0);
+  auto deg_matrix = AMatrix<double>::Filled(num_rows, num_cols, 0.0);
+  for (size_t row = 0; row < num_rows; row++) {
+    for (size_t col = 0; col < num_cols; col++) {
+      ref_matrix(row, col) = content(gen);
+    }
+    for (size_t col = lag; col < num_cols; col++) {
+      deg_matrix(row, col) = ref_matrix(row, col - lag) + noise(gen);
+    }
+  }
+
+  const size_t patch_size = 20;
+  std::vector<size_t> patch_indices;
+  for (size_t i = 0; i + patch_size <= num_cols - lag; i += patch_size) {
+    patch_indices.push_back(i);
+  }
+  ImagePatchCreator patch_creator(patch_size);
+  std::vector<ImagePatch> ref_patches =
+      patch_creator.CreatePatchesFromIndices(ref_matrix, patch_indices);
+
+  const double frame_duration = 0.01;
+  const int search_window = 10;
+  ComparisonPatchesSelector pruned_selector(
+      absl::make_unique<NeurogramSimiliarityIndexMeasure>());
+  PatchSearchStats pruned_stats;
+  auto pruned = pruned_selector.FindMostOptimalDegPatches(
+      ref_patches, patch_indices, deg_matrix, frame_duration, search_window,
+      &pruned_stats);
+  ASSERT_TRUE(pruned.ok());
+
+  ComparisonPatchesSelector exhaustive_selector(
+      absl::make_unique<UnboundedNeurogramSimiliarityIndexMeasure>());
+  PatchSearchStats exhaustive_stats;
+  auto exhaustive = exhaustive_selector.FindMostOptimalDegPatches(
+      ref_patches, patch_indices, deg_matrix, frame_duration, search_window,
+      &exhaustive_stats);
+  ASSERT_TRUE(exhaustive.ok());
+
+  // The policy disables pruning for a comparator with an upper bound.
+  PatchSearchPolicy no_pruning;
+  no_pruning.prune = false;
+  ComparisonPatchesSelector unpruned_selector(
+      absl::make_unique<NeurogramSimiliarityIndexMeasure>(),
+      FineAlignmentPolicy(), no_pruning);
+  PatchSearchStats unpruned_stats;
+  auto unpruned = unpruned_selector.FindMostOptimalDegPatches(
+      ref_patches, patch_indices, deg_matrix, frame_duration, search_window,
+      &unpruned_stats);
+  ASSERT_TRUE(unpruned.ok());
+  EXPECT_EQ(0, unpruned_stats.num_candidates_pruned);
+  EXPECT_EQ(exhaustive_stats.num_candidates_evaluated,
+            unpruned_stats.num_candidates_evaluated);
+
+  ASSERT_EQ(exhaustive.value().size(), pruned.value().size());
+  ASSERT_EQ(exhaustive.value().size(), unpruned.value().size());
+  for (size_t i = 0; i < pruned.value().size(); i++) {
+    EXPECT_EQ(exhaustive.value()[i].deg_patch_start_time,
+              pruned.value()[i].deg_patch_start_time);
+    EXPECT_EQ(exhaustive.value()[i].similarity, pruned.value()[i].similarity);
+    EXPECT_EQ(exhaustive.value()[i].deg_patch_start_time,
+              unpruned.value()[i].deg_patch_start_time);
+    EXPECT_EQ(exhaustive.value()[i].similarity,
+              unpruned.value()[i].similarity);
+  }
+  EXPECT_DOUBLE_EQ((patch_indices[1] + lag) * frame_duration,
+                   pruned.value()[1].deg_patch_start_time);
+  EXPECT_EQ(0, exhaustive_stats.num_candidates_pruned);
+  EXPECT_GT(pruned_stats.num_candidates_pruned, 0);
+  EXPECT_EQ(exhaustive_stats.num_candidates_evaluated,
+            pruned_stats.num_candidates_evaluated +
+                pruned_stats.num_candidates_pruned);
+}
+
+// Check that a reference patch prepared once gives the same similarity to
+// every degraded patch as measuring each pair from scratch.
+TEST_F(ComparisonPatchesSelectorTest, PreparedReferencePatch) {
+  const size_t num_rows = 8;
+  const size_t patch_size = 20;
+  std::mt19937 gen(11);
+  std::uniform_real_distribution<double> content(0.0, 50.0);
+  ImagePatch ref_patch = AMatrix<double>::Filled(num_rows, patch_size, 0.0);
+  for (auto &value : ref_patch) {
+    value = content(gen);
+  }
+  const NeurogramSimiliarityIndexMeasure nsim;
+  const auto prepared = nsim.PrepareReferencePatch(ref_patch);
+  for (int i = 0; i < 5; i++) {
+    ImagePatch deg_patch = AMatrix<double>::Filled(num_rows, patch_size, 0.0);
+    for (auto &value : deg_patch) {
+      value = content(gen);
+    }
+    const PatchSimilarityResult expected =
+        nsim.MeasurePatchSimilarity(ref_patch, deg_patch);
+    const PatchSimilarityResult result =
+        nsim.MeasurePreparedPatchSimilarity(*prepared, deg_patch);
+    EXPECT_EQ(expected.similarity, result.similarity);
+    ASSERT_EQ(expected.freq_band_means.NumRows(),
+              result.freq_band_means.NumRows());
+    for (size_t band = 0; band < num_rows; band++) {
+      EXPECT_EQ(expected.freq_band_means(band), result.freq_band_means(band));
+      EXPECT_EQ(expected.freq_band_stddevs(band),
+                result.freq_band_stddevs(band));
+    }
+  }
+}
+
 }  // namespace
 }  // namespace Visqol
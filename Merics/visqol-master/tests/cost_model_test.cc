@@ -0,0 +1,108 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cost_model.h"
+
+#include <fstream>
+
+#include "gtest/gtest.h"
+
+namespace Visqol {
+namespace {
+
+const FilePath kReference(
+    "testdata/conformance_testdata_subset/guitar48_stereo.wav");
+const FilePath kDegraded(
+    "testdata/conformance_testdata_subset/guitar48_stereo_64kbps_aac.wav");
+
+PairCostFeatures MakeFeatures(double duration, int sample_rate) {
+  PairCostFeatures features;
+  features.reference_duration = duration;
+  features.degraded_duration = duration;
+  features.sample_rate = sample_rate;
+  features.num_channels = 1;
+  return features;
+}
+
+// The features are read from the WAV headers.
+TEST(CostModelTest, ReadsFeaturesFromHeaders) {
+  auto features_statusor = CostModel::ReadFeatures(kReference, kDegraded);
+  ASSERT_TRUE(features_statusor.ok());
+  const PairCostFeatures &features = features_statusor.value();
+  EXPECT_NEAR(12.454, features.reference_duration, 1e-3);
+  EXPECT_NEAR(12.544, features.degraded_duration, 1e-3);
+  EXPECT_EQ(48000, features.sample_rate);
+  EXPECT_EQ(2, features.num_channels);
+
+  EXPECT_EQ(absl::StatusCode::kNotFound,
+            CostModel::ReadFeatures(kReference, FilePath("missing.wav"))
+                .status()
+                .code());
+}
+
+// Longer signals, and higher sample rates, are predicted to cost more.
+TEST(CostModelTest, UncalibratedPredictionsAreOrdered) {
+  const CostModel model(false, 60);
+  EXPECT_LT(model.Predict(MakeFeatures(5, 48000)),
+            model.Predict(MakeFeatures(10, 48000)));
+  EXPECT_LT(model.Predict(MakeFeatures(10, 16000)),
+            model.Predict(MakeFeatures(10, 48000)));
+  EXPECT_GE(model.Predict(PairCostFeatures()),
+            CostModel::kMinPredictedSeconds);
+  EXPECT_EQ(0, model.NumObservations());
+}
+
+// Calibration converges on the measured cost, and only affects the mode it
+// was measured in.
+TEST(CostModelTest, CalibratesToObservations) {
+  CostModel model(false, 60);
+  for (int i = 0; i < 20; i++) {
+    // A host that is four times slower than the default predictions.
+    for (double duration : {2.0, 10.0, 30.0}) {
+      const PairCostFeatures features = MakeFeatures(duration, 48000);
+      model.AddObservation(features, 4 * CostModel(false, 60).Predict(
+                                             features));
+    }
+  }
+  EXPECT_EQ(60, model.NumObservations());
+  const PairCostFeatures features = MakeFeatures(20, 48000);
+  const double expected = 4 * CostModel(false, 60).Predict(features);
+  EXPECT_NEAR(expected, model.Predict(features), 0.1 * expected);
+
+  const FilePath path(::testing::TempDir() + "/cost_model.txt");
+  ASSERT_TRUE(model.Write(path).ok());
+  CostModel audio(false, 60);
+  ASSERT_TRUE(audio.Read(path).ok());
+  EXPECT_EQ(60, audio.NumObservations());
+  EXPECT_NEAR(model.Predict(features), audio.Predict(features), 1e-9);
+  CostModel speech(true, 60);
+  ASSERT_TRUE(speech.Read(path).ok());
+  EXPECT_EQ(0, speech.NumObservations());
+  EXPECT_EQ(CostModel(true, 60).Predict(features), speech.Predict(features));
+}
+
+TEST(CostModelTest, RejectsInvalidFiles) {
+  CostModel model(false, 60);
+  EXPECT_EQ(absl::StatusCode::kNotFound,
+            model.Read(FilePath(::testing::TempDir() + "/missing.txt"))
+                .code());
+
+  const FilePath path(::testing::TempDir() + "/invalid_cost_model.txt");
+  std::ofstream(path.Path()) << "version=1\naudio=1 2 3\n";
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument, model.Read(path).code());
+  std::ofstream(path.Path()) << "version=2\n";
+  EXPECT_EQ(absl::StatusCode::kFailedPrecondition, model.Read(path).code());
+}
+}  // namespace
+}  // namespace Visqol
@@ -0,0 +1,111 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "cpu_time_watchdog.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "batch_comparison_runner.h"
+#include "cancellation_token.h"
+
+namespace Visqol {
+namespace {
+
+const double kLimit = 0.05;
+
+// Spin until the token is cancelled, checking it as a comparison would.
+absl::Status SpinUntilCancelled(const CancellationToken *token) {
+  while (true) {
+    const absl::Status status = CancellationToken::Check(token);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+}
+
+TEST(CancellationTokenTest, KeepsFirstReason) {
+  EXPECT_TRUE(CancellationToken::Check(nullptr).ok());
+  CancellationToken token;
+  EXPECT_TRUE(CancellationToken::Check(&token).ok());
+  token.Cancel("first");
+  token.Cancel("second");
+  const absl::Status status = CancellationToken::Check(&token);
+  EXPECT_EQ(absl::StatusCode::kDeadlineExceeded, status.code());
+  EXPECT_EQ("first", status.message());
+}
+
+// A busy comparison is cancelled once it exceeds the limit.
+TEST(CpuTimeWatchdogTest, CancelsBusyComparison) {
+  CpuTimeWatchdog watchdog(kLimit);
+  watchdog.Start(1);
+  CancellationToken token;
+  watchdog.Watch(0, &token);
+  const double start = CpuTimeWatchdog::ThreadCpuSeconds();
+  const absl::Status status = SpinUntilCancelled(&token);
+  const double used = CpuTimeWatchdog::ThreadCpuSeconds() - start;
+  watchdog.Unwatch(0);
+  watchdog.Stop();
+  EXPECT_EQ(absl::StatusCode::kDeadlineExceeded, status.code());
+  EXPECT_GE(used, kLimit);
+}
+
+#if defined(__linux__)
+// Time spent waiting does not count towards the limit.
+TEST(CpuTimeWatchdogTest, IgnoresIdleTime) {
+  CpuTimeWatchdog watchdog(kLimit);
+  watchdog.Start(1);
+  CancellationToken token;
+  watchdog.Watch(0, &token);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  watchdog.Unwatch(0);
+  watchdog.Stop();
+  EXPECT_FALSE(token.IsCancelled());
+}
+#endif
+
+// A job that exceeds the limit fails with deadline exceeded, without
+// affecting the other jobs of the batch.
+TEST(CpuTimeWatchdogTest, BatchRunnerCancelsSlowJob) {
+  const size_t kNumJobs = 4;
+  const size_t kSlowJob = 1;
+  BatchComparisonRunner runner(2);
+  runner.SetPairCpuTimeLimit(kLimit);
+  std::vector<absl::StatusCode> codes;
+  runner.Run(
+      kNumJobs,
+      [](VisqolManager *, size_t job_index,
+         const CancellationToken *cancellation) {
+        if (job_index == kSlowJob) {
+          return absl::StatusOr<SimilarityResultMsg>(
+              SpinUntilCancelled(cancellation));
+        }
+        return absl::StatusOr<SimilarityResultMsg>(SimilarityResultMsg());
+      },
+      [&codes](size_t, const absl::StatusOr<SimilarityResultMsg> &result) {
+        codes.push_back(result.status().code());
+      });
+  ASSERT_EQ(kNumJobs, codes.size());
+  for (size_t i = 0; i < kNumJobs; i++) {
+    EXPECT_EQ(i == kSlowJob ? absl::StatusCode::kDeadlineExceeded
+                            : absl::StatusCode::kOk,
+              codes[i]);
+  }
+}
+}  // namespace
+}  // namespace Visqol
@@ -0,0 +1,224 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "directory_watcher.h"
+
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "gtest/gtest.h"
+
+#include "batch_comparison_runner.h"
+#include "commandline_parser.h"
+
+namespace Visqol {
+namespace {
+
+const FilePath kDefaultModel =
+    FilePath(FilePath::currentWorkingDir() + kDefaultAudioModelFile);
+
+// Create an empty directory for a test.
+std::string MakeTestDir(const std::string &name) {
+  const std::string dir = ::testing::TempDir() + "/directory_watcher/" + name;
+  boost::filesystem::remove_all(dir);
+  boost::filesystem::create_directories(dir);
+  return dir;
+}
+
+void WriteFile(const std::string &path, const std::string &contents) {
+  std::ofstream out(path);
+  out << contents;
+}
+
+bool SamePath(const FilePath &a, const std::string &b) {
+  return boost::filesystem::equivalent(a.Path(), b);
+}
+
+TEST(DirectoryWatcherTest, MatchesByNamingRule) {
+  const std::string refs = MakeTestDir("rule_refs");
+  const std::string degs = MakeTestDir("rule_degs");
+  WriteFile(refs + "/CA01_01.wav", "ref");
+  WriteFile(degs + "/transcoded_CA01_01.wav", "deg");
+  WatchNamingRule rule;
+  rule.reference_dir = FilePath(refs);
+  rule.degraded_pattern = "transcoded_*.wav";
+  rule.reference_pattern = "*.wav";
+  const DirectoryWatcher watcher(FilePath(degs), rule);
+
+  auto pair = watcher.Match("transcoded_CA01_01.wav");
+  ASSERT_TRUE(pair.ok());
+  EXPECT_TRUE(SamePath(pair.value().reference, refs + "/CA01_01.wav"));
+  EXPECT_TRUE(SamePath(pair.value().degraded,
+                       degs + "/transcoded_CA01_01.wav"));
+  EXPECT_EQ(absl::StatusCode::kNotFound,
+            watcher.Match("CA01_01.wav").status().code());
+  EXPECT_EQ(absl::StatusCode::kFailedPrecondition,
+            watcher.Match("transcoded_CA01_02.wav").status().code());
+}
+
+// A sidecar file names the reference, relative to the watched directory,
+// whatever the naming rule.
+TEST(DirectoryWatcherTest, MatchesBySidecar) {
+  const std::string refs = MakeTestDir("sidecar_refs");
+  const std::string degs = MakeTestDir("sidecar_degs");
+  WriteFile(refs + "/original.wav", "ref");
+  WriteFile(degs + "/encoded.wav", "deg");
+  WriteFile(degs + "/encoded.wav" + DirectoryWatcher::kSidecarExtension,
+            "../sidecar_refs/original.wav\r\n");
+  WatchNamingRule rule;
+  rule.reference_dir = FilePath(refs);
+  const DirectoryWatcher watcher(FilePath(degs), rule);
+
+  auto pair = watcher.Match("encoded.wav");
+  ASSERT_TRUE(pair.ok());
+  EXPECT_TRUE(SamePath(pair.value().reference, refs + "/original.wav"));
+}
+
+// A file cannot be compared with itself.
+TEST(DirectoryWatcherTest, SkipsOwnReference) {
+  const std::string dir = MakeTestDir("own_reference");
+  WriteFile(dir + "/clip.wav", "clip");
+  WatchNamingRule rule;
+  rule.reference_dir = FilePath(dir);
+  const DirectoryWatcher watcher(FilePath(dir), rule);
+  EXPECT_EQ(absl::StatusCode::kFailedPrecondition,
+            watcher.Match("clip.wav").status().code());
+}
+
+// A rule that names every file as its own reference is rejected.
+TEST(DirectoryWatcherTest, ValidateNamingRule) {
+  const std::string dir = MakeTestDir("rule_dir");
+  const std::string refs = MakeTestDir("rule_refs");
+  WatchNamingRule rule;
+  rule.reference_dir = FilePath(dir);
+  EXPECT_FALSE(DirectoryWatcher::ValidateNamingRule(FilePath(dir), rule).ok());
+  rule.degraded_pattern = "transcoded_*.wav";
+  EXPECT_TRUE(DirectoryWatcher::ValidateNamingRule(FilePath(dir), rule).ok());
+  rule = WatchNamingRule();
+  rule.reference_dir = FilePath(refs);
+  EXPECT_TRUE(DirectoryWatcher::ValidateNamingRule(FilePath(dir), rule).ok());
+}
+
+#if defined(__linux__)
+// Files are queued in the order they are written, even when more are written
+// than the queue holds.
+TEST(DirectoryWatcherTest, QueuesWrittenFiles) {
+  const std::string refs = MakeTestDir("queue_refs");
+  const std::string degs = MakeTestDir("queue_degs");
+  WatchNamingRule rule;
+  rule.reference_dir = FilePath(refs);
+  DirectoryWatcher watcher(FilePath(degs), rule, 1);
+  ASSERT_TRUE(watcher.Start().ok());
+
+  const std::vector<std::string> names = {"a.wav", "b.wav", "c.wav"};
+  for (const auto &name : names) {
+    WriteFile(refs + "/" + name, "ref");
+    WriteFile(degs + "/" + name, "deg");
+  }
+  // Neither the unmatched file nor the sidecar is queued.
+  WriteFile(degs + "/notes.txt", "notes");
+  WriteFile(degs + "/d.wav" + DirectoryWatcher::kSidecarExtension,
+            refs + "/a.wav");
+  for (const auto &name : names) {
+    auto pair = watcher.Next();
+    ASSERT_TRUE(pair.has_value());
+    EXPECT_TRUE(SamePath(pair.value().degraded, degs + "/" + name));
+    EXPECT_TRUE(SamePath(pair.value().reference, refs + "/" + name));
+  }
+  watcher.RequestStop();
+  EXPECT_FALSE(watcher.Next().has_value());
+}
+
+// When more files are written than the kernel buffers events for, the
+// rescan queues the files whose events were lost once they settle, but not
+// the files that were already in the directory.
+TEST(DirectoryWatcherTest, RescansAfterOverflow) {
+  const std::string refs = MakeTestDir("overflow_refs");
+  const std::string degs = MakeTestDir("overflow_degs");
+  WriteFile(refs + "/ref.wav", "ref");
+  WriteFile(degs + "/existing.wav", "deg");
+  WatchNamingRule rule;
+  rule.reference_dir = FilePath(refs);
+  rule.reference_pattern = "ref.wav";
+  DirectoryWatcher watcher(FilePath(degs), rule, 1, 1.0);
+  ASSERT_TRUE(watcher.Start().ok());
+
+  // The watcher stops reading events once its queue holds one pair, so this
+  // overflows the kernel's default buffer of 16384 events.
+  const size_t kNumFiles = 20000;
+  for (size_t i = 0; i < kNumFiles; i++) {
+    WriteFile(degs + "/" + std::to_string(i) + ".wav", "deg");
+  }
+  std::set<std::string> names;
+  while (auto pair = watcher.Next()) {
+    const std::string name =
+        boost::filesystem::path(pair.value().degraded.Path())
+            .filename().string();
+    EXPECT_NE("existing.wav", name);
+    EXPECT_TRUE(names.insert(name).second) << name << " was queued twice.";
+  }
+  EXPECT_EQ(kNumFiles, names.size());
+}
+
+TEST(DirectoryWatcherTest, StopsWhenIdle) {
+  const std::string dir = MakeTestDir("idle");
+  WatchNamingRule rule;
+  rule.reference_dir = FilePath(dir);
+  DirectoryWatcher watcher(FilePath(dir), rule,
+                           DirectoryWatcher::kDefaultQueueCapacity, 0.2);
+  ASSERT_TRUE(watcher.Start().ok());
+  EXPECT_FALSE(watcher.Next().has_value());
+}
+
+// The pairs of a watch are compared on the runner's warm workers as they
+// arrive.
+TEST(DirectoryWatcherTest, RunnerComparesWatchedFiles) {
+  const std::string refs = MakeTestDir("runner_refs");
+  const std::string degs = MakeTestDir("runner_degs");
+  WatchNamingRule rule;
+  rule.reference_dir = FilePath(refs);
+  rule.degraded_pattern = "transcoded_*.wav";
+  DirectoryWatcher watcher(FilePath(degs), rule);
+  ASSERT_TRUE(watcher.Start().ok());
+  BatchComparisonRunner runner(2);
+  ASSERT_TRUE(runner.Init(kDefaultModel, true, false, 60).ok());
+
+  boost::filesystem::copy_file("testdata/clean_speech/CA01_01.wav",
+                               refs + "/CA01_01.wav");
+  boost::filesystem::copy_file("testdata/clean_speech/transcoded_CA01_01.wav",
+                               degs + "/transcoded_CA01_01.wav");
+  std::vector<absl::StatusOr<SimilarityResultMsg>> results;
+  runner.RunStream([&watcher]() { return watcher.Next(); },
+                   [&watcher, &results](
+                       const ReferenceDegradedPathPair &pair,
+                       const absl::StatusOr<SimilarityResultMsg> &result) {
+                     results.push_back(result);
+                     watcher.RequestStop();
+                   });
+  ASSERT_EQ(1, results.size());
+  ASSERT_TRUE(results[0].ok());
+
+  VisqolManager manager;
+  ASSERT_TRUE(manager.Init(kDefaultModel, true, false, 60).ok());
+  auto expected = manager.Run(FilePath("testdata/clean_speech/CA01_01.wav"),
+      FilePath("testdata/clean_speech/transcoded_CA01_01.wav"));
+  ASSERT_TRUE(expected.ok());
+  EXPECT_EQ(expected.value().moslqo(), results[0].value().moslqo());
+}
+#endif
+}  // namespace
+}  // namespace Visqol
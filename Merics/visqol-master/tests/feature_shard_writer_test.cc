@@ -0,0 +1,244 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "feature_shard_writer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "batch_comparison_runner.h"
+#include "commandline_parser.h"
+#include "similarity_result.pb.h"
+
+namespace Visqol {
+namespace {
+
+const size_t kNumBands = 4;
+
+// An .npy file read back into its header dict and values.
+struct Npy {
+  std::string header;
+  std::vector<double> data;
+};
+
+// Read an .npy file, checking its preamble and alignment.
+Npy ReadNpy(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  const std::string bytes((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+  Npy npy;
+  EXPECT_GE(bytes.size(), 10);
+  if (bytes.size() < 10) {
+    return npy;
+  }
+  EXPECT_EQ("\x93NUMPY", bytes.substr(0, 6));
+  EXPECT_EQ(1, bytes[6]);
+  EXPECT_EQ(0, bytes[7]);
+  const size_t header_size = static_cast<uint8_t>(bytes[8]) |
+                             static_cast<uint8_t>(bytes[9]) << 8;
+  EXPECT_EQ(0, (10 + header_size) % 64);
+  npy.header = bytes.substr(10, header_size);
+  EXPECT_EQ('\n', npy.header.back());
+  npy.data.resize((bytes.size() - 10 - header_size) / sizeof(double));
+  std::memcpy(npy.data.data(), &bytes[10 + header_size],
+              npy.data.size() * sizeof(double));
+  return npy;
+}
+
+std::vector<std::string> ReadLines(const std::string &path) {
+  std::ifstream in(path);
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(in, line)) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+SimilarityResultMsg MakeResult(size_t pair_index, size_t num_patches) {
+  SimilarityResultMsg msg;
+  msg.set_reference_filepath("ref" + std::to_string(pair_index) + ".wav");
+  msg.set_degraded_filepath("deg" + std::to_string(pair_index) + ".wav");
+  msg.set_moslqo(pair_index);
+  msg.set_vnsim(0.5);
+  for (size_t band = 0; band < kNumBands; band++) {
+    msg.add_center_freq_bands(100.0 * (band + 1));
+    msg.add_fvnsim(pair_index + band / 10.0);
+    msg.add_fstdnsim(0.1);
+    msg.add_fvdegenergy(1.0);
+  }
+  for (size_t i = 0; i < num_patches; i++) {
+    auto *patch = msg.add_patch_sims();
+    patch->set_similarity(pair_index);
+    patch->set_ref_patch_start_time(i);
+    patch->set_ref_patch_end_time(i + 1);
+    for (size_t band = 0; band < kNumBands; band++) {
+      patch->add_freq_band_means(pair_index);
+    }
+  }
+  return msg;
+}
+
+TEST(FeatureShardWriterTest, WriteNpy) {
+  const std::string path = ::testing::TempDir() + "/array.npy";
+  ASSERT_TRUE(FeatureShardWriter::WriteNpy(FilePath(path), {2, 3},
+                                           {1, 2, 3, 4, 5, 6}).ok());
+  const Npy npy = ReadNpy(path);
+  EXPECT_EQ(0, npy.header.find("{'descr': '<f8', 'fortran_order': False, "
+                               "'shape': (2, 3), }"));
+  EXPECT_EQ(std::vector<double>({1, 2, 3, 4, 5, 6}), npy.data);
+
+  ASSERT_TRUE(FeatureShardWriter::WriteNpy(FilePath(path), {3}, {1, 2, 3})
+                  .ok());
+  EXPECT_NE(std::string::npos, ReadNpy(path).header.find("'shape': (3,)"));
+}
+
+TEST(FeatureShardWriterTest, ParseStage) {
+  EXPECT_EQ(FeatureStage::kSpectrogram,
+            FeatureShardWriter::ParseStage("spectrogram").value());
+  EXPECT_EQ(FeatureStage::kPatches,
+            FeatureShardWriter::ParseStage("patches").value());
+  EXPECT_EQ(FeatureStage::kFvnsim,
+            FeatureShardWriter::ParseStage("fvnsim").value());
+  EXPECT_FALSE(FeatureShardWriter::ParseStage("moslqo").ok());
+}
+
+// Pairs added out of order from several threads are written to shards of
+// consecutive pairs, with failed pairs kept as NaN rows.
+TEST(FeatureShardWriterTest, WritesShardsInPairOrder) {
+  const std::string dir = ::testing::TempDir() + "/features";
+  const size_t kNumPairs = 5;
+  const size_t kPairsPerShard = 2;
+  FeatureShardWriter writer(FilePath(dir), FeatureStage::kPatches, kNumPairs,
+                            kPairsPerShard);
+  ASSERT_TRUE(writer.Open().ok());
+  std::vector<std::thread> threads;
+  for (size_t i = kNumPairs; i-- > 0;) {
+    threads.emplace_back([&writer, i]() {
+      if (i == 3) {
+        ReferenceDegradedPathPair pair;
+        pair.reference = FilePath("ref3.wav");
+        pair.degraded = FilePath("deg3.wav");
+        EXPECT_TRUE(writer.AddFailed(i, pair,
+            absl::Status(absl::StatusCode::kInvalidArgument, "bad, file"))
+                .ok());
+      } else {
+        EXPECT_TRUE(writer.AddResult(i, MakeResult(i, i + 1)).ok());
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  ASSERT_TRUE(writer.Close().ok());
+
+  const Npy fvnsim = ReadNpy(dir + "/shard-00001.fvnsim.npy");
+  EXPECT_NE(std::string::npos, fvnsim.header.find("'shape': (2, 4)"));
+  ASSERT_EQ(2 * kNumBands, fvnsim.data.size());
+  EXPECT_EQ(2.0, fvnsim.data[0]);
+  EXPECT_DOUBLE_EQ(2.3, fvnsim.data[kNumBands - 1]);
+  EXPECT_TRUE(std::isnan(fvnsim.data[kNumBands]));
+  const Npy moslqo = ReadNpy(dir + "/shard-00002.moslqo.npy");
+  EXPECT_EQ(std::vector<double>({4.0}), moslqo.data);
+
+  // Pairs 0 and 1 have 1 and 2 patches.
+  const Npy patches = ReadNpy(dir + "/shard-00000.patch_freq_band_means.npy");
+  EXPECT_NE(std::string::npos, patches.header.find("'shape': (3, 4)"));
+  const Npy times = ReadNpy(dir + "/shard-00000.patch_times.npy");
+  EXPECT_NE(std::string::npos, times.header.find("'shape': (3, 4)"));
+  EXPECT_EQ(1.0, times.data[8]);
+
+  const Npy bands = ReadNpy(dir + "/center_freq_bands.npy");
+  EXPECT_EQ(std::vector<double>({100, 200, 300, 400}), bands.data);
+
+  const auto index = ReadLines(dir + "/index.csv");
+  ASSERT_EQ(kNumPairs + 1, index.size());
+  EXPECT_EQ("1,ref1.wav,deg1.wav,0,1,0,0,0,0,0,0,1,2,", index[2]);
+  EXPECT_EQ(0, index[4].find("3,ref3.wav,deg3.wav,1,1,"));
+  EXPECT_NE(std::string::npos,
+            index[4].find("\"INVALID_ARGUMENT: bad, file\""));
+}
+
+// A shard that is missing pairs, for example after an aborted batch, is
+// written when the writer is closed.
+TEST(FeatureShardWriterTest, CloseWritesIncompleteShards) {
+  const std::string dir = ::testing::TempDir() + "/incomplete_features";
+  FeatureShardWriter writer(FilePath(dir), FeatureStage::kFvnsim, 3, 2);
+  ASSERT_TRUE(writer.Open().ok());
+  ASSERT_TRUE(writer.AddResult(0, MakeResult(0, 1)).ok());
+  ASSERT_TRUE(writer.Close().ok());
+  const Npy moslqo = ReadNpy(dir + "/shard-00000.moslqo.npy");
+  ASSERT_EQ(2, moslqo.data.size());
+  EXPECT_EQ(0.0, moslqo.data[0]);
+  EXPECT_TRUE(std::isnan(moslqo.data[1]));
+  EXPECT_TRUE(std::isnan(ReadNpy(dir + "/shard-00001.vnsim.npy").data[0]));
+  const auto index = ReadLines(dir + "/index.csv");
+  ASSERT_EQ(4, index.size());
+  EXPECT_NE(std::string::npos, index[3].find("not run"));
+}
+
+// The batch runner extracts the prepared spectrograms of each pair without
+// comparing them.
+TEST(FeatureShardWriterTest, BatchRunnerExtractsSpectrograms) {
+  const std::string dir = ::testing::TempDir() + "/spectrogram_features";
+  const FilePath ref("testdata/clean_speech/CA01_01.wav");
+  const FilePath deg("testdata/clean_speech/transcoded_CA01_01.wav");
+  const std::vector<ReferenceDegradedPathPair> pairs(2, {ref, deg});
+  FeatureShardWriter writer(FilePath(dir), FeatureStage::kSpectrogram,
+                            pairs.size());
+  ASSERT_TRUE(writer.Open().ok());
+  BatchComparisonRunner runner(2);
+  ASSERT_TRUE(runner.Init(FilePath(FilePath::currentWorkingDir() +
+                                   kDefaultAudioModelFile),
+                          false, false, 60).ok());
+  runner.SetFeatureWriter(&writer);
+  size_t num_ok = 0;
+  runner.Run(pairs, [&num_ok](size_t,
+      const absl::StatusOr<SimilarityResultMsg> &result) {
+    ASSERT_TRUE(result.ok());
+    EXPECT_EQ(0.0, result.value().moslqo());
+    num_ok++;
+  });
+  ASSERT_EQ(pairs.size(), num_ok);
+  ASSERT_TRUE(writer.Close().ok());
+
+  const Npy ref_spectrogram =
+      ReadNpy(dir + "/shard-00000.ref_spectrogram.npy");
+  const Npy bands = ReadNpy(dir + "/center_freq_bands.npy");
+  ASSERT_EQ(VisqolManager::kNumBandsAudio, bands.data.size());
+  ASSERT_FALSE(ref_spectrogram.data.empty());
+  EXPECT_EQ(0, ref_spectrogram.data.size() % bands.data.size());
+  // Both pairs are the same, so have the same frames.
+  const size_t half = ref_spectrogram.data.size() / 2;
+  EXPECT_TRUE(std::equal(ref_spectrogram.data.begin(),
+                         ref_spectrogram.data.begin() + half,
+                         ref_spectrogram.data.begin() + half));
+  const auto index = ReadLines(dir + "/index.csv");
+  ASSERT_EQ(3, index.size());
+  EXPECT_NE(std::string::npos,
+            index[2].find("," + std::to_string(half / bands.data.size()) +
+                          ","));
+}
+
+}  // namespace
+}  // namespace Visqol
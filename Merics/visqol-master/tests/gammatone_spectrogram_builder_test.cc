@@ -14,6 +14,10 @@
 
 #include "gammatone_filterbank.h"
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "absl/memory/memory.h"
 
@@ -70,5 +74,59 @@ TEST(BuildSpectrogramTest, basic_positive_flow) {
   ASSERT_EQ(kNumBands, spectrogram_deg.Data().NumRows());
 }
 
+// Ensure that the audio mode bands do not depend on the sample rate, and that
+// the bands above half the sample rate are empty.
+TEST(BuildSpectrogramTest, rate_independent_band_plan) {
+  const size_t kSampleRate48k = 48000;
+  const size_t kSampleRate32k = 32000;
+  const double kDuration = 0.5;
+  auto make_noise = [kDuration](size_t sample_rate) {
+    std::vector<double> samples(sample_rate * kDuration);
+    for (size_t i = 0; i < samples.size(); i++) {
+      samples[i] = std::sin(i * 1.7) * std::cos(i * 0.31);
+    }
+    return AudioSignal{AMatrix<double>(samples), sample_rate};
+  };
+  const AudioSignal signal_48k = make_noise(kSampleRate48k);
+  const AudioSignal signal_32k = make_noise(kSampleRate32k);
+
+  GammatoneSpectrogramBuilder builder(
+      GammatoneFilterBank{kNumBands, kMinimumFreq}, false);
+  const Spectrogram spectrogram_48k =
+      builder.Build(signal_48k, AnalysisWindow{kSampleRate48k, kOverlap})
+          .value();
+  const Spectrogram spectrogram_32k =
+      builder.Build(signal_32k, AnalysisWindow{kSampleRate32k, kOverlap})
+          .value();
+  ASSERT_EQ(spectrogram_48k.GetCenterFreqBands(),
+            spectrogram_32k.GetCenterFreqBands());
+  // The band plan is known without building a spectrogram.
+  ASSERT_EQ(spectrogram_32k.GetCenterFreqBands(),
+            builder.GetCenterFreqBands(kSampleRate32k));
+  ASSERT_EQ(spectrogram_48k.Data().NumCols(),
+            spectrogram_32k.Data().NumCols());
+
+  // The bands are ordered from lowest to highest.
+  const auto center_freqs = spectrogram_32k.GetCenterFreqBands();
+  for (size_t band = 0; band < kNumBands; band++) {
+    const auto row = spectrogram_32k.Data().GetRow(band);
+    const double max_energy = *std::max_element(row.begin(), row.end());
+    if (center_freqs[band] < kSampleRate32k / 2.0) {
+      ASSERT_GT(max_energy, 0.0);
+    } else {
+      ASSERT_EQ(0.0, max_energy);
+    }
+  }
+
+  // At 48kHz, the band plan is the one of the sample rate.
+  const ErbFiltersResult fixed = EquivalentRectangularBandwidth::
+      MakeFixedFilters(kSampleRate48k, kNumBands, kMinimumFreq,
+                       GammatoneSpectrogramBuilder::kAudioModeMaxFreq);
+  const ErbFiltersResult native = EquivalentRectangularBandwidth::MakeFilters(
+      kSampleRate48k, kNumBands, kMinimumFreq, kSampleRate48k / 2.0);
+  ASSERT_EQ(native.centerFreqs, fixed.centerFreqs);
+  ASSERT_EQ(native.filterCoeffs, fixed.filterCoeffs);
+}
+
 }  // namespace
 }  // namespace Visqol
@@ -0,0 +1,92 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lazy_spectrogram_pair.h"
+
+#include "gtest/gtest.h"
+
+#include "amatrix.h"
+#include "analysis_window.h"
+#include "cancellation_token.h"
+#include "file_path.h"
+#include "gammatone_filterbank.h"
+#include "gammatone_spectrogram_builder.h"
+#include "misc_audio.h"
+#include "spectrogram.h"
+
+namespace Visqol {
+namespace {
+
+const double kMinimumFreq = 50;
+const size_t kNumBands = 32;
+const double kOverlap = 0.25;
+const size_t kFirstCol = 100;
+const size_t kLastCol = 140;
+
+// Ensure that the lazily computed columns are identical to the same columns
+// of the eagerly built and prepared spectrograms, and that only the blocks
+// spanning the requested columns are computed.
+TEST(LazySpectrogramPair, MatchesEagerBuild) {
+  const AudioSignal ref_signal = MiscAudio::LoadAsMono(FilePath(
+      "testdata/conformance_testdata_subset/contrabassoon48_stereo.wav"));
+  const AudioSignal deg_signal = MiscAudio::LoadAsMono(FilePath(
+      "testdata/conformance_testdata_subset/"
+      "contrabassoon48_stereo_24kbps_aac.wav"));
+  const AnalysisWindow window{ref_signal.sample_rate, kOverlap};
+  GammatoneSpectrogramBuilder builder(
+      GammatoneFilterBank{kNumBands, kMinimumFreq}, false);
+
+  Spectrogram eager_ref = builder.Build(ref_signal, window).value();
+  Spectrogram eager_deg = builder.Build(deg_signal, window).value();
+  MiscAudio::PrepareSpectrogramsForComparison(eager_ref, eager_deg);
+
+  LazySpectrogramPair lazy(&builder, ref_signal, deg_signal, window);
+  ASSERT_TRUE(lazy.Init().ok());
+  ASSERT_TRUE(lazy.EnsureColumns(kFirstCol, kLastCol).ok());
+  ASSERT_EQ(eager_ref.Data().NumCols() + eager_deg.Data().NumCols(),
+            lazy.NumColumnsTotal());
+  ASSERT_LT(lazy.NumColumnsComputed(), lazy.NumColumnsTotal());
+  ASSERT_EQ(eager_ref.GetCenterFreqBands(), lazy.GetCenterFreqBands());
+
+  for (size_t col = kFirstCol; col <= kLastCol; col++) {
+    for (size_t row = 0; row < kNumBands; row++) {
+      ASSERT_EQ(eager_ref.Data()(row, col), lazy.RefData()(row, col));
+      ASSERT_EQ(eager_deg.Data()(row, col), lazy.DegData()(row, col));
+    }
+  }
+
+  // Requesting the same columns again must not compute anything further.
+  const size_t num_computed = lazy.NumColumnsComputed();
+  ASSERT_TRUE(lazy.EnsureColumns(kFirstCol, kLastCol).ok());
+  ASSERT_EQ(num_computed, lazy.NumColumnsComputed());
+}
+
+// A cancelled token stops the initial blocks from being built.
+TEST(LazySpectrogramPair, InitCancelled) {
+  const AudioSignal signal = MiscAudio::LoadAsMono(FilePath(
+      "testdata/conformance_testdata_subset/contrabassoon48_stereo.wav"));
+  const AnalysisWindow window{signal.sample_rate, kOverlap};
+  GammatoneSpectrogramBuilder builder(
+      GammatoneFilterBank{kNumBands, kMinimumFreq}, false);
+  CancellationToken cancellation;
+  cancellation.Cancel("test");
+
+  LazySpectrogramPair lazy(&builder, signal, signal, window);
+  EXPECT_EQ(absl::StatusCode::kDeadlineExceeded,
+            lazy.Init(&cancellation).code());
+  EXPECT_EQ(0, lazy.NumColumnsComputed());
+}
+
+}  // namespace
+}  // namespace Visqol
@@ -14,6 +14,14 @@
 
 #include "misc_audio.h"
 
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <utility>
+
 #include "gtest/gtest.h"
 
 #include "file_path.h"
@@ -67,6 +75,54 @@ TEST(LoadAsMono, MonoFromEmptyStream) {
   ASSERT_NE(kMonoTestsample_rate, wavreader_audio.sample_rate);
 }
 
+// A stream buffer over a string that, like a pipe, cannot be seeked.
+class PipeBuffer : public std::streambuf {
+ public:
+  explicit PipeBuffer(std::string data) : data_(std::move(data)) {
+    setg(&data_[0], &data_[0], &data_[0] + data_.size());
+  }
+
+ private:
+  std::string data_;
+};
+
+// The mono test file, with the size of its data chunk unset as written by
+// tools streaming to a pipe, and without the chunks after its data.
+std::string ReadMonoWithUnknownDataSize() {
+  std::ifstream wav_file("testdata/clean_speech/CA01_01.wav",
+                         std::ios::binary);
+  std::stringstream wav_string_stream;
+  wav_string_stream << wav_file.rdbuf();
+  std::string wav = wav_string_stream.str();
+  const size_t data_pos = wav.find("data");
+  EXPECT_NE(std::string::npos, data_pos);
+  wav.resize(data_pos + 8 + kMonoTestNumRows * sizeof(int16_t));
+  wav.replace(data_pos + 4, 4, 4, '\xFF');
+  return wav;
+}
+
+TEST(LoadAsMono, MonoFromPipeWithUnknownDataSize) {
+  const auto expected_audio = Visqol::MiscAudio::LoadAsMono(
+      FilePath("testdata/clean_speech/CA01_01.wav"));
+  PipeBuffer pipe_buffer(ReadMonoWithUnknownDataSize());
+  std::istream pipe_stream(&pipe_buffer);
+
+  auto wavreader_audio = Visqol::MiscAudio::LoadAsMono(&pipe_stream);
+  ASSERT_EQ(kMonoTestsample_rate, wavreader_audio.sample_rate);
+  ASSERT_EQ(kMonoTestNumRows, wavreader_audio.data_matrix.NumRows());
+  for (size_t i = 0; i < kMonoTestNumRows; i++) {
+    ASSERT_EQ(expected_audio.data_matrix(i), wavreader_audio.data_matrix(i));
+  }
+}
+
+TEST(LoadAsMono, MonoFromStreamWithUnknownDataSize) {
+  std::stringstream wav_string_stream(ReadMonoWithUnknownDataSize());
+
+  auto wavreader_audio = Visqol::MiscAudio::LoadAsMono(&wav_string_stream);
+  ASSERT_EQ(kMonoTestsample_rate, wavreader_audio.sample_rate);
+  ASSERT_EQ(kMonoTestNumRows, wavreader_audio.data_matrix.NumRows());
+}
+
 TEST(LoadAsMono, Stereo) {
   FilePath stereo_file{
       "testdata/conformance_testdata_subset/guitar48_stereo.wav"};
@@ -80,5 +136,41 @@ TEST(LoadAsMono, Stereo) {
               kDurationTolerance);
 }
 
+// The active region runs between the first and last loud frames, padded on
+// each side where the signal allows.
+TEST(FindActiveRegion, TrimsSilence) {
+  const size_t kSampleRate = 1000;
+  AMatrix<double> samples = AMatrix<double>::Filled(10000, 1, 0.0);
+  for (size_t i = 3000; i < 6000; i++) {
+    samples(i, 0) = (i % 2 == 0) ? 0.5 : -0.5;
+  }
+  // Quiet noise floor, far below the activity threshold.
+  for (size_t i = 0; i < 10000; i += 7) {
+    samples(i, 0) += 1e-5;
+  }
+  const AudioSignal signal{samples, kSampleRate};
+  const auto region = MiscAudio::FindActiveRegion(signal, 0.5);
+  EXPECT_EQ(2500, region.first);
+  EXPECT_EQ(6500, region.second);
+
+  // The padding is clamped to the signal.
+  const auto wide_region = MiscAudio::FindActiveRegion(signal, 5.0);
+  EXPECT_EQ(0, wide_region.first);
+  EXPECT_EQ(10000, wide_region.second);
+
+  const AudioSignal sliced =
+      MiscAudio::SliceSamples(signal, region.first, region.second);
+  ASSERT_EQ(4000, sliced.data_matrix.NumRows());
+  EXPECT_EQ(kSampleRate, sliced.sample_rate);
+  EXPECT_EQ(samples(3000, 0), sliced.data_matrix(500, 0));
+}
+
+TEST(FindActiveRegion, SilentSignal) {
+  const AudioSignal signal{AMatrix<double>::Filled(1000, 1, 0.0), 1000};
+  const auto region = MiscAudio::FindActiveRegion(signal, 0.5);
+  EXPECT_EQ(0, region.first);
+  EXPECT_EQ(1000, region.second);
+}
+
 }  // namespace
 }  // namespace Visqol
@@ -0,0 +1,92 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "patch_similarity_table.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "amatrix.h"
+#include "patch_similarity_comparator.h"
+
+namespace Visqol {
+namespace {
+
+// A patch result with the given band values and times.
+PatchSimilarityResult MakeResult(const std::vector<double> &means,
+                                 double ref_start, double deg_start) {
+  PatchSimilarityResult result;
+  result.freq_band_means = AMatrix<double>(means);
+  result.freq_band_stddevs = AMatrix<double>(means) * 0.5;
+  result.freq_band_deg_energy = AMatrix<double>(means) * 2.0;
+  result.similarity = means[0];
+  result.ref_patch_start_time = ref_start;
+  result.ref_patch_end_time = ref_start + 1.0;
+  result.deg_patch_start_time = deg_start;
+  result.deg_patch_end_time = deg_start == 0.0 ? 0.0 : deg_start + 1.0;
+  return result;
+}
+
+// The band values of each patch are stored in one row per patch.
+TEST(PatchSimilarityTableTest, AppendStoresRowsPerPatch) {
+  PatchSimilarityTable table;
+  table.Append(MakeResult({0.1, 0.2, 0.3}, 0.0, 0.5));
+  table.Append(MakeResult({0.4, 0.5, 0.6}, 1.0, 1.5));
+
+  ASSERT_EQ(2, table.NumPatches());
+  ASSERT_EQ(3, table.NumFreqBands());
+  EXPECT_EQ(std::vector<double>({0.1, 0.2, 0.3, 0.4, 0.5, 0.6}),
+            table.FreqBandMeans());
+  EXPECT_EQ(std::vector<double>({0.05, 0.1, 0.15, 0.2, 0.25, 0.3}),
+            table.FreqBandStdDevs());
+  EXPECT_EQ(std::vector<double>({0.2, 0.4, 0.6, 0.8, 1.0, 1.2}),
+            table.FreqBandDegEnergy());
+  EXPECT_EQ(std::vector<double>({0.1, 0.4}), table.Similarities());
+  EXPECT_EQ(std::vector<double>({0.0, 1.0}), table.RefPatchStartTimes());
+  EXPECT_EQ(std::vector<double>({1.0, 2.0}), table.RefPatchEndTimes());
+  EXPECT_EQ(std::vector<double>({0.5, 1.5}), table.DegPatchStartTimes());
+  EXPECT_EQ(std::vector<double>({1.5, 2.5}), table.DegPatchEndTimes());
+}
+
+// Unmatched patches keep their zero degraded times.
+TEST(PatchSimilarityTableTest, ShiftTimes) {
+  PatchSimilarityTable table;
+  table.Append(MakeResult({0.1}, 0.0, 0.5));
+  table.Append(MakeResult({0.2}, 1.0, 0.0));
+  table.ShiftTimes(2.0);
+
+  EXPECT_EQ(std::vector<double>({2.0, 3.0}), table.RefPatchStartTimes());
+  EXPECT_EQ(std::vector<double>({3.0, 4.0}), table.RefPatchEndTimes());
+  EXPECT_EQ(std::vector<double>({2.5, 0.0}), table.DegPatchStartTimes());
+  EXPECT_EQ(std::vector<double>({3.5, 0.0}), table.DegPatchEndTimes());
+}
+
+TEST(PatchSimilarityTableTest, Select) {
+  PatchSimilarityTable table;
+  table.Append(MakeResult({0.1, 0.2}, 0.0, 0.5));
+  table.Append(MakeResult({0.3, 0.4}, 1.0, 1.5));
+  table.Append(MakeResult({0.5, 0.6}, 2.0, 2.5));
+
+  const PatchSimilarityTable selected = table.Select({2, 0});
+  ASSERT_EQ(2, selected.NumPatches());
+  ASSERT_EQ(2, selected.NumFreqBands());
+  EXPECT_EQ(std::vector<double>({0.5, 0.6, 0.1, 0.2}),
+            selected.FreqBandMeans());
+  EXPECT_EQ(std::vector<double>({0.5, 0.1}), selected.Similarities());
+  EXPECT_EQ(std::vector<double>({2.0, 0.0}), selected.RefPatchStartTimes());
+  EXPECT_EQ(std::vector<double>({2.5, 0.5}), selected.DegPatchStartTimes());
+}
+}  // namespace
+}  // namespace Visqol
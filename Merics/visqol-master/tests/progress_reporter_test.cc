@@ -0,0 +1,133 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "progress_reporter.h"
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "google/protobuf/util/json_util.h"
+
+#include "batch_comparison_runner.h"
+
+namespace Visqol {
+namespace {
+
+const double kInterval = 0.01;
+
+std::vector<ProgressReportMsg> ReadReports(const FilePath &path) {
+  std::vector<ProgressReportMsg> reports;
+  std::ifstream in(path.Path());
+  std::string line;
+  while (std::getline(in, line)) {
+    ProgressReportMsg report;
+    EXPECT_TRUE(google::protobuf::util::JsonStringToMessage(line, &report)
+                    .ok());
+    reports.push_back(report);
+  }
+  return reports;
+}
+
+TEST(ProgressReporterTest, SummarisesFinishedJobs) {
+  const FilePath path(::testing::TempDir() + "/progress.jsonl");
+  ProgressReporter reporter(path, kInterval);
+  ASSERT_TRUE(reporter.Open().ok());
+  reporter.Start(3, 2, []() { return 42.0; });
+  reporter.JobStarted(0, 0, 1.0);
+  reporter.JobStarted(1, 1, 1.0);
+  reporter.JobFinished(0, true, 2.5);
+  reporter.JobFinished(1, false, 1.5);
+  reporter.JobStarted(0, 2, 1.0);
+
+  const ProgressReportMsg report = reporter.Snapshot();
+  EXPECT_EQ(2, report.pairs_done());
+  EXPECT_EQ(1, report.pairs_failed());
+  EXPECT_EQ(3, report.pairs_total());
+  EXPECT_EQ(2, report.num_workers());
+  EXPECT_EQ(1, report.workers_busy());
+  EXPECT_EQ(42.0, report.eta_seconds());
+  EXPECT_GT(report.pairs_per_second(), 0.0);
+  EXPECT_NEAR(4.0 / 2.0, report.audio_seconds_per_second() /
+                             report.pairs_per_second(), 1e-9);
+  EXPECT_FALSE(report.finished());
+
+  // Let the reporting thread write at least one report.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  reporter.JobFinished(0, true, 1.0);
+  reporter.Finish();
+  const auto reports = ReadReports(path);
+  ASSERT_GE(reports.size(), 2);
+  EXPECT_FALSE(reports.front().finished());
+  EXPECT_TRUE(reports.back().finished());
+  EXPECT_EQ(3, reports.back().pairs_done());
+  EXPECT_EQ(0, reports.back().workers_busy());
+}
+
+// A job running for much longer than the finished jobs took per unit of
+// cost is reported as a straggler.
+TEST(ProgressReporterTest, ReportsStragglers) {
+  ProgressReporter reporter(FilePath(::testing::TempDir() + "/stragglers"),
+                            kInterval);
+  ASSERT_TRUE(reporter.Open().ok());
+  reporter.Start(3, 2, nullptr);
+  reporter.JobStarted(0, 0, 1.0);
+  reporter.JobStarted(1, 1, 10.0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  reporter.JobFinished(0, true, 1.0);
+  EXPECT_EQ(0, reporter.Snapshot().stragglers_size());
+
+  reporter.JobStarted(0, 2, 1.0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  const ProgressReportMsg report = reporter.Snapshot();
+  ASSERT_EQ(1, report.stragglers_size());
+  EXPECT_EQ(2, report.stragglers(0).pair_index());
+  EXPECT_EQ(0, report.stragglers(0).worker());
+  EXPECT_GT(report.stragglers(0).running_seconds(),
+            ProgressReporter::kStragglerFactor *
+                report.stragglers(0).expected_seconds());
+  reporter.Finish();
+}
+
+// The batch runner reports every job to its reporter.
+TEST(ProgressReporterTest, BatchRunnerReportsProgress) {
+  const size_t kNumJobs = 5;
+  const FilePath path(::testing::TempDir() + "/runner_progress.jsonl");
+  ProgressReporter reporter(path, kInterval);
+  ASSERT_TRUE(reporter.Open().ok());
+  BatchComparisonRunner runner(2);
+  runner.SetProgressReporter(&reporter);
+  runner.Run(
+      kNumJobs,
+      [](VisqolManager *, size_t, const CancellationToken *) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        return absl::StatusOr<SimilarityResultMsg>(SimilarityResultMsg());
+      },
+      [](size_t, const absl::StatusOr<SimilarityResultMsg> &) {}, {}, {},
+      std::vector<double>(kNumJobs, 2.0));
+  const auto reports = ReadReports(path);
+  ASSERT_FALSE(reports.empty());
+  const ProgressReportMsg &last = reports.back();
+  EXPECT_TRUE(last.finished());
+  EXPECT_EQ(kNumJobs, last.pairs_done());
+  EXPECT_EQ(kNumJobs, last.pairs_total());
+  EXPECT_EQ(0, last.pairs_failed());
+  EXPECT_EQ(2, last.num_workers());
+  EXPECT_GT(last.audio_seconds_per_second(), 0.0);
+}
+}  // namespace
+}  // namespace Visqol
@@ -0,0 +1,159 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reference_cache_service.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace Visqol {
+namespace {
+
+TEST(StringLruCacheTest, EvictsLeastRecentlyUsed) {
+  StringLruCache cache(10);
+  cache.Put("a", "aaa");
+  cache.Put("b", "bbb");
+  ASSERT_TRUE(cache.Get("a").has_value());
+  // Makes room by evicting b, which was used less recently than a.
+  cache.Put("c", "ccc");
+  EXPECT_EQ("aaa", cache.Get("a").value());
+  EXPECT_FALSE(cache.Get("b").has_value());
+  EXPECT_EQ("ccc", cache.Get("c").value());
+  EXPECT_EQ(8, cache.SizeBytes());
+
+  // Replacing a value frees the old one, and an oversized value is dropped.
+  cache.Put("a", "a");
+  EXPECT_EQ(6, cache.SizeBytes());
+  cache.Put("d", std::string(100, 'd'));
+  EXPECT_FALSE(cache.Get("d").has_value());
+  EXPECT_EQ(6, cache.SizeBytes());
+}
+
+TEST(ReferenceCacheServiceTest, RoundTrip) {
+  ReferenceCacheServer server(1 << 20);
+  ASSERT_TRUE(server.Start(0, "127.0.0.1").ok());
+  ASSERT_GT(server.Port(), 0);
+  const ReferenceCacheClient client("127.0.0.1", server.Port());
+
+  auto missing = client.Get("v1-missing");
+  ASSERT_TRUE(missing.ok());
+  EXPECT_FALSE(missing.value().has_value());
+
+  // Values are binary, and may hold newlines and zeros.
+  std::string value = "line\nbreak";
+  value += '\0';
+  value += std::string(100000, 'x');
+  ASSERT_TRUE(client.Put("v1-key", value).ok());
+  auto found = client.Get("v1-key");
+  ASSERT_TRUE(found.ok());
+  ASSERT_TRUE(found.value().has_value());
+  EXPECT_EQ(value, found.value().value());
+
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+            client.Put("bad key", "value").code());
+  server.Stop();
+  EXPECT_EQ(0, server.Port());
+}
+
+#ifndef _WIN32
+// A client that stalls, or trickles in its request, neither delays the other
+// clients nor holds its connection open past the deadline.
+TEST(ReferenceCacheServiceTest, StalledClient) {
+  ReferenceCacheServer server(1 << 20, 2);
+  ASSERT_TRUE(server.Start(0, "127.0.0.1").ok());
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(server.Port()));
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr *>(&addr),
+                       sizeof(addr)));
+  const auto start = std::chrono::steady_clock::now();
+  std::atomic<bool> closed{false};
+  std::thread trickle([fd, &closed]() {
+    // Send a byte of a request line every 100 ms until the server hangs up.
+    while (send(fd, "G", 1, MSG_NOSIGNAL) == 1) {
+      pollfd poll_fd = {fd, POLLIN, 0};
+      char c;
+      if (poll(&poll_fd, 1, 100) > 0 && recv(fd, &c, 1, 0) <= 0) {
+        break;
+      }
+    }
+    closed = true;
+  });
+
+  const ReferenceCacheClient client("127.0.0.1", server.Port());
+  ASSERT_TRUE(client.Put("v1-key", "value").ok());
+  auto found = client.Get("v1-key");
+  ASSERT_TRUE(found.ok());
+  EXPECT_EQ("value", found.value().value());
+  EXPECT_FALSE(closed);
+
+  trickle.join();
+  close(fd);
+  const std::chrono::duration<double> held =
+      std::chrono::steady_clock::now() - start;
+  EXPECT_LT(held.count(), ReferenceCacheServer::kIoTimeoutSeconds + 1.0);
+  server.Stop();
+}
+#endif
+
+// The deadline of a call allows for the size of its value, so that the
+// largest values are moved within a timeout meant for the round trip.
+TEST(ReferenceCacheServiceTest, LargeValue) {
+  ReferenceCacheServer server(2 * ReferenceCacheServer::kMaxValueBytes);
+  ASSERT_TRUE(server.Start(0).ok());
+  const ReferenceCacheClient client("127.0.0.1", server.Port(), 0.5);
+  const std::string value(ReferenceCacheServer::kMaxValueBytes, 'x');
+  ASSERT_TRUE(client.Put("v1-key", value).ok());
+  auto found = client.Get("v1-key");
+  ASSERT_TRUE(found.ok());
+  ASSERT_TRUE(found.value().has_value());
+  EXPECT_EQ(value.size(), found.value()->size());
+  server.Stop();
+}
+
+TEST(ReferenceCacheServiceTest, UnreachableServer) {
+  ReferenceCacheServer server(1 << 20);
+  ASSERT_TRUE(server.Start(0, "127.0.0.1").ok());
+  const ReferenceCacheClient client("127.0.0.1", server.Port(), 0.5);
+  server.Stop();
+  EXPECT_FALSE(client.Get("v1-key").ok());
+  EXPECT_FALSE(client.Put("v1-key", "value").ok());
+}
+
+TEST(ReferenceCacheServiceTest, ParseAddress) {
+  auto address = ReferenceCacheClient::ParseAddress("cache.local:7431");
+  ASSERT_TRUE(address.ok());
+  EXPECT_EQ("cache.local", address.value().first);
+  EXPECT_EQ(7431, address.value().second);
+  EXPECT_FALSE(ReferenceCacheClient::ParseAddress("cache.local").ok());
+  EXPECT_FALSE(ReferenceCacheClient::ParseAddress(":7431").ok());
+  EXPECT_FALSE(ReferenceCacheClient::ParseAddress("host:70000").ok());
+}
+}  // namespace
+}  // namespace Visqol
@@ -0,0 +1,182 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reference_feature_cache.h"
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "gtest/gtest.h"
+
+#include "amatrix.h"
+#include "analysis_window.h"
+#include "audio_signal.h"
+#include "reference_cache_service.h"
+#include "spectrogram.h"
+
+namespace Visqol {
+namespace {
+
+const size_t kSampleRate = 48000;
+const double kOverlap = 0.25;
+const char kSecret[] = "a secret shared by the fleet";
+
+AudioSignal MakeSignal(double scale) {
+  std::vector<double> samples(kSampleRate / 10);
+  for (size_t i = 0; i < samples.size(); i++) {
+    samples[i] = scale * ((i % 100) / 100.0 - 0.5);
+  }
+  return AudioSignal{AMatrix<double>(samples), kSampleRate};
+}
+
+Spectrogram MakeSpectrogram() {
+  Spectrogram spectrogram(AMatrix<double>(
+      std::vector<std::vector<double>>{{1.0, 2.0, 3.0}, {4.0, -5.5, 6.25}}));
+  spectrogram.SetCenterFreqBands({50.0, 100.0, 200.0});
+  return spectrogram;
+}
+
+TEST(ReferenceFeatureCacheTest, SerializeRoundTrip) {
+  const Spectrogram spectrogram = MakeSpectrogram();
+  const std::string bytes = ReferenceFeatureCache::Serialize(spectrogram);
+  auto restored = ReferenceFeatureCache::Deserialize(bytes);
+  ASSERT_TRUE(restored.ok());
+  EXPECT_TRUE(spectrogram.Data() == restored.value().Data());
+  EXPECT_EQ(spectrogram.GetCenterFreqBands(),
+            restored.value().GetCenterFreqBands());
+
+  EXPECT_FALSE(ReferenceFeatureCache::Deserialize(
+      bytes.substr(0, bytes.size() - 1)).ok());
+  EXPECT_FALSE(ReferenceFeatureCache::Deserialize("VQRF").ok());
+  EXPECT_FALSE(ReferenceFeatureCache::Deserialize("").ok());
+}
+
+TEST(ReferenceFeatureCacheTest, ContentKey) {
+  const AudioSignal signal = MakeSignal(1.0);
+  const AnalysisWindow window{kSampleRate, kOverlap};
+  const std::string key =
+      ReferenceFeatureCache::ContentKey(signal, window, false);
+  EXPECT_EQ(key, ReferenceFeatureCache::ContentKey(MakeSignal(1.0), window,
+                                                   false));
+  EXPECT_NE(key, ReferenceFeatureCache::ContentKey(MakeSignal(0.5), window,
+                                                   false));
+  EXPECT_NE(key, ReferenceFeatureCache::ContentKey(signal, window, true));
+  const AnalysisWindow other_window{kSampleRate, kOverlap, 0.1};
+  EXPECT_NE(key,
+            ReferenceFeatureCache::ContentKey(signal, other_window, false));
+}
+
+TEST(ReferenceFeatureCacheTest, LocalOnly) {
+  ReferenceFeatureCache cache(1 << 20);
+  EXPECT_FALSE(cache.Fetch("v1-key").has_value());
+  cache.Publish("v1-key", MakeSpectrogram());
+  auto found = cache.Fetch("v1-key");
+  ASSERT_TRUE(found.has_value());
+  EXPECT_TRUE(MakeSpectrogram().Data() == found->Data());
+  EXPECT_EQ(1, cache.Stats().misses);
+  EXPECT_EQ(1, cache.Stats().local_hits);
+}
+
+// Features published by one node are fetched by another through the server.
+TEST(ReferenceFeatureCacheTest, SharedThroughServer) {
+  ReferenceCacheServer server(1 << 20);
+  ASSERT_TRUE(server.Start(0, "127.0.0.1").ok());
+  ReferenceFeatureCache publisher(
+      1 << 20,
+      absl::make_unique<ReferenceCacheClient>("127.0.0.1", server.Port()),
+      kSecret);
+  ReferenceFeatureCache fetcher(
+      1 << 20,
+      absl::make_unique<ReferenceCacheClient>("127.0.0.1", server.Port()),
+      kSecret);
+  publisher.Publish("v1-key", MakeSpectrogram());
+  auto found = fetcher.Fetch("v1-key");
+  ASSERT_TRUE(found.has_value());
+  EXPECT_TRUE(MakeSpectrogram().Data() == found->Data());
+  EXPECT_EQ(1, fetcher.Stats().remote_hits);
+
+  // The fetched features are kept locally.
+  server.Stop();
+  EXPECT_TRUE(fetcher.Fetch("v1-key").has_value());
+  EXPECT_EQ(1, fetcher.Stats().local_hits);
+  EXPECT_EQ(0, fetcher.Stats().remote_errors);
+}
+
+// Entries stored without the secret of the fleet are misses.
+TEST(ReferenceFeatureCacheTest, UnsignedEntriesIgnored) {
+  ReferenceCacheServer server(1 << 20);
+  ASSERT_TRUE(server.Start(0).ok());
+  const ReferenceCacheClient client("127.0.0.1", server.Port());
+  const std::string bytes = ReferenceFeatureCache::Serialize(MakeSpectrogram());
+  ASSERT_TRUE(client.Put("v1-unsigned", bytes).ok());
+  ReferenceFeatureCache other_fleet(
+      1 << 20,
+      absl::make_unique<ReferenceCacheClient>("127.0.0.1", server.Port()),
+      "another fleet's secret");
+  other_fleet.Publish("v1-other", MakeSpectrogram());
+  ReferenceFeatureCache signed_entry(
+      1 << 20,
+      absl::make_unique<ReferenceCacheClient>("127.0.0.1", server.Port()),
+      kSecret);
+  signed_entry.Publish("v1-signed", MakeSpectrogram());
+  // A signed entry replayed under another key.
+  auto replayed = client.Get("v1-signed");
+  ASSERT_TRUE(replayed.ok() && replayed.value().has_value());
+  ASSERT_TRUE(client.Put("v1-replayed", replayed.value().value()).ok());
+
+  ReferenceFeatureCache fetcher(
+      1 << 20,
+      absl::make_unique<ReferenceCacheClient>("127.0.0.1", server.Port()),
+      kSecret);
+  EXPECT_FALSE(fetcher.Fetch("v1-unsigned").has_value());
+  EXPECT_FALSE(fetcher.Fetch("v1-other").has_value());
+  EXPECT_FALSE(fetcher.Fetch("v1-replayed").has_value());
+  EXPECT_TRUE(fetcher.Fetch("v1-signed").has_value());
+  EXPECT_EQ(3, fetcher.Stats().misses);
+  EXPECT_EQ(1, fetcher.Stats().remote_hits);
+  EXPECT_EQ(0, fetcher.Stats().remote_errors);
+}
+
+TEST(ReferenceFeatureCacheTest, ReadSecret) {
+  const std::string path = ::testing::TempDir() + "/reference_cache_secret";
+  std::ofstream(path) << kSecret << "\n";
+  auto secret = ReferenceFeatureCache::ReadSecret(path);
+  ASSERT_TRUE(secret.ok());
+  EXPECT_EQ(kSecret, secret.value());
+  std::ofstream(path) << "too short\n";
+  EXPECT_FALSE(ReferenceFeatureCache::ReadSecret(path).ok());
+  EXPECT_FALSE(ReferenceFeatureCache::ReadSecret(path + ".missing").ok());
+}
+
+// An unreachable server is a miss, and is skipped after the first error.
+TEST(ReferenceFeatureCacheTest, UnreachableServer) {
+  ReferenceCacheServer server(1 << 20);
+  ASSERT_TRUE(server.Start(0, "127.0.0.1").ok());
+  ReferenceFeatureCache cache(
+      1 << 20,
+      absl::make_unique<ReferenceCacheClient>("127.0.0.1", server.Port(), 0.5),
+      kSecret);
+  server.Stop();
+  EXPECT_FALSE(cache.Fetch("v1-key").has_value());
+  cache.Publish("v1-key", MakeSpectrogram());
+  EXPECT_TRUE(cache.Fetch("v1-key").has_value());
+  EXPECT_EQ(1, cache.Stats().misses);
+  EXPECT_EQ(1, cache.Stats().local_hits);
+  EXPECT_EQ(1, cache.Stats().remote_errors);
+}
+}  // namespace
+}  // namespace Visqol
@@ -0,0 +1,140 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "resource_probe.h"
+
+#include <fstream>
+#include <string>
+
+#include "boost/filesystem.hpp"
+#include "gtest/gtest.h"
+
+namespace Visqol {
+namespace {
+
+const size_t kHostConcurrency = 16;
+const size_t kBytesPerGiB = 1024 * 1024 * 1024;
+
+// Create a fake cgroup filesystem under the test temp dir.
+class ResourceProbeTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = ::testing::TempDir() + "/resource_probe_" +
+        ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    boost::filesystem::remove_all(root_);
+    boost::filesystem::create_directories(root_);
+  }
+
+  void WriteFile(const std::string &relative_path,
+                 const std::string &contents) {
+    const boost::filesystem::path path(root_ + "/" + relative_path);
+    boost::filesystem::create_directories(path.parent_path());
+    std::ofstream(path.string()) << contents;
+  }
+
+  ResourceLimits Probe() {
+    return ResourceProbe::Probe(FilePath(root_ + "/cgroup"),
+                                FilePath(root_ + "/proc_self_cgroup"),
+                                kHostConcurrency);
+  }
+
+  std::string root_;
+};
+
+// A cgroup v2 pod with a 2.5 CPU quota and a 4 GiB memory limit.
+TEST_F(ResourceProbeTest, CgroupV2) {
+  WriteFile("proc_self_cgroup", "0::/kubepods/pod1\n");
+  WriteFile("cgroup/cgroup.controllers", "cpu memory\n");
+  WriteFile("cgroup/kubepods/pod1/cpu.max", "250000 100000\n");
+  WriteFile("cgroup/kubepods/pod1/memory.max",
+            std::to_string(4 * kBytesPerGiB));
+  // A looser limit on an ancestor does not override the pod's limit.
+  WriteFile("cgroup/kubepods/memory.max", std::to_string(8 * kBytesPerGiB));
+
+  const ResourceLimits limits = Probe();
+  EXPECT_EQ(kHostConcurrency, limits.hardware_concurrency);
+  EXPECT_DOUBLE_EQ(2.5, limits.cpu_limit);
+  EXPECT_EQ(4 * kBytesPerGiB, limits.memory_limit_bytes);
+
+  const ExecutionConfig config = ResourceProbe::DeriveExecutionConfig(limits);
+  EXPECT_EQ(2, config.num_workers);
+  EXPECT_EQ(3 * kBytesPerGiB, config.memory_budget_bytes);
+}
+
+// A cgroup v2 host without limits, which leaves the host resources in use.
+TEST_F(ResourceProbeTest, CgroupV2Unlimited) {
+  WriteFile("proc_self_cgroup", "0::/\n");
+  WriteFile("cgroup/cgroup.controllers", "cpu memory\n");
+  WriteFile("cgroup/cpu.max", "max 100000\n");
+  WriteFile("cgroup/memory.max", "max\n");
+
+  const ResourceLimits limits = Probe();
+  EXPECT_EQ(0.0, limits.cpu_limit);
+  EXPECT_EQ(0, limits.memory_limit_bytes);
+
+  const ExecutionConfig config = ResourceProbe::DeriveExecutionConfig(limits);
+  EXPECT_EQ(kHostConcurrency, config.num_workers);
+  EXPECT_EQ(0, config.memory_budget_bytes);
+}
+
+// A cgroup v1 container, where the cgroup namespace root is mounted directly
+// so the path listed in /proc/self/cgroup does not exist.
+TEST_F(ResourceProbeTest, CgroupV1) {
+  WriteFile("proc_self_cgroup",
+            "4:memory:/docker/abc\n3:cpu,cpuacct:/docker/abc\n");
+  WriteFile("cgroup/cpu,cpuacct/cgroup.procs", "");
+  WriteFile("cgroup/cpu,cpuacct/cpu.cfs_quota_us", "400000\n");
+  WriteFile("cgroup/cpu,cpuacct/cpu.cfs_period_us", "100000\n");
+  WriteFile("cgroup/memory/cgroup.procs", "");
+  WriteFile("cgroup/memory/memory.limit_in_bytes",
+            std::to_string(kBytesPerGiB / 8));
+
+  const ResourceLimits limits = Probe();
+  EXPECT_DOUBLE_EQ(4.0, limits.cpu_limit);
+  EXPECT_EQ(kBytesPerGiB / 8, limits.memory_limit_bytes);
+
+  // The memory budget only fits 3 comparisons.
+  const ExecutionConfig config = ResourceProbe::DeriveExecutionConfig(limits);
+  EXPECT_EQ(3, config.num_workers);
+}
+
+// A cgroup v1 host reports unlimited values as -1 and a near max int64.
+TEST_F(ResourceProbeTest, CgroupV1Unlimited) {
+  WriteFile("proc_self_cgroup", "4:memory:/\n3:cpu:/\n");
+  WriteFile("cgroup/cpu/cgroup.procs", "");
+  WriteFile("cgroup/cpu/cpu.cfs_quota_us", "-1\n");
+  WriteFile("cgroup/cpu/cpu.cfs_period_us", "100000\n");
+  WriteFile("cgroup/memory/cgroup.procs", "");
+  WriteFile("cgroup/memory/memory.limit_in_bytes", "9223372036854771712\n");
+
+  const ResourceLimits limits = Probe();
+  EXPECT_EQ(0.0, limits.cpu_limit);
+  EXPECT_EQ(0, limits.memory_limit_bytes);
+}
+
+// Without any cgroup information, the host resources are used.
+TEST_F(ResourceProbeTest, NoCgroups) {
+  const ResourceLimits limits = Probe();
+  EXPECT_EQ(kHostConcurrency, limits.hardware_concurrency);
+  EXPECT_EQ(0.0, limits.cpu_limit);
+  EXPECT_EQ(0, limits.memory_limit_bytes);
+
+  // A quota below one CPU still allows a single worker.
+  ResourceLimits small_quota = limits;
+  small_quota.cpu_limit = 0.5;
+  EXPECT_EQ(1, ResourceProbe::DeriveExecutionConfig(small_quota).num_workers);
+}
+
+}  // namespace
+}  // namespace Visqol
@@ -0,0 +1,73 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sha256.h"
+
+#include <string>
+
+#include "absl/strings/escaping.h"
+#include "gtest/gtest.h"
+
+namespace Visqol {
+namespace {
+
+std::string HexHash(const std::string &data) {
+  return absl::BytesToHexString(Sha256::Hash(data));
+}
+
+// The test vectors of FIPS 180-4 and its examples.
+TEST(Sha256Test, KnownDigests) {
+  EXPECT_EQ(
+      "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+      HexHash(""));
+  EXPECT_EQ(
+      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+      HexHash("abc"));
+  EXPECT_EQ(
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+      HexHash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"));
+  EXPECT_EQ(
+      "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+      HexHash(std::string(1000000, 'a')));
+}
+
+TEST(Sha256Test, UpdateInPieces) {
+  const std::string data(1000, 'x');
+  for (const size_t split : {0, 1, 55, 56, 63, 64, 65, 999}) {
+    Sha256 hasher;
+    hasher.Update(data.data(), split);
+    hasher.Update(data.data() + split, data.size() - split);
+    EXPECT_EQ(Sha256::Hash(data), hasher.Finish()) << split;
+  }
+}
+
+// The test cases of RFC 4231.
+TEST(Sha256Test, KnownHmacs) {
+  EXPECT_EQ(
+      "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7",
+      absl::BytesToHexString(
+          Sha256::Hmac(std::string(20, '\x0b'), "Hi There")));
+  EXPECT_EQ(
+      "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843",
+      absl::BytesToHexString(
+          Sha256::Hmac("Jefe", "what do ya want for nothing?")));
+  EXPECT_EQ(
+      "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54",
+      absl::BytesToHexString(Sha256::Hmac(
+          std::string(131, '\xaa'),
+          "Test Using Larger Than Block-Size Key - Hash Key First")));
+}
+
+}  // namespace
+}  // namespace Visqol
@@ -0,0 +1,96 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "spill_storage.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "commandline_parser.h"
+#include "visqol_manager.h"
+
+namespace Visqol {
+namespace {
+
+const FilePath kDefaultModel =
+    FilePath(FilePath::currentWorkingDir() + kDefaultAudioModelFile);
+
+// Restores the default of never spilling when a test ends.
+class SpillStorageTest : public ::testing::Test {
+ protected:
+  void TearDown() override { SpillStorage::Configure(FilePath(), 0); }
+};
+
+TEST_F(SpillStorageTest, SpillsAboveThreshold) {
+  SpillStorage::Configure(FilePath(::testing::TempDir()), 1024);
+  SpillableTable<double> small(8, 8);
+  EXPECT_FALSE(small.IsSpilled());
+  SpillableTable<double> large(100, 100);
+  ASSERT_TRUE(large.IsSpilled());
+  EXPECT_EQ(100, large.NumRows());
+  EXPECT_EQ(100, large.NumCols());
+
+  // The mapped table starts out zero filled, and holds what is written.
+  for (size_t row = 0; row < large.NumRows(); row++) {
+    for (size_t col = 0; col < large.NumCols(); col++) {
+      ASSERT_EQ(0.0, large[row][col]);
+      large[row][col] = row * 1000.0 + col;
+    }
+  }
+  EXPECT_EQ(42017.0, large[42][17]);
+  EXPECT_EQ(99099.0, large[99][99]);
+}
+
+TEST_F(SpillStorageTest, NeverSpillsByDefault) {
+  SpillableTable<int> table(1000, 1000);
+  EXPECT_FALSE(table.IsSpilled());
+  EXPECT_EQ(0, table[999][999]);
+}
+
+// A table that cannot be spilled is kept in memory instead.
+TEST_F(SpillStorageTest, FallsBackToMemory) {
+  const FilePath missing(::testing::TempDir() + "/missing_spill_dir");
+  EXPECT_FALSE(MappedTempFile::Create(missing, 1024).ok());
+  // Nor can a file larger than any disk be reserved.
+  EXPECT_FALSE(MappedTempFile::Create(FilePath(::testing::TempDir()),
+                                      size_t{1} << 60).ok());
+  SpillStorage::Configure(missing, 1024);
+  SpillableTable<double> table(100, 100);
+  EXPECT_FALSE(table.IsSpilled());
+  table[99][99] = 1.0;
+  EXPECT_EQ(1.0, table[99][99]);
+}
+
+// Spilling the patch search tables does not change the results.
+TEST_F(SpillStorageTest, SpilledComparisonMatches) {
+  const FilePath ref("testdata/clean_speech/CA01_01.wav");
+  const FilePath deg("testdata/clean_speech/transcoded_CA01_01.wav");
+  VisqolManager manager;
+  ASSERT_TRUE(manager.Init(kDefaultModel, false, false, 60).ok());
+  const auto in_memory = manager.Run(ref, deg);
+  ASSERT_TRUE(in_memory.ok());
+  SpillStorage::Configure(FilePath(::testing::TempDir()), 1);
+  const auto spilled = manager.Run(ref, deg);
+  ASSERT_TRUE(spilled.ok());
+  EXPECT_EQ(in_memory.value().moslqo(), spilled.value().moslqo());
+  ASSERT_EQ(in_memory.value().patch_sims_size(),
+            spilled.value().patch_sims_size());
+  for (int i = 0; i < in_memory.value().patch_sims_size(); i++) {
+    EXPECT_EQ(in_memory.value().patch_sims(i).deg_patch_start_time(),
+              spilled.value().patch_sims(i).deg_patch_start_time());
+  }
+}
+}  // namespace
+}  // namespace Visqol
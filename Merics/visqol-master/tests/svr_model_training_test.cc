@@ -18,6 +18,7 @@
 #include "misc_vector.h"
 #include "support_vector_regression_model.h"
 #include "training_data_file_reader.h"
+#include "training_matrix_file.h"
 
 namespace Visqol {
 namespace {
@@ -69,5 +70,30 @@ TEST(SupportVectorRegressionModel_Test, vs_model_file) {
   // Don't expect the values to be anywhere near each other.
   EXPECT_NEAR(prediction_model_file, prediction_targ_obv, kTolerance);
 }
+
+/**
+ * In this test, the training data is converted to a training matrix file,
+ * and a model trained on the mapped matrix is expected to make the same
+ * predictions as a model trained on the text files.
+ */
+TEST(SupportVectorRegressionModel_Test, vs_training_matrix_file) {
+  auto targets_mat = TrainingDataFileReader::Read(kTargetsPath, ',');
+  auto observations_mat = TrainingDataFileReader::Read(kObservationsPath, ',');
+  auto targets_vec = MiscVector::ConvertVecOfVecToVec(targets_mat);
+  SupportVectorRegressionModel model_text;
+  model_text.Init(observations_mat, targets_vec);
+
+  const FilePath matrix_path(::testing::TempDir() + "/training.vqtm");
+  ASSERT_TRUE(TrainingMatrixFile::Write(matrix_path, observations_mat,
+                                        targets_vec).ok());
+  TrainingMatrixFile matrix;
+  ASSERT_TRUE(matrix.Open(matrix_path).ok());
+  SupportVectorRegressionModel model_matrix;
+  model_matrix.Init(matrix.Observations(), matrix.Targets(),
+                    matrix.NumObservations(), matrix.NumFeatures());
+
+  EXPECT_DOUBLE_EQ(model_text.Predict(kSampleObservation),
+                   model_matrix.Predict(kSampleObservation));
+}
 }  // namespace
 }  // namespace Visqol
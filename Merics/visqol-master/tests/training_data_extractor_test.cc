@@ -0,0 +1,104 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "training_data_extractor.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "training_data_file_reader.h"
+
+namespace Visqol {
+namespace {
+
+const char kReference[] = "testdata/clean_speech/CA01_01.wav";
+const char kDegraded[] = "testdata/clean_speech/transcoded_CA01_01.wav";
+const int kSearchWindow = 60;
+
+std::string WriteManifest(const std::string &name,
+                          const std::string &contents) {
+  const std::string path = ::testing::TempDir() + "/" + name;
+  std::ofstream(path) << contents;
+  return path;
+}
+
+TEST(TrainingDataExtractorTest, ReadManifest) {
+  const std::string path = WriteManifest("manifest.csv",
+      "reference,degraded,moslqs\r\n"
+      "ref1.wav,deg1.wav,4.25\r\n"
+      "\r\n"
+      "ref2.wav,deg2.wav,condition_b,2.5\r\n");
+  auto pairs_statusor = TrainingDataExtractor::ReadManifest(FilePath(path));
+  ASSERT_TRUE(pairs_statusor.ok());
+  const auto &pairs = pairs_statusor.value();
+  ASSERT_EQ(2, pairs.size());
+  EXPECT_EQ("ref1.wav", pairs[0].files.reference.Path());
+  EXPECT_EQ("deg1.wav", pairs[0].files.degraded.Path());
+  EXPECT_DOUBLE_EQ(4.25, pairs[0].moslqs);
+  EXPECT_EQ("deg2.wav", pairs[1].files.degraded.Path());
+  EXPECT_DOUBLE_EQ(2.5, pairs[1].moslqs);
+}
+
+TEST(TrainingDataExtractorTest, RejectsMalformedManifest) {
+  const std::string path = WriteManifest("malformed.csv",
+      "reference,degraded,moslqs\n"
+      "ref1.wav,deg1.wav,4.25\n"
+      "ref2.wav,deg2.wav,unknown\n");
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+            TrainingDataExtractor::ReadManifest(FilePath(path))
+                .status().code());
+  EXPECT_EQ(absl::StatusCode::kNotFound,
+            TrainingDataExtractor::ReadManifest(
+                FilePath(::testing::TempDir() + "/missing.csv"))
+                .status().code());
+}
+
+// Pairs that fail to compare are left out, and the rest are written in
+// the format read by TrainingDataFileReader.
+TEST(TrainingDataExtractorTest, ExtractAndWrite) {
+  const std::vector<LabeledFilePair> pairs{
+      {{FilePath(kReference), FilePath(kDegraded)}, 3.5},
+      {{FilePath(kReference), FilePath("missing.wav")}, 1.0},
+      {{FilePath(kReference), FilePath(kReference)}, 4.75}};
+  TrainingDataExtractor extractor(2);
+  ASSERT_TRUE(extractor.Init(FilePath(""), true, false, kSearchWindow).ok());
+  const TrainingData data = extractor.Extract(pairs);
+  ASSERT_EQ(2, data.observations.size());
+  ASSERT_EQ(2, data.targets.size());
+  EXPECT_DOUBLE_EQ(3.5, data.targets[0]);
+  EXPECT_DOUBLE_EQ(4.75, data.targets[1]);
+  ASSERT_FALSE(data.observations[0].empty());
+  EXPECT_EQ(data.observations[0].size(), data.observations[1].size());
+
+  const FilePath observations_path(::testing::TempDir() + "/fvnsims.txt");
+  const FilePath targets_path(::testing::TempDir() + "/moslqs.txt");
+  ASSERT_TRUE(
+      TrainingDataExtractor::Write(data, observations_path, targets_path)
+          .ok());
+  const auto observations = TrainingDataFileReader::Read(observations_path,
+                                                         ',');
+  const auto targets = TrainingDataFileReader::Read(targets_path, ',');
+  ASSERT_EQ(2, observations.size());
+  ASSERT_EQ(2, targets.size());
+  EXPECT_DOUBLE_EQ(4.75, targets[1][0]);
+  ASSERT_EQ(data.observations[0].size(), observations[0].size());
+  for (size_t i = 0; i < observations[0].size(); i++) {
+    EXPECT_NEAR(data.observations[0][i], observations[0][i], 1e-14);
+  }
+}
+}  // namespace
+}  // namespace Visqol
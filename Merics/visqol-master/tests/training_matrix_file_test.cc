@@ -0,0 +1,116 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "training_matrix_file.h"
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "libsvm_target_observation_convertor.h"
+#include "training_data_file_reader.h"
+
+namespace Visqol {
+namespace {
+
+const FilePath kTargetsPath = FilePath(
+    "testdata/svr_training/training_mat_tcdaudio14_aacvopus15_moslqs.txt");
+const FilePath kObservationsPath = FilePath(
+    "testdata/svr_training/training_mat_tcdaudio14_aacvopus15_fvnsims.txt");
+
+const std::vector<MlObservation> kObservations{
+    {0.25, 0.5, 0.75}, {1.0, 0.125, 0.0}};
+const std::vector<MlTarget> kTargets{4.5, 1.5};
+
+// The text training files convert to a matrix holding the same values.
+TEST(TrainingMatrixFileTest, RoundTripsTextTrainingData) {
+  const auto observations = TrainingDataFileReader::Read(kObservationsPath,
+                                                         ',');
+  std::vector<MlTarget> targets;
+  for (const auto &row : TrainingDataFileReader::Read(kTargetsPath, ',')) {
+    targets.push_back(row[0]);
+  }
+  const FilePath path(::testing::TempDir() + "/training.vqtm");
+  ASSERT_TRUE(TrainingMatrixFile::Write(path, observations, targets).ok());
+
+  TrainingMatrixFile matrix;
+  ASSERT_TRUE(matrix.Open(path).ok());
+  ASSERT_EQ(observations.size(), matrix.NumObservations());
+  ASSERT_EQ(observations[0].size(), matrix.NumFeatures());
+  for (size_t row = 0; row < observations.size(); row++) {
+    EXPECT_EQ(targets[row], matrix.Targets()[row]);
+    for (size_t col = 0; col < observations[row].size(); col++) {
+      EXPECT_EQ(observations[row][col],
+                matrix.Observations()[row * matrix.NumFeatures() + col]);
+    }
+  }
+}
+
+TEST(TrainingMatrixFileTest, RejectsInconsistentData) {
+  const FilePath path(::testing::TempDir() + "/inconsistent.vqtm");
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+            TrainingMatrixFile::Write(path, kObservations, {4.5}).code());
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+            TrainingMatrixFile::Write(path, {{0.25, 0.5}, {1.0}}, kTargets)
+                .code());
+}
+
+TEST(TrainingMatrixFileTest, RejectsInvalidFiles) {
+  TrainingMatrixFile matrix;
+  EXPECT_EQ(absl::StatusCode::kNotFound,
+            matrix.Open(FilePath(::testing::TempDir() + "/missing.vqtm"))
+                .code());
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+            matrix.Open(kTargetsPath).code());
+
+  // A truncated file is rejected, rather than read past its end.
+  const FilePath path(::testing::TempDir() + "/truncated.vqtm");
+  ASSERT_TRUE(TrainingMatrixFile::Write(path, kObservations, kTargets).ok());
+  std::string contents;
+  {
+    std::ifstream in(path.Path(), std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>());
+  }
+  std::ofstream(path.Path(), std::ios::binary | std::ios::trunc)
+      .write(contents.data(), contents.size() - sizeof(double));
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument, matrix.Open(path).code());
+  EXPECT_EQ(0, matrix.NumObservations());
+}
+
+// The LIBSVM rows are laid out back to back in a single arena.
+TEST(TrainingMatrixFileTest, ConvertsToContiguousLibSvmRows) {
+  const FilePath path(::testing::TempDir() + "/arena.vqtm");
+  ASSERT_TRUE(TrainingMatrixFile::Write(path, kObservations, kTargets).ok());
+  TrainingMatrixFile matrix;
+  ASSERT_TRUE(matrix.Open(path).ok());
+
+  const LibSvmTargetObservationConvertor conv;
+  svm_node **rows = conv.ConvertObservations(
+      matrix.Observations(), matrix.NumObservations(), matrix.NumFeatures());
+  for (size_t row = 0; row < kObservations.size(); row++) {
+    EXPECT_EQ(rows[0] + row * (kObservations[0].size() + 1), rows[row]);
+    for (size_t col = 0; col < kObservations[row].size(); col++) {
+      EXPECT_EQ(col + 1, rows[row][col].index);
+      EXPECT_EQ(kObservations[row][col], rows[row][col].value);
+    }
+    EXPECT_EQ(-1, rows[row][kObservations[row].size()].index);
+  }
+  conv.FreeObservations(rows);
+}
+}  // namespace
+}  // namespace Visqol
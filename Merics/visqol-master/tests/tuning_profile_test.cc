@@ -0,0 +1,67 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tuning_profile.h"
+
+#include <fstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace Visqol {
+namespace {
+
+const size_t kHostConcurrency = 8;
+const size_t kNumWorkers = 4;
+
+// Write a tuning profile and ensure that it is read back unchanged.
+TEST(TuningProfileFile, RoundTrip) {
+  const FilePath path(::testing::TempDir() + "/round_trip_profile.txt");
+  TuningProfile profile;
+  profile.host_concurrency = kHostConcurrency;
+  profile.num_workers = kNumWorkers;
+  ASSERT_TRUE(TuningProfileFile::Write(path, profile).ok());
+
+  auto read_statusor = TuningProfileFile::Read(path);
+  ASSERT_TRUE(read_statusor.ok());
+  ASSERT_EQ(kHostConcurrency, read_statusor.value().host_concurrency);
+  ASSERT_EQ(kNumWorkers, read_statusor.value().num_workers);
+}
+
+// Ensure that unknown keys are ignored, but invalid values are rejected.
+TEST(TuningProfileFile, UnknownKeysAndInvalidValues) {
+  const FilePath path(::testing::TempDir() + "/unknown_key_profile.txt");
+  std::ofstream(path.Path()) << "version=1\nfuture_key=7\nnum_workers=2\n";
+  auto read_statusor = TuningProfileFile::Read(path);
+  ASSERT_TRUE(read_statusor.ok());
+  ASSERT_EQ(2, read_statusor.value().num_workers);
+
+  std::ofstream(path.Path()) << "version=1\nnum_workers=0\n";
+  ASSERT_FALSE(TuningProfileFile::Read(path).ok());
+
+  std::ofstream(path.Path()) << "version=999\nnum_workers=2\n";
+  ASSERT_FALSE(TuningProfileFile::Read(path).ok());
+
+  std::ofstream(path.Path()) << "num_workers\n";
+  ASSERT_FALSE(TuningProfileFile::Read(path).ok());
+}
+
+// Ensure that a missing profile results in an error status.
+TEST(TuningProfileFile, MissingFile) {
+  ASSERT_FALSE(TuningProfileFile::Read(
+      FilePath(::testing::TempDir() + "/does_not_exist.txt")).ok());
+}
+
+}  // namespace
+}  // namespace Visqol
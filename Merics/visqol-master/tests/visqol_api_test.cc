@@ -29,7 +29,8 @@ namespace Visqol {
 namespace {
 
 const size_t kSampleRate = 48000;
-const size_t kUnsupportedSampleRate = 44100;
+const size_t kUnsupportedSampleRate = 32000;
+const size_t kNon48kSampleRate = 44100;
 const double kTolerance = 0.0001;
 const char kContrabassoonRef[] =
   "testdata/conformance_testdata_subset/contrabassoon48_stereo.wav";
@@ -44,7 +45,7 @@ const char kNoSampleRateErrMsg[] =
 const char kNonExistantModelFile[] = "non_existant.txt";
 const char kNonExistantModelFileErrMsg[] =
     "INVALID_ARGUMENT: Failed to load the SVR model file: non_existant.txt";
-const char kNon48kSampleRateErrMsg[] =
+const char kUnsupportedSampleRateErrMsg[] =
     "INVALID_ARGUMENT: Currently, 48k is the only sample rate supported by "
     "ViSQOL Audio. See README for details of overriding.";
 
@@ -153,7 +154,7 @@ TEST(VisqolApi, unsupported_sample_rate_no_override) {
   auto result = visqol.Create(config);
 
   ASSERT_FALSE(result.ok());
-  ASSERT_EQ(kNon48kSampleRateErrMsg, result.ToString());
+  ASSERT_EQ(kUnsupportedSampleRateErrMsg, result.ToString());
 }
 
 /**
@@ -173,6 +174,23 @@ TEST(VisqolApi, unsupported_sample_rate_with_override) {
   ASSERT_TRUE(result.ok());
 }
 
+/**
+ *  Test calling the ViSQOL API with a 44.1k sample rate, whose empty top band
+ *  still needs the override.
+ */
+TEST(VisqolApi, non_48k_sample_rate_no_override) {
+  VisqolConfig config;
+  config.mutable_audio()->set_sample_rate(kNon48kSampleRate);
+  config.mutable_options()->set_svr_model_path(
+      FilePath::currentWorkingDir() + kDefaultAudioModelFile);
+
+  VisqolApi visqol;
+  auto result = visqol.Create(config);
+
+  ASSERT_FALSE(result.ok());
+  ASSERT_EQ(kUnsupportedSampleRateErrMsg, result.ToString());
+}
+
 /**
  *  Test calling the ViSQOL API with a model file specified that does not exist.
  */
@@ -14,10 +14,20 @@
 
 #include "visqol_manager.h"
 
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "absl/flags/flag.h"
+#include "absl/memory/memory.h"
+#include "cancellation_token.h"
 #include "commandline_parser.h"
 #include "conformance.h"
+#include "misc_audio.h"
+#include "reference_cache_service.h"
+#include "reference_feature_cache.h"
 #include "similarity_result.h"
 #include "test_utility.h"
 
@@ -35,6 +45,10 @@ const double kLag = 0.05;  // 50ms
 const double k10kCenterFreqBand = 10261.08660;
 const size_t k10kCenterFreqBandIndex = 26;
 const double kPerfectScore = 5.0;
+const double kTimelineWindow = 2.0;
+const double kTrimmedMosTolerance = 0.2;
+const double kTimelineHop = 1.0;
+const double kLongTimelineWindow = 1000.0;
 
 /**
  *  Compare against the ground truth obtained from the KNOWN version
@@ -428,5 +442,330 @@ TEST(VisqolCommandLineTest, UnscaledSpeechMode) {
               kTolerance);
 }
 
+/**
+ * Test that the fine alignment policy controls which patches are finely
+ * aligned. By default every matched patch is refined, whereas a threshold
+ * below any possible similarity skips them all.
+ */
+TEST(VisqolCommandLineTest, FineAlignmentPolicy) {
+  const Visqol::CommandLineArgs cmd_args = CommandLineArgsHelper
+      ("testdata/clean_speech/CA01_01.wav",
+       "testdata/clean_speech/transcoded_CA01_01.wav");
+  auto files_to_compare = VisqolCommandLineParser::BuildFilePairPaths(cmd_args);
+
+  Visqol::VisqolManager visqol;
+  auto status = visqol.Init(cmd_args.sim_to_quality_mapper_model,
+      cmd_args.use_speech_mode,
+      cmd_args.use_unscaled_speech_mos_mapping,
+      cmd_args.search_window_radius);
+  ASSERT_TRUE(status.ok());
+  auto status_or = visqol.Run(files_to_compare[0].reference,
+                              files_to_compare[0].degraded);
+  ASSERT_TRUE(status_or.ok());
+  const auto &stats = status_or.value().computation_stats();
+  EXPECT_GT(stats.patches_fine_aligned(), 0);
+  EXPECT_EQ(0, stats.patches_fine_alignment_skipped());
+
+  FineAlignmentPolicy skip_all;
+  skip_all.skip_similarity_threshold = -std::numeric_limits<double>::max();
+  Visqol::VisqolManager visqol_skip_all;
+  status = visqol_skip_all.Init(cmd_args.sim_to_quality_mapper_model,
+      cmd_args.use_speech_mode,
+      cmd_args.use_unscaled_speech_mos_mapping,
+      cmd_args.search_window_radius, skip_all);
+  ASSERT_TRUE(status.ok());
+  auto skip_all_status_or = visqol_skip_all.Run(files_to_compare[0].reference,
+                                                files_to_compare[0].degraded);
+  ASSERT_TRUE(skip_all_status_or.ok());
+  const auto &skip_all_stats = skip_all_status_or.value().computation_stats();
+  EXPECT_EQ(0, skip_all_stats.patches_fine_aligned());
+  EXPECT_EQ(stats.patches_fine_aligned(),
+            skip_all_stats.patches_fine_alignment_skipped());
+}
+
+/**
+ * Test that the wall time of every stage of a comparison is reported.
+ */
+TEST(VisqolCommandLineTest, StageTimes) {
+  const Visqol::CommandLineArgs cmd_args = CommandLineArgsHelper
+      ("testdata/clean_speech/CA01_01.wav",
+       "testdata/clean_speech/transcoded_CA01_01.wav");
+  auto files_to_compare = VisqolCommandLineParser::BuildFilePairPaths(cmd_args);
+
+  Visqol::VisqolManager visqol;
+  auto status = visqol.Init(cmd_args.sim_to_quality_mapper_model,
+      cmd_args.use_speech_mode,
+      cmd_args.use_unscaled_speech_mos_mapping,
+      cmd_args.search_window_radius);
+  ASSERT_TRUE(status.ok());
+  auto status_or = visqol.Run(files_to_compare[0].reference,
+                              files_to_compare[0].degraded);
+  ASSERT_TRUE(status_or.ok());
+  const auto &stats = status_or.value().computation_stats();
+  EXPECT_GT(stats.load_seconds(), 0.0);
+  EXPECT_GT(stats.global_alignment_seconds(), 0.0);
+  EXPECT_GT(stats.preprocessing_seconds(), 0.0);
+  EXPECT_GT(stats.patch_search_seconds(), 0.0);
+  EXPECT_GT(stats.fine_alignment_seconds(), 0.0);
+  EXPECT_GT(stats.quality_mapping_seconds(), 0.0);
+}
+
+/**
+ * Test that trimming the silence added around a pair of signals reports the
+ * trimmed silence and patch times relative to the untrimmed signals, with
+ * a score close to that of the pair without the added silence. The patches
+ * are not placed as they are for that pair, since the padding kept around
+ * the active region moves them.
+ */
+TEST(VisqolCommandLineTest, TrimSilence) {
+  const Visqol::CommandLineArgs cmd_args = CommandLineArgsHelper
+      ("testdata/clean_speech/CA01_01.wav",
+       "testdata/clean_speech/transcoded_CA01_01.wav");
+  auto files_to_compare = VisqolCommandLineParser::BuildFilePairPaths(cmd_args);
+  const AudioSignal ref =
+      MiscAudio::LoadAsMono(files_to_compare[0].reference);
+  const AudioSignal deg = MiscAudio::LoadAsMono(files_to_compare[0].degraded);
+  auto pad = [](const AudioSignal &signal, double leading, double trailing) {
+    const auto before = AMatrix<double>::Filled(
+        static_cast<size_t>(leading * signal.sample_rate), 1, 0.0);
+    const auto after = AMatrix<double>::Filled(
+        static_cast<size_t>(trailing * signal.sample_rate), 1, 0.0);
+    AudioSignal padded{
+        before.JoinVertically(signal.data_matrix).JoinVertically(after),
+        signal.sample_rate};
+    return padded;
+  };
+  const double kLeadingSilence = 4.0;
+  const double kTrailingSilence = 3.0;
+  const AudioSignal padded_ref = pad(ref, kLeadingSilence, kTrailingSilence);
+  AudioSignal padded_deg = pad(deg, kLeadingSilence, kTrailingSilence);
+  AudioSignal unpadded_deg = deg;
+
+  Visqol::VisqolManager visqol;
+  auto status = visqol.Init(cmd_args.sim_to_quality_mapper_model,
+      cmd_args.use_speech_mode,
+      cmd_args.use_unscaled_speech_mos_mapping,
+      cmd_args.search_window_radius);
+  ASSERT_TRUE(status.ok());
+  auto unpadded_status_or = visqol.Run(ref, unpadded_deg);
+  ASSERT_TRUE(unpadded_status_or.ok());
+  visqol.SetSilenceTrimming(true);
+  auto status_or = visqol.Run(padded_ref, padded_deg);
+  ASSERT_TRUE(status_or.ok());
+
+  const auto &stats = status_or.value().computation_stats();
+  const double leading_trimmed = stats.leading_silence_trimmed();
+  EXPECT_GE(leading_trimmed,
+            kLeadingSilence - VisqolManager::kSilenceTrimPadding);
+  EXPECT_GE(stats.trailing_silence_trimmed(),
+            kTrailingSilence - VisqolManager::kSilenceTrimPadding);
+  const auto &patches = status_or.value().patch_sims();
+  ASSERT_FALSE(patches.empty());
+  const double padded_duration = padded_ref.GetDuration();
+  for (const auto &patch : patches) {
+    EXPECT_GE(patch.ref_patch_start_time(), leading_trimmed);
+    EXPECT_LE(patch.ref_patch_end_time(),
+              padded_duration - stats.trailing_silence_trimmed() +
+                  kLagTolerance);
+  }
+  EXPECT_NEAR(unpadded_status_or.value().moslqo(),
+              status_or.value().moslqo(), kTrimmedMosTolerance);
+}
+
+/**
+ * Test that extracting the spectrograms of signals too short for a single
+ * frame fails with an error status.
+ */
+TEST(VisqolCommandLineTest, ExtractSpectrogramsTooShort) {
+  const Visqol::CommandLineArgs cmd_args = CommandLineArgsHelper
+      ("testdata/short_duration/1_sample/guitar48_stereo_1_sample.wav",
+       "testdata/short_duration/1_sample/guitar48_stereo_1_sample.wav");
+  auto files_to_compare = VisqolCommandLineParser::BuildFilePairPaths(cmd_args);
+  Visqol::VisqolManager visqol;
+  auto status = visqol.Init(cmd_args.sim_to_quality_mapper_model,
+      cmd_args.use_speech_mode,
+      cmd_args.use_unscaled_speech_mos_mapping,
+      cmd_args.search_window_radius);
+  ASSERT_TRUE(status.ok());
+  auto features = visqol.ExtractSpectrograms(files_to_compare[0].reference,
+                                             files_to_compare[0].degraded);
+  EXPECT_FALSE(features.ok());
+}
+
+/**
+ * Test that a cancelled comparison stops with a status of deadline exceeded
+ * that gives the times of the stages that ran.
+ */
+TEST(VisqolCommandLineTest, CancelledComparison) {
+  const Visqol::CommandLineArgs cmd_args = CommandLineArgsHelper
+      ("testdata/clean_speech/CA01_01.wav",
+       "testdata/clean_speech/transcoded_CA01_01.wav");
+  auto files_to_compare = VisqolCommandLineParser::BuildFilePairPaths(cmd_args);
+
+  Visqol::VisqolManager visqol;
+  auto status = visqol.Init(cmd_args.sim_to_quality_mapper_model,
+      cmd_args.use_speech_mode,
+      cmd_args.use_unscaled_speech_mos_mapping,
+      cmd_args.search_window_radius);
+  ASSERT_TRUE(status.ok());
+  CancellationToken cancellation;
+  cancellation.Cancel("Cancelled by the test.");
+  auto status_or = visqol.Run(files_to_compare[0].reference,
+                              files_to_compare[0].degraded, &cancellation);
+  ASSERT_FALSE(status_or.ok());
+  EXPECT_EQ(absl::StatusCode::kDeadlineExceeded, status_or.status().code());
+  const std::string message(status_or.status().message());
+  EXPECT_EQ(0, message.find("Cancelled by the test. Stage times (s): load "));
+}
+
+/**
+ * Test that a single timeline window covering the whole signal reproduces the
+ * overall result, since it is made from the same patch matches.
+ */
+TEST(VisqolCommandLineTest, TimelineSingleWindow) {
+  const Visqol::CommandLineArgs cmd_args = CommandLineArgsHelper
+      ("testdata/conformance_testdata_subset/guitar48_stereo.wav",
+       "testdata/conformance_testdata_subset/guitar48_stereo_64kbps_aac.wav");
+  auto files_to_compare = VisqolCommandLineParser::BuildFilePairPaths(cmd_args);
+
+  Visqol::VisqolManager visqol;
+  auto status = visqol.Init(cmd_args.sim_to_quality_mapper_model,
+      cmd_args.use_speech_mode,
+      cmd_args.use_unscaled_speech_mos_mapping,
+      cmd_args.search_window_radius);
+  ASSERT_TRUE(status.ok());
+  visqol.SetTimeline(kLongTimelineWindow, kTimelineHop);
+  auto status_or = visqol.Run(files_to_compare[0].reference,
+                              files_to_compare[0].degraded);
+  ASSERT_TRUE(status_or.ok());
+  const auto &result = status_or.value();
+  ASSERT_EQ(1, result.timeline_size());
+  const auto &window = result.timeline(0);
+  EXPECT_EQ(0.0, window.start_time());
+  EXPECT_EQ(result.patch_sims_size(), window.num_patches());
+  EXPECT_NEAR(result.moslqo(), window.moslqo(), kTolerance);
+  EXPECT_NEAR(result.vnsim(), window.vnsim(), kTolerance);
+  ASSERT_EQ(result.fvnsim_size(), window.fvnsim_size());
+  for (int i = 0; i < result.fvnsim_size(); i++) {
+    EXPECT_NEAR(result.fvnsim(i), window.fvnsim(i), kTolerance);
+  }
+}
+
+/**
+ * Test that the timeline windows slide over the reference by the hop, and
+ * only cover the patches with midpoints inside them.
+ */
+TEST(VisqolCommandLineTest, TimelineSlidingWindows) {
+  const Visqol::CommandLineArgs cmd_args = CommandLineArgsHelper
+      ("testdata/conformance_testdata_subset/guitar48_stereo.wav",
+       "testdata/conformance_testdata_subset/guitar48_stereo_64kbps_aac.wav");
+  auto files_to_compare = VisqolCommandLineParser::BuildFilePairPaths(cmd_args);
+
+  Visqol::VisqolManager visqol;
+  auto status = visqol.Init(cmd_args.sim_to_quality_mapper_model,
+      cmd_args.use_speech_mode,
+      cmd_args.use_unscaled_speech_mos_mapping,
+      cmd_args.search_window_radius);
+  ASSERT_TRUE(status.ok());
+  visqol.SetTimeline(kTimelineWindow, kTimelineHop);
+  auto status_or = visqol.Run(files_to_compare[0].reference,
+                              files_to_compare[0].degraded);
+  ASSERT_TRUE(status_or.ok());
+  const auto &result = status_or.value();
+  ASSERT_GT(result.timeline_size(), 1);
+  for (int i = 0; i < result.timeline_size(); i++) {
+    const auto &window = result.timeline(i);
+    EXPECT_NEAR(i * kTimelineHop, window.start_time(), kTolerance);
+    EXPECT_LE(window.end_time(), window.start_time() + kTimelineWindow);
+    EXPECT_GE(window.moslqo(), 1.0);
+    EXPECT_LE(window.moslqo(), kPerfectScore);
+    int num_patches = 0;
+    for (const auto &patch : result.patch_sims()) {
+      const double midpoint =
+          (patch.ref_patch_start_time() + patch.ref_patch_end_time()) / 2.0;
+      if (midpoint >= window.start_time() &&
+          midpoint < window.start_time() + kTimelineWindow) {
+        num_patches++;
+      }
+    }
+    EXPECT_EQ(num_patches, window.num_patches());
+  }
+}
+
+/**
+ * Test that the reference features fetched from a shared cache give exactly
+ * the scores computed without it, that an unreachable cache server falls
+ * back to computing them, and that a mismatched entry is ignored.
+ */
+TEST(VisqolCommandLineTest, ReferenceFeatureCache) {
+  const Visqol::CommandLineArgs cmd_args = CommandLineArgsHelper
+      ("testdata/clean_speech/CA01_01.wav",
+       "testdata/clean_speech/transcoded_CA01_01.wav");
+  auto files_to_compare = VisqolCommandLineParser::BuildFilePairPaths(cmd_args);
+  auto run = [&](std::shared_ptr<ReferenceFeatureCache> cache) {
+    Visqol::VisqolManager visqol;
+    EXPECT_TRUE(visqol.Init(cmd_args.sim_to_quality_mapper_model,
+        cmd_args.use_speech_mode,
+        cmd_args.use_unscaled_speech_mos_mapping,
+        cmd_args.search_window_radius).ok());
+    visqol.SetReferenceFeatureCache(cache);
+    return visqol.Run(files_to_compare[0].reference,
+                      files_to_compare[0].degraded);
+  };
+  auto expected = run(nullptr);
+  ASSERT_TRUE(expected.ok());
+
+  ReferenceCacheServer server(1 << 26);
+  ASSERT_TRUE(server.Start(0, "127.0.0.1").ok());
+  const int port = server.Port();
+  auto make_cache = [port]() {
+    return std::make_shared<ReferenceFeatureCache>(
+        ReferenceFeatureCache::kDefaultLocalCapacityBytes,
+        absl::make_unique<ReferenceCacheClient>("127.0.0.1", port),
+        "a secret shared by the fleet");
+  };
+
+  // The first node computes and publishes the features, and a second node
+  // fetches them from the server.
+  const auto cold_cache = make_cache();
+  const auto warm_cache = make_cache();
+  auto cold = run(cold_cache);
+  auto warm = run(warm_cache);
+  server.Stop();
+  const auto dead_cache = make_cache();
+  auto dead = run(dead_cache);
+
+  // An entry with another band plan is ignored, even if it has the shape of
+  // the reference spectrogram.
+  const AudioSignal ref = MiscAudio::LoadAsMono(files_to_compare[0].reference);
+  const std::string key = ReferenceFeatureCache::ContentKey(
+      ref, AnalysisWindow{ref.sample_rate, VisqolManager::kOverlap},
+      cmd_args.use_speech_mode);
+  const auto entry = cold_cache->Fetch(key);
+  ASSERT_TRUE(entry.has_value());
+  Spectrogram mismatched(entry->Data() * 2.0);
+  std::vector<double> bands = entry->GetCenterFreqBands();
+  bands.front() += 1.0;
+  mismatched.SetCenterFreqBands(bands);
+  const auto mismatched_cache = std::make_shared<ReferenceFeatureCache>(
+      ReferenceFeatureCache::kDefaultLocalCapacityBytes, nullptr);
+  mismatched_cache->Publish(key, mismatched);
+  auto rebuilt = run(mismatched_cache);
+
+  EXPECT_EQ(1, cold_cache->Stats().misses);
+  EXPECT_EQ(1, warm_cache->Stats().remote_hits);
+  EXPECT_EQ(1, dead_cache->Stats().misses);
+  EXPECT_EQ(1, dead_cache->Stats().remote_errors);
+  for (const auto *result : {&cold, &warm, &dead, &rebuilt}) {
+    ASSERT_TRUE(result->ok());
+    EXPECT_EQ(expected.value().moslqo(), result->value().moslqo());
+    EXPECT_EQ(expected.value().vnsim(), result->value().vnsim());
+    ASSERT_EQ(expected.value().fvnsim_size(), result->value().fvnsim_size());
+    for (int i = 0; i < expected.value().fvnsim_size(); i++) {
+      EXPECT_EQ(expected.value().fvnsim(i), result->value().fvnsim(i));
+    }
+  }
+}
+
 }  // namespace
 }  // namespace Visqol
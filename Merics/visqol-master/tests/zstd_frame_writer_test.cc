@@ -0,0 +1,171 @@
+// Copyright 2019 Google LLC, Andrew Hines
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zstd_frame_writer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "zstd.h"
+
+namespace Visqol {
+namespace {
+
+uint32_t ReadU32(const std::string &bytes, size_t pos) {
+  uint32_t value;
+  std::memcpy(&value, &bytes[pos], sizeof(value));
+  return value;
+}
+
+std::string ReadFile(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+}
+
+// Decompress a whole file, which zstd treats as a sequence of frames.
+std::string Decompress(const std::string &compressed) {
+  std::string data;
+  ZSTD_DStream *stream = ZSTD_createDStream();
+  ZSTD_inBuffer in = {compressed.data(), compressed.size(), 0};
+  std::vector<char> chunk(ZSTD_DStreamOutSize());
+  while (in.pos < in.size) {
+    ZSTD_outBuffer out = {chunk.data(), chunk.size(), 0};
+    const size_t ret = ZSTD_decompressStream(stream, &out, &in);
+    EXPECT_FALSE(ZSTD_isError(ret));
+    if (ZSTD_isError(ret)) {
+      break;
+    }
+    data.append(chunk.data(), out.pos);
+  }
+  ZSTD_freeDStream(stream);
+  return data;
+}
+
+// The stream is cut into frames of the given size, each of which decompresses
+// on its own, and the seek table at the end of the file locates them.
+TEST(ZstdFrameWriterTest, WritesSeekableFrames) {
+  const std::string path = ::testing::TempDir() + "/frames.zst";
+  std::string data;
+  for (int i = 0; i < 100; i++) {
+    data += "row " + std::to_string(i) + "\n";
+  }
+  const size_t kFrameSize = 64;
+  {
+    ZstdFrameWriter writer(FilePath(path), 3, kFrameSize);
+    ASSERT_TRUE(writer.Open().ok());
+    // Write in pieces that do not line up with the frames.
+    for (size_t pos = 0; pos < data.size(); pos += 100) {
+      ASSERT_TRUE(writer.Write(data.substr(pos, 100)).ok());
+    }
+    EXPECT_EQ(data.size(), writer.BytesWritten());
+    ASSERT_TRUE(writer.Close().ok());
+  }
+
+  const std::string file = ReadFile(path);
+  ASSERT_GE(file.size(), 17);
+  EXPECT_EQ(ZstdFrameWriter::kSeekTableFooterMagic,
+            ReadU32(file, file.size() - 4));
+  EXPECT_EQ(0, file[file.size() - 5]);
+  const size_t num_frames = ReadU32(file, file.size() - 9);
+  ASSERT_EQ((data.size() + kFrameSize - 1) / kFrameSize, num_frames);
+  const size_t table_start = file.size() - (num_frames * 8 + 17);
+  EXPECT_EQ(ZstdFrameWriter::kSkippableFrameMagic,
+            ReadU32(file, table_start));
+  EXPECT_EQ(num_frames * 8 + 9, ReadU32(file, table_start + 4));
+
+  size_t compressed_pos = 0;
+  size_t decompressed_pos = 0;
+  for (size_t i = 0; i < num_frames; i++) {
+    const size_t compressed_size = ReadU32(file, table_start + 8 + 8 * i);
+    const size_t decompressed_size = ReadU32(file, table_start + 12 + 8 * i);
+    EXPECT_EQ(std::min(kFrameSize, data.size() - decompressed_pos),
+              decompressed_size);
+    std::string frame(decompressed_size, '\0');
+    ASSERT_EQ(decompressed_size,
+              ZSTD_decompress(&frame[0], frame.size(), &file[compressed_pos],
+                              compressed_size));
+    EXPECT_EQ(data.substr(decompressed_pos, decompressed_size), frame);
+    compressed_pos += compressed_size;
+    decompressed_pos += decompressed_size;
+  }
+  EXPECT_EQ(table_start, compressed_pos);
+
+  // A plain decoder skips the seek table.
+  EXPECT_EQ(data, Decompress(file));
+}
+
+// Writes from many threads are each kept whole.
+TEST(ZstdFrameWriterTest, ConcurrentWrites) {
+  const std::string path = ::testing::TempDir() + "/concurrent.zst";
+  const int kNumThreads = 4;
+  const int kLinesPerThread = 500;
+  {
+    ZstdFrameWriter writer(FilePath(path), 1, 256);
+    ASSERT_TRUE(writer.Open().ok());
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kNumThreads; t++) {
+      threads.emplace_back([&writer, t]() {
+        for (int i = 0; i < kLinesPerThread; i++) {
+          EXPECT_TRUE(writer.Write(std::to_string(t) + "," +
+                                   std::to_string(i) + "\n").ok());
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    ASSERT_TRUE(writer.Close().ok());
+  }
+
+  std::vector<std::string> lines;
+  std::string line;
+  for (char c : Decompress(ReadFile(path))) {
+    if (c == '\n') {
+      lines.push_back(line);
+      line.clear();
+    } else {
+      line += c;
+    }
+  }
+  ASSERT_EQ(kNumThreads * kLinesPerThread, lines.size());
+  std::sort(lines.begin(), lines.end());
+  EXPECT_TRUE(std::adjacent_find(lines.begin(), lines.end()) == lines.end());
+}
+
+TEST(ZstdFrameWriterTest, EmptyStream) {
+  const std::string path = ::testing::TempDir() + "/empty.zst";
+  ZstdFrameWriter writer(FilePath(path), 3);
+  ASSERT_TRUE(writer.Open().ok());
+  ASSERT_TRUE(writer.Close().ok());
+  const std::string file = ReadFile(path);
+  ASSERT_EQ(17, file.size());
+  EXPECT_EQ(0, ReadU32(file, 8));
+  EXPECT_EQ("", Decompress(file));
+}
+
+TEST(ZstdFrameWriterTest, WriteBeforeOpenFails) {
+  ZstdFrameWriter writer(FilePath(::testing::TempDir() + "/unopened.zst"), 3);
+  EXPECT_EQ(absl::StatusCode::kFailedPrecondition,
+            writer.Write("data").code());
+}
+}  // namespace
+}  // namespace Visqol